@@ -0,0 +1,302 @@
+#!/usr/bin/env python3
+#
+# Build step: the uwbs firmware image as the target stores it, and the
+# HBCI download header and checksum of every chunk of it, so the target
+# sends them from tables instead of working them out at each boot
+#
+#   hbci_chunks.py <firmware .h> -o hbci_fw_chunks.h [--chunk 2048] [--pack [--min-saving 128]]
+#
+# or the uwbs_fw flash partition, one or more images the target picks
+# from by what the uwbs says its ids are
+#
+#   hbci_chunks.py <firmware .h>[@chip=<hex>|@helios=<hex>] ... --partition uwbs_fw.bin
+#                  [--hex-base <address>] [--sim-flash flash.bin --offset 0x100000]
+#
+# The image is the C array in the vendor header.  Each chunk goes as a
+# FW_DWNLD_CMD_CLA / FW_DWNLD_DWNLD_IMAGE packet, segmented except the
+# last, and is followed on the bus by a checksum that makes header,
+# payload and checksum sum to 0 (see hbci_done in hbci_proto.c)
+#
+# Chunks are stored one after the other, each on its own so the target
+# can unpack one into its download buffer without any other state.  With
+# --pack a chunk is stored lzss packed when that saves at least
+# --min-saving bytes, otherwise as is (and sent straight from flash).
+# Encrypted images hardly pack at all (none of the 46.41.06 chunks do),
+# so by default nothing is packed and the target leaves out unpacking
+#
+# In the partition each image is a header (see hbci_fw_hdr_t in
+# hbci_proto.c) followed by the image as is, the target reads it a chunk
+# at a time and works out the download headers and checksums itself.
+# Images start on an erase page, so one can be rewritten on its own.
+# The first whose id matches is the one downloaded, one with no @ goes
+# to any uwbs so put it last
+#
+# lzss: a flag byte for each 8 items, lsb first, set for a literal
+# byte, clear for a 2 byte little endian reference back into what was
+# unpacked so far: distance - 1 in the low 11 bits, length - 3 above
+#
+import argparse
+import os
+import re
+import struct
+import sys
+import zlib
+
+# from hbci_defs.h, hbci_proto.c checks they still match
+FW_DWNLD_CMD_CLA = 0x53
+FW_DWNLD_DWNLD_IMAGE = 0x01
+SEG_PACKET = 0x08
+FINAL_PACKET = 0x00
+HBCI_HDR_LEN = 4
+QRY_CHIP_ID_INS = 0x31
+QRY_HELIOS_ID_INS = 0x32
+
+# partition image header, hbci_fw_hdr_t
+FW_HDR_MAGIC = 0x57464248   # "HBFW"
+FW_HDR_FORMAT = 1           # the image as is
+FW_HDR = struct.Struct("<IHHIIIIBB2x16s")
+FW_HDR_LEN = FW_HDR.size + 4
+FW_MATCH_MAX = 16
+FW_PAGE = 0x1000
+
+LZ_MIN = 3
+LZ_MAX = LZ_MIN + 0x1F
+LZ_WINDOW = 0x800
+
+
+def read_image(path):
+    with open(path, "r") as f:
+        text = f.read()
+    m = re.search(r"_bin\[\]\s*=\s*\{(.*?)\};", text, re.S)
+    if not m:
+        raise ValueError("%s has no firmware array" % path)
+    return bytes(int(v, 16) for v in re.findall(r"0x([0-9a-fA-F]{1,2})", m.group(1)))
+
+
+def image_version(path):
+    # vendor files are named ..._FW_46.41.06_..., kept as 0x00464106
+    m = re.search(r"FW_([0-9a-fA-F]+)\.([0-9a-fA-F]+)\.([0-9a-fA-F]+)", os.path.basename(path))
+    if not m:
+        return 0
+    return (int(m.group(1), 16) << 16) | (int(m.group(2), 16) << 8) | int(m.group(3), 16)
+
+
+def image_spec(spec):
+    # path[@chip=hex|@helios=hex]
+    path, _, match = spec.partition("@")
+    if not match:
+        return path, 0, b""
+    kind, _, value = match.partition("=")
+    ins = {"chip": QRY_CHIP_ID_INS, "helios": QRY_HELIOS_ID_INS}.get(kind)
+    ident = bytes.fromhex(value)
+    if ins is None or not ident or len(ident) > FW_MATCH_MAX:
+        raise ValueError("%s: expected @chip=<hex> or @helios=<hex>, up to %d bytes" % (spec, FW_MATCH_MAX))
+    return path, ins, ident
+
+
+def partition(specs):
+    out = bytearray()
+    for i, spec in enumerate(specs):
+        path, ins, ident = image_spec(spec)
+        image = read_image(path)
+        at = len(out)
+        end = at + FW_HDR_LEN + len(image)
+        following = (end + FW_PAGE - 1) & ~(FW_PAGE - 1) if i + 1 < len(specs) else 0
+        hdr = FW_HDR.pack(FW_HDR_MAGIC, FW_HDR_LEN, FW_HDR_FORMAT, len(image), following,
+                          image_version(path), zlib.crc32(image), ins, len(ident), ident)
+        out += hdr + struct.pack("<I", zlib.crc32(hdr)) + image
+        if following:
+            out += b"\xff" * (following - end)
+        print("hbci: %s at 0x%x, %d bytes, version %06x, crc %08x, for %s" % (
+            os.path.basename(path), at, len(image), image_version(path), zlib.crc32(image),
+            "%s %s" % ("chip" if ins == QRY_CHIP_ID_INS else "helios", ident.hex()) if ins else "any uwbs"),
+            file=sys.stderr)
+    return bytes(out)
+
+
+def write_hex(path, data, base):
+    lines = []
+    upper = -1
+    for at in range(0, len(data), 16):
+        addr = base + at
+        if addr >> 16 != upper:
+            upper = addr >> 16
+            rec = bytes((2, 0, 0, 4, upper >> 8, upper & 0xFF))
+            lines.append(":" + (rec + bytes(((-sum(rec)) & 0xFF,))).hex().upper())
+        rec = bytes((len(data[at:at + 16]), (addr >> 8) & 0xFF, addr & 0xFF, 0)) + data[at:at + 16]
+        lines.append(":" + (rec + bytes(((-sum(rec)) & 0xFF,))).hex().upper())
+    lines.append(":00000001FF")
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def write_sim_flash(path, data, offset, size):
+    # the native_sim flash simulator's backing file, erased is 0xff
+    if not os.path.exists(path):
+        with open(path, "wb") as f:
+            f.write(b"\xff" * size)
+    with open(path, "r+b") as f:
+        f.seek(0, os.SEEK_END)
+        if f.tell() < offset + len(data):
+            f.write(b"\xff" * (offset + len(data) - f.tell()))
+        f.seek(offset)
+        f.write(data)
+
+
+def chunk_header(size, final):
+    hdr = [FW_DWNLD_CMD_CLA, FW_DWNLD_DWNLD_IMAGE, 0, 0]
+    if final:
+        # length covers the checksum too, only the final packet has one
+        hdr[2] = (size + 1) & 0xFF
+        hdr[3] = (FINAL_PACKET << 4) | (((size + 1) >> 8) & 0x0F)
+    else:
+        hdr[3] = (SEG_PACKET << 4) & 0xFF
+    return hdr
+
+
+def lzss_pack(data):
+    out = bytearray()
+    heads = {}
+    pos = 0
+    while pos < len(data):
+        flags_at = len(out)
+        out.append(0)
+        for bit in range(8):
+            if pos >= len(data):
+                break
+            best_len = 0
+            best_dist = 0
+            key = data[pos:pos + LZ_MIN]
+            for cand in reversed(heads.get(key, ())):
+                if pos - cand > LZ_WINDOW:
+                    break
+                n = 0
+                while n < LZ_MAX and pos + n < len(data) and data[cand + n] == data[pos + n]:
+                    n += 1
+                if n > best_len:
+                    best_len, best_dist = n, pos - cand
+                    if n == LZ_MAX:
+                        break
+            if best_len >= LZ_MIN:
+                ref = (best_dist - 1) | ((best_len - LZ_MIN) << 11)
+                out += bytes((ref & 0xFF, ref >> 8))
+                step = best_len
+            else:
+                out[flags_at] |= 1 << bit
+                out.append(data[pos])
+                step = 1
+            for i in range(pos, pos + step):
+                heads.setdefault(data[i:i + LZ_MIN], []).append(i)
+            pos += step
+    return bytes(out)
+
+
+def lzss_unpack(packed, size):
+    out = bytearray()
+    at = 0
+    while len(out) < size:
+        flags = packed[at]
+        at += 1
+        for bit in range(8):
+            if len(out) >= size:
+                break
+            if flags & (1 << bit):
+                out.append(packed[at])
+                at += 1
+            else:
+                ref = packed[at] | (packed[at + 1] << 8)
+                at += 2
+                dist = (ref & 0x7FF) + 1
+                for _ in range((ref >> 11) + LZ_MIN):
+                    out.append(out[-dist])
+    return bytes(out)
+
+
+def chunks(image, chunk, min_saving):
+    for at in range(0, len(image), chunk):
+        payload = image[at:at + chunk]
+        hdr = chunk_header(len(payload), at + chunk >= len(image))
+        lrc = (-(sum(hdr) + sum(payload))) & 0xFF
+        stored = payload
+        if min_saving > 0:
+            packed = lzss_pack(payload)
+            if len(packed) + min_saving <= len(payload):
+                if lzss_unpack(packed, len(payload)) != payload:
+                    raise ValueError("chunk at %d doesn't unpack" % at)
+                stored = packed
+        yield hdr, lrc, len(payload), stored
+
+
+def main():
+    parser = argparse.ArgumentParser(description="HBCI firmware chunk table")
+    parser.add_argument("image", nargs="+", help="vendor image, @chip=<hex> or @helios=<hex> in a partition")
+    parser.add_argument("-o", "--output", help="chunk table header to build into the app")
+    parser.add_argument("--partition", help="uwbs_fw partition contents, .bin or .hex")
+    parser.add_argument("--hex-base", type=lambda v: int(v, 0), default=0, help="partition address for .hex")
+    parser.add_argument("--sim-flash", help="also write it into this native_sim flash file")
+    parser.add_argument("--offset", type=lambda v: int(v, 0), default=0x100000, help="partition offset in --sim-flash")
+    parser.add_argument("--flash-size", type=lambda v: int(v, 0), default=0x200000, help="size of a new --sim-flash")
+    parser.add_argument("--chunk", type=int, default=2048, help="FW_CHUNK_LEN")
+    parser.add_argument("--pack", action="store_true", help="lzss pack chunks that pack well")
+    parser.add_argument("--min-saving", type=int, default=128, help="pack a chunk when it saves this many bytes")
+    args = parser.parse_args()
+
+    if args.partition or args.sim_flash:
+        data = partition(args.image)
+        if args.partition and args.partition.endswith(".hex"):
+            write_hex(args.partition, data, args.hex_base)
+        elif args.partition:
+            with open(args.partition, "wb") as f:
+                f.write(data)
+        if args.sim_flash:
+            write_sim_flash(args.sim_flash, data, args.offset, args.flash_size)
+        print("hbci: partition %d bytes" % len(data), file=sys.stderr)
+    if not args.output:
+        return
+    if len(args.image) != 1:
+        parser.error("the chunk table is for one image")
+
+    path = image_spec(args.image[0])[0]
+    image = read_image(path)
+    table = list(chunks(image, args.chunk, args.min_saving if args.pack else 0))
+    stored = b"".join(t[3] for t in table)
+    packed = sum(1 for t in table if len(t[3]) != t[2])
+
+    out = []
+    out.append("// Generated by hbci_chunks.py from %s, don't edit" % os.path.basename(path))
+    out.append("//")
+    out.append("#pragma once")
+    out.append("")
+    out.append("#define HBCI_FW_CHUNK_LEN       (%d)" % args.chunk)
+    out.append("#define HBCI_FW_IMAGE_LEN       (%d)" % len(image))
+    out.append("#define HBCI_FW_STORED_LEN      (%d)" % len(stored))
+    out.append("#define HBCI_FW_CHUNK_COUNT     (%d)" % len(table))
+    out.append("#define HBCI_FW_PACKED_CHUNKS   (%d)" % packed)
+    out.append("#define HBCI_FW_CHUNK_CLA       (0x%02X)" % FW_DWNLD_CMD_CLA)
+    out.append("#define HBCI_FW_CHUNK_INS       (0x%02X)" % FW_DWNLD_DWNLD_IMAGE)
+    out.append("")
+    out.append("static const uint8_t mHbciFwImage[HBCI_FW_STORED_LEN] =")
+    out.append("{")
+    for at in range(0, len(stored), 16):
+        out.append("    " + ",".join("0x%02x" % b for b in stored[at:at + 16]) + ",")
+    out.append("};")
+    out.append("")
+    out.append("static const hbci_chunk_t mHbciFwChunks[HBCI_FW_CHUNK_COUNT] =")
+    out.append("{")
+    offset = 0
+    for hdr, lrc, size, data in table:
+        out.append("    { %6d, %4d, { 0x%02X, 0x%02X, 0x%02X, 0x%02X }, 0x%02X, %d }," % (
+            offset, len(data), hdr[0], hdr[1], hdr[2], hdr[3], lrc, 1 if len(data) != size else 0))
+        offset += len(data)
+    out.append("};")
+    out.append("")
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(out))
+    print("hbci: %d byte image stored in %d bytes (%+d), %d of %d chunks packed, tables %d bytes" % (
+        len(image), len(stored), len(stored) - len(image), packed, len(table), len(table) * 12),
+        file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
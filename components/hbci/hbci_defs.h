@@ -5,8 +5,10 @@
 #define FW_CHUNK_LEN 2048
 #define HBCI_HDR_LEN 4
 #define MAX_HBCI_LEN (FW_CHUNK_LEN + HBCI_HDR_LEN + 1)
-#define HBCI_HDR_LEN_MSB 0x02
-#define HBCI_HDR_LEN_LSB 0x03
+/* length is 12 bits, the low byte then the high nibble under the segment
+   flag. It counts the payload and its LRC byte */
+#define HBCI_HDR_LEN_LSB 0x02
+#define HBCI_HDR_LEN_MSB 0x03
 
 /* HBCI GENERAL COMMAND SET */
 /* CLA definitions */
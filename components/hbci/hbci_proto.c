@@ -4,9 +4,12 @@
 #include "nrfspi.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/types.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/crc.h>
 
 #define COMPONENT_NAME hbciproto
 #include "Logging.h"
@@ -14,11 +17,33 @@
 // define this non-0 to debug packet trx
 #define DUMP_PACKETS 0
 
-// firmware image
-#include "H1_IOT.SR150_MAINLINE_PROD_FW_46.41.06_0052bbfed983a1f1.h"
-
-#define heliosEncryptedMainlineFwImage  H1_IOT_SR150_MAINLINE_PROD_FW_46_41_06_0052bbfed983a1f1_bin
-#define heliosEncryptedMainlineFwImageLen H1_IOT_SR150_MAINLINE_PROD_FW_46_41_06_0052bbfed983a1f1_bin_len
+// answers from the boot loader are a header or a few bytes (ids,
+// keys), nothing big is built or read in RAM since the firmware goes
+// out straight from flash
+//
+#define HBCI_MAX_RX_LEN         (HBCI_HDR_LEN + 256 + 1)
+
+// how long the uwbs has to answer, and to take a payload write
+//
+#define HBCI_READY_TIMEOUT_MS   (500)
+#define HBCI_SEND_TIMEOUT_MS    (100)
+
+// Waiting for the boot loader to come up after ce, and for the image
+// to be installed after the last chunk, is done by polling with status
+// queries.  Each waits this long for its answer, and they back off from
+// MIN to MAX between them, up to the deadline
+//
+#define HBCI_POLL_ANSWER_MS     (2)
+#define HBCI_POLL_MIN_US        (500)
+#define HBCI_POLL_MAX_US        (4000)
+#define HBCI_BOOT_DEADLINE_MS   (100)
+#define HBCI_INSTALL_DEADLINE_MS (500)
+
+// after an answer is read the uwbs drops irq once it is listening
+// again, a write before that can get lost.  It is normally down by
+// the time we look, if not we go ahead after this long anyway
+//
+#define HBCI_IDLE_WAIT_US       (100)
 
 typedef struct
 {
@@ -29,8 +54,152 @@ typedef struct
 }
 hbci_packet_t;
 
-static uint8_t mIObuf[MAX_HBCI_LEN];
-static uint8_t mRxHeader[HBCI_HDR_LEN];
+// Where each chunk of the firmware image is stored, its download header
+// and checksum, all worked out at build time by hbci_chunks.py.  With
+// HBCI_FW_PACK a chunk that packed well enough is stored lzss packed and
+// unpacked into the download buffer, the rest are sent as stored
+//
+typedef struct
+{
+    uint32_t offset;
+    uint16_t size;
+    uint8_t hdr[HBCI_HDR_LEN];
+    uint8_t lrc;
+    uint8_t packed;
+}
+hbci_chunk_t;
+
+#if HBCI_FW_BUILTIN
+// firmware image (generated from H1_IOT.SR150_MAINLINE_PROD_FW_46.41.06_0052bbfed983a1f1.h)
+#include "hbci_fw_chunks.h"
+
+BUILD_ASSERT(HBCI_FW_CHUNK_LEN == FW_CHUNK_LEN, "chunk table is for another chunk size");
+BUILD_ASSERT(HBCI_FW_CHUNK_CLA == FW_DWNLD_CMD_CLA && HBCI_FW_CHUNK_INS == FW_DWNLD_DWNLD_IMAGE,
+             "chunk table has another download command");
+#else
+#define HBCI_FW_PACKED_CHUNKS   (0)
+#endif
+
+#if FIXED_PARTITION_EXISTS(uwbs_fw)
+#define HBCI_FW_PARTITION       FIXED_PARTITION_ID(uwbs_fw)
+#elif !HBCI_FW_BUILTIN
+#error "no uwbs_fw partition and no built-in firmware image"
+#endif
+
+// Header of each image in the uwbs_fw partition, written by
+// hbci_chunks.py --partition.  The image follows it as is, and the
+// next one starts at next.  The first whose match bytes are what the
+// uwbs's answer to match_ins starts with is downloaded, match_ins 0
+// matches any uwbs.  crc is checked as the image is read, the last
+// chunk isn't sent if it is wrong so the uwbs never installs it
+//
+#define HBCI_FW_MAGIC           (0x57464248)    // "HBFW"
+#define HBCI_FW_FORMAT          (1)
+#define HBCI_FW_MATCH_MAX       (16)
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t hdr_len;
+    uint16_t format;
+    uint32_t size;
+    uint32_t next;
+    uint32_t version;       // 0x00MMmmpp
+    uint32_t crc;           // crc32 ieee of the image
+    uint8_t  match_ins;     // QRY_CHIP_ID_INS, QRY_HELIOS_ID_INS or 0
+    uint8_t  match_len;
+    uint8_t  reserved[2];
+    uint8_t  match[HBCI_FW_MATCH_MAX];
+    uint32_t hdr_crc;       // of all of the above
+}
+hbci_fw_hdr_t;
+
+BUILD_ASSERT(sizeof(hbci_fw_hdr_t) == 48, "partition image header doesn't match hbci_chunks.py");
+
+// the image being downloaded, from the partition or the built-in one
+//
+typedef struct
+{
+    const struct flash_area *fa;    // open while downloading from the partition
+    bool        partition;
+    uint32_t    at;                 // its header in the partition
+    uint32_t    data;               // and the image
+    uint32_t    size;
+    uint32_t    version;
+    uint32_t    crc;
+}
+hbci_image_t;
+
+// the last download, times in microseconds
+//
+typedef struct
+{
+    uint32_t    downloads;
+    uint32_t    failures;
+    uint32_t    bytes;
+    uint32_t    chunks;
+    uint32_t    total_us;
+    uint32_t    unpack_us;      // unpacking packed chunks, under the header ack wait
+    uint32_t    read_us;        // reading the partition, the same
+    uint32_t    ack_us;         // waiting for answers
+    uint32_t    ack_max_us;
+    uint32_t    idle_waits;     // irq still up from the last answer when we went to write
+    uint32_t    idle_timeouts;  // and it didn't drop in HBCI_IDLE_WAIT_US
+    uint32_t    boot_us;        // ce to the boot loader answering
+    uint32_t    boot_polls;
+    uint32_t    boot_max_us;
+    uint32_t    install_us;     // last chunk to the image status
+    uint32_t    install_polls;
+    uint32_t    install_max_us;
+    uint32_t    partition_images;   // downloaded from the partition
+    uint32_t    builtin_images;
+    uint32_t    bad_images;         // partition image that failed its crc
+}
+hbci_stats_t;
+
+// per uwbs
+//
+// Built-in firmware chunks are sent from flash, header and checksum
+// from the table and the payload from the image, unless it is packed.
+// Then it is unpacked into mHbciChunk while the uwbs acks its header.
+// A partition image is read into mHbciChunk while its header is acked,
+// and chunkHdr and chunkLrc are worked out for it.  iobuf is only for
+// the other commands and what we read
+//
+typedef struct
+{
+    nrfspi_t   *spi;
+    uint8_t     iobuf[HBCI_MAX_RX_LEN];
+    uint8_t     rxHeader[HBCI_HDR_LEN];
+    uint8_t     chunkHdr[HBCI_HDR_LEN];
+    uint8_t     chunkLrc;
+    uint32_t    crc;
+    hbci_image_t image;
+    bool        badImage;       // the partition image at badAt failed its crc, passed over until reboot
+    uint32_t    badAt;
+
+    // what the uwbs answered to QRY_CHIP_ID_INS and QRY_HELIOS_ID_INS
+    uint8_t     chipId[HBCI_FW_MATCH_MAX];
+    uint8_t     chipIdLen;
+    uint8_t     heliosId[HBCI_FW_MATCH_MAX];
+    uint8_t     heliosIdLen;
+    struct k_sem readySem;
+    struct k_sem sentSem;
+    int         sentResult;
+    hbci_stats_t stats;
+}
+hbci_t;
+
+static hbci_t mHBCI[NRFSPI_MAX_DEVICES];
+
+// download buffer, shared by the units. Downloads are one at a time
+// anyway (each unit boots from its uci slice on the main loop), the
+// lock just makes sure of it
+//
+#if HBCI_FW_PACKED_CHUNKS || defined(HBCI_FW_PARTITION)
+static uint8_t mHbciChunk[FW_CHUNK_LEN];
+#endif
+static K_MUTEX_DEFINE(mHbciDownloadLock);
 
 static int hbci_check(hbci_packet_t *packet, uint8_t cla, uint8_t ins, uint8_t seg)
 {
@@ -38,38 +207,25 @@ static int hbci_check(hbci_packet_t *packet, uint8_t cla, uint8_t ins, uint8_t s
             &&  (packet->len > 0)
             &&  (packet->data[0] == cla)
             &&  (packet->data[1] == ins)
-            &&  ((packet->data[2] >> 4) == seg);
+            &&  ((packet->data[3] >> 4) == seg);
 
     if (!ok)
     {
-        LOG_ERR("Unexpected CLA/INS/SEG : %02x %02x %02x", packet->data[0], packet->data[1], packet->data[2] >> 4);
+        LOG_ERR("Unexpected CLA/INS/SEG : %02x %02x %02x", packet->data[0], packet->data[1], packet->data[3] >> 4);
     }
 
     return ok ? 0 : -1;
 }
 
-static void hbci_prepare(hbci_packet_t *packet, uint8_t cla, uint8_t ins, uint8_t seg)
+static void hbci_prepare(hbci_t *hbci, hbci_packet_t *packet, uint8_t cla, uint8_t ins, uint8_t seg)
 {
-    packet->data = mIObuf;
+    packet->data = hbci->iobuf;
     HBCI_HDR(packet->data, cla, ins, seg);
     packet->seg = seg;
     packet->len = HBCI_HDR_LEN;
     packet->crc = 0;
 }
 
-static int hbci_add(hbci_packet_t *packet, const uint8_t *payload, uint16_t size)
-{
-    if (packet->len + size > MAX_HBCI_LEN)
-    {
-        return -1;
-    }
-
-    memcpy(&packet->data[packet->len], payload, size);
-    packet->len += size;
-
-    return 0;
-}
-
 static int hbci_done(hbci_packet_t *packet)
 {
     if (packet->seg == FINAL_PACKET)
@@ -93,7 +249,7 @@ static int hbci_done(hbci_packet_t *packet)
 
     if (packet->len > HBCI_HDR_LEN)
     {
-        //Add CRC. Be aware that CRC is not included in the payload size in the packet header
+        //Add CRC. Be aware that CRC is included in the payload size in the packet header
         /// BDD = looks more like a checksum vs crc, but whatever, nobody checks it
         packet->crc = 0;
         for (int i = 0; i < packet->len; i++)
@@ -108,79 +264,180 @@ static int hbci_done(hbci_packet_t *packet)
     return 0;
 }
 
-static int hbci_wait_ready(void)
+// irq isr while we have the bus, the uwbs has an answer
+//
+static void hbci_request_callback(void *inContext)
 {
-    int ret = -1;
+    hbci_t *hbci = (hbci_t *)inContext;
+
+    k_sem_give(&hbci->readySem);
+}
+
+// Wait for the uwbs to raise irq with its answer.  The edge wakes us,
+// the line is polled as well in case it came up before we got here
+//
+static int hbci_wait_ready(hbci_t *hbci, uint32_t inTimeoutMs)
+{
+    int64_t deadline = k_uptime_get() + inTimeoutMs;
+    int64_t left;
     bool readable;
-    int timeout = 0;
+    int ret;
 
-    do
+    while (true)
     {
-        ret = NRFSPIpoll(&readable);
+        ret = NRFSPIpoll(hbci->spi, &readable);
         if (ret)
         {
+            LOG_ERR("HBCI error");
             break;
         }
         if (readable)
         {
-            ret = 0;
             break;
         }
-        if (timeout < 100)
-        {
-            k_sleep(K_USEC(250));
-        }
-        else
+
+        left = deadline - k_uptime_get();
+        if (left <= 0)
         {
-            k_sleep(K_MSEC(1));
+            ret = -ETIMEDOUT;
+            break;
         }
+        k_sem_take(&hbci->readySem, K_MSEC(left));
     }
-    while (timeout++ < 500);
+    return ret;
+}
 
-    if (timeout >= 500)
+// Before a write, give the uwbs the moment it takes to let go of irq
+// after its last answer was read
+//
+static void hbci_wait_idle(hbci_t *hbci)
+{
+    int waited;
+
+    if (!NRFSPIirqActive(hbci->spi))
     {
-        LOG_ERR("HBCI timeout");
-        ret = -ETIMEDOUT;
+        return;
     }
-    else if (ret)
+
+    hbci->stats.idle_waits++;
+    for (waited = 0; waited < HBCI_IDLE_WAIT_US; waited++)
     {
-        LOG_ERR("HBCI error");
+        k_busy_wait(1);
+        if (!NRFSPIirqActive(hbci->spi))
+        {
+            return;
+        }
     }
+    hbci->stats.idle_timeouts++;
+}
 
+// async write done, spi isr
+//
+static void hbci_sent_callback(int inResult, void *inContext)
+{
+    hbci_t *hbci = (hbci_t *)inContext;
+
+    hbci->sentResult = inResult;
+    k_sem_give(&hbci->sentSem);
+}
+
+// Payload of an image chunk, its data (where it is stored, unpacked or
+// read) and its checksum gathered into one write
+//
+static int hbci_send_chunk(hbci_t *hbci, const uint8_t *inData, int inCount, const uint8_t *inLrc)
+{
+    nrfspi_iovec_t vec[2];
+    int ret;
+
+    vec[0].data  = inData;
+    vec[0].count = inCount;
+    vec[1].data  = inLrc;
+    vec[1].count = 1;
+
+    hbci_wait_idle(hbci);
+
+    k_sem_reset(&hbci->sentSem);
+    ret = NRFSPIwritevAsync(hbci->spi, vec, ARRAY_SIZE(vec), hbci_sent_callback, hbci);
+    require_noerr(ret, exit);
+
+    if (k_sem_take(&hbci->sentSem, K_MSEC(HBCI_SEND_TIMEOUT_MS)))
+    {
+        LOG_ERR("HBCI write never finished");
+        ret = -ETIMEDOUT;
+        goto exit;
+    }
+    ret = hbci->sentResult;
+exit:
     return ret;
 }
 
-static int hbci_transceive(hbci_packet_t *snd, int sndBegin, int sndLen, hbci_packet_t *rcv)
+// Read the uwbs's answer to what was just written, if it comes in
+// inTimeoutMs
+//
+static int hbci_receive(hbci_t *hbci, hbci_packet_t *rcv, uint32_t inTimeoutMs)
 {
     int ret;
     uint32_t paylen;
+    uint8_t sum;
+    int i;
 
-    ret = NRFSPIwrite(&snd->data[sndBegin], sndLen);
-    require_noerr(ret, exit);
+    memset(hbci->rxHeader, 0, sizeof(hbci->rxHeader));
 
-#if DUMP_PACKETS
-    LOG_HEXDUMP_INF(snd->data + sndBegin, sndLen > 4 ? 4 : sndLen, "TX->");
-#endif
-    ret = hbci_wait_ready();
-    require_noerr(ret, exit);
+    // not require_noerr, polls time out as a matter of course
+    ret = hbci_wait_ready(hbci, inTimeoutMs);
+    if (ret)
+    {
+        goto exit;
+    }
 
-    ret = NRFSPIread(mRxHeader, HBCI_HDR_LEN);
+    ret = NRFSPIread(hbci->spi, hbci->rxHeader, HBCI_HDR_LEN);
     require_noerr(ret, exit);
 
-    rcv->data = mRxHeader;
+    rcv->data = hbci->rxHeader;
 
-    paylen = ((uint32_t)mRxHeader[HBCI_HDR_LEN_MSB] << 8) | ((uint32_t)mRxHeader[HBCI_HDR_LEN_LSB]);
-    require((paylen + HBCI_HDR_LEN + 1) <= MAX_HBCI_LEN, exit);
+    // same layout as we send (see hbci_done), the length counts the lrc
+    //
+    paylen = ((uint32_t)(hbci->rxHeader[HBCI_HDR_LEN_MSB] & 0x0F) << 8) | ((uint32_t)hbci->rxHeader[HBCI_HDR_LEN_LSB]);
+    if ((paylen + HBCI_HDR_LEN) > sizeof(hbci->iobuf))
+    {
+        LOG_ERR("Bad length %u", paylen);
+        NRFSPIlinkCheck(hbci->spi, false);
+        ret = -EBADMSG;
+        goto exit;
+    }
+
+    if (hbci->rxHeader[0] == GENERAL_ACK_CLA && hbci->rxHeader[1] == ACK_LRC_MISMATCH_INS)
+    {
+        // uwbs got what we sent corrupted
+        NRFSPIlinkCheck(hbci->spi, false);
+    }
 
     if (paylen > 0)
     {
-        // note this shares mIObuf with the send-data which should have already
+        // note this shares iobuf with the send-data which should have already
         // been all sent if we are reading more than a header response
-        rcv->data = mIObuf;
-        memcpy(rcv->data, mRxHeader, HBCI_HDR_LEN);
+        rcv->data = hbci->iobuf;
+        memcpy(rcv->data, hbci->rxHeader, HBCI_HDR_LEN);
 
-        ret = NRFSPIread(rcv->data + HBCI_HDR_LEN, paylen + 1);
+        ret = NRFSPIread(hbci->spi, rcv->data + HBCI_HDR_LEN, paylen);
         require_noerr(ret, exit);
+
+        // same checksum as we send, everything including it sums to 0
+        //
+        for (i = sum = 0; i < (paylen + HBCI_HDR_LEN); i++)
+        {
+            sum += rcv->data[i];
+        }
+        NRFSPIlinkCheck(hbci->spi, sum == 0);
+        if (sum)
+        {
+            LOG_ERR("Bad checksum");
+            ret = -EBADMSG;
+            goto exit;
+        }
+
+        // callers get the payload without the lrc
+        paylen--;
     }
 
     rcv->len = paylen + HBCI_HDR_LEN;
@@ -191,41 +448,483 @@ static int hbci_transceive(hbci_packet_t *snd, int sndBegin, int sndLen, hbci_pa
 exit:
     if (ret)
     {
+        // leave data pointing somewhere readable, callers look at
+        // the header before checking the length
+        //
         rcv->len  = 0;
-        rcv->data = 0;
+        rcv->data = hbci->rxHeader;
+    }
+
+    return ret;
+}
+
+static int hbci_write(hbci_t *hbci, const uint8_t *inData, int inCount)
+{
+    int ret;
+
+    hbci_wait_idle(hbci);
+
+    ret = NRFSPIwrite(hbci->spi, inData, inCount);
+#if DUMP_PACKETS
+    LOG_HEXDUMP_INF(inData, inCount > 4 ? 4 : inCount, "TX->");
+#endif
+    return ret;
+}
+
+static int hbci_transceive(hbci_t *hbci, const uint8_t *inData, int inCount, hbci_packet_t *rcv)
+{
+    int ret;
+
+    ret = hbci_write(hbci, inData, inCount);
+    if (ret)
+    {
+        memset(hbci->rxHeader, 0, sizeof(hbci->rxHeader));
+        rcv->len  = 0;
+        rcv->data = hbci->rxHeader;
+        return ret;
+    }
+
+    ret = hbci_receive(hbci, rcv, HBCI_READY_TIMEOUT_MS);
+    if (ret == -ETIMEDOUT)
+    {
+        LOG_ERR("HBCI timeout");
+    }
+    return ret;
+}
+
+// a download chunk's header or payload ack
+//
+static int hbci_receive_ack(hbci_t *hbci, hbci_packet_t *rcv)
+{
+    uint32_t start = k_cycle_get_32();
+    uint32_t waited;
+    int ret;
+
+    ret = hbci_receive(hbci, rcv, HBCI_READY_TIMEOUT_MS);
+
+    waited = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    hbci->stats.ack_us += waited;
+    if (waited > hbci->stats.ack_max_us)
+    {
+        hbci->stats.ack_max_us = waited;
+    }
+    return ret;
+}
+
+// Query inCLA/inINS until the uwbs answers or inDeadlineMs is up, with
+// a short wait for each answer and a growing gap between queries.  An
+// answer that comes in after its query was given up on is taken, not
+// queried again.  outUs is how long it took
+//
+static int hbci_poll(
+                hbci_t *hbci,
+                uint8_t inCLA,
+                uint8_t inINS,
+                uint32_t inDeadlineMs,
+                hbci_packet_t *rcv,
+                uint32_t *outPolls,
+                uint32_t *outUs)
+{
+    int64_t deadline = k_uptime_get() + inDeadlineMs;
+    uint32_t start = k_cycle_get_32();
+    uint32_t backoff = HBCI_POLL_MIN_US;
+    hbci_packet_t snd;
+    bool readable;
+    int ret;
+
+    memset(hbci->rxHeader, 0, sizeof(hbci->rxHeader));
+    rcv->len  = 0;
+    rcv->data = hbci->rxHeader;
+
+    *outPolls = 0;
+    while (true)
+    {
+        ret = NRFSPIpoll(hbci->spi, &readable);
+        if (!ret && !readable)
+        {
+            hbci_prepare(hbci, &snd, inCLA, inINS, FINAL_PACKET);
+            hbci_done(&snd);
+            ret = hbci_write(hbci, snd.data, HBCI_HDR_LEN);
+            (*outPolls)++;
+        }
+        if (!ret)
+        {
+            ret = hbci_receive(hbci, rcv, HBCI_POLL_ANSWER_MS);
+        }
+        if (ret != -ETIMEDOUT || k_uptime_get() >= deadline)
+        {
+            break;
+        }
+
+        k_sleep(K_USEC(backoff));
+        backoff = MIN(backoff * 2, HBCI_POLL_MAX_US);
+    }
+
+    *outUs = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    if (ret == -ETIMEDOUT)
+    {
+        LOG_ERR("No answer to %02x %02x in %u ms (%u polls)", inCLA, inINS, inDeadlineMs, *outPolls);
+    }
+    return ret;
+}
+
+static int hbci_transceive_hdr(hbci_t *hbci, hbci_packet_t *snd, hbci_packet_t *rcv)
+{
+    return hbci_transceive(hbci, snd->data, HBCI_HDR_LEN, rcv);
+}
+
+#if HBCI_FW_PACKED_CHUNKS
+// Unpack a stored chunk (see hbci_chunks.py): a flag byte for each 8
+// items, set for a literal byte, clear for a 2 byte reference back into
+// what has been unpacked, 11 bits distance - 1 and 5 bits length - 3
+//
+static int hbci_unpack(const uint8_t *inPacked, int inCount, uint8_t *outData, int inSize)
+{
+    const uint8_t *end = inPacked + inCount;
+    uint16_t ref;
+    uint8_t flags = 0;
+    int bits = 0;
+    int dist;
+    int len;
+    int out = 0;
+
+    while (out < inSize && inPacked < end)
+    {
+        if (bits == 0)
+        {
+            flags = *inPacked++;
+            bits = 8;
+            continue;
+        }
+
+        if (flags & 1)
+        {
+            outData[out++] = *inPacked++;
+        }
+        else
+        {
+            if (end - inPacked < 2)
+            {
+                break;
+            }
+            ref = inPacked[0] | ((uint16_t)inPacked[1] << 8);
+            inPacked += 2;
+
+            dist = (ref & 0x7FF) + 1;
+            len  = (ref >> 11) + 3;
+            if (dist > out || out + len > inSize)
+            {
+                break;
+            }
+            while (len--)
+            {
+                outData[out] = outData[out - dist];
+                out++;
+            }
+        }
+
+        flags >>= 1;
+        bits--;
+    }
+
+    return (out == inSize) ? 0 : -EBADMSG;
+}
+#endif
+
+// One of the uwbs's ids, the payload of its answer to query inINS.  A
+// boot loader that doesn't know the query leaves it empty
+//
+static void hbci_query_id(hbci_t *hbci, uint8_t inINS, uint8_t *outId, uint8_t *outLen)
+{
+    hbci_packet_t snd;
+    hbci_packet_t rcv;
+
+    *outLen = 0;
+
+    hbci_prepare(hbci, &snd, GENERAL_QRY_CLA, inINS, FINAL_PACKET);
+    hbci_done(&snd);
+    if (hbci_transceive_hdr(hbci, &snd, &rcv) || rcv.data[0] != GENERAL_ANS_CLA)
+    {
+        return;
+    }
+    *outLen = MIN(rcv.len - HBCI_HDR_LEN, HBCI_FW_MATCH_MAX);
+    memcpy(outId, rcv.data + HBCI_HDR_LEN, *outLen);
+}
+
+#ifdef HBCI_FW_PARTITION
+// Image header at inAt in the partition, -ENOENT when there's none (it
+// is erased, or past the last one)
+//
+static int hbci_read_image_hdr(const struct flash_area *fa, uint32_t inAt, hbci_fw_hdr_t *outHdr)
+{
+    if (inAt + sizeof(*outHdr) > fa->fa_size || flash_area_read(fa, inAt, outHdr, sizeof(*outHdr)))
+    {
+        return -ENOENT;
+    }
+    if (outHdr->magic != HBCI_FW_MAGIC)
+    {
+        return -ENOENT;
+    }
+
+    if (
+            outHdr->hdr_crc != crc32_ieee((const uint8_t *)outHdr, offsetof(hbci_fw_hdr_t, hdr_crc))
+        ||  outHdr->hdr_len < sizeof(*outHdr)
+        ||  outHdr->format != HBCI_FW_FORMAT
+        ||  outHdr->match_len > HBCI_FW_MATCH_MAX
+        ||  ((uint64_t)inAt + outHdr->hdr_len + outHdr->size) > fa->fa_size
+        ||  (outHdr->next != 0 && outHdr->next <= inAt)
+    )
+    {
+        LOG_ERR("Bad image header at 0x%x in uwbs_fw", inAt);
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+static bool hbci_image_matches(hbci_t *hbci, const hbci_fw_hdr_t *inHdr)
+{
+    switch (inHdr->match_ins)
+    {
+    case 0:
+        return true;
+    case QRY_CHIP_ID_INS:
+        return hbci->chipIdLen >= inHdr->match_len && !memcmp(hbci->chipId, inHdr->match, inHdr->match_len);
+    case QRY_HELIOS_ID_INS:
+        return hbci->heliosIdLen >= inHdr->match_len && !memcmp(hbci->heliosId, inHdr->match, inHdr->match_len);
+    default:
+        return false;
+    }
+}
+#endif
+
+// Pick the image for this uwbs, the first in the partition that is for
+// its ids, else the built-in one.  One that turned out corrupt is left
+// for the next that matches on the retry
+//
+static int hbci_select_image(hbci_t *hbci)
+{
+    hbci_image_t *image = &hbci->image;
+    int ret = -ENOENT;
+#ifdef HBCI_FW_PARTITION
+    const struct flash_area *fa;
+    hbci_fw_hdr_t hdr;
+    uint32_t at;
+#endif
+
+    memset(image, 0, sizeof(*image));
+
+#ifdef HBCI_FW_PARTITION
+    if (flash_area_open(HBCI_FW_PARTITION, &fa))
+    {
+        LOG_ERR("Can't open uwbs_fw");
+        fa = NULL;
     }
 
+    for (at = 0; fa && !hbci_read_image_hdr(fa, at, &hdr); at = hdr.next)
+    {
+        if (hbci_image_matches(hbci, &hdr) && !(hbci->badImage && hbci->badAt == at))
+        {
+            image->fa           = fa;
+            image->partition    = true;
+            image->at           = at;
+            image->data         = at + hdr.hdr_len;
+            image->size         = hdr.size;
+            image->version      = hdr.version;
+            image->crc          = hdr.crc;
+
+            LOG_INF("UWBS firmware %02x.%02x.%02x from uwbs_fw at 0x%x",
+                        (hdr.version >> 16) & 0xFF, (hdr.version >> 8) & 0xFF, hdr.version & 0xFF, at);
+            return 0;
+        }
+        if (hdr.next == 0)
+        {
+            break;
+        }
+    }
+
+    if (fa)
+    {
+        flash_area_close(fa);
+    }
+#endif
+
+#if HBCI_FW_BUILTIN
+    image->size = HBCI_FW_IMAGE_LEN;
+    LOG_INF("UWBS firmware built in");
+    ret = 0;
+#else
+    LOG_ERR("No uwbs firmware for this chip");
+#endif
     return ret;
 }
 
-static int hbci_transceive_hdr(hbci_packet_t *snd, hbci_packet_t *rcv)
+// Download header of a chunk of inCount bytes of the image, the final
+// one's length counts its checksum too
+//
+static const uint8_t *hbci_chunk_header(hbci_t *hbci, int inChunk, int inCount, bool inFinal)
 {
-    return hbci_transceive(snd, 0, HBCI_HDR_LEN, rcv);
+#if HBCI_FW_BUILTIN
+    if (!hbci->image.partition)
+    {
+        return mHbciFwChunks[inChunk].hdr;
+    }
+#endif
+
+    hbci->chunkHdr[0] = FW_DWNLD_CMD_CLA;
+    hbci->chunkHdr[1] = FW_DWNLD_DWNLD_IMAGE;
+    if (inFinal)
+    {
+        hbci->chunkHdr[2] = (inCount + 1) & 0xFF;
+        hbci->chunkHdr[3] = (FINAL_PACKET << 4) | (((inCount + 1) >> 8) & 0x0F);
+    }
+    else
+    {
+        hbci->chunkHdr[2] = 0;
+        hbci->chunkHdr[3] = SEG_PACKET << 4;
+    }
+    return hbci->chunkHdr;
 }
 
-static int hbci_transceive_payload(hbci_packet_t *snd, hbci_packet_t *rcv)
+// Payload of chunk inChunk, inOffset into the image, and its checksum,
+// got ready while the uwbs acks the header.  A packed built-in chunk is
+// unpacked, a partition one read and added to the image crc, which has
+// to be right before the final one goes
+//
+static int hbci_load_chunk(
+                hbci_t *hbci,
+                int inChunk,
+                uint32_t inOffset,
+                int inCount,
+                bool inFinal,
+                const uint8_t **outData,
+                const uint8_t **outLrc)
 {
-    return hbci_transceive(snd, HBCI_HDR_LEN, snd->len - HBCI_HDR_LEN, rcv);
+    int ret = 0;
+
+#if HBCI_FW_BUILTIN
+    if (!hbci->image.partition)
+    {
+        *outData = &mHbciFwImage[mHbciFwChunks[inChunk].offset];
+        *outLrc  = &mHbciFwChunks[inChunk].lrc;
+#if HBCI_FW_PACKED_CHUNKS
+        if (mHbciFwChunks[inChunk].packed)
+        {
+            uint32_t start = k_cycle_get_32();
+
+            ret = hbci_unpack(*outData, mHbciFwChunks[inChunk].size, mHbciChunk, inCount);
+            *outData = mHbciChunk;
+            hbci->stats.unpack_us += k_cyc_to_us_floor32(k_cycle_get_32() - start);
+            if (ret)
+            {
+                LOG_ERR("Chunk %d doesn't unpack", inChunk);
+            }
+        }
+#endif
+        return ret;
+    }
+#endif
+
+#ifdef HBCI_FW_PARTITION
+    {
+        uint32_t start = k_cycle_get_32();
+        uint8_t sum;
+        int i;
+
+        ret = flash_area_read(hbci->image.fa, hbci->image.data + inOffset, mHbciChunk, inCount);
+        if (ret)
+        {
+            LOG_ERR("Can't read uwbs_fw at 0x%x (%d)", hbci->image.data + inOffset, ret);
+            return ret;
+        }
+        hbci->crc = crc32_ieee_update(hbci->crc, mHbciChunk, inCount);
+
+        for (i = sum = 0; i < HBCI_HDR_LEN; i++)
+        {
+            sum += hbci->chunkHdr[i];
+        }
+        for (i = 0; i < inCount; i++)
+        {
+            sum += mHbciChunk[i];
+        }
+        hbci->chunkLrc = (sum ^ 0xFF) + 1;
+
+        *outData = mHbciChunk;
+        *outLrc  = &hbci->chunkLrc;
+        hbci->stats.read_us += k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+        if (inFinal && hbci->crc != hbci->image.crc)
+        {
+            LOG_ERR("Image at 0x%x in uwbs_fw is corrupt, crc %08x not %08x",
+                        hbci->image.at, hbci->crc, hbci->image.crc);
+            hbci->stats.bad_images++;
+            hbci->badImage = true;
+            hbci->badAt = hbci->image.at;
+            ret = -EBADMSG;
+        }
+    }
+#endif
+    return ret;
+}
+
+// Known-answer exchange for clock calibration, the boot loader
+// answers a status query with a fixed header
+//
+static int _hbci_probe(nrfspi_t *inSPI)
+{
+    hbci_t *hbci = &mHBCI[NRFSPIunit(inSPI)];
+    hbci_packet_t snd;
+    hbci_packet_t rcv;
+    int ret;
+
+    hbci_prepare(hbci, &snd, GENERAL_QRY_CLA, QRY_STATUS_INS, FINAL_PACKET);
+    hbci_done(&snd);
+    ret = hbci_transceive_hdr(hbci, &snd, &rcv);
+    if (ret)
+    {
+        return ret;
+    }
+
+    if (
+            rcv.len != HBCI_HDR_LEN
+        ||  rcv.data[0] != GENERAL_ANS_CLA
+        ||  rcv.data[1] != ANS_HBCI_READY_INS
+        ||  rcv.data[2] != 0
+        ||  rcv.data[3] != 0
+    )
+    {
+        return -EIO;
+    }
+    return 0;
 }
 
-static int _HbciEncryptedFwDownload(void)
+static int _HbciEncryptedFwDownload(hbci_t *hbci)
 {
     hbci_packet_t snd;
     hbci_packet_t rcv;
+    const uint8_t *data;
+    const uint8_t *lrc;
+    uint32_t start;
     int fwSize;
     int total;
+    int chunk;
+    int chunkLen;
+    bool final;
+    bool downloading = false;
+    int err;
     int ret = -1;
+    int probe;
     uint8_t mtype;
     uint8_t gid;
     uint8_t oid;
 
     // Probe the device with the first query to see if its already running
-    // the f/w we load and is in UCI mode
+    // the f/w we load and is in UCI mode.  Just after ce the boot loader
+    // is still starting (about 9ms), keep asking until it answers
     //
     // HBCI QUERY
-    hbci_prepare(&snd, GENERAL_QRY_CLA, QRY_STATUS_INS, FINAL_PACKET);
-    hbci_done(&snd);
-    hbci_transceive_hdr(&snd, &rcv);
+    probe = hbci_poll(hbci, GENERAL_QRY_CLA, QRY_STATUS_INS, HBCI_BOOT_DEADLINE_MS,
+                &rcv, &hbci->stats.boot_polls, &hbci->stats.boot_us);
+    hbci->stats.boot_max_us = MAX(hbci->stats.boot_max_us, hbci->stats.boot_us);
 
     LOG_HEXDUMP_INF(rcv.data, 4, "Probe");
 
@@ -233,12 +932,12 @@ static int _HbciEncryptedFwDownload(void)
     {
         // not hbci reply see if its uci
         //
-        hbci_prepare(&snd, GENERAL_QRY_CLA, QRY_STATUS_INS, FINAL_PACKET);
+        hbci_prepare(hbci, &snd, GENERAL_QRY_CLA, QRY_STATUS_INS, FINAL_PACKET);
         hbci_done(&snd);
 
-        NRFSPIstartSync();
-        hbci_transceive_hdr(&snd, &rcv);
-        NRFSPIstopSync();
+        NRFSPIstartSync(hbci->spi);
+        hbci_transceive_hdr(hbci, &snd, &rcv);
+        NRFSPIstopSync(hbci->spi);
 
         mtype   = rcv.data[0] >> UCI_MT_SHIFT;
         gid     = rcv.data[0] & UCI_GID_MASK;
@@ -261,13 +960,37 @@ static int _HbciEncryptedFwDownload(void)
     if (hbci_check(&rcv, GENERAL_ANS_CLA, ANS_HBCI_READY_INS, FINAL_PACKET))
     {
         LOG_ERR("Wrong response to [GENERAL_QRY_CLA, QRY_STATUS_INS]");
+        if (probe != -ETIMEDOUT)
+        {
+            // it answered, but not with anything we know, a saved
+            // clock can be too fast for this board. Slow down for
+            // the retry
+            //
+            NRFSPIdownshift(hbci->spi);
+        }
+        goto exit;
+    }
+
+    // the boot loader is up and answering, find the fastest clock
+    // that talks to it reliably (re-checks a saved one)
+    //
+    NRFSPIcalibrate(hbci->spi, _hbci_probe);
+
+    // which uwbs this is picks the image for it
+    //
+    hbci_query_id(hbci, QRY_CHIP_ID_INS, hbci->chipId, &hbci->chipIdLen);
+    hbci_query_id(hbci, QRY_HELIOS_ID_INS, hbci->heliosId, &hbci->heliosIdLen);
+    LOG_HEXDUMP_INF(hbci->chipId, hbci->chipIdLen, "Chip id");
+
+    if (hbci_select_image(hbci))
+    {
         goto exit;
     }
 
     // HIF MODE
-    hbci_prepare(&snd, GENERAL_CMD_CLA, CMD_MODE_HIF_INS, FINAL_PACKET);
+    hbci_prepare(hbci, &snd, GENERAL_CMD_CLA, CMD_MODE_HIF_INS, FINAL_PACKET);
     hbci_done(&snd);
-    hbci_transceive_hdr(&snd, &rcv);
+    hbci_transceive_hdr(hbci, &snd, &rcv);
     if (hbci_check(&rcv, GENERAL_ACK_CLA, ACK_VALID_APDU_INS, FINAL_PACKET))
     {
         LOG_ERR("Wrong response to [GENERAL_CMD_CLA, CMD_MODE_HIF_INS]");
@@ -275,9 +998,9 @@ static int _HbciEncryptedFwDownload(void)
     }
 
     // HIF MODE STATUS QUERY
-    hbci_prepare(&snd, GENERAL_QRY_CLA, QRY_STATUS_INS, FINAL_PACKET);
+    hbci_prepare(hbci, &snd, GENERAL_QRY_CLA, QRY_STATUS_INS, FINAL_PACKET);
     hbci_done(&snd);
-    hbci_transceive_hdr(&snd, &rcv);
+    hbci_transceive_hdr(hbci, &snd, &rcv);
     if (hbci_check(&rcv, GENERAL_ANS_CLA, ANS_MODE_PATCH_HIF_READY_INS, FINAL_PACKET))
     {
         LOG_ERR("Wrong response to [GENERAL_QRY_CLA, QRY_STATUS_INS]");
@@ -285,98 +1008,347 @@ static int _HbciEncryptedFwDownload(void)
     }
 
     // Download FW
-    fwSize = heliosEncryptedMainlineFwImageLen;
+    fwSize = hbci->image.size;
     if (fwSize == 0 || fwSize < 0)
     {
         LOG_ERR("Invalid fw image size");
         goto exit;
     }
 
-    total = 0;
-    while (total < fwSize)
+    downloading = true;
+    hbci->stats.downloads++;
+    hbci->stats.bytes = 0;
+    hbci->stats.chunks = 0;
+    hbci->stats.unpack_us = 0;
+    hbci->stats.read_us = 0;
+    hbci->stats.ack_us = 0;
+    hbci->stats.ack_max_us = 0;
+    hbci->stats.idle_waits = 0;
+    hbci->stats.idle_timeouts = 0;
+    if (hbci->image.partition)
+    {
+        hbci->stats.partition_images++;
+    }
+    else
     {
-        uint8_t seg;
-        int chunkLen;
+        hbci->stats.builtin_images++;
+    }
+    hbci->crc = 0;
+    start = k_cycle_get_32();
 
+    // the writes used to be spaced with fixed sleeps (the uwbs loses one
+    // that comes too soon, a B2 workaround), hbci_wait_idle waits for
+    // it to be listening instead
+    //
+    for (chunk = total = 0; total < fwSize; chunk++, total += chunkLen)
+    {
         //LOG_INF("FW Image %d/%d", total, fwSize);
 
-        chunkLen = fwSize - total;
-        if (chunkLen > FW_CHUNK_LEN)
+        chunkLen = MIN(fwSize - total, FW_CHUNK_LEN);
+        final = (total + chunkLen) >= fwSize;
+
+        // the payload is read or unpacked while the uwbs acks its header
+        //
+        err = hbci_write(hbci, hbci_chunk_header(hbci, chunk, chunkLen, final), HBCI_HDR_LEN);
+        if (!err && hbci_load_chunk(hbci, chunk, total, chunkLen, final, &data, &lrc))
         {
-            seg      = SEG_PACKET;
-            chunkLen = FW_CHUNK_LEN;
+            goto exit;
         }
-        else
+        if (!err)
         {
-            seg      = FINAL_PACKET;
+            hbci_receive_ack(hbci, &rcv);
         }
-
-        hbci_prepare(&snd, FW_DWNLD_CMD_CLA, FW_DWNLD_DWNLD_IMAGE, seg);
-        if (hbci_add(&snd, &heliosEncryptedMainlineFwImage[total], chunkLen))
+        if (err || hbci_check(&rcv, GENERAL_ACK_CLA, ACK_VALID_APDU_INS, FINAL_PACKET))
         {
-            LOG_ERR("Error adding payload to packet");
+            LOG_ERR("Wrong response to [FW_DWNLD_CMD_CLA, FW_DWNLD_DWNLD_IMAGE]");
             goto exit;
         }
 
-        hbci_done(&snd);
-        hbci_transceive_hdr(&snd, &rcv);
-
-        /*FW download stuck here if logs are disable so adding some delay*/
-        k_sleep(K_USEC(10));
-
-        if (hbci_check(&rcv, GENERAL_ACK_CLA, ACK_VALID_APDU_INS, FINAL_PACKET))
+        err = hbci_send_chunk(hbci, data, chunkLen, lrc);
+        if (!err)
         {
-            LOG_ERR("Wrong response to [FW_DWNLD_CMD_CLA, FW_DWNLD_DWNLD_IMAGE]");
-            goto exit;
+            hbci_receive_ack(hbci, &rcv);
         }
-
-        k_sleep(K_USEC(10)); // WAR for B2
-
-        hbci_transceive_payload(&snd, &rcv);
-        if (hbci_check(&rcv, GENERAL_ACK_CLA, ACK_VALID_APDU_INS, FINAL_PACKET))
+        if (err || hbci_check(&rcv, GENERAL_ACK_CLA, ACK_VALID_APDU_INS, FINAL_PACKET))
         {
             // Wrong packet header
             LOG_ERR("Wrong response to payload");
             goto exit;
         }
 
-        total += chunkLen;
+        hbci->stats.bytes = total + chunkLen;
+        hbci->stats.chunks++;
     }
 
-    // hack, wait for chip to flash this f/w
-    k_sleep(K_MSEC(60));
+    hbci->stats.total_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
 
+    // the chip installs the image before it answers the status query,
+    // ask until it does
+    //
     // HBCI QUERY
-    hbci_prepare(&snd, FW_DWNLD_QRY_CLA, FW_DWNLD_QRY_IMAGE_STATUS, FINAL_PACKET);
-    hbci_done(&snd);
-    hbci_transceive_hdr(&snd, &rcv);
+    hbci_poll(hbci, FW_DWNLD_QRY_CLA, FW_DWNLD_QRY_IMAGE_STATUS, HBCI_INSTALL_DEADLINE_MS,
+                &rcv, &hbci->stats.install_polls, &hbci->stats.install_us);
+    hbci->stats.install_max_us = MAX(hbci->stats.install_max_us, hbci->stats.install_us);
     if (hbci_check(&rcv, FW_DWNLD_ANS_CLA, FW_DWNLD_IMAGE_SUCCESS, FINAL_PACKET))
     {
         LOG_ERR("Wrong response to [FW_DWNLD_QRY_CLA, FW_DWNLD_QRY_IMAGE_STATUS]");
         goto exit;
     }
 
-    LOG_INF("HELIOS FW download completed");
+    LOG_INF("HELIOS FW download completed, %u bytes in %u ms (%u KB/s), boot %u us, install %u us",
+                hbci->stats.bytes, hbci->stats.total_us / 1000,
+                hbci->stats.total_us ? (uint32_t)(((uint64_t)hbci->stats.bytes * 1000) / hbci->stats.total_us) : 0,
+                hbci->stats.boot_us, hbci->stats.install_us);
     ret = 0;
 exit:
+    if (ret && downloading)
+    {
+        hbci->stats.failures++;
+    }
+    if (hbci->image.fa)
+    {
+        flash_area_close(hbci->image.fa);
+        hbci->image.fa = NULL;
+    }
     return ret;
 }
 
-int HBCIprotoInit()
+int HBCIprotoInit(nrfspi_t *inSPI)
 {
+    hbci_t *hbci;
     int ret = -EINVAL;
 
+    require(inSPI, exit);
+    hbci = &mHBCI[NRFSPIunit(inSPI)];
+    hbci->spi = inSPI;
+
+    k_sem_init(&hbci->readySem, 0, 1);
+    k_sem_init(&hbci->sentSem, 0, 1);
+
+    // answers wake us, the uci layer takes the irq back after
+    NRFSPIsetRequestHandler(hbci->spi, hbci_request_callback, hbci);
+
     // enable device
-    ret = NRFSPIenableChip(true);
+    ret = NRFSPIenableChip(hbci->spi, true);
     require_noerr(ret, exit);
 
-    // note that the module takes about 9ms to auto-load boot-loader and be online
-    // TODO - move this wait to the app layer?
-    k_sleep(K_MSEC(10));
+    // the module takes about 9ms to auto-load the boot-loader and be
+    // online, the download's first query polls until it is
+    //
+    k_mutex_lock(&mHbciDownloadLock, K_FOREVER);
+    ret = _HbciEncryptedFwDownload(hbci);
+    k_mutex_unlock(&mHbciDownloadLock);
+
+    NRFSPIsetRequestHandler(hbci->spi, NULL, NULL);
+exit:
+    return ret;
+}
+
+int HBCIprotoImage(nrfspi_t *inSPI, int32_t *outAt, uint32_t *outVersion)
+{
+    hbci_t *hbci;
+    int ret = -EINVAL;
+
+    require(inSPI, exit);
+    hbci = &mHBCI[NRFSPIunit(inSPI)];
 
-    ret = _HbciEncryptedFwDownload();
+    ret = -ENOENT;
+    require(hbci->image.size, exit);
+
+    *outAt      = hbci->image.partition ? (int32_t)hbci->image.at : -1;
+    *outVersion = hbci->image.version;
+    ret = 0;
 exit:
     return ret;
 }
 
 
+
+#ifdef CONFIG_SHELL
+
+#include <zephyr/shell/shell.h>
+
+static int _CmdHbciStats( const struct shell *shell, size_t argc, char **argv )
+{
+    hbci_stats_t *stats;
+    hbci_image_t *image;
+    int unit;
+
+#if HBCI_FW_BUILTIN
+    shell_print(shell, "Built-in image %u bytes in %u chunks, %u packed, stored in %u bytes (%u bytes RAM per unit)",
+                HBCI_FW_IMAGE_LEN, HBCI_FW_CHUNK_COUNT, HBCI_FW_PACKED_CHUNKS, HBCI_FW_STORED_LEN,
+                (uint32_t)sizeof(hbci_t));
+#else
+    shell_print(shell, "No built-in image (%u bytes RAM per unit)", (uint32_t)sizeof(hbci_t));
+#endif
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        stats = &mHBCI[unit].stats;
+        image = &mHBCI[unit].image;
+        if (!mHBCI[unit].spi)
+        {
+            continue;
+        }
+
+        shell_print(shell, "[%d] Downloads=%u failed=%u  last %u bytes in %u chunks, %u ms (%u KB/s)", unit,
+                    stats->downloads, stats->failures, stats->bytes, stats->chunks, stats->total_us / 1000,
+                    stats->total_us ? (uint32_t)(((uint64_t)stats->bytes * 1000) / stats->total_us) : 0);
+        if (image->partition)
+        {
+            shell_print(shell, "    Image %02x.%02x.%02x from uwbs_fw at 0x%x, %u bytes crc %08x",
+                        (image->version >> 16) & 0xFF, (image->version >> 8) & 0xFF, image->version & 0xFF,
+                        image->at, image->size, image->crc);
+        }
+        else
+        {
+            shell_print(shell, "    Image built in, %u bytes", image->size);
+        }
+        shell_print(shell, "    From uwbs_fw=%u built in=%u  bad crc=%u",
+                    stats->partition_images, stats->builtin_images, stats->bad_images);
+        shell_print(shell, "    Acks wait=%uus max=%uus avg=%uus  unpacking=%uus  reading uwbs_fw=%uus",
+                    stats->ack_us, stats->ack_max_us,
+                    stats->chunks ? stats->ack_us / (stats->chunks * 2) : 0, stats->unpack_us, stats->read_us);
+        shell_print(shell, "    Writes held for irq to drop=%u (went anyway %u)",
+                    stats->idle_waits, stats->idle_timeouts);
+        shell_print(shell, "    Boot loader up after %uus (%u polls, max %uus)  image installed after %uus (%u polls, max %uus)",
+                    stats->boot_us, stats->boot_polls, stats->boot_max_us,
+                    stats->install_us, stats->install_polls, stats->install_max_us);
+    }
+    return 0;
+}
+
+// The images in the uwbs_fw partition, and the ids each uwbs gave
+//
+static int _CmdHbciImages( const struct shell *shell, size_t argc, char **argv )
+{
+    int unit;
+#ifdef HBCI_FW_PARTITION
+    const struct flash_area *fa;
+    hbci_fw_hdr_t hdr;
+    uint32_t at;
+    int ret;
+    int i;
+
+    if (flash_area_open(HBCI_FW_PARTITION, &fa))
+    {
+        shell_error(shell, "Can't open uwbs_fw");
+        return -ENOENT;
+    }
+    shell_print(shell, "uwbs_fw at 0x%x, %u bytes", (uint32_t)fa->fa_off, (uint32_t)fa->fa_size);
+
+    for (at = 0; !(ret = hbci_read_image_hdr(fa, at, &hdr)); at = hdr.next)
+    {
+        char match[HBCI_FW_MATCH_MAX * 2 + 1];
+
+        for (i = 0; i < hdr.match_len; i++)
+        {
+            snprintf(&match[i * 2], 3, "%02x", hdr.match[i]);
+        }
+        match[hdr.match_len * 2] = 0;
+
+        shell_print(shell, "  0x%06x %02x.%02x.%02x %u bytes crc %08x for %s %s", at,
+                    (hdr.version >> 16) & 0xFF, (hdr.version >> 8) & 0xFF, hdr.version & 0xFF,
+                    hdr.size, hdr.crc,
+                    hdr.match_ins == QRY_CHIP_ID_INS ? "chip" : hdr.match_ins == QRY_HELIOS_ID_INS ? "helios" : "any uwbs",
+                    match);
+        if (hdr.next == 0)
+        {
+            break;
+        }
+    }
+    if (ret == -EBADMSG)
+    {
+        shell_print(shell, "  0x%06x bad header", at);
+    }
+    flash_area_close(fa);
+#else
+    shell_print(shell, "No uwbs_fw partition");
+#endif
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        if (!mHBCI[unit].spi)
+        {
+            continue;
+        }
+        shell_print(shell, "[%d] Chip id", unit);
+        shell_hexdump(shell, mHBCI[unit].chipId, mHBCI[unit].chipIdLen);
+        shell_print(shell, "[%d] Helios id", unit);
+        shell_hexdump(shell, mHBCI[unit].heliosId, mHBCI[unit].heliosIdLen);
+    }
+    return 0;
+}
+
+// Unpack the packed chunks, to compare with how fast the bus takes them
+//
+static int _CmdHbciBench( const struct shell *shell, size_t argc, char **argv )
+{
+#if HBCI_FW_PACKED_CHUNKS
+    uint32_t rounds = 1;
+    uint32_t round;
+    uint64_t bytes = 0;
+    uint32_t start;
+    uint32_t us;
+    int chunk;
+    int size;
+    int ret = 0;
+
+    if (argc > 1)
+    {
+        rounds = strtoul(argv[1], NULL, 0);
+    }
+
+    // the download buffer, a unit that boots meanwhile waits for it
+    //
+    k_mutex_lock(&mHbciDownloadLock, K_FOREVER);
+
+    start = k_cycle_get_32();
+    for (round = 0; round < rounds && !ret; round++)
+    {
+        for (chunk = 0; chunk < HBCI_FW_CHUNK_COUNT; chunk++)
+        {
+            if (!mHbciFwChunks[chunk].packed)
+            {
+                continue;
+            }
+            size = MIN(HBCI_FW_IMAGE_LEN - chunk * FW_CHUNK_LEN, FW_CHUNK_LEN);
+            if (hbci_unpack(&mHbciFwImage[mHbciFwChunks[chunk].offset], mHbciFwChunks[chunk].size,
+                        mHbciChunk, size))
+            {
+                shell_error(shell, "Chunk %d doesn't unpack", chunk);
+                ret = -EBADMSG;
+                break;
+            }
+            bytes += size;
+        }
+    }
+    us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+    k_mutex_unlock(&mHbciDownloadLock);
+
+    if (ret)
+    {
+        return ret;
+    }
+
+    shell_print(shell, "Unpacked %llu bytes in %uus (%u KB/s), last download ran at %u KB/s",
+                bytes, us, us ? (uint32_t)((bytes * 1000) / us) : 0,
+                mHBCI[0].stats.total_us ?
+                    (uint32_t)(((uint64_t)mHBCI[0].stats.bytes * 1000) / mHBCI[0].stats.total_us) : 0);
+#else
+    shell_print(shell, "No packed chunks, the image is all sent straight from flash");
+#endif
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_hbci,
+    SHELL_CMD(stats, NULL,   " Print the last firmware download per unit (re-run one with uwbsim hang on native_sim)\n", _CmdHbciStats),
+    SHELL_CMD(images, NULL,  " List the images in the uwbs_fw partition and the ids of each uwbs\n", _CmdHbciImages),
+    SHELL_CMD_ARG(bench, NULL, " Time unpacking the packed firmware chunks (use hbci bench [rounds])\n", _CmdHbciBench, 1, 1),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(hbci, &sub_hbci, "UWBS firmware download", NULL);
+
+#endif
@@ -4,5 +4,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-int HBCIprotoInit(void);
+#include "nrfspi.h"
+
+// Boot the uwbs on inSPI and download the firmware to it, blocks
+// until it is running uci (or failed).  Takes the irq request handler
+// while it runs and leaves none set
+//
+int HBCIprotoInit(nrfspi_t *inSPI);
+
+// The image the last download on inSPI was of, its offset in the
+// uwbs_fw partition (-1 for the built-in one) and version (0x00MMmmpp,
+// 0 built-in).  -ENOENT when none was picked
+//
+int HBCIprotoImage(nrfspi_t *inSPI, int32_t *outAt, uint32_t *outVersion);
 
@@ -18,6 +18,11 @@
 
 #define NI_MAX_MESSAGE  256
 
+// the uwbs used for phone sessions, any others are driven from
+// the uwb shell
+//
+#define NI_UWB_UNIT     (0)
+
 static struct
 {
     bool        were_initiator;
@@ -434,7 +439,7 @@ int NIrxMessage(void *conn_ctx, const uint8_t *inData, const uint32_t inCount)
 
         if (!ret)
         {
-            ret = UWBstart(mNI.were_initiator  ? UWB_DeviceType_Controller : UWB_DeviceType_Controlee,
+            ret = UWBstart(NI_UWB_UNIT, mNI.were_initiator  ? UWB_DeviceType_Controller : UWB_DeviceType_Controlee,
                         0, mNI.msgbuf, mNI.msgcnt);
             if (ret)
             {
@@ -448,7 +453,7 @@ int NIrxMessage(void *conn_ctx, const uint8_t *inData, const uint32_t inCount)
         }
         break;
     case UWBMSG_STOP:
-        ret = UWBstop();
+        ret = UWBstop(NI_UWB_UNIT);
         break;
     default:
         LOG_WRN("Ignoring cmd 0x%02X", inData[0]);
@@ -459,10 +464,15 @@ exit:
     return ret;
 }
 
-static int _SessionStateCallback(uint32_t session_id, uint8_t state, uint8_t reason)
+static int _SessionStateCallback(int unit, uint32_t session_id, uint8_t state, uint8_t reason)
 {
     int ret = 0;
 
+    if (unit != NI_UWB_UNIT)
+    {
+        return 0;
+    }
+
     mNI.session_state = state;
 
     switch (state)
@@ -523,7 +533,7 @@ static int _SessionStateCallback(uint32_t session_id, uint8_t state, uint8_t rea
 
         // make sure underlying session is stopped for sure
         //
-        UWBstop();
+        UWBstop(NI_UWB_UNIT);
     }
 
     return ret;
@@ -546,13 +556,13 @@ int NIbleConnectHandler(const void * const inConnectionHandle, const uint16_t in
         if (mNI.session_state != SS_INACTIVE)
         {
             LOG_INF("BLE disconnect stops ranging session");
-            UWBstop();
+            UWBstop(NI_UWB_UNIT);
         }
     }
 
     // when connected, we have no idea what state UWB is in so ask
     //
-    ret = UWBgetSessionState(&session_id, &sess_state);
+    ret = UWBgetSessionState(NI_UWB_UNIT, &session_id, &sess_state);
     if (!ret)
     {
         switch (sess_state)
@@ -629,14 +639,14 @@ static int _CmdStart( const struct shell *shell, size_t argc, char **argv )
     shell_print(shell, "Starting %s ranging session id %08X",
             initiate ? "initator" : "responder", session_id);
 
-    int ret = UWBstart(mNI.our_device_type, session_id, NULL, 0);
+    int ret = UWBstart(NI_UWB_UNIT, mNI.our_device_type, session_id, NULL, 0);
 
     return ret;
 }
 
 static int _CmdStop( const struct shell *shell, size_t argc, char **argv )
 {
-    int ret = UWBstop();
+    int ret = UWBstop(NI_UWB_UNIT);
 
     return ret;
 }
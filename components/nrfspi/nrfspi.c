@@ -1,41 +1,180 @@
 #include "nrfspi.h"
+#include "nrfspi_backend.h"
 #include "timesvc.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/types.h>
-#include <zephyr/drivers/spi.h>
 
 #include "autoconf.h"
 
+#ifdef CONFIG_SETTINGS
+#include <zephyr/settings/settings.h>
+#endif
+
 #define COMPONENT_NAME nrfspi_c
 #include "Logging.h"
 
-// This code implements the controller (SPIM) side of SPI bus
+// This code implements the controller (SPIM) side of SPI bus. The
+// bytes and lines are moved by a backend, the real spi/gpio hardware
+// or, on native_sim, an in-process uwbs model
 //
-#define SPI_DEV_NODE DT_NODELABEL(spi1)
+#ifdef CONFIG_BOARD_NATIVE_SIM
+#define NRFSPI_BACKEND  (&NRFSPIsimOps)
+#else
+#define NRFSPI_BACKEND  (&NRFSPIzephyrOps)
+#endif
 
 #define SPI_MAX_DATA        (256)
 #define SPI_PACKET_SIZE     (4 + SPI_MAX_DATA)
 
+// how long (microseconds) the uwbs gets to drop and then re-raise
+// the irq line after we raise sync before we give up on a read
+//
+#define NRFSPI_SYNC_TIMEOUT_US  (2000)
+
+// bus clocks, slowest first. Calibration and link errors only ever
+// step down from the unit's spi-max-frequency (8MHz, the most the
+// uwbs's SPIM1 does), it checks the bus works there and finds how far
+// under it, never anything faster
+//
+static const uint32_t mClockSteps[] =
+{
+    1000000, 2000000, 4000000, 8000000
+};
+
+// known-answer exchanges that all have to pass at a clock
+//
+#define NRFSPI_CAL_PROBES       (8)
+
+// this many integrity errors in a window of checks drops the clock
+// a step
+//
+#define NRFSPI_LINK_WINDOW      (64)
+#define NRFSPI_LINK_MAX_ERRORS  (3)
+
+// per unit
+#define NRFSPI_SETTINGS_CLOCK   "uwbspi/%d/clock"
+
+typedef enum
+{
+    NRFSPI_SYNC_IDLE,
+    NRFSPI_SYNC_WAIT_LOW,
+    NRFSPI_SYNC_WAIT_HIGH,
+    NRFSPI_SYNC_READY
+}
+nrfspi_sync_state_t;
+
+typedef struct
+{
+    uint32_t                count;
+    uint32_t                timeouts;
+    uint32_t                min_us;
+    uint32_t                max_us;
+    uint64_t                total_us;
+}
+nrfspi_sync_stats_t;
+
+typedef struct
+{
+    uint32_t                count;
+    uint32_t                errors;
+    uint32_t                busy;
+    uint64_t                bytes;
+    uint64_t                total_us;
+}
+nrfspi_async_stats_t;
+
 typedef struct
 {
+    uint32_t                checks;
+    uint32_t                errors;
+    uint32_t                window_checks;
+    uint32_t                window_errors;
+    uint32_t                downshifts;
+    uint32_t                calibrations;
+}
+nrfspi_link_stats_t;
+
+struct nrfspi
+{
+    int                     unit;
     bool                    initialized;
     bool                    enabled;
-    int                     max_packet;
-    const struct device     *dev;
+    const nrfspi_ops_t      *ops;
     uint32_t                rxRequested;
-    struct gpio_callback    irqCallback;
-    struct spi_config       spi_cfg;
-    const struct gpio_dt_spec *irq_gpio;
-    const struct gpio_dt_spec *sync_gpio;
-    const struct gpio_dt_spec *ce_gpio;
+    uint32_t                rxStamp;
+    nrfspi_request_t        requestHandler;
+    void                   *requestContext;
+    struct k_sem            syncSem;
+    struct k_spinlock       syncLock;
+    volatile nrfspi_sync_state_t syncState;
+    uint32_t                syncStart;
+    nrfspi_sync_stats_t     syncStats;
+    volatile bool           asyncBusy;
+    bool                    asyncIsRead;
+    uint32_t                asyncStart;
+    nrfspi_done_t           asyncDone;
+    void                   *asyncContext;
+    nrfspi_async_stats_t    asyncStats;
+    uint32_t                clock_hz;
+    uint32_t                clock_pending;
+    bool                    clock_loaded;
+    bool                    clock_saved;
+    atomic_t                clock_unsaved;
+    bool                    calibrating;
+    nrfspi_link_stats_t     linkStats;
+};
+
+static nrfspi_t mSPI[NRFSPI_MAX_DEVICES];
+
+BUILD_ASSERT(NRFSPI_MAX_DEVICES > 0, "No nxp,sr150-uci devices in the devicetree");
+
+int NRFSPIcount(void)
+{
+    const nrfspi_ops_t *ops = NRFSPI_BACKEND;
+    int count = ops->count();
+
+    return (count < NRFSPI_MAX_DEVICES) ? count : NRFSPI_MAX_DEVICES;
+}
+
+nrfspi_t *NRFSPIget(int inUnit)
+{
+    nrfspi_t *nrfspi;
+
+    if (inUnit < 0 || inUnit >= NRFSPI_MAX_DEVICES)
+    {
+        return NULL;
+    }
+
+    nrfspi = &mSPI[inUnit];
+    nrfspi->unit = inUnit;
+    nrfspi->ops = NRFSPI_BACKEND;
+    return nrfspi;
 }
-nrfspi_t;
 
-static nrfspi_t mSPI;
+int NRFSPIunit(const nrfspi_t *inSPI)
+{
+    return inSPI->unit;
+}
+
+// A clock change waits for the bus to be idle, i.e. the start of the
+// next transfer
+//
+static void _nrfspi_apply_clock(nrfspi_t *nrfspi)
+{
+    if (nrfspi->clock_pending && nrfspi->ops->set_clock)
+    {
+        if (!nrfspi->ops->set_clock(nrfspi->unit, nrfspi->clock_pending))
+        {
+            nrfspi->clock_hz = nrfspi->clock_pending;
+        }
+    }
+    nrfspi->clock_pending = 0;
+}
 
 static int _nrfspi_trx(
                     nrfspi_t *nrfspi,
@@ -44,203 +183,297 @@ static int _nrfspi_trx(
                     uint8_t *rxdata,
                     const int rxsize)
 {
-    int ret;
-
-    struct spi_buf rx_buf[1];
-    struct spi_buf_set rx;
+    nrfspi_iovec_t vec;
 
-    struct spi_buf tx_buf[1];
-    struct spi_buf_set tx;
+    _nrfspi_apply_clock(nrfspi);
 
-    rx_buf[0].buf = (uint8_t*)rxdata;
-    rx_buf[0].len = rxsize;
+    vec.data = txdata;
+    vec.count = txcount;
 
-    rx.buffers = rx_buf;
-    rx.count = rxdata ? 1 : 0;
-
-    tx_buf[0].buf = (uint8_t*)txdata;
-    tx_buf[0].len = txcount;
-
-    tx.buffers = tx_buf;
-    tx.count = txdata ? 1 : 0;
-
-    ret = spi_transceive(nrfspi->dev, &nrfspi->spi_cfg, &tx, &rx);
-    return ret;
+    return nrfspi->ops->transfer(nrfspi->unit, txdata ? &vec : NULL, txdata ? 1 : 0, rxdata, rxsize);
 }
 
-static void _host_irq_callback(const struct device *dev,
-                     struct gpio_callback *cb, uint32_t pins)
+static void _nrfspi_async_complete(nrfspi_t *nrfspi, int result)
 {
+    nrfspi_done_t done = nrfspi->asyncDone;
+    void *context = nrfspi->asyncContext;
 
-    nrfspi_t *nrfspi = CONTAINER_OF(cb, nrfspi_t, irqCallback);
-
-    // just count the request, well do the xfer in poll if
-    // needed. the host should never interrupt unless it has
-    // the whole packet to send already loaded into the sp
-    // tx buffer on its side
-    //
-    nrfspi->rxRequested++;
+    nrfspi->asyncStats.total_us += k_cyc_to_us_floor32(k_cycle_get_32() - nrfspi->asyncStart);
+    if (result)
+    {
+        nrfspi->asyncStats.errors++;
+    }
 
-    // disable host int for a bit
-    gpio_pin_interrupt_configure_dt(nrfspi->irq_gpio, GPIO_INT_DISABLE);
+    if (nrfspi->asyncIsRead)
+    {
+        // same as the end of a blocking read
+        nrfspi->rxRequested = 0;
+        nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_TO_ACTIVE);
+    }
 
-    // signal any waiter to wake up
-    TimeSignalApplicationEvent();
+    nrfspi->asyncDone = NULL;
+    nrfspi->asyncBusy = false;
 
+    if (done)
+    {
+        done(result, context);
+    }
 }
 
-static const struct spi_cs_control mspi_cs =
+static void _nrfspi_async_callback(int result, void *data)
 {
-    .gpio = GPIO_DT_SPEC_GET_BY_IDX(SPI_DEV_NODE, cs_gpios, 0),
-    .delay = 0
-};
-
-#define SPI1_NODE DT_NODELABEL(uci_spi)
+    // note this is called from the spi isr, and the driver still
+    // owns the bus, so the done callback must not start another transfer
+    //
+    _nrfspi_async_complete((nrfspi_t *)data, result);
+}
 
-#define IPC_GPIO_NODE DT_PATH(gpio)
+// Start an async transfer. Either gathers txveccount tx buffers into
+// one transaction (one chip-select) or reads into rxdata
+//
+static int _nrfspi_trx_async(
+                    nrfspi_t *nrfspi,
+                    const nrfspi_iovec_t *txvec,
+                    const int txveccount,
+                    uint8_t *rxdata,
+                    const int rxsize,
+                    nrfspi_done_t inDone,
+                    void *inContext)
+{
+    int ret = -EBUSY;
+    int i;
 
-static const struct gpio_dt_spec mspi_irq  = GPIO_DT_SPEC_GET(DT_NODELABEL(uwb_spi_irq), gpios);
-static const struct gpio_dt_spec mspi_sync = GPIO_DT_SPEC_GET(DT_NODELABEL(uwb_spi_sync), gpios);
-static const struct gpio_dt_spec mspi_ce   = GPIO_DT_SPEC_GET(DT_NODELABEL(uwb_spi_ce), gpios);
+    if (nrfspi->asyncBusy)
+    {
+        nrfspi->asyncStats.busy++;
+        goto exit;
+    }
 
-/*
-The time required for the module to go into DPD state is < 100 s controlled by the firmware.
-The required time for the module to enter HPD state is less then 100 s starting for the instance
-that CE is de-asserted, in both modes VDD_1V8_DIG is turned off. The Wakeup timing from DPD
-state is around 370 s, the wakeup from HPD state is triggered once CE is asserted and takes
-around 380 s.
-*/
+    ret = -EINVAL;
+    require(txveccount <= NRFSPI_MAX_IOVEC, exit);
 
-/*
- * From NXP code
+    _nrfspi_apply_clock(nrfspi);
 
-    masterConfig.baudRate_Bps = UWB_SPI_BAUDRATE;           // 8MHx
-    masterConfig.dataWidth    = kSPI_Data8Bits;             // 8 bit
-    masterConfig.polarity     = kSPI_ClockPolarityActiveHigh;// CPOL=0
-    masterConfig.phase        = kSPI_ClockPhaseFirstEdge;   // CPHA=0
-    masterConfig.direction    = kSPI_MsbFirst;              //
+    nrfspi->asyncBusy = true;
+    nrfspi->asyncIsRead = (rxdata != NULL);
+    nrfspi->asyncDone = inDone;
+    nrfspi->asyncContext = inContext;
+    nrfspi->asyncStart = k_cycle_get_32();
 
-    masterConfig.delayConfig.preDelay      = 15U;
-    masterConfig.delayConfig.postDelay     = 15U;
-    masterConfig.delayConfig.frameDelay    = 15U;
-    masterConfig.delayConfig.transferDelay = 15U;
+    nrfspi->asyncStats.count++;
+    if (rxdata)
+    {
+        nrfspi->asyncStats.bytes += rxsize;
+    }
+    else
+    {
+        for (i = 0; i < txveccount; i++)
+        {
+            nrfspi->asyncStats.bytes += txvec[i].count;
+        }
+    }
 
-    masterConfig.sselPol = kSPI_SpolActiveAllLow;           //
-    masterConfig.sselNum = UWB_SPI_SSEL;
-*/
+    if (nrfspi->ops->transfer_async)
+    {
+        ret = nrfspi->ops->transfer_async(nrfspi->unit, txvec, txveccount, rxdata, rxsize,
+                    _nrfspi_async_callback, nrfspi);
+        if (ret)
+        {
+            // never started, so no callback is coming
+            nrfspi->asyncStats.errors++;
+            nrfspi->asyncDone = NULL;
+            nrfspi->asyncBusy = false;
+        }
+    }
+    else
+    {
+        // no async support in the backend, do it inline and
+        // complete immediately
+        //
+        ret = nrfspi->ops->transfer(nrfspi->unit, txvec, txveccount, rxdata, rxsize);
+        _nrfspi_async_complete(nrfspi, ret);
+        ret = 0;
+    }
+exit:
+    return ret;
+}
 
-static int _nrfspi_init(nrfspi_t *nrfspi)
+// Advance the read handshake.  The uwbs acknowledges sync by dropping
+// its irq line (it is preparing rx data) and then raising it again
+// when the data is ready to clock out. Called from the irq edge isr
+// (inEdge true) and once from the thread after sync is raised in case
+// the line was already low
+//
+static void _nrfspi_sync_advance(nrfspi_t *nrfspi, bool inEdge)
 {
-    int ret = -ENODEV;
-
-    memcpy(&nrfspi->spi_cfg.cs, &mspi_cs, sizeof(mspi_cs));
-    nrfspi->spi_cfg.frequency = DT_PROP(SPI1_NODE, spi_max_frequency);
-    nrfspi->spi_cfg.slave = DT_REG_ADDR(SPI1_NODE);
-    nrfspi->irq_gpio = &mspi_irq;
-    nrfspi->sync_gpio = &mspi_sync;
-    nrfspi->ce_gpio = &mspi_ce;
+    k_spinlock_key_t key;
+    int irq_state;
 
-    nrfspi->spi_cfg.cs.delay = 15;
+    key = k_spin_lock(&nrfspi->syncLock);
 
-    nrfspi->spi_cfg.operation = SPI_WORD_SET(8) | SPI_TRANSFER_MSB;
-    nrfspi->spi_cfg.operation |= SPI_OP_MODE_MASTER;
+    irq_state = nrfspi->ops->get_irq(nrfspi->unit);
 
-    // de-assert sync
-    ret = gpio_pin_configure_dt(nrfspi->sync_gpio, GPIO_OUTPUT_INACTIVE);
+    if (nrfspi->syncState == NRFSPI_SYNC_WAIT_LOW && (inEdge || !irq_state))
+    {
+        // a falling edge was latched, even if the line is already back up
+        // by the time we got here, so arm for the rising edge and then
+        // re-sample in case it rose before the edge was armed
+        //
+        nrfspi->syncState = NRFSPI_SYNC_WAIT_HIGH;
+        nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_TO_ACTIVE);
+        irq_state = nrfspi->ops->get_irq(nrfspi->unit);
+    }
 
-    // disable chip
-    ret = gpio_pin_configure_dt(nrfspi->ce_gpio, GPIO_OUTPUT_INACTIVE);
+    if (nrfspi->syncState == NRFSPI_SYNC_WAIT_HIGH && irq_state)
+    {
+        nrfspi->syncState = NRFSPI_SYNC_READY;
 
-    // setup an interrupt on gpio for peripheral initiated transfers
-    ret = gpio_pin_configure_dt(nrfspi->irq_gpio, GPIO_INPUT | GPIO_PULL_UP);
-    require_noerr(ret, exit);
+        // read path re-enables host interrupts when it is done
+        nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_DISABLE);
+        k_sem_give(&nrfspi->syncSem);
+    }
 
-    // delay a bit to reset chip
-    k_sleep(K_USEC(400));
+    k_spin_unlock(&nrfspi->syncLock, key);
+}
 
-#if 0
-    // enable chip
-    ret = gpio_pin_configure_dt(nrfspi->ce_gpio, GPIO_OUTPUT_ACTIVE);
+static void _host_irq_callback(int inUnit)
+{
+    nrfspi_t *nrfspi = &mSPI[inUnit];
 
-    // let chip boot
-    k_sleep(K_USEC(400));
+    if (nrfspi->syncState != NRFSPI_SYNC_IDLE)
+    {
+        // edges during a read handshake belong to the handshake
+        _nrfspi_sync_advance(nrfspi, true);
+        return;
+    }
 
-    // If irq pin is stuck active, disable it and assume no spi attachement
+    // just count the request, well do the xfer in poll if
+    // needed. the host should never interrupt unless it has
+    // the whole packet to send already loaded into the sp
+    // tx buffer on its side
     //
-    volatile int state = gpio_pin_get_dt(nrfspi->irq_gpio);
-    volatile int xstate = gpio_pin_get_raw(nrfspi->irq_gpio->port, nrfspi->irq_gpio->pin);
-    int attempt;
+    nrfspi->rxRequested++;
+    nrfspi->rxStamp = k_cycle_get_32();
 
-    LOG_INF("SPI irq pin %d is %d.%d on open", nrfspi->irq_gpio->pin, state, xstate);
+    // disable host int for a bit
+    nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_DISABLE);
 
-    // note, the slave could be just coming out of reset, so wait a second to let
-    // it come up before we decide its there or not, and read it to clesr its irq
-    //
-    for (attempt = 0; state && (attempt < 20); attempt++)
+    // signal any waiter to wake up
+    if (nrfspi->requestHandler)
     {
-        state = gpio_pin_get_dt(nrfspi->irq_gpio);
-        if (state)
-        {
-            uint8_t junk[32];
-
-            nrfspi->rxRequested = 1;
-            NRFSPIread(junk, sizeof(junk));
-            k_sleep(K_MSEC(1));
-        }
+        nrfspi->requestHandler(nrfspi->requestContext);
     }
-
-    if (state)
+    else
     {
-        // irq high for over 200ms, assume board is not populated
-        //
-        LOG_WRN("SPI pin %d irq stuck on, assuming no device attached", nrfspi->irq_gpio->pin);
-        ret = -EIO;
-        goto exit;
+        TimeSignalApplicationEvent();
     }
-#endif
-    gpio_pin_interrupt_configure_dt(nrfspi->irq_gpio, GPIO_INT_EDGE_TO_ACTIVE);
+}
 
-    gpio_init_callback(&nrfspi->irqCallback, _host_irq_callback, BIT(nrfspi->irq_gpio->pin));
-    ret = gpio_add_callback(nrfspi->irq_gpio->port, &nrfspi->irqCallback);
-    require_noerr(ret, exit);
+void NRFSPIsetRequestHandler(nrfspi_t *nrfspi, nrfspi_request_t inHandler, void *inContext)
+{
+    nrfspi->requestContext = inContext;
+    nrfspi->requestHandler = inHandler;
+}
+
+int NRFSPIread(
+                nrfspi_t *nrfspi,
+                uint8_t *outRxData,
+                int inRxSize)
+{
+    int ret = -EINVAL;
+
+    require(nrfspi, exit);
+    require(outRxData, exit);
+    require(inRxSize, exit);
 
-    NRFSPIenableChip(0);
+    ret = -ENODEV;
+    require(nrfspi->initialized, exit);
+
+    // read the data
+    ret = _nrfspi_trx(nrfspi, NULL, 0, outRxData, inRxSize);
 
     nrfspi->rxRequested = 0;
-    ret = 0;
+    nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_TO_ACTIVE);
 exit:
     return ret;
 }
 
-int NRFSPIread(
+int NRFSPIreadAsync(
+                nrfspi_t *nrfspi,
                 uint8_t *outRxData,
-                int inRxSize)
+                int inRxSize,
+                nrfspi_done_t inDone,
+                void *inContext)
 {
-    nrfspi_t *nrfspi = &mSPI;
     int ret = -EINVAL;
 
+    require(nrfspi, exit);
     require(outRxData, exit);
     require(inRxSize, exit);
 
     ret = -ENODEV;
     require(nrfspi->initialized, exit);
 
-    // read the data
-    ret = _nrfspi_trx(nrfspi, NULL, 0, outRxData, inRxSize);
+    ret = _nrfspi_trx_async(nrfspi, NULL, 0, outRxData, inRxSize, inDone, inContext);
+exit:
+    return ret;
+}
+
+int NRFSPIwritevAsync(
+                nrfspi_t *nrfspi,
+                const nrfspi_iovec_t *inTxVec,
+                const int inTxVecCount,
+                nrfspi_done_t inDone,
+                void *inContext)
+{
+    int ret = -EINVAL;
+    int i;
+
+    require(nrfspi, exit);
+    require(inTxVec, exit);
+    require(inTxVecCount > 0 && inTxVecCount <= NRFSPI_MAX_IOVEC, exit);
+
+    for (i = 0; i < inTxVecCount; i++)
+    {
+        require(inTxVec[i].data && inTxVec[i].count > 0, exit);
+    }
+
+    ret = -ENODEV;
+    require(nrfspi->initialized, exit);
 
+    ret = _nrfspi_trx_async(nrfspi, inTxVec, inTxVecCount, NULL, 0, inDone, inContext);
 exit:
-    nrfspi->rxRequested = 0;
-    gpio_pin_interrupt_configure_dt(nrfspi->irq_gpio, GPIO_INT_EDGE_TO_ACTIVE);
     return ret;
 }
 
+int NRFSPIwriteAsync(
+                nrfspi_t *nrfspi,
+                const uint8_t *inTxData,
+                const int inTxCount,
+                nrfspi_done_t inDone,
+                void *inContext)
+{
+    nrfspi_iovec_t vec;
+
+    vec.data = inTxData;
+    vec.count = inTxCount;
+
+    return NRFSPIwritevAsync(nrfspi, &vec, 1, inDone, inContext);
+}
+
+bool NRFSPIbusy(nrfspi_t *nrfspi)
+{
+    return nrfspi->asyncBusy;
+}
+
 int NRFSPIwrite(
+                nrfspi_t *nrfspi,
                 const uint8_t *inTxData,
                 const int inTxCount)
 {
-    nrfspi_t *nrfspi = &mSPI;
     int ret = -EINVAL;
 
+    require(nrfspi, exit);
     require(inTxData, exit);
     require(inTxCount, exit);
 
@@ -253,103 +486,128 @@ exit:
     return ret;
 }
 
-int NRFSPIenableChip(bool enable)
+int NRFSPIenableChip(nrfspi_t *nrfspi, bool enable)
 {
     int ret;
-    nrfspi_t *nrfspi = &mSPI;
 
-    ret = gpio_pin_configure_dt(nrfspi->ce_gpio, enable ? GPIO_OUTPUT_ACTIVE : GPIO_OUTPUT_INACTIVE);
+    ret = nrfspi->ops->set_ce(nrfspi->unit, enable);
 
-    mSPI.enabled = enable;
-    if (enable)
-    {
-        gpio_pin_interrupt_configure_dt(nrfspi->irq_gpio, GPIO_INT_EDGE_TO_ACTIVE);
-    }
-    else
-    {
-        gpio_pin_interrupt_configure_dt(nrfspi->irq_gpio, GPIO_INT_DISABLE);
-    }
+    nrfspi->enabled = enable;
+    nrfspi->ops->irq_mode(nrfspi->unit, enable ? NRFSPI_IRQ_TO_ACTIVE : NRFSPI_IRQ_DISABLE);
     return ret;
 }
 
-int NRFSPIstartSync(void)
+int NRFSPIstartSync(nrfspi_t *nrfspi)
 {
     int ret;
-    nrfspi_t *nrfspi = &mSPI;
-    volatile int irq_state;
-    int timeout;
+    uint32_t elapsed;
+
+    k_sem_reset(&nrfspi->syncSem);
+    nrfspi->syncStart = k_cycle_get_32();
+    nrfspi->syncState = NRFSPI_SYNC_WAIT_LOW;
+
+    // arm for the uwbs dropping its irq line before raising sync
+    // so the edge can't be missed
+    //
+    nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_TO_INACTIVE);
 
     // raise sync to allow reading
-    ret = gpio_pin_configure_dt(nrfspi->sync_gpio, GPIO_OUTPUT_ACTIVE);
+    ret = nrfspi->ops->set_sync(nrfspi->unit, true);
     require_noerr(ret, exit);
 
-    // wait for uwbs to drop irq line so we know its preparing rx data
+    // irq may already be low
+    _nrfspi_sync_advance(nrfspi, false);
+
+    // sleep until the isr has seen the uwbs drop and re-raise irq
     //
-    timeout = 0;
-    do
+    ret = k_sem_take(&nrfspi->syncSem, K_USEC(NRFSPI_SYNC_TIMEOUT_US));
+    if (ret)
     {
-        irq_state = gpio_pin_get_dt(nrfspi->irq_gpio);
+        LOG_ERR("UWBS %d not read-ready%s", nrfspi->unit,
+                (nrfspi->syncState == NRFSPI_SYNC_WAIT_LOW) ? "" : " (2)");
+        nrfspi->syncStats.timeouts++;
+        ret = -ETIMEDOUT;
+        goto exit;
+    }
 
-        if (irq_state)
-        {
-            k_sleep(K_USEC(20));
-            timeout += 20;
-        }
+    elapsed = k_cyc_to_us_floor32(k_cycle_get_32() - nrfspi->syncStart);
+
+    nrfspi->syncStats.count++;
+    nrfspi->syncStats.total_us += elapsed;
+    if (elapsed > nrfspi->syncStats.max_us)
+    {
+        nrfspi->syncStats.max_us = elapsed;
+    }
+    if (elapsed < nrfspi->syncStats.min_us || nrfspi->syncStats.count == 1)
+    {
+        nrfspi->syncStats.min_us = elapsed;
     }
-    while (irq_state && timeout < 1000);
+    ret = 0;
 
-    if (irq_state)
+exit:
+    if (ret)
     {
-        LOG_ERR("UWBS not read-ready");
-        ret = -ETIMEDOUT;
-        goto exit;
+        nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_DISABLE);
     }
+    nrfspi->syncState = NRFSPI_SYNC_IDLE;
+    return ret;
+}
+
+int NRFSPIcontinueSync(nrfspi_t *nrfspi, uint32_t inWaitUs)
+{
+    int ret;
 
-    // now wait for uwbs to raise irq line so we know its ready to xfer
+    // sync is still active from the message just read. A uwbs with
+    // more to send raises irq again (read-ready) without another
+    // sync cycle, so just wait for the rising edge
     //
-    timeout = 0;
-    do
-    {
-        irq_state = gpio_pin_get_dt(nrfspi->irq_gpio);
+    k_sem_reset(&nrfspi->syncSem);
+    nrfspi->syncState = NRFSPI_SYNC_WAIT_HIGH;
+    nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_TO_ACTIVE);
 
-        if (!irq_state)
-        {
-            k_sleep(K_USEC(20));
-            timeout += 20;
-        }
-    }
-    while (!irq_state && timeout < 1000);
+    // irq may already be up
+    _nrfspi_sync_advance(nrfspi, false);
 
-    if (!irq_state)
+    ret = k_sem_take(&nrfspi->syncSem, K_USEC(inWaitUs));
+    if (ret)
     {
-        LOG_ERR("UWBS not read-ready (2)");
-        ret = -ETIMEDOUT;
+        // nothing more, an irq after this is a new request
+        nrfspi->syncState = NRFSPI_SYNC_IDLE;
+        nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_TO_ACTIVE);
+        ret = -EAGAIN;
         goto exit;
     }
 
+    // this read covers anything the irq isr counted
+    nrfspi->rxRequested = 0;
+    nrfspi->rxStamp = k_cycle_get_32();
+    nrfspi->syncState = NRFSPI_SYNC_IDLE;
     ret = 0;
-
 exit:
     return ret;
 }
 
-int NRFSPIstopSync(void)
+uint32_t NRFSPIrxRequestTime(nrfspi_t *nrfspi)
+{
+    return nrfspi->rxStamp;
+}
+
+int NRFSPIstopSync(nrfspi_t *nrfspi)
 {
     int ret;
-    nrfspi_t *nrfspi = &mSPI;
+
+    nrfspi->syncState = NRFSPI_SYNC_IDLE;
 
     // lower sync
-    ret = gpio_pin_configure_dt(nrfspi->sync_gpio, GPIO_OUTPUT_INACTIVE);
+    ret = nrfspi->ops->set_sync(nrfspi->unit, false);
     return ret;
 }
 
-int NRFSPIpoll(bool *outReadable)
+int NRFSPIpoll(nrfspi_t *nrfspi, bool *outReadable)
 {
     int ret = -EINVAL;
-    nrfspi_t *nrfspi;
-
-    nrfspi = &mSPI;
 
+    require(nrfspi, exit);
     require(outReadable, exit);
 
     if (nrfspi->enabled)
@@ -359,11 +617,12 @@ int NRFSPIpoll(bool *outReadable)
             // its possible another interrupt happened while we had it
             // disabled during reading, so poll the irq line here
             //
-            int irq_state = gpio_pin_get_dt(nrfspi->irq_gpio);
+            int irq_state = nrfspi->ops->get_irq(nrfspi->unit);
 
             if (irq_state)
             {
                 nrfspi->rxRequested = 1;
+                nrfspi->rxStamp = k_cycle_get_32();
                 TimeSignalApplicationEvent();
             }
         }
@@ -379,42 +638,387 @@ exit:
     return ret;
 }
 
-void NRFSPIdeinit(void)
+bool NRFSPIirqActive(nrfspi_t *nrfspi)
 {
-    nrfspi_t *nrfspi;
-
-    nrfspi = &mSPI;
+    return nrfspi->enabled && nrfspi->ops->get_irq(nrfspi->unit) != 0;
+}
 
+void NRFSPIdeinit(nrfspi_t *nrfspi)
+{
     if (nrfspi->initialized)
     {
         // abort any active spi transactions
         nrfspi->initialized = false;
+        nrfspi->asyncDone = NULL;
+        nrfspi->asyncBusy = false;
 
         // turn off host interrupts
-        gpio_pin_interrupt_configure_dt(nrfspi->irq_gpio, GPIO_INT_DISABLE);
+        nrfspi->ops->irq_mode(nrfspi->unit, NRFSPI_IRQ_DISABLE);
+    }
+}
+
+#ifdef CONFIG_SETTINGS
+static int _nrfspi_settings_load(
+                    const char *key,
+                    size_t len,
+                    settings_read_cb read_cb,
+                    void *cb_arg,
+                    void *param)
+{
+    uint32_t *hz = (uint32_t *)param;
+
+    if (len == sizeof(*hz))
+    {
+        read_cb(cb_arg, hz, sizeof(*hz));
+    }
+    return 0;
+}
+#endif
+
+static uint32_t _nrfspi_load_clock(nrfspi_t *nrfspi)
+{
+    uint32_t hz = 0;
+
+#ifdef CONFIG_SETTINGS
+    char key[32];
+
+    if (!settings_subsys_init())
+    {
+        snprintf(key, sizeof(key), NRFSPI_SETTINGS_CLOCK, nrfspi->unit);
+        settings_load_subtree_direct(key, _nrfspi_settings_load, &hz);
+    }
+#endif
+    return hz;
+}
+
+// Write (or with 0, forget) the clock for later boots. It only counts
+// as saved once it is in flash
+//
+static int _nrfspi_save_clock(nrfspi_t *nrfspi, uint32_t inHz)
+{
+    int ret = -ENOTSUP;
+
+#ifdef CONFIG_SETTINGS
+    char key[32];
+
+    snprintf(key, sizeof(key), NRFSPI_SETTINGS_CLOCK, nrfspi->unit);
+    if (inHz)
+    {
+        ret = settings_save_one(key, &inHz, sizeof(inHz));
+    }
+    else
+    {
+        ret = settings_delete(key);
+    }
+    if (ret)
+    {
+        LOG_ERR("SPI %d clock %u not saved (%d)", nrfspi->unit, inHz, ret);
+    }
+#endif
+    nrfspi->clock_saved = (inHz != 0) && !ret;
+    return ret;
+}
+
+int NRFSPIsetClock(nrfspi_t *nrfspi, uint32_t inHz)
+{
+    uint32_t max = nrfspi->ops->default_hz(nrfspi->unit);
+
+    if (!inHz || inHz > max)
+    {
+        inHz = max;
+    }
+    if (!nrfspi->ops->set_clock)
+    {
+        return -ENOTSUP;
+    }
+
+    nrfspi->clock_pending = inHz;
+    return 0;
+}
+
+uint32_t NRFSPIgetClock(nrfspi_t *nrfspi)
+{
+    return nrfspi->clock_pending ? nrfspi->clock_pending : nrfspi->clock_hz;
+}
+
+int NRFSPIdownshift(nrfspi_t *nrfspi)
+{
+    uint32_t clock = NRFSPIgetClock(nrfspi);
+    int step;
+
+    for (step = ARRAY_SIZE(mClockSteps) - 1; step >= 0; step--)
+    {
+        if (mClockSteps[step] < clock)
+        {
+            break;
+        }
+    }
+    if (step < 0)
+    {
+        // already as slow as we go
+        return -ERANGE;
+    }
+
+    LOG_WRN("SPI %d clock %u -> %u", nrfspi->unit, clock, mClockSteps[step]);
+
+    nrfspi->linkStats.downshifts++;
+    NRFSPIsetClock(nrfspi, mClockSteps[step]);
+
+    // link checks come from the uci reader thread, writing flash there
+    // stalls reads. NRFSPIsaveClock does it from the main loop
+    //
+    atomic_set(&nrfspi->clock_unsaved, mClockSteps[step]);
+    return 0;
+}
+
+void NRFSPIsaveClock(nrfspi_t *nrfspi)
+{
+    uint32_t hz = (uint32_t)atomic_clear(&nrfspi->clock_unsaved);
+
+    if (hz)
+    {
+        _nrfspi_save_clock(nrfspi, hz);
     }
 }
 
-int NRFSPIinit(void)
+void NRFSPIlinkCheck(nrfspi_t *nrfspi, bool inGood)
+{
+    nrfspi_link_stats_t *stats = &nrfspi->linkStats;
+
+    if (nrfspi->calibrating)
+    {
+        // calibration is expected to see errors, it handles them
+        return;
+    }
+
+    stats->checks++;
+    stats->window_checks++;
+    if (!inGood)
+    {
+        stats->errors++;
+        stats->window_errors++;
+    }
+
+    if (stats->window_errors >= NRFSPI_LINK_MAX_ERRORS)
+    {
+        NRFSPIdownshift(nrfspi);
+        stats->window_checks = 0;
+        stats->window_errors = 0;
+    }
+    else if (stats->window_checks >= NRFSPI_LINK_WINDOW)
+    {
+        stats->window_checks = 0;
+        stats->window_errors = 0;
+    }
+}
+
+static bool _nrfspi_probe_clock(nrfspi_t *nrfspi, nrfspi_probe_t inProbe, uint32_t inHz)
+{
+    int i;
+
+    NRFSPIsetClock(nrfspi, inHz);
+
+    for (i = 0; i < NRFSPI_CAL_PROBES; i++)
+    {
+        if (inProbe(nrfspi))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int NRFSPIcalibrate(nrfspi_t *nrfspi, nrfspi_probe_t inProbe)
+{
+    uint32_t start;
+    int step;
+    int ret = -EINVAL;
+
+    require(inProbe, exit);
+    require(nrfspi->initialized, exit);
+
+    start = NRFSPIgetClock(nrfspi);
+    nrfspi->calibrating = true;
+    nrfspi->linkStats.calibrations++;
+
+    if (nrfspi->clock_saved && _nrfspi_probe_clock(nrfspi, inProbe, start))
+    {
+        // what we settled on before still works
+        ret = 0;
+        goto exit;
+    }
+
+    // start at (or just under) the clock the bus is specified for
+    // and come down until it works. Nothing above that is tried
+    //
+    for (step = ARRAY_SIZE(mClockSteps) - 1; step > 0; step--)
+    {
+        if (mClockSteps[step] <= nrfspi->ops->default_hz(nrfspi->unit))
+        {
+            break;
+        }
+    }
+
+    while (!_nrfspi_probe_clock(nrfspi, inProbe, mClockSteps[step]))
+    {
+        if (step == 0)
+        {
+            LOG_ERR("SPI %d fails at every clock", nrfspi->unit);
+            NRFSPIsetClock(nrfspi, start);
+            ret = -EIO;
+            goto exit;
+        }
+        step--;
+    }
+
+    NRFSPIsetClock(nrfspi, mClockSteps[step]);
+    atomic_clear(&nrfspi->clock_unsaved);
+    _nrfspi_save_clock(nrfspi, mClockSteps[step]);
+
+    LOG_INF("SPI %d clock calibrated to %u", nrfspi->unit, mClockSteps[step]);
+    ret = 0;
+exit:
+    nrfspi->calibrating = false;
+    return ret;
+}
+
+#ifdef CONFIG_SHELL
+
+#include <zephyr/shell/shell.h>
+
+static int _CmdSpiStats( const struct shell *shell, size_t argc, char **argv )
 {
     nrfspi_t *nrfspi;
+    nrfspi_sync_stats_t *stats;
+    nrfspi_async_stats_t *astats;
+    nrfspi_link_stats_t *lstats;
+    int unit;
+
+    shell_print(shell, "Transport %s, %d unit(s)", NRFSPI_BACKEND->name, NRFSPIcount());
+
+    for (unit = 0; unit < NRFSPIcount(); unit++)
+    {
+        nrfspi = &mSPI[unit];
+        stats = &nrfspi->syncStats;
+        astats = &nrfspi->asyncStats;
+        lstats = &nrfspi->linkStats;
+
+        if (!nrfspi->initialized)
+        {
+            shell_print(shell, "[%d] not open", unit);
+            continue;
+        }
+
+        shell_print(shell, "[%d] Sync handshakes=%u timeouts=%u  min=%uus max=%uus avg=%uus", unit,
+                    stats->count, stats->timeouts, stats->min_us, stats->max_us,
+                    stats->count ? (uint32_t)(stats->total_us / stats->count) : 0);
+        shell_print(shell, "    Async xfers=%u errors=%u busy=%u  bytes=%llu  on-bus=%lluus",
+                    astats->count, astats->errors, astats->busy, astats->bytes, astats->total_us);
+        shell_print(shell, "    Clock %uHz (%s)  calibrations=%u",
+                    NRFSPIgetClock(nrfspi), nrfspi->clock_saved ? "saved" : "default", lstats->calibrations);
+        shell_print(shell, "    Link checks=%u errors=%u  downshifts=%u",
+                    lstats->checks, lstats->errors, lstats->downshifts);
+    }
+    return 0;
+}
+
+static int _CmdSpiClock( const struct shell *shell, size_t argc, char **argv )
+{
+    nrfspi_t *nrfspi;
+    uint32_t hz = 0;
+    int unit = 0;
+
+    if (argc > 1)
+    {
+        hz = strtoul(argv[1], NULL, 0);
+    }
+    if (argc > 2)
+    {
+        unit = strtoul(argv[2], NULL, 0);
+    }
+
+    nrfspi = NRFSPIget(unit);
+    if (!nrfspi || unit >= NRFSPIcount())
+    {
+        shell_error(shell, "No unit %d", unit);
+        return -EINVAL;
+    }
+
+    if (argc < 2)
+    {
+        shell_print(shell, "Clock %uHz", NRFSPIgetClock(nrfspi));
+        return 0;
+    }
+
+    // 0 forgets the saved clock so the next boot calibrates again
+    //
+    NRFSPIsetClock(nrfspi, hz);
+    atomic_clear(&nrfspi->clock_unsaved);
+    _nrfspi_save_clock(nrfspi, hz);
+    return 0;
+}
+
+static int _CmdSpiReset( const struct shell *shell, size_t argc, char **argv )
+{
+    int unit;
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        memset(&mSPI[unit].syncStats, 0, sizeof(mSPI[unit].syncStats));
+        memset(&mSPI[unit].asyncStats, 0, sizeof(mSPI[unit].asyncStats));
+        memset(&mSPI[unit].linkStats, 0, sizeof(mSPI[unit].linkStats));
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_nrfspi,
+    SHELL_CMD(stats, NULL,   " Print SPI statistics\n", _CmdSpiStats),
+    SHELL_CMD(reset, NULL,   " Reset SPI statistics\n", _CmdSpiReset),
+    SHELL_CMD_ARG(clock, NULL, " Show or set (and save) the bus clock (use uwbspi clock [hz] [unit], 0 to re-calibrate)\n", _CmdSpiClock, 1, 2),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(uwbspi, &sub_nrfspi, "UWBS SPI transport", NULL);
+
+#endif
+
+int NRFSPIinit(nrfspi_t *nrfspi)
+{
     int ret = -ENODEV;
 
-    nrfspi = &mSPI;
+    require(nrfspi, exit);
+    require(nrfspi->unit < NRFSPIcount(), exit);
 
     if (!nrfspi->initialized)
     {
-        nrfspi->dev = DEVICE_DT_GET(SPI_DEV_NODE);
-        require(nrfspi->dev, exit);
-
-        require(device_is_ready(nrfspi->dev), exit);
+        k_sem_init(&nrfspi->syncSem, 0, 1);
+        nrfspi->syncState = NRFSPI_SYNC_IDLE;
+    }
 
-        nrfspi->initialized = true;
-        nrfspi->max_packet = 255;
+    if (!nrfspi->clock_loaded)
+    {
+        // use the clock calibrated on an earlier boot, if any
+        //
+        nrfspi->clock_loaded = true;
+        nrfspi->clock_hz = nrfspi->ops->default_hz(nrfspi->unit);
+        nrfspi->clock_pending = _nrfspi_load_clock(nrfspi);
+        nrfspi->clock_saved = (nrfspi->clock_pending != 0);
+        if (nrfspi->clock_pending > nrfspi->clock_hz)
+        {
+            // saved by a calibration that went past what the bus can do
+            nrfspi->clock_pending = 0;
+            nrfspi->clock_saved = false;
+        }
     }
 
-    ret = _nrfspi_init(nrfspi);
+    ret = nrfspi->ops->open(nrfspi->unit, _host_irq_callback);
     require_noerr(ret, exit);
+
+    nrfspi->initialized = true;
+
+    NRFSPIenableChip(nrfspi, 0);
+
+    nrfspi->rxRequested = 0;
 exit:
     return ret;
 }
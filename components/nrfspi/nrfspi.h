@@ -23,19 +23,128 @@
 // with the sync gpio and waits for the peripheral to then
 // signal ready by deactivating the irq line.
 //
+// Each uwbs is a unit with its own lines and handle.  On hardware
+// there is one for each "nxp,sr150-uci" devicetree node, in instance
+// order, on native_sim one per simulated uwbs
+//
+#ifdef CONFIG_BOARD_NATIVE_SIM
+#define NRFSPI_MAX_DEVICES  (4)
+#else
+#define NRFSPI_MAX_DEVICES  DT_NUM_INST_STATUS_OKAY(nxp_sr150_uci)
+#endif
+
+typedef struct nrfspi nrfspi_t;
+
+// units the transport has (can grow on native_sim as simulated
+// uwbs are added)
+//
+int NRFSPIcount(void);
+nrfspi_t *NRFSPIget(int inUnit);
+int NRFSPIunit(const nrfspi_t *inSPI);
+
+// Completion callback for async transfers. Note this is called
+// from interrupt context so it should only note the result and
+// signal a thread, and must not start another transfer
+//
+typedef void (*nrfspi_done_t)(int inResult, void *inContext);
+
+// Async versions of read/write return as soon as the transfer is
+// started and call inDone when it completes. The buffer must stay
+// valid until then.  Only one transfer can be in progress at a time
+//
+int NRFSPIwriteAsync(
+                nrfspi_t *inSPI,
+                const uint8_t *inData,
+                const int inCount,
+                nrfspi_done_t inDone,
+                void *inContext);
+
+// Gather write, all the buffers go out back to back in one
+// transaction (one chip-select).  Up to NRFSPI_MAX_IOVEC buffers
+//
+#define NRFSPI_MAX_IOVEC    (3)
+
+typedef struct
+{
+    const uint8_t  *data;
+    int             count;
+}
+nrfspi_iovec_t;
+
+int NRFSPIwritevAsync(
+                nrfspi_t *inSPI,
+                const nrfspi_iovec_t *inVec,
+                const int inVecCount,
+                nrfspi_done_t inDone,
+                void *inContext);
+int NRFSPIreadAsync(
+                nrfspi_t *inSPI,
+                uint8_t *outData,
+                int inCount,
+                nrfspi_done_t inDone,
+                void *inContext);
+bool NRFSPIbusy(nrfspi_t *inSPI);
 
 int NRFSPIwrite(
+                nrfspi_t *inSPI,
                 const uint8_t *inData,
                 const int inCount);
 int NRFSPIread(
+                nrfspi_t *inSPI,
                 uint8_t *outData,
                 int inCoun);
 
-int NRFSPIenableChip(bool enable);
-int NRFSPIstartSync(void);
-int NRFSPIstopSync(void);
-int NRFSPIpoll(bool *outReadable);
+int NRFSPIenableChip(nrfspi_t *inSPI, bool enable);
+int NRFSPIstartSync(nrfspi_t *inSPI);
+
+// With sync still active after a read, wait up to inWaitUs for the
+// uwbs to signal it has another message ready. Returns 0 if it did
+// (read it without another sync cycle), -EAGAIN if not
+//
+int NRFSPIcontinueSync(nrfspi_t *inSPI, uint32_t inWaitUs);
+int NRFSPIstopSync(nrfspi_t *inSPI);
+
+// Cycle count when the uwbs last signalled it has data (irq edge,
+// polled level or a continued sync)
+//
+uint32_t NRFSPIrxRequestTime(nrfspi_t *inSPI);
+int NRFSPIpoll(nrfspi_t *inSPI, bool *outReadable);
+
+// Level of the irq line right now, without taking it as a request.
+// For watching the uwbs let go of it after an answer was read
+//
+bool NRFSPIirqActive(nrfspi_t *inSPI);
+
+// Called from the irq isr when the uwbs asks to be read (edges during
+// a read handshake are the handshake's), to wake whatever reads it.
+// Without one the application event is signalled
+//
+typedef void (*nrfspi_request_t)(void *inContext);
+
+void NRFSPIsetRequestHandler(nrfspi_t *inSPI, nrfspi_request_t inHandler, void *inContext);
+
+// Bus clock.  NRFSPIcalibrate starts at the configured clock (the
+// unit's spi-max-frequency, never exceeded) and steps down until inProbe
+// (a known-answer exchange with the uwbs, 0 when it checks out)
+// passes, then saves the result for later boots. A saved clock is just
+// re-verified. It only checks and comes down, nothing faster than the
+// configured clock is ever tried. Each unit has its own clock
+//
+typedef int (*nrfspi_probe_t)(nrfspi_t *inSPI);
+
+int NRFSPIcalibrate(nrfspi_t *inSPI, nrfspi_probe_t inProbe);
+int NRFSPIsetClock(nrfspi_t *inSPI, uint32_t inHz);
+uint32_t NRFSPIgetClock(nrfspi_t *inSPI);
+
+// Protocol layers report each integrity check (checksum, frame format)
+// here. Too many failures drops the clock a step. That can happen on
+// any thread so the new clock is only saved by NRFSPIsaveClock, which
+// the main loop calls (it writes flash)
+//
+void NRFSPIlinkCheck(nrfspi_t *inSPI, bool inGood);
+int NRFSPIdownshift(nrfspi_t *inSPI);
+void NRFSPIsaveClock(nrfspi_t *inSPI);
 
-void NRFSPIdeinit(void);
-int  NRFSPIinit(void);
+void NRFSPIdeinit(nrfspi_t *inSPI);
+int  NRFSPIinit(nrfspi_t *inSPI);
 
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "nrfspi.h"
+
+// Transport backend interface for nrfspi.  nrfspi.c implements the
+// protocol (sync/irq handshake, async bookkeeping, stats) on top of
+// one of these, which just moves bytes and drives/reads the lines.
+//
+// The hardware backend (nrfspi_zephyr.c) uses the zephyr spi/gpio
+// drivers and devicetree nodes, the native_sim backend (nrfspi_sim.c)
+// connects to in-process uwbs models
+//
+// A backend can drive several uwbs, each op takes the unit (0 up to
+// count) it is for
+//
+
+typedef enum
+{
+    NRFSPI_IRQ_DISABLE,
+    NRFSPI_IRQ_TO_ACTIVE,
+    NRFSPI_IRQ_TO_INACTIVE
+}
+nrfspi_irq_mode_t;
+
+// Called by the backend (in interrupt context) on an armed irq edge
+//
+typedef void (*nrfspi_irq_handler_t)(int inUnit);
+
+typedef struct
+{
+    const char *name;
+
+    // how many uwbs there are lines for
+    //
+    int  (*count)(void);
+
+    // bus clock a unit opens at, also the fastest it is run at (the
+    // node's spi-max-frequency, spim1 on the nrf5340 tops out at 8MHz)
+    //
+    uint32_t (*default_hz)(int inUnit);
+
+    // (re)open the transport, lines are left with ce and sync
+    // inactive and the irq edge armed to-active
+    //
+    int  (*open)(int inUnit, nrfspi_irq_handler_t inIrqHandler);
+
+    // blocking transfer, either gathers the tx buffers or reads.
+    // Units can share a bus, the driver serializes them
+    //
+    int  (*transfer)(
+                int inUnit,
+                const nrfspi_iovec_t *inTxVec,
+                const int inTxVecCount,
+                uint8_t *outRxData,
+                const int inRxSize);
+
+    // same but completes by calling inDone, can be NULL if
+    // the backend can't do async transfers
+    //
+    int  (*transfer_async)(
+                int inUnit,
+                const nrfspi_iovec_t *inTxVec,
+                const int inTxVecCount,
+                uint8_t *outRxData,
+                const int inRxSize,
+                nrfspi_done_t inDone,
+                void *inContext);
+
+    int  (*set_ce)(int inUnit, bool inActive);
+    int  (*set_sync)(int inUnit, bool inActive);
+    int  (*get_irq)(int inUnit);
+    int  (*irq_mode)(int inUnit, nrfspi_irq_mode_t inMode);
+
+    // change the bus clock, only called with no transfer in progress
+    //
+    int  (*set_clock)(int inUnit, uint32_t inHz);
+}
+nrfspi_ops_t;
+
+extern const nrfspi_ops_t NRFSPIzephyrOps;
+extern const nrfspi_ops_t NRFSPIsimOps;
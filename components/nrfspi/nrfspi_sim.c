@@ -0,0 +1,321 @@
+#include "nrfspi_backend.h"
+#include "nrfspi_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+
+#include "autoconf.h"
+
+#define COMPONENT_NAME nrfspi_sim
+#include "Logging.h"
+#include "uci_defs.h"
+#include "hbci_defs.h"
+
+// nrfspi transport for native_sim.  There is no bus, bytes are handed
+// to an in-process uwbs model (see nrfspi_sim.h) and the transfer
+// completes after the time it would have taken on the wire.  Each
+// unit is its own bus, so several of them do run at once
+//
+
+// default modelled bus clock, same as the real spi-max-frequency
+//
+#define NRFSPI_SIM_CLOCK_HZ     (8000000)
+
+// largest single write: a whole uci packet (header and payload in one
+// transaction when there's no tx gap, uwbsim takes payloads up to
+// UCI_MAX_DATA_PACKET_SIZE) or a firmware chunk with its lrc
+//
+#define NRFSPI_SIM_MAX_XFER     MAX(UCI_MSG_HDR_SIZE + UCI_MAX_DATA_PACKET_SIZE, MAX_HBCI_LEN)
+
+typedef struct
+{
+    int                     unit;
+    const nrfspi_sim_peer_t *peer;
+    void                   *peerContext;
+    nrfspi_irq_handler_t    irqHandler;
+    struct k_spinlock       lock;
+    nrfspi_irq_mode_t       irqMode;
+    bool                    irq;
+    bool                    ce;
+    bool                    sync;
+    uint32_t                clock_hz;
+    uint32_t                fail_hz;
+    struct k_timer          asyncTimer;
+    nrfspi_done_t           asyncDone;
+    void                   *asyncContext;
+    int                     asyncResult;
+    uint8_t                 txbuf[NRFSPI_SIM_MAX_XFER];
+}
+nrfspi_sim_t;
+
+static nrfspi_sim_t mSimSPI[NRFSPI_MAX_DEVICES];
+
+static uint32_t _sim_wire_us(nrfspi_sim_t *sim, int inCount)
+{
+    uint64_t us;
+
+    us = ((uint64_t)inCount * 8 * 1000000) / sim->clock_hz;
+    return us ? (uint32_t)us : 1;
+}
+
+// Move the bytes of one transaction to/from the peer, returns the
+// number of bytes on the wire
+//
+static int _sim_exchange(
+                    nrfspi_sim_t *sim,
+                    const nrfspi_iovec_t *txvec,
+                    const int txveccount,
+                    uint8_t *rxdata,
+                    const int rxsize)
+{
+    int count;
+    int i;
+
+    if (rxdata)
+    {
+        memset(rxdata, 0, rxsize);
+        if (sim->peer && sim->peer->read && sim->ce)
+        {
+            sim->peer->read(sim->peerContext, rxdata, rxsize);
+        }
+        if (sim->fail_hz && sim->clock_hz > sim->fail_hz)
+        {
+            for (i = 0; i < rxsize; i++)
+            {
+                rxdata[i] ^= 0x80;
+            }
+        }
+        return rxsize;
+    }
+
+    for (i = count = 0; i < txveccount; i++)
+    {
+        if ((count + txvec[i].count) > sizeof(sim->txbuf))
+        {
+            LOG_ERR("Transaction too big");
+            return -EINVAL;
+        }
+        memcpy(sim->txbuf + count, txvec[i].data, txvec[i].count);
+        count += txvec[i].count;
+    }
+
+    if (sim->peer && sim->peer->write && sim->ce)
+    {
+        sim->peer->write(sim->peerContext, sim->txbuf, count);
+    }
+    return count;
+}
+
+static int _sim_transfer(
+                    int unit,
+                    const nrfspi_iovec_t *txvec,
+                    const int txveccount,
+                    uint8_t *rxdata,
+                    const int rxsize)
+{
+    nrfspi_sim_t *sim = &mSimSPI[unit];
+    int ret;
+
+    ret = _sim_exchange(sim, txvec, txveccount, rxdata, rxsize);
+    if (ret > 0)
+    {
+        k_busy_wait(_sim_wire_us(sim, ret));
+        ret = 0;
+    }
+    return ret;
+}
+
+static void _sim_async_expiry(struct k_timer *timer)
+{
+    nrfspi_sim_t *sim = CONTAINER_OF(timer, nrfspi_sim_t, asyncTimer);
+
+    // timer expiry is isr context, same as a real spi completion
+    //
+    sim->asyncDone(sim->asyncResult, sim->asyncContext);
+}
+
+static int _sim_transfer_async(
+                    int unit,
+                    const nrfspi_iovec_t *txvec,
+                    const int txveccount,
+                    uint8_t *rxdata,
+                    const int rxsize,
+                    nrfspi_done_t inDone,
+                    void *inContext)
+{
+    nrfspi_sim_t *sim = &mSimSPI[unit];
+    int ret;
+
+    ret = _sim_exchange(sim, txvec, txveccount, rxdata, rxsize);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    sim->asyncDone = inDone;
+    sim->asyncContext = inContext;
+    sim->asyncResult = 0;
+
+    k_timer_start(&sim->asyncTimer, K_USEC(_sim_wire_us(sim, ret)), K_NO_WAIT);
+    return 0;
+}
+
+static int _sim_set_ce(int unit, bool inActive)
+{
+    nrfspi_sim_t *sim = &mSimSPI[unit];
+
+    if (sim->ce != inActive)
+    {
+        sim->ce = inActive;
+        if (sim->peer && sim->peer->ce)
+        {
+            sim->peer->ce(sim->peerContext, inActive);
+        }
+    }
+    return 0;
+}
+
+static int _sim_set_sync(int unit, bool inActive)
+{
+    nrfspi_sim_t *sim = &mSimSPI[unit];
+
+    if (sim->sync != inActive)
+    {
+        sim->sync = inActive;
+        if (sim->peer && sim->peer->sync && sim->ce)
+        {
+            sim->peer->sync(sim->peerContext, inActive);
+        }
+    }
+    return 0;
+}
+
+static int _sim_get_irq(int unit)
+{
+    return mSimSPI[unit].irq ? 1 : 0;
+}
+
+static int _sim_irq_mode(int unit, nrfspi_irq_mode_t inMode)
+{
+    mSimSPI[unit].irqMode = inMode;
+    return 0;
+}
+
+static int _sim_set_clock(int unit, uint32_t inHz)
+{
+    if (!inHz)
+    {
+        return -EINVAL;
+    }
+    mSimSPI[unit].clock_hz = inHz;
+    return 0;
+}
+
+static int _sim_count(void)
+{
+    int unit;
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        if (!mSimSPI[unit].peer)
+        {
+            break;
+        }
+    }
+    return unit;
+}
+
+static uint32_t _sim_default_hz(int unit)
+{
+    return NRFSPI_SIM_CLOCK_HZ;
+}
+
+static int _sim_open(int unit, nrfspi_irq_handler_t inIrqHandler)
+{
+    nrfspi_sim_t *sim = &mSimSPI[unit];
+
+    sim->unit = unit;
+    sim->irqHandler = inIrqHandler;
+    if (!sim->clock_hz)
+    {
+        sim->clock_hz = NRFSPI_SIM_CLOCK_HZ;
+    }
+
+    // a transfer from before the reopen never completes
+    k_timer_stop(&sim->asyncTimer);
+
+    _sim_set_sync(unit, false);
+    _sim_set_ce(unit, false);
+
+    sim->irqMode = NRFSPI_IRQ_TO_ACTIVE;
+
+    LOG_INF("Sim SPI %d open, peer %s", unit, sim->peer ? "attached" : "none");
+    return 0;
+}
+
+int NRFSPIsimAttach(int inUnit, const nrfspi_sim_peer_t *inPeer, void *inContext)
+{
+    if (inUnit < 0 || inUnit >= NRFSPI_MAX_DEVICES)
+    {
+        return -EINVAL;
+    }
+    mSimSPI[inUnit].unit = inUnit;
+    mSimSPI[inUnit].peerContext = inContext;
+    mSimSPI[inUnit].peer = inPeer;
+
+    // once, open (on every uwbs boot) may find it running
+    k_timer_init(&mSimSPI[inUnit].asyncTimer, _sim_async_expiry, NULL);
+    return 0;
+}
+
+void NRFSPIsimSetIrq(int inUnit, bool inActive)
+{
+    nrfspi_sim_t *sim = &mSimSPI[inUnit];
+    k_spinlock_key_t key;
+    bool fire = false;
+
+    key = k_spin_lock(&sim->lock);
+
+    if (sim->irq != inActive)
+    {
+        sim->irq = inActive;
+
+        if (inActive)
+        {
+            fire = (sim->irqMode == NRFSPI_IRQ_TO_ACTIVE);
+        }
+        else
+        {
+            fire = (sim->irqMode == NRFSPI_IRQ_TO_INACTIVE);
+        }
+    }
+
+    k_spin_unlock(&sim->lock, key);
+
+    if (fire && sim->irqHandler)
+    {
+        sim->irqHandler(sim->unit);
+    }
+}
+
+void NRFSPIsimSetFailAbove(int inUnit, uint32_t inHz)
+{
+    mSimSPI[inUnit].fail_hz = inHz;
+}
+
+const nrfspi_ops_t NRFSPIsimOps =
+{
+    .name           = "native_sim",
+    .count          = _sim_count,
+    .default_hz     = _sim_default_hz,
+    .open           = _sim_open,
+    .transfer       = _sim_transfer,
+    .transfer_async = _sim_transfer_async,
+    .set_ce         = _sim_set_ce,
+    .set_sync       = _sim_set_sync,
+    .get_irq        = _sim_get_irq,
+    .irq_mode       = _sim_irq_mode,
+    .set_clock      = _sim_set_clock,
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Peer side of the native_sim nrfspi transport.  A simulated uwbs
+// attaches here and sees the lines and bytes the host side drives
+// through the normal nrfspi api, and drives the irq line back
+//
+// The peer callbacks are called from the host thread doing the
+// transfer or line change, so they should be quick.  A peer may
+// call NRFSPIsimSetIrq from inside them
+//
+// There is one peer per unit, the units the host sees are the ones
+// attached starting at 0
+//
+typedef struct
+{
+    void (*ce)(void *inContext, bool inActive);
+    void (*sync)(void *inContext, bool inActive);
+
+    // host clocked out one transaction (gathered buffers in order)
+    void (*write)(void *inContext, const uint8_t *inData, const int inCount);
+
+    // host is clocking in inCount bytes
+    void (*read)(void *inContext, uint8_t *outData, const int inCount);
+}
+nrfspi_sim_peer_t;
+
+int  NRFSPIsimAttach(int inUnit, const nrfspi_sim_peer_t *inPeer, void *inContext);
+
+// drive the irq line, fires the host edge interrupt if armed
+//
+void NRFSPIsimSetIrq(int inUnit, bool inActive);
+
+// model a marginal bus: above inHz every byte read back from the
+// peer has its top bit flipped (0 for a bus that always works)
+//
+void NRFSPIsimSetFailAbove(int inUnit, uint32_t inHz);
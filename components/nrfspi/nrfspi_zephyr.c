@@ -0,0 +1,312 @@
+#include "nrfspi_backend.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/types.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/spi.h>
+
+#include "autoconf.h"
+
+#define COMPONENT_NAME nrfspi_zephyr
+#include "Logging.h"
+
+// nrfspi transport on the zephyr spi (SPIM) and gpio drivers.  Each
+// uwbs is an "nxp,sr150-uci" node on a spi bus (see the binding) with
+// its own chip-select and irq/sync/ce lines, the units are the enabled
+// nodes in instance order
+//
+#define DT_DRV_COMPAT nxp_sr150_uci
+
+typedef struct
+{
+    struct spi_dt_spec      spi;
+    struct gpio_dt_spec     irq;
+    struct gpio_dt_spec     sync;
+    struct gpio_dt_spec     ce;
+}
+nrfspi_zephyr_node_t;
+
+typedef struct
+{
+    int                     unit;
+    const nrfspi_zephyr_node_t *node;
+
+    // the driver only re-applies a config it hasn't seen (it compares
+    // the pointer) so a clock change flips to the other one
+    //
+    struct spi_config       spi_cfg[2];
+    int                     cfg;
+    struct gpio_callback    irqCallback;
+    nrfspi_irq_handler_t    irqHandler;
+    nrfspi_done_t           asyncDone;
+    void                   *asyncContext;
+    struct spi_buf          asyncBuf[NRFSPI_MAX_IOVEC];
+    struct spi_buf_set      asyncSet;
+}
+nrfspi_zephyr_t;
+
+#define NRFSPI_ZEPHYR_NODE(inst)                                        \
+    {                                                                   \
+        .spi  = SPI_DT_SPEC_INST_GET(inst,                              \
+                    SPI_WORD_SET(8) | SPI_TRANSFER_MSB | SPI_OP_MODE_MASTER, 15), \
+        .irq  = GPIO_DT_SPEC_INST_GET(inst, irq_gpios),                 \
+        .sync = GPIO_DT_SPEC_INST_GET(inst, sync_gpios),                \
+        .ce   = GPIO_DT_SPEC_INST_GET(inst, ce_gpios),                  \
+    },
+
+static const nrfspi_zephyr_node_t mZSPInodes[] =
+{
+    DT_INST_FOREACH_STATUS_OKAY(NRFSPI_ZEPHYR_NODE)
+};
+
+static nrfspi_zephyr_t mZSPI[ARRAY_SIZE(mZSPInodes)];
+
+/*
+The time required for the module to go into DPD state is < 100 s controlled by the firmware.
+The required time for the module to enter HPD state is less then 100 s starting for the instance
+that CE is de-asserted, in both modes VDD_1V8_DIG is turned off. The Wakeup timing from DPD
+state is around 370 s, the wakeup from HPD state is triggered once CE is asserted and takes
+around 380 s.
+*/
+
+/*
+ * From NXP code
+
+    masterConfig.baudRate_Bps = UWB_SPI_BAUDRATE;           // 8MHx
+    masterConfig.dataWidth    = kSPI_Data8Bits;             // 8 bit
+    masterConfig.polarity     = kSPI_ClockPolarityActiveHigh;// CPOL=0
+    masterConfig.phase        = kSPI_ClockPhaseFirstEdge;   // CPHA=0
+    masterConfig.direction    = kSPI_MsbFirst;              //
+
+    masterConfig.delayConfig.preDelay      = 15U;
+    masterConfig.delayConfig.postDelay     = 15U;
+    masterConfig.delayConfig.frameDelay    = 15U;
+    masterConfig.delayConfig.transferDelay = 15U;
+
+    masterConfig.sselPol = kSPI_SpolActiveAllLow;           //
+    masterConfig.sselNum = UWB_SPI_SSEL;
+*/
+
+static void _zspi_irq_callback(const struct device *dev,
+                     struct gpio_callback *cb, uint32_t pins)
+{
+    nrfspi_zephyr_t *zspi = CONTAINER_OF(cb, nrfspi_zephyr_t, irqCallback);
+
+    if (zspi->irqHandler)
+    {
+        zspi->irqHandler(zspi->unit);
+    }
+}
+
+// Fill the buffer set for a gather write or a read
+//
+static void _zspi_bufset(
+                    nrfspi_zephyr_t *zspi,
+                    const nrfspi_iovec_t *txvec,
+                    const int txveccount,
+                    uint8_t *rxdata,
+                    const int rxsize)
+{
+    int count;
+
+    if (rxdata)
+    {
+        zspi->asyncBuf[0].buf = rxdata;
+        zspi->asyncBuf[0].len = rxsize;
+        count = 1;
+    }
+    else
+    {
+        for (count = 0; count < txveccount && count < NRFSPI_MAX_IOVEC; count++)
+        {
+            zspi->asyncBuf[count].buf = (void*)txvec[count].data;
+            zspi->asyncBuf[count].len = txvec[count].count;
+        }
+    }
+
+    zspi->asyncSet.buffers = zspi->asyncBuf;
+    zspi->asyncSet.count = count;
+}
+
+static int _zspi_transfer(
+                    int unit,
+                    const nrfspi_iovec_t *txvec,
+                    const int txveccount,
+                    uint8_t *rxdata,
+                    const int rxsize)
+{
+    nrfspi_zephyr_t *zspi = &mZSPI[unit];
+
+    _zspi_bufset(zspi, txvec, txveccount, rxdata, rxsize);
+
+    // units on the same bus take turns, the driver holds this
+    // (and the async version) until a transfer by another one is done
+    //
+    return spi_transceive(zspi->node->spi.bus, &zspi->spi_cfg[zspi->cfg],
+                rxdata ? NULL : &zspi->asyncSet,
+                rxdata ? &zspi->asyncSet : NULL);
+}
+
+#ifdef CONFIG_SPI_ASYNC
+static void _zspi_async_callback(const struct device *dev, int result, void *data)
+{
+    nrfspi_zephyr_t *zspi = (nrfspi_zephyr_t *)data;
+
+    // note this is called from the spi isr, and the driver still
+    // owns the bus, so the done callback must not start another transfer
+    //
+    zspi->asyncDone(result, zspi->asyncContext);
+}
+
+static int _zspi_transfer_async(
+                    int unit,
+                    const nrfspi_iovec_t *txvec,
+                    const int txveccount,
+                    uint8_t *rxdata,
+                    const int rxsize,
+                    nrfspi_done_t inDone,
+                    void *inContext)
+{
+    nrfspi_zephyr_t *zspi = &mZSPI[unit];
+
+    zspi->asyncDone = inDone;
+    zspi->asyncContext = inContext;
+
+    _zspi_bufset(zspi, txvec, txveccount, rxdata, rxsize);
+
+    return spi_transceive_cb(zspi->node->spi.bus, &zspi->spi_cfg[zspi->cfg],
+                rxdata ? NULL : &zspi->asyncSet,
+                rxdata ? &zspi->asyncSet : NULL,
+                _zspi_async_callback, zspi);
+}
+#endif
+
+static int _zspi_count(void)
+{
+    return ARRAY_SIZE(mZSPInodes);
+}
+
+static uint32_t _zspi_default_hz(int unit)
+{
+    return mZSPInodes[unit].spi.config.frequency;
+}
+
+static int _zspi_set_ce(int unit, bool inActive)
+{
+    return gpio_pin_configure_dt(&mZSPInodes[unit].ce, inActive ? GPIO_OUTPUT_ACTIVE : GPIO_OUTPUT_INACTIVE);
+}
+
+static int _zspi_set_sync(int unit, bool inActive)
+{
+    return gpio_pin_configure_dt(&mZSPInodes[unit].sync, inActive ? GPIO_OUTPUT_ACTIVE : GPIO_OUTPUT_INACTIVE);
+}
+
+static int _zspi_get_irq(int unit)
+{
+    return gpio_pin_get_dt(&mZSPInodes[unit].irq);
+}
+
+static int _zspi_irq_mode(int unit, nrfspi_irq_mode_t inMode)
+{
+    gpio_flags_t flags;
+
+    switch (inMode)
+    {
+    case NRFSPI_IRQ_TO_ACTIVE:      flags = GPIO_INT_EDGE_TO_ACTIVE; break;
+    case NRFSPI_IRQ_TO_INACTIVE:    flags = GPIO_INT_EDGE_TO_INACTIVE; break;
+    default:                        flags = GPIO_INT_DISABLE; break;
+    }
+
+    return gpio_pin_interrupt_configure_dt(&mZSPInodes[unit].irq, flags);
+}
+
+static int _zspi_set_clock(int unit, uint32_t inHz)
+{
+    nrfspi_zephyr_t *zspi = &mZSPI[unit];
+    int next = !zspi->cfg;
+
+    if (!inHz)
+    {
+        return -EINVAL;
+    }
+
+    // the spim driver rounds down to a clock the instance can do
+    //
+    zspi->spi_cfg[next] = zspi->spi_cfg[zspi->cfg];
+    zspi->spi_cfg[next].frequency = inHz;
+    zspi->cfg = next;
+    return 0;
+}
+
+static int _zspi_open(int unit, nrfspi_irq_handler_t inIrqHandler)
+{
+    nrfspi_zephyr_t *zspi = &mZSPI[unit];
+    const nrfspi_zephyr_node_t *node = &mZSPInodes[unit];
+    struct spi_config *cfg;
+    uint32_t frequency;
+    int ret = -ENODEV;
+
+    require(unit < ARRAY_SIZE(mZSPInodes), exit);
+    require(spi_is_ready_dt(&node->spi), exit);
+
+    if (zspi->node)
+    {
+        // re-open, the lines are already set up
+        gpio_remove_callback(node->irq.port, &zspi->irqCallback);
+    }
+
+    zspi->unit = unit;
+    zspi->node = node;
+    zspi->irqHandler = inIrqHandler;
+
+    // re-open keeps whatever clock was set
+    cfg = &zspi->spi_cfg[zspi->cfg];
+    frequency = cfg->frequency ? cfg->frequency : node->spi.config.frequency;
+
+    // mode, word size and chip-select all come from the node
+    *cfg = node->spi.config;
+    cfg->frequency = frequency;
+
+    // de-assert sync
+    ret = gpio_pin_configure_dt(&node->sync, GPIO_OUTPUT_INACTIVE);
+
+    // disable chip
+    ret = gpio_pin_configure_dt(&node->ce, GPIO_OUTPUT_INACTIVE);
+
+    // setup an interrupt on gpio for peripheral initiated transfers
+    ret = gpio_pin_configure_dt(&node->irq, GPIO_INPUT | GPIO_PULL_UP);
+    require_noerr(ret, exit);
+
+    // delay a bit to reset chip
+    k_sleep(K_USEC(400));
+
+    gpio_pin_interrupt_configure_dt(&node->irq, GPIO_INT_EDGE_TO_ACTIVE);
+
+    gpio_init_callback(&zspi->irqCallback, _zspi_irq_callback, BIT(node->irq.pin));
+    ret = gpio_add_callback(node->irq.port, &zspi->irqCallback);
+    require_noerr(ret, exit);
+exit:
+    return ret;
+}
+
+const nrfspi_ops_t NRFSPIzephyrOps =
+{
+    .name           = "zephyr spi",
+    .count          = _zspi_count,
+    .default_hz     = _zspi_default_hz,
+    .open           = _zspi_open,
+    .transfer       = _zspi_transfer,
+#ifdef CONFIG_SPI_ASYNC
+    .transfer_async = _zspi_transfer_async,
+#else
+    .transfer_async = NULL,
+#endif
+    .set_ce         = _zspi_set_ce,
+    .set_sync       = _zspi_set_sync,
+    .get_irq        = _zspi_get_irq,
+    .irq_mode       = _zspi_irq_mode,
+    .set_clock      = _zspi_set_clock,
+};
@@ -10,18 +10,20 @@
 #define SECONDS_PER_HOUR    (60 * 60)
 #define SECONDS_PER_DAY     (24 * SECONDS_PER_HOUR)
 
-#include <hal/nrf_clock.h>
-#include <hal/nrf_rtc.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/types.h>
-#include <zephyr/drivers/clock_control.h>
-#include <zephyr/drivers/clock_control/nrf_clock_control.h>
 #include <zephyr/shell/shell.h>
 
 #include <stdlib.h>
 
+#ifdef CONFIG_SOC_FAMILY_NRF
+#include <hal/nrf_clock.h>
+#include <hal/nrf_rtc.h>
+#include <zephyr/drivers/clock_control.h>
+#include <zephyr/drivers/clock_control/nrf_clock_control.h>
+
 #ifdef CONFIG_SOC_NRF5340_CPUAPP
 // only 2 rtcs in 5340, so use 0, since 1 is used for zephyr
 #define RTC     (NRF_RTC0)
@@ -31,6 +33,7 @@
 #define RTC     (NRF_RTC2)
 #define RTC_IRQ (RTC2_IRQn)
 #endif
+#endif
 
 static struct
 {
@@ -39,15 +42,18 @@ static struct
     int64_t drift;      // microseconds per second +/- drift
     int64_t last_set;   // Time when last set
     struct k_sem event;
+#ifndef CONFIG_SOC_FAMILY_NRF
+    struct k_timer tick;
+#endif
 }
 mTime;
 
-ISR_DIRECT_DECLARE(_RTC_ISR)
+// Called at 8Hz
+//
+static void _TimeTick(void)
 {
     static uint32_t irq_counter;
 
-    nrf_rtc_event_clear(RTC, NRF_RTC_EVENT_TICK);
-
     irq_counter++;
     if (!(irq_counter & 0x7))
     {
@@ -55,9 +61,22 @@ ISR_DIRECT_DECLARE(_RTC_ISR)
         mTime.epoch+= mTime.drift;
         mTime.rawsecs++;
     }
+}
+
+#ifdef CONFIG_SOC_FAMILY_NRF
+ISR_DIRECT_DECLARE(_RTC_ISR)
+{
+    nrf_rtc_event_clear(RTC, NRF_RTC_EVENT_TICK);
 
+    _TimeTick();
     return 0;
 }
+#else
+static void _TimeTimerTick(struct k_timer *timer)
+{
+    _TimeTick();
+}
+#endif
 
 uint64_t TimeUptimeMilliseconds( void )
 {
@@ -224,6 +243,7 @@ int TimeInit( void )
     err = k_sem_init(&mTime.event, 1, 1);
     require_noerr( err, exit );
 
+#ifdef CONFIG_SOC_FAMILY_NRF
     // clock is already started in system clock init by zephyr
     // z_nrf_clock_control_lf_on(CLOCK_CONTROL_NRF_LF_START_NOWAIT);
 
@@ -237,6 +257,11 @@ int TimeInit( void )
     // hook in RTC Interrupt
     IRQ_DIRECT_CONNECT(RTC_IRQ, IRQ_PRIO_LOWEST, _RTC_ISR, 0);
     irq_enable(RTC_IRQ);
+#else
+    // no nrf rtc (native_sim), tick from a kernel timer instead
+    k_timer_init(&mTime.tick, _TimeTimerTick, NULL);
+    k_timer_start(&mTime.tick, K_MSEC(125), K_MSEC(125));
+#endif
 
 exit:
     return err;
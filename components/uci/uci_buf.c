@@ -0,0 +1,127 @@
+#include "uci_buf.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+
+#define COMPONENT_NAME ucibuf
+#include "Logging.h"
+
+K_MEM_SLAB_DEFINE_STATIC(mUCIbufSlab,
+            ROUND_UP(sizeof(uci_buf_t) + UCI_MAX_PAYLOAD_SIZE, 4), UCI_BUF_COUNT, 4);
+K_MEM_SLAB_DEFINE_STATIC(mUCIbufLargeSlab,
+            ROUND_UP(sizeof(uci_buf_t) + UCI_BUF_LARGE_SIZE, 4), UCI_BUF_LARGE_COUNT, 4);
+
+static uci_buf_stats_t mUCIbufStats;
+
+uci_buf_t *UCIbufAlloc(void)
+{
+    uci_buf_t *buf = NULL;
+    uint32_t in_use;
+
+    if (k_mem_slab_alloc(&mUCIbufSlab, (void **)&buf, K_NO_WAIT))
+    {
+        mUCIbufStats.fails++;
+        return NULL;
+    }
+
+    atomic_set(&buf->refs, 1);
+    buf->len = 0;
+    buf->size = UCI_MAX_PAYLOAD_SIZE;
+    buf->stamp = 0;
+
+    mUCIbufStats.allocs++;
+
+    in_use = k_mem_slab_num_used_get(&mUCIbufSlab);
+    mUCIbufStats.in_use = in_use;
+    if (in_use > mUCIbufStats.high_water)
+    {
+        mUCIbufStats.high_water = in_use;
+    }
+    return buf;
+}
+
+uci_buf_t *UCIbufAllocLarge(void)
+{
+    uci_buf_t *buf = NULL;
+    uint32_t in_use;
+
+    if (k_mem_slab_alloc(&mUCIbufLargeSlab, (void **)&buf, K_NO_WAIT))
+    {
+        mUCIbufStats.large_fails++;
+        return NULL;
+    }
+
+    atomic_set(&buf->refs, 1);
+    buf->len = 0;
+    buf->size = UCI_BUF_LARGE_SIZE;
+    buf->stamp = 0;
+
+    mUCIbufStats.large_allocs++;
+
+    in_use = k_mem_slab_num_used_get(&mUCIbufLargeSlab);
+    mUCIbufStats.large_in_use = in_use;
+    if (in_use > mUCIbufStats.large_high_water)
+    {
+        mUCIbufStats.large_high_water = in_use;
+    }
+    return buf;
+}
+
+uci_buf_t *UCIbufRef(uci_buf_t *inBuf)
+{
+    if (inBuf)
+    {
+        atomic_inc(&inBuf->refs);
+    }
+    return inBuf;
+}
+
+void UCIbufUnref(uci_buf_t *inBuf)
+{
+    if (!inBuf)
+    {
+        return;
+    }
+
+    // atomic_dec returns the count from before
+    if (atomic_dec(&inBuf->refs) == 1)
+    {
+        if (inBuf->size == UCI_BUF_LARGE_SIZE)
+        {
+            k_mem_slab_free(&mUCIbufLargeSlab, (void *)inBuf);
+            mUCIbufStats.large_in_use = k_mem_slab_num_used_get(&mUCIbufLargeSlab);
+            return;
+        }
+        k_mem_slab_free(&mUCIbufSlab, (void *)inBuf);
+        mUCIbufStats.frees++;
+        mUCIbufStats.in_use = k_mem_slab_num_used_get(&mUCIbufSlab);
+    }
+}
+
+uci_buf_t *UCIbufFromPayload(const uint8_t *inPayload)
+{
+    if (!inPayload)
+    {
+        return NULL;
+    }
+    return CONTAINER_OF(inPayload, uci_buf_t, data);
+}
+
+void UCIbufGetStats(uci_buf_stats_t *outStats)
+{
+    *outStats = mUCIbufStats;
+}
+
+void UCIbufResetStats(void)
+{
+    uint32_t in_use = mUCIbufStats.in_use;
+    uint32_t large_in_use = mUCIbufStats.large_in_use;
+
+    memset(&mUCIbufStats, 0, sizeof(mUCIbufStats));
+    mUCIbufStats.in_use = in_use;
+    mUCIbufStats.high_water = in_use;
+    mUCIbufStats.large_in_use = large_in_use;
+    mUCIbufStats.large_high_water = large_in_use;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+
+#include "uci_defs.h"
+#include "nrfspi.h"
+
+// Fixed size, reference counted buffers for received UCI messages.
+// The spi read goes straight into one and the same buffer is handed
+// up through the uci and uwb layers to whoever wants it, so nothing is
+// copied and nothing gets overwritten while someone is still looking
+//
+// A buffer comes from UCIbufAlloc holding one reference. Anyone that
+// keeps it past the call it was handed to them in takes their own
+// with UCIbufRef, and everyone drops theirs with UCIbufUnref. The last
+// one out frees it
+//
+// Each unit's read messages wait in a ring (uci_proto) of this many
+// for the caller to get to them
+//
+#define UCI_RX_RING_SIZE    (8)
+
+// The pool is shared by all units, sized for each to have a full ring
+// with the one before it still held up the stack and a read going
+//
+#define UCI_BUF_COUNT   ((UCI_RX_RING_SIZE + 4) * NRFSPI_MAX_DEVICES)
+
+// and a few large ones for messages that don't fit a packet, put
+// back together from PBF segments or sent with an extended length
+// (radar, CIR and other debug logs)
+//
+#define UCI_BUF_LARGE_COUNT (2)
+#define UCI_BUF_LARGE_SIZE  (UCI_MAX_DATA_PACKET_SIZE)
+
+typedef struct uci_buf
+{
+    atomic_t    refs;
+    uint32_t    stamp;      // cycle count the uwbs signalled it
+    uint16_t    len;        // payload bytes
+    uint16_t    size;       // room for payload
+    uint8_t     hdr[UCI_MSG_HDR_SIZE];
+    uint8_t     data[];
+}
+uci_buf_t;
+
+typedef struct
+{
+    uint32_t    allocs;
+    uint32_t    frees;
+    uint32_t    fails;
+    uint32_t    in_use;
+    uint32_t    high_water;
+    uint32_t    large_allocs;
+    uint32_t    large_fails;
+    uint32_t    large_in_use;
+    uint32_t    large_high_water;
+}
+uci_buf_stats_t;
+
+uci_buf_t *UCIbufAlloc(void);
+uci_buf_t *UCIbufAllocLarge(void);
+uci_buf_t *UCIbufRef(uci_buf_t *inBuf);
+void UCIbufUnref(uci_buf_t *inBuf);
+
+// the buffer a payload handed up by UCIprotoSlice/UCIprotoNextMessage
+// lives in
+//
+uci_buf_t *UCIbufFromPayload(const uint8_t *inPayload);
+
+void UCIbufGetStats(uci_buf_stats_t *outStats);
+void UCIbufResetStats(void);
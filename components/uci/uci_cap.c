@@ -0,0 +1,296 @@
+#include "uci_cap.h"
+#include "uci_defs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+
+#define COMPONENT_NAME ucicap
+#include "Logging.h"
+
+BUILD_ASSERT((UCI_CAP_SIZE & (UCI_CAP_SIZE - 1)) == 0, "capture ring has to be a power of 2");
+BUILD_ASSERT(sizeof(uci_cap_rec_t) == 12, "capture record header is 12 bytes");
+BUILD_ASSERT(UCI_CAP_MAX_SNAPLEN >= UCI_MAX_DATA_PACKET_SIZE, "a capture for replay has to be able to keep whole messages");
+
+// head and tail count bytes ever written and dropped, the ring index
+// is the low bits, so head - tail is what's in it
+//
+static uint8_t  mCap[UCI_CAP_SIZE];
+static uint32_t mCapHead;
+static uint32_t mCapTail;
+static int64_t  mCapStart;
+
+static struct k_spinlock mCapLock;
+static uci_cap_stats_t mCapStats;
+
+static void _cap_put(uint32_t inPos, const uint8_t *inData, int inCount)
+{
+    uint32_t at = inPos & (UCI_CAP_SIZE - 1);
+    int first = UCI_CAP_SIZE - at;
+
+    if (first > inCount)
+    {
+        first = inCount;
+    }
+    memcpy(mCap + at, inData, first);
+    if (inCount > first)
+    {
+        memcpy(mCap, inData + first, inCount - first);
+    }
+}
+
+static void _cap_get(uint32_t inPos, uint8_t *outData, int inCount)
+{
+    uint32_t at = inPos & (UCI_CAP_SIZE - 1);
+    int first = UCI_CAP_SIZE - at;
+
+    if (first > inCount)
+    {
+        first = inCount;
+    }
+    memcpy(outData, mCap + at, first);
+    if (inCount > first)
+    {
+        memcpy(outData + first, mCap, inCount - first);
+    }
+}
+
+static uint16_t _cap_size_at(uint32_t inPos)
+{
+    uint16_t size;
+
+    _cap_get(inPos, (uint8_t *)&size, sizeof(size));
+    return size;
+}
+
+void UCIcapRecord(
+                int inUnit,
+                int inDir,
+                const uint8_t *inHdr,
+                const uint8_t *inPayload,
+                const int inCount)
+{
+    k_spinlock_key_t key;
+    uci_cap_rec_t rec;
+    int keep;
+
+    if (!mCapStats.running)
+    {
+        return;
+    }
+
+    keep = inCount;
+    if (keep > mCapStats.snaplen)
+    {
+        keep = mCapStats.snaplen;
+    }
+
+    rec.size = sizeof(rec) + keep;
+    rec.unit = inUnit;
+    rec.dir = inDir;
+    rec.hdr0 = inHdr[0] & (UCI_MT_MASK | UCI_GID_MASK);
+    rec.oid = inHdr[1] & UCI_OID_MASK;
+    rec.length = inCount;
+
+    key = k_spin_lock(&mCapLock);
+
+    rec.stamp_us = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks() - mCapStart);
+
+    // make room, oldest first
+    //
+    while ((mCapHead - mCapTail + rec.size) > UCI_CAP_SIZE)
+    {
+        mCapTail += _cap_size_at(mCapTail);
+        mCapStats.overwritten++;
+    }
+
+    _cap_put(mCapHead, (const uint8_t *)&rec, sizeof(rec));
+    if (keep)
+    {
+        _cap_put(mCapHead + sizeof(rec), inPayload, keep);
+    }
+    mCapHead += rec.size;
+
+    mCapStats.records++;
+    if (keep < inCount)
+    {
+        mCapStats.truncated++;
+    }
+
+    k_spin_unlock(&mCapLock, key);
+}
+
+int UCIcapNext(uint32_t *ioPos, uint8_t *outRec, const int inSize)
+{
+    k_spinlock_key_t key = k_spin_lock(&mCapLock);
+    uint16_t size = 0;
+    int ret;
+
+    // anything older than the tail was written over
+    //
+    if ((int32_t)(*ioPos - mCapTail) < 0)
+    {
+        *ioPos = mCapTail;
+    }
+
+    if (*ioPos == mCapHead)
+    {
+        ret = 0;
+    }
+    else
+    {
+        size = _cap_size_at(*ioPos);
+        if (size > inSize)
+        {
+            ret = -ENOSPC;
+        }
+        else
+        {
+            _cap_get(*ioPos, outRec, size);
+            *ioPos += size;
+            ret = size;
+        }
+    }
+
+    k_spin_unlock(&mCapLock, key);
+    return ret;
+}
+
+void UCIcapStart(uint16_t inSnapLen)
+{
+    k_spinlock_key_t key = k_spin_lock(&mCapLock);
+
+    if (inSnapLen > UCI_CAP_MAX_SNAPLEN)
+    {
+        inSnapLen = UCI_CAP_MAX_SNAPLEN;
+    }
+    if (mCapHead == mCapTail)
+    {
+        // stamps count from the first start after a clear
+        mCapStart = k_uptime_ticks();
+    }
+    mCapStats.snaplen = inSnapLen;
+    mCapStats.running = true;
+
+    k_spin_unlock(&mCapLock, key);
+}
+
+void UCIcapStop(void)
+{
+    mCapStats.running = false;
+}
+
+void UCIcapClear(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&mCapLock);
+    bool running = mCapStats.running;
+    uint16_t snaplen = mCapStats.snaplen;
+
+    mCapHead = 0;
+    mCapTail = 0;
+    mCapStart = k_uptime_ticks();
+
+    memset(&mCapStats, 0, sizeof(mCapStats));
+    mCapStats.running = running;
+    mCapStats.snaplen = snaplen;
+
+    k_spin_unlock(&mCapLock, key);
+}
+
+void UCIcapGetStats(uci_cap_stats_t *outStats)
+{
+    k_spinlock_key_t key = k_spin_lock(&mCapLock);
+
+    *outStats = mCapStats;
+    outStats->bytes = mCapHead - mCapTail;
+
+    k_spin_unlock(&mCapLock, key);
+}
+
+#ifdef CONFIG_SHELL
+
+#include <zephyr/shell/shell.h>
+
+// bytes of a record per dump line, ucicap.py joins them back up
+//
+#define UCI_CAP_DUMP_LINE   (48)
+
+static int _CmdCapStart( const struct shell *shell, size_t argc, char **argv )
+{
+    uint16_t snaplen = UCI_CAP_SNAPLEN;
+
+    if (argc > 1)
+    {
+        snaplen = strtoul(*++argv, NULL, 0);
+    }
+    UCIcapStart(snaplen);
+    return 0;
+}
+
+static int _CmdCapStop( const struct shell *shell, size_t argc, char **argv )
+{
+    UCIcapStop();
+    return 0;
+}
+
+static int _CmdCapClear( const struct shell *shell, size_t argc, char **argv )
+{
+    UCIcapClear();
+    return 0;
+}
+
+static int _CmdCapStatus( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_cap_stats_t stats;
+
+    UCIcapGetStats(&stats);
+
+    shell_print(shell, "Capture %s  snap length=%u", stats.running ? "running" : "stopped", stats.snaplen);
+    shell_print(shell, "  records=%u truncated=%u overwritten=%u  %u of %u bytes",
+                stats.records, stats.truncated, stats.overwritten, stats.bytes, UCI_CAP_SIZE);
+    return 0;
+}
+
+static int _CmdCapDump( const struct shell *shell, size_t argc, char **argv )
+{
+    static uint8_t rec[sizeof(uci_cap_rec_t) + UCI_CAP_MAX_SNAPLEN];
+    char line[UCI_CAP_DUMP_LINE * 2 + 1];
+    uint32_t pos = 0;
+    int records = 0;
+    int size;
+    int off;
+    int i;
+
+    shell_print(shell, "UCICAP-BEGIN 1");
+
+    while ((size = UCIcapNext(&pos, rec, sizeof(rec))) > 0)
+    {
+        for (off = 0; off < size; off += UCI_CAP_DUMP_LINE)
+        {
+            for (i = 0; i < UCI_CAP_DUMP_LINE && (off + i) < size; i++)
+            {
+                snprintf(line + 2 * i, 3, "%02X", rec[off + i]);
+            }
+            shell_print(shell, "UCICAP %s", line);
+        }
+        records++;
+    }
+
+    shell_print(shell, "UCICAP-END %d", records);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_ucicap,
+    SHELL_CMD_ARG(start, NULL, " Start capturing (use ucicap start [snap length])\n", _CmdCapStart, 1, 1),
+    SHELL_CMD(stop, NULL,      " Stop capturing, what's there is kept\n", _CmdCapStop),
+    SHELL_CMD(clear, NULL,     " Empty the capture\n", _CmdCapClear),
+    SHELL_CMD(status, NULL,    " Print capture status\n", _CmdCapStatus),
+    SHELL_CMD(dump, NULL,      " Print the capture as hex records for ucicap.py\n", _CmdCapDump),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(ucicap, &sub_ucicap, "UCI traffic capture", NULL);
+
+#endif
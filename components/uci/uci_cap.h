@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Binary capture of the uci traffic on every unit, kept in a ring in
+// ram.  Each message (commands as sent, messages as read and put back
+// together) is one record, a fixed header and the first snap length
+// bytes of its payload, copied in with no formatting so capturing
+// doesn't change the timing it's there to look at.  When the ring is
+// full the oldest records go
+//
+// "ucicap dump" prints the ring as hex lines for ucicap.py to pull out
+// of a console log, and uwbsim can replay a capture at full speed.  A
+// replay needs whole messages, a snap length up to the largest message
+// (UCI_MAX_DATA_PACKET_SIZE) keeps them all
+//
+#define UCI_CAP_SIZE        (16384)
+#define UCI_CAP_SNAPLEN     (64)
+#define UCI_CAP_MAX_SNAPLEN (4200)
+
+#define UCI_CAP_TX          (0)     // host to uwbs
+#define UCI_CAP_RX          (1)     // uwbs to host
+
+// record header, little endian, the payload follows it.  size is the
+// whole record, length the payload the message had, which is more than
+// what follows when it was cut at the snap length
+//
+typedef struct
+{
+    uint16_t    size;
+    uint8_t     unit;
+    uint8_t     dir;
+    uint32_t    stamp_us;   // since the capture was started
+    uint8_t     hdr0;       // mt and gid, as in the uci header
+    uint8_t     oid;
+    uint16_t    length;
+}
+uci_cap_rec_t;
+
+typedef struct
+{
+    bool        running;
+    uint16_t    snaplen;
+    uint32_t    records;
+    uint32_t    bytes;      // in the ring now
+    uint32_t    overwritten;
+    uint32_t    truncated;
+}
+uci_cap_stats_t;
+
+void UCIcapStart(uint16_t inSnapLen);
+void UCIcapStop(void);
+void UCIcapClear(void);
+
+void UCIcapRecord(
+                int inUnit,
+                int inDir,
+                const uint8_t *inHdr,
+                const uint8_t *inPayload,
+                const int inCount);
+
+// Copy out the record at or after *ioPos (0 is the oldest still there)
+// and move *ioPos past it. Returns its size, 0 when there are no more
+// and -ENOSPC if it doesn't fit in inSize
+//
+int  UCIcapNext(uint32_t *ioPos, uint8_t *outRec, const int inSize);
+
+void UCIcapGetStats(uci_cap_stats_t *outStats);
@@ -0,0 +1,875 @@
+#include "uci_data.h"
+#include "uci_defs.h"
+#include "nrfspi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+
+#define COMPONENT_NAME ucidata
+#include "Logging.h"
+
+BUILD_ASSERT((UCI_DATA_QUEUE_DEPTH & (UCI_DATA_QUEUE_DEPTH - 1)) == 0, "data queue depth has to be a power of 2");
+
+typedef enum
+{
+    DATA_FREE,
+    DATA_QUEUED,        // written to the uwbs up to sent
+    DATA_WAIT_STATUS,   // all written
+}
+uci_data_state_t;
+
+typedef struct
+{
+    uci_data_state_t state;
+    uint16_t    seq;
+    int         len;        // header and data
+    int         sent;
+    uint32_t    queued;     // cycles
+    uint8_t     buf[UCI_DATA_SND_HDR_SIZE + APP_DATA_MAX_SIZE];
+}
+uci_data_msg_t;
+
+// Messages are put at put, written to the uwbs from tx and freed from
+// get as their status comes in (free running, the slot is the low
+// bits).  Only one packet is with uci_proto at a time, writing, so the
+// slot it's from stays put until it's done even if the channel closes
+//
+typedef struct
+{
+    uci_t          *uci;
+    bool            open;
+    uint32_t        session;
+    uint8_t         dest[UCI_DATA_ADDR_SIZE];
+    uci_data_rcv_t  received;
+    uci_data_sent_t sent;
+    void           *context;
+
+    int             segment;        // packet payload
+    int             max_size;       // data per message
+    int             max_credits;
+    int             credits;
+    bool            stalled;
+
+    bool            writing;
+    int             writelen;
+
+    uint16_t        seq;
+    uint16_t        rx_seq;
+    bool            rx_seen;
+
+    uci_data_msg_t  queue[UCI_DATA_QUEUE_DEPTH];
+    uint32_t        put;
+    uint32_t        tx;
+    uint32_t        get;
+
+    uci_data_stats_t stats;
+}
+uci_data_t;
+
+static uci_data_t mUCIdata[NRFSPI_MAX_DEVICES];
+
+// everything in a channel, the callbacks to the app and uci_proto are
+// made without it
+//
+static struct k_spinlock mUCIdataLock;
+
+static uci_data_t *_data_get(uci_t *inUCI)
+{
+    int unit;
+
+    if (!inUCI)
+    {
+        return NULL;
+    }
+    unit = UCIprotoUnit(inUCI);
+    if (unit < 0 || unit >= NRFSPI_MAX_DEVICES)
+    {
+        return NULL;
+    }
+    return &mUCIdata[unit];
+}
+
+static uci_data_msg_t *_data_msg(uci_data_t *d, uint32_t inPos)
+{
+    return &d->queue[inPos & (UCI_DATA_QUEUE_DEPTH - 1)];
+}
+
+static void _data_put_le(uint8_t *outData, uint32_t inValue, int inCount)
+{
+    int i;
+
+    for (i = 0; i < inCount; i++)
+    {
+        outData[i] = inValue >> (8 * i);
+    }
+}
+
+static uint32_t _data_get_le(const uint8_t *inData, int inCount)
+{
+    uint32_t value = 0;
+    int i;
+
+    for (i = 0; i < inCount; i++)
+    {
+        value |= (uint32_t)inData[i] << (8 * i);
+    }
+    return value;
+}
+
+// statuses free their slots in any order, the queue only gives back
+// ones at its end
+//
+static void _data_reclaim(uci_data_t *d)
+{
+    while (d->get != d->tx && _data_msg(d, d->get)->state == DATA_FREE)
+    {
+        d->get++;
+    }
+}
+
+static uint32_t _data_finish(uci_data_t *d, uci_data_msg_t *msg, uint8_t inStatus)
+{
+    uci_data_stats_t *stats = &d->stats;
+    uint32_t latency;
+
+    latency = k_cyc_to_us_floor32(k_cycle_get_32() - msg->queued);
+
+    if (inStatus == UCI_DATA_STATUS_OK)
+    {
+        stats->acked++;
+        stats->bytes += msg->len - UCI_DATA_SND_HDR_SIZE;
+        stats->latency_last_us = latency;
+        stats->latency_total_us += latency;
+        if (latency > stats->latency_max_us)
+        {
+            stats->latency_max_us = latency;
+        }
+    }
+    else
+    {
+        stats->failed++;
+    }
+
+    msg->state = DATA_FREE;
+    return latency;
+}
+
+static void _data_written(uci_t *inUCI, int inResult, void *inContext);
+
+// Hand the next packet to uci_proto when there's credit for it and the
+// last one is out
+//
+static void _data_pump(uci_data_t *d)
+{
+    k_spinlock_key_t key = k_spin_lock(&mUCIdataLock);
+    uci_data_msg_t *msg;
+    const uint8_t *payload;
+    bool more;
+    int len;
+    int ret;
+
+    if (!d->open || d->writing || d->tx == d->put)
+    {
+        k_spin_unlock(&mUCIdataLock, key);
+        return;
+    }
+
+    if (d->credits <= 0)
+    {
+        // until a credit ntf
+        if (!d->stalled)
+        {
+            d->stalled = true;
+            d->stats.credit_stalls++;
+        }
+        k_spin_unlock(&mUCIdataLock, key);
+        return;
+    }
+
+    msg = _data_msg(d, d->tx);
+    len = msg->len - msg->sent;
+    more = len > d->segment;
+    if (more)
+    {
+        len = d->segment;
+    }
+    payload = msg->buf + msg->sent;
+
+    d->writing = true;
+    d->writelen = len;
+    d->credits--;
+
+    k_spin_unlock(&mUCIdataLock, key);
+
+    ret = UCIprotoWriteData(d->uci, UCI_DPF_SND, more, payload, len, _data_written, d);
+    if (ret)
+    {
+        // bus isn't up (booting, parked), the next send or ntf tries again
+        LOG_WRN("Can't write data packet %d", ret);
+
+        key = k_spin_lock(&mUCIdataLock);
+        d->writing = false;
+        d->credits++;
+        k_spin_unlock(&mUCIdataLock, key);
+    }
+}
+
+// A packet is on the bus, or failed to get there
+//
+static void _data_written(uci_t *inUCI, int inResult, void *inContext)
+{
+    uci_data_t *d = (uci_data_t *)inContext;
+    k_spinlock_key_t key = k_spin_lock(&mUCIdataLock);
+    uci_data_msg_t *msg;
+    uci_data_sent_t sent = NULL;
+    uint32_t latency = 0;
+    uint16_t seq = 0;
+
+    d->writing = false;
+
+    if (!d->open || d->tx == d->put)
+    {
+        // closed while it was out
+        k_spin_unlock(&mUCIdataLock, key);
+        return;
+    }
+
+    msg = _data_msg(d, d->tx);
+    if (inResult)
+    {
+        LOG_ERR("Data %u not sent %d", msg->seq, inResult);
+
+        seq = msg->seq;
+        latency = _data_finish(d, msg, UCI_DATA_STATUS_NOT_SENT);
+        sent = d->sent;
+        d->tx++;
+        _data_reclaim(d);
+    }
+    else
+    {
+        d->stats.packets++;
+        msg->sent += d->writelen;
+        if (msg->sent >= msg->len)
+        {
+            msg->state = DATA_WAIT_STATUS;
+            d->stats.sent++;
+            d->tx++;
+        }
+    }
+
+    k_spin_unlock(&mUCIdataLock, key);
+
+    if (sent)
+    {
+        sent(inUCI, seq, UCI_DATA_STATUS_NOT_SENT, latency, d->context);
+    }
+    _data_pump(d);
+}
+
+// DATA_CREDIT_NTF: session handle, credit availability
+//
+static void _data_credit_ntf(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *inPayload,
+                int inPayloadLength,
+                void *inContext)
+{
+    uci_data_t *d = (uci_data_t *)inContext;
+    k_spinlock_key_t key;
+
+    if (inPayloadLength < 5 || _data_get_le(inPayload, 4) != d->session)
+    {
+        return;
+    }
+
+    key = k_spin_lock(&mUCIdataLock);
+
+    d->stats.credit_ntfs++;
+    if (inPayload[4])
+    {
+        d->credits = d->max_credits;
+        d->stalled = false;
+    }
+    else
+    {
+        d->credits = 0;
+    }
+
+    k_spin_unlock(&mUCIdataLock, key);
+
+    _data_pump(d);
+}
+
+// DATA_TRANSMIT_STATUS_NTF: session handle, sequence number, status
+// and (uci 2) how many times it went out
+//
+static void _data_status_ntf(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *inPayload,
+                int inPayloadLength,
+                void *inContext)
+{
+    uci_data_t *d = (uci_data_t *)inContext;
+    k_spinlock_key_t key;
+    uci_data_msg_t *msg = NULL;
+    uci_data_sent_t sent = NULL;
+    uint32_t latency = 0;
+    uint32_t pos;
+    uint16_t seq;
+    uint8_t status;
+
+    if (inPayloadLength < 7 || _data_get_le(inPayload, 4) != d->session)
+    {
+        return;
+    }
+    seq = _data_get_le(inPayload + 4, 2);
+    status = inPayload[6];
+
+    key = k_spin_lock(&mUCIdataLock);
+
+    for (pos = d->get; pos != d->tx; pos++)
+    {
+        if (_data_msg(d, pos)->state == DATA_WAIT_STATUS && _data_msg(d, pos)->seq == seq)
+        {
+            msg = _data_msg(d, pos);
+            break;
+        }
+    }
+
+    if (msg)
+    {
+        latency = _data_finish(d, msg, status);
+        sent = d->sent;
+        _data_reclaim(d);
+    }
+    else
+    {
+        d->stats.unmatched++;
+    }
+
+    k_spin_unlock(&mUCIdataLock, key);
+
+    if (!msg)
+    {
+        LOG_WRN("Transmit status %02X for data %u, not ours", status, seq);
+    }
+    else if (status != UCI_DATA_STATUS_OK)
+    {
+        LOG_WRN("Data %u status %02X", seq, status);
+    }
+
+    if (sent)
+    {
+        sent(inUCI, seq, status, latency, d->context);
+    }
+    _data_pump(d);
+}
+
+// DATA_MESSAGE_RCV, put back together by uci_proto
+//
+static void _data_received(
+                uci_t *inUCI,
+                uint8_t inDPF,
+                uint8_t inOID,
+                const uint8_t *inPayload,
+                int inPayloadLength,
+                void *inContext)
+{
+    uci_data_t *d = (uci_data_t *)inContext;
+    uci_data_stats_t *stats = &d->stats;
+    uint32_t session;
+    uint16_t seq;
+    int len;
+
+    if (inPayloadLength < UCI_DATA_RCV_HDR_SIZE)
+    {
+        LOG_ERR("Data message of %d bytes", inPayloadLength);
+        return;
+    }
+
+    session = _data_get_le(inPayload, 4);
+    seq = _data_get_le(inPayload + 13, 2);
+    len = _data_get_le(inPayload + 15, 2);
+
+    if (session != d->session)
+    {
+        return;
+    }
+    if (len > (inPayloadLength - UCI_DATA_RCV_HDR_SIZE))
+    {
+        LOG_ERR("Data %u says %d bytes, has %d", seq, len, inPayloadLength - UCI_DATA_RCV_HDR_SIZE);
+        len = inPayloadLength - UCI_DATA_RCV_HDR_SIZE;
+    }
+
+    stats->received++;
+    stats->rx_bytes += len;
+    if (inPayload[4] != UCI_STATUS_OK)
+    {
+        stats->rx_errors++;
+    }
+    if (d->rx_seen && seq != (uint16_t)(d->rx_seq + 1))
+    {
+        stats->rx_gaps++;
+    }
+    d->rx_seq = seq;
+    d->rx_seen = true;
+
+    if (d->received)
+    {
+        d->received(inUCI, session, inPayload + 5, seq, inPayload + UCI_DATA_RCV_HDR_SIZE, len, d->context);
+    }
+}
+
+int UCIdataOpen(
+                uci_t *inUCI,
+                uint32_t inSession,
+                const uint8_t inDest[UCI_DATA_ADDR_SIZE],
+                uci_data_rcv_t inReceived,
+                uci_data_sent_t inSent,
+                void *inContext)
+{
+    uci_data_t *d = _data_get(inUCI);
+    const uci_caps_t *caps;
+    int ret = -EINVAL;
+
+    require(d && inDest, exit);
+
+    ret = -EBUSY;
+    require(!d->open && !d->writing, exit);
+
+    memset(d, 0, sizeof(*d));
+    d->uci = inUCI;
+    d->session = inSession;
+    memcpy(d->dest, inDest, sizeof(d->dest));
+    d->received = inReceived;
+    d->sent = inSent;
+    d->context = inContext;
+
+    // packets are a block each, and a message has to fit in the blocks
+    // the uwbs has
+    //
+    caps = UCIprotoCaps(inUCI);
+    d->segment = UCIprotoMaxPacket(inUCI);
+    if (caps->data_block_size && caps->data_block_size < d->segment)
+    {
+        d->segment = caps->data_block_size;
+    }
+    d->max_credits = caps->data_max_blocks ? caps->data_max_blocks : 1;
+    d->credits = d->max_credits;
+
+    d->max_size = APP_DATA_MAX_SIZE;
+    if (caps->data_block_size && caps->data_max_blocks)
+    {
+        d->max_size = MIN(d->max_size, caps->data_block_size * caps->data_max_blocks - UCI_DATA_SND_HDR_SIZE);
+    }
+
+    ret = UCIprotoSubscribe(inUCI, UCI_GID_DATA_CONTROL, UCI_MSG_DATA_CREDIT_NTF, _data_credit_ntf, d);
+    require_noerr(ret, exit);
+    ret = UCIprotoSubscribe(inUCI, UCI_GID_DATA_CONTROL, UCI_MSG_DATA_TRANSMIT_STATUS_NTF, _data_status_ntf, d);
+    require_noerr(ret, unsubscribe);
+    ret = UCIprotoSubscribeData(inUCI, UCI_DPF_RCV, _data_received, d);
+    require_noerr(ret, unsubscribe);
+
+    LOG_INF("Data on session %08X  %d byte packets, %d credits, %d bytes per message",
+                inSession, d->segment, d->max_credits, d->max_size);
+
+    d->open = true;
+    return 0;
+
+unsubscribe:
+    UCIprotoUnsubscribe(inUCI, UCI_GID_DATA_CONTROL, UCI_MSG_DATA_CREDIT_NTF, _data_credit_ntf, d);
+    UCIprotoUnsubscribe(inUCI, UCI_GID_DATA_CONTROL, UCI_MSG_DATA_TRANSMIT_STATUS_NTF, _data_status_ntf, d);
+exit:
+    return ret;
+}
+
+int UCIdataClose(uci_t *inUCI)
+{
+    uci_data_t *d = _data_get(inUCI);
+    k_spinlock_key_t key;
+    uci_data_msg_t *msg;
+    uint32_t latency;
+    uint16_t seq;
+
+    if (!d || !d->open)
+    {
+        return -EINVAL;
+    }
+
+    UCIprotoUnsubscribe(inUCI, UCI_GID_DATA_CONTROL, UCI_MSG_DATA_CREDIT_NTF, _data_credit_ntf, d);
+    UCIprotoUnsubscribe(inUCI, UCI_GID_DATA_CONTROL, UCI_MSG_DATA_TRANSMIT_STATUS_NTF, _data_status_ntf, d);
+    UCIprotoUnsubscribeData(inUCI, UCI_DPF_RCV, _data_received, d);
+
+    // whatever is still queued or waiting for a status won't get one
+    //
+    key = k_spin_lock(&mUCIdataLock);
+    d->open = false;
+    for (; d->get != d->put; d->get++)
+    {
+        msg = _data_msg(d, d->get);
+        if (msg->state == DATA_FREE)
+        {
+            continue;
+        }
+        seq = msg->seq;
+        latency = _data_finish(d, msg, UCI_DATA_STATUS_NOT_SENT);
+
+        k_spin_unlock(&mUCIdataLock, key);
+        if (d->sent)
+        {
+            d->sent(inUCI, seq, UCI_DATA_STATUS_NOT_SENT, latency, d->context);
+        }
+        key = k_spin_lock(&mUCIdataLock);
+    }
+    d->tx = d->put;
+    k_spin_unlock(&mUCIdataLock, key);
+    return 0;
+}
+
+bool UCIdataIsOpen(uci_t *inUCI)
+{
+    uci_data_t *d = _data_get(inUCI);
+
+    return d && d->open;
+}
+
+int UCIdataMaxSize(uci_t *inUCI)
+{
+    uci_data_t *d = _data_get(inUCI);
+
+    if (!d || !d->open)
+    {
+        return APP_DATA_MAX_SIZE;
+    }
+    return d->max_size;
+}
+
+int UCIdataSend(
+                uci_t *inUCI,
+                const uint8_t *inData,
+                const int inCount,
+                uint16_t *outSeq)
+{
+    uci_data_t *d = _data_get(inUCI);
+    k_spinlock_key_t key;
+    uci_data_msg_t *msg;
+    int ret = -EINVAL;
+
+    require(d && d->open, exit);
+    require(inData && inCount > 0, exit);
+
+    ret = -EMSGSIZE;
+    require(inCount <= d->max_size, exit);
+
+    key = k_spin_lock(&mUCIdataLock);
+
+    if ((d->put - d->get) >= UCI_DATA_QUEUE_DEPTH)
+    {
+        d->stats.queue_full++;
+        k_spin_unlock(&mUCIdataLock, key);
+        ret = -ENOMEM;
+        goto exit;
+    }
+
+    msg = _data_msg(d, d->put);
+    msg->seq = d->seq++;
+    msg->len = UCI_DATA_SND_HDR_SIZE + inCount;
+    msg->sent = 0;
+    msg->queued = k_cycle_get_32();
+    msg->state = DATA_QUEUED;
+
+    _data_put_le(msg->buf, d->session, 4);
+    memcpy(msg->buf + 4, d->dest, UCI_DATA_ADDR_SIZE);
+    _data_put_le(msg->buf + 12, msg->seq, 2);
+    _data_put_le(msg->buf + 14, inCount, 2);
+    memcpy(msg->buf + UCI_DATA_SND_HDR_SIZE, inData, inCount);
+
+    if (outSeq)
+    {
+        *outSeq = msg->seq;
+    }
+    d->put++;
+    d->stats.queued++;
+
+    k_spin_unlock(&mUCIdataLock, key);
+
+    _data_pump(d);
+    ret = 0;
+exit:
+    return ret;
+}
+
+int UCIdataGetStats(uci_t *inUCI, uci_data_stats_t *outStats)
+{
+    uci_data_t *d = _data_get(inUCI);
+    k_spinlock_key_t key;
+
+    if (!d || !outStats)
+    {
+        return -EINVAL;
+    }
+    key = k_spin_lock(&mUCIdataLock);
+    *outStats = d->stats;
+    k_spin_unlock(&mUCIdataLock, key);
+    return 0;
+}
+
+void UCIdataResetStats(uci_t *inUCI)
+{
+    uci_data_t *d = _data_get(inUCI);
+    k_spinlock_key_t key;
+
+    if (d)
+    {
+        key = k_spin_lock(&mUCIdataLock);
+        memset(&d->stats, 0, sizeof(d->stats));
+        k_spin_unlock(&mUCIdataLock, key);
+    }
+}
+
+#ifdef CONFIG_SHELL
+
+#include <zephyr/shell/shell.h>
+
+// Throughput bench, keeps the queue full with count messages of size
+// bytes and reports when the last status is in.  With uwbsim's data
+// loopback on, what comes back is counted too
+//
+typedef struct
+{
+    bool        running;
+    int         unit;
+    int         size;
+    int         count;
+    int         queued;
+    int         done;
+    int         received;
+    uint32_t    start;
+}
+uci_data_bench_t;
+
+static uci_data_bench_t mUCIdataBench;
+
+static void _bench_fill(uci_t *inUCI)
+{
+    static uint8_t data[APP_DATA_MAX_SIZE];
+    uci_data_bench_t *bench = &mUCIdataBench;
+
+    while (bench->running && bench->queued < bench->count)
+    {
+        memset(data, bench->queued, bench->size);
+        if (UCIdataSend(inUCI, data, bench->size, NULL))
+        {
+            break;
+        }
+        bench->queued++;
+    }
+}
+
+static void _bench_sent(uci_t *inUCI, uint16_t inSeq, uint8_t inStatus, uint32_t inLatencyUs, void *inContext)
+{
+    uci_data_bench_t *bench = &mUCIdataBench;
+    uci_data_stats_t stats;
+    uint32_t elapsed;
+
+    if (!bench->running || UCIprotoUnit(inUCI) != bench->unit)
+    {
+        return;
+    }
+
+    bench->done++;
+    if (bench->done < bench->count)
+    {
+        _bench_fill(inUCI);
+        return;
+    }
+
+    bench->running = false;
+    elapsed = k_cyc_to_us_floor32(k_cycle_get_32() - bench->start);
+    UCIdataGetStats(inUCI, &stats);
+
+    LOG_INF("Bench %d x %d bytes in %uus: %u bytes/s, %u messages/s",
+                bench->count, bench->size, elapsed,
+                elapsed ? (uint32_t)(stats.bytes * 1000000ULL / elapsed) : 0,
+                elapsed ? (uint32_t)(bench->count * 1000000ULL / elapsed) : 0);
+    LOG_INF("  acked=%u failed=%u  latency max=%uus avg=%uus  credit stalls=%u  received=%d",
+                stats.acked, stats.failed, stats.latency_max_us,
+                stats.acked ? (uint32_t)(stats.latency_total_us / stats.acked) : 0,
+                stats.credit_stalls, bench->received);
+}
+
+static void _bench_received(
+                uci_t *inUCI,
+                uint32_t inSession,
+                const uint8_t *inSource,
+                uint16_t inSeq,
+                const uint8_t *inData,
+                int inCount,
+                void *inContext)
+{
+    mUCIdataBench.received++;
+    LOG_DBG("Data %u, %d bytes from %02X%02X", inSeq, inCount, inSource[1], inSource[0]);
+}
+
+static uci_t *_shell_unit(const struct shell *shell, size_t argc, char **argv, int inArg)
+{
+    int unit = 0;
+
+    if (argc > inArg)
+    {
+        unit = strtoul(argv[inArg], NULL, 0);
+    }
+    if (unit >= UCIprotoCount())
+    {
+        shell_error(shell, "No unit %d, have %d", unit, UCIprotoCount());
+        return NULL;
+    }
+    return UCIprotoGet(unit);
+}
+
+static int _CmdDataOpen( const struct shell *shell, size_t argc, char **argv )
+{
+    uint8_t dest[UCI_DATA_ADDR_SIZE] = { 0 };
+    uint32_t session;
+    uint16_t addr;
+    uci_t *uci;
+    int ret;
+
+    session = strtoul(argv[1], NULL, 0);
+    addr = strtoul(argv[2], NULL, 0);
+    uci = _shell_unit(shell, argc, argv, 3);
+    if (!uci)
+    {
+        return -EINVAL;
+    }
+
+    _data_put_le(dest, addr, 2);
+    ret = UCIdataOpen(uci, session, dest, _bench_received, _bench_sent, NULL);
+    if (ret)
+    {
+        shell_error(shell, "Can't open %d", ret);
+    }
+    return ret;
+}
+
+static int _CmdDataClose( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_t *uci = _shell_unit(shell, argc, argv, 1);
+
+    if (!uci)
+    {
+        return -EINVAL;
+    }
+    mUCIdataBench.running = false;
+    return UCIdataClose(uci);
+}
+
+static int _CmdDataSend( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_t *uci = _shell_unit(shell, argc, argv, 2);
+    uint16_t seq;
+    int ret;
+
+    if (!uci)
+    {
+        return -EINVAL;
+    }
+    ret = UCIdataSend(uci, (const uint8_t *)argv[1], strlen(argv[1]), &seq);
+    if (ret)
+    {
+        shell_error(shell, "Can't send %d", ret);
+        return ret;
+    }
+    shell_print(shell, "Sent as %u", seq);
+    return 0;
+}
+
+static int _CmdDataBench( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_data_bench_t *bench = &mUCIdataBench;
+    uci_t *uci;
+    int size;
+
+    uci = _shell_unit(shell, argc, argv, 3);
+    if (!uci || !UCIdataIsOpen(uci))
+    {
+        shell_error(shell, "Open the unit first");
+        return -EINVAL;
+    }
+    if (bench->running)
+    {
+        shell_error(shell, "Bench already running, %d of %d done", bench->done, bench->count);
+        return -EBUSY;
+    }
+
+    size = UCIdataMaxSize(uci);
+    if (argc > 2)
+    {
+        size = MIN(size, (int)strtoul(argv[2], NULL, 0));
+    }
+
+    memset(bench, 0, sizeof(*bench));
+    bench->unit = UCIprotoUnit(uci);
+    bench->count = strtoul(argv[1], NULL, 0);
+    bench->size = MAX(size, 1);
+    if (bench->count <= 0)
+    {
+        return -EINVAL;
+    }
+
+    UCIdataResetStats(uci);
+    bench->running = true;
+    bench->start = k_cycle_get_32();
+    _bench_fill(uci);
+
+    shell_print(shell, "Sending %d x %d bytes", bench->count, bench->size);
+    return 0;
+}
+
+static int _CmdDataStats( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_t *uci = _shell_unit(shell, argc, argv, 1);
+    uci_data_stats_t stats;
+    uci_data_t *d;
+
+    if (!uci)
+    {
+        return -EINVAL;
+    }
+    d = _data_get(uci);
+    UCIdataGetStats(uci, &stats);
+
+    shell_print(shell, "Unit %d %s  session=%08X  packets of %d, credits %d of %d, %d bytes per message",
+                UCIprotoUnit(uci), d->open ? "open" : "closed", d->session,
+                d->segment, d->credits, d->max_credits, d->max_size);
+    shell_print(shell, "TX queued=%u (full %u) sent=%u in %u packets  acked=%u failed=%u unmatched=%u  bytes=%llu",
+                stats.queued, stats.queue_full, stats.sent, stats.packets,
+                stats.acked, stats.failed, stats.unmatched, stats.bytes);
+    shell_print(shell, "TX credit ntfs=%u stalls=%u  send to status last=%uus max=%uus avg=%uus",
+                stats.credit_ntfs, stats.credit_stalls,
+                stats.latency_last_us, stats.latency_max_us,
+                stats.acked ? (uint32_t)(stats.latency_total_us / stats.acked) : 0);
+    shell_print(shell, "RX messages=%u errors=%u gaps=%u  bytes=%llu",
+                stats.received, stats.rx_errors, stats.rx_gaps, stats.rx_bytes);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_ucidata,
+    SHELL_CMD_ARG(open, NULL,  " Open data on a session (use ucidata open <session handle> <peer short addr> [unit])\n", _CmdDataOpen, 3, 1),
+    SHELL_CMD_ARG(close, NULL, " Close data (use ucidata close [unit])\n", _CmdDataClose, 1, 1),
+    SHELL_CMD_ARG(send, NULL,  " Send a string (use ucidata send <text> [unit])\n", _CmdDataSend, 2, 1),
+    SHELL_CMD_ARG(bench, NULL, " Send messages back to back (use ucidata bench <count> [size] [unit])\n", _CmdDataBench, 2, 2),
+    SHELL_CMD_ARG(stats, NULL, " Print data statistics (use ucidata stats [unit])\n", _CmdDataStats, 1, 1),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(ucidata, &sub_ucidata, "UCI application data", NULL);
+
+#endif
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "uci_proto.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Application data over the uwb link, UCI data messages to and from a
+// peer in a running session, one channel per unit.  Messages of up to
+// UCIdataMaxSize bytes are queued, numbered and cut into data packets
+// of the uwbs's in-band data block size.  The uwbs has credit for as
+// many packets as it has blocks (max blocks in its caps, 1 if it
+// doesn't say), each packet sent takes one and a DATA_CREDIT_NTF says
+// whether it has room again (all of them) or none.  Every message is
+// finished by the DATA_TRANSMIT_STATUS_NTF with its sequence number
+//
+#define UCI_DATA_QUEUE_DEPTH    (4)
+#define UCI_DATA_ADDR_SIZE      (8)
+
+// what comes before the data in a DATA_MESSAGE_SND: session handle,
+// destination address, sequence number and data length, and in a
+// DATA_MESSAGE_RCV: session handle, status, source address, sequence
+// number and data length.  All little endian
+//
+#define UCI_DATA_SND_HDR_SIZE   (16)
+#define UCI_DATA_RCV_HDR_SIZE   (17)
+
+// transmit status, NOT_SENT is ours for a message that never made it
+// to the uwbs (closed, reset, bus error)
+//
+#define UCI_DATA_STATUS_OK          (0x00)
+#define UCI_DATA_STATUS_ERROR       (0x01)
+#define UCI_DATA_STATUS_NO_CREDIT   (0x02)
+#define UCI_DATA_STATUS_REJECTED    (0x03)
+#define UCI_DATA_STATUS_NOT_SENT    (0xFF)
+
+// Callbacks run in whichever thread handed the notification or data
+// up (the caller of UCIprotoSlice) or, for NOT_SENT, the uci reader,
+// and can send.  Latency is from UCIdataSend to the transmit status
+//
+typedef void (*uci_data_rcv_t)(
+                uci_t *inUCI,
+                uint32_t inSession,
+                const uint8_t *inSource,
+                uint16_t inSeq,
+                const uint8_t *inData,
+                int inCount,
+                void *inContext);
+typedef void (*uci_data_sent_t)(
+                uci_t *inUCI,
+                uint16_t inSeq,
+                uint8_t inStatus,
+                uint32_t inLatencyUs,
+                void *inContext);
+
+typedef struct
+{
+    uint32_t    queued;
+    uint32_t    queue_full;
+    uint32_t    sent;           // all of it written to the uwbs
+    uint32_t    packets;
+    uint32_t    acked;          // transmit status ok
+    uint32_t    failed;         // any other status, or not sent
+    uint32_t    unmatched;      // status for no message we have
+    uint64_t    bytes;          // data acked
+    uint32_t    credit_ntfs;
+    uint32_t    credit_stalls;  // had a packet to send and no credit
+    uint32_t    latency_last_us;
+    uint32_t    latency_max_us;
+    uint64_t    latency_total_us;
+    uint32_t    received;
+    uint32_t    rx_errors;      // with a non-0 status
+    uint32_t    rx_gaps;        // sequence numbers skipped
+    uint64_t    rx_bytes;
+}
+uci_data_stats_t;
+
+// inDest is the peer's address, a short address in the first 2 bytes
+//
+int UCIdataOpen(
+                uci_t *inUCI,
+                uint32_t inSession,
+                const uint8_t inDest[UCI_DATA_ADDR_SIZE],
+                uci_data_rcv_t inReceived,
+                uci_data_sent_t inSent,
+                void *inContext);
+int UCIdataClose(uci_t *inUCI);
+bool UCIdataIsOpen(uci_t *inUCI);
+
+int UCIdataMaxSize(uci_t *inUCI);
+
+// The data is copied, outSeq (can be NULL) is the sequence number its
+// transmit status will have.  -ENOMEM when the queue is full, until a
+// status frees a place
+//
+int UCIdataSend(
+                uci_t *inUCI,
+                const uint8_t *inData,
+                const int inCount,
+                uint16_t *outSeq);
+
+int UCIdataGetStats(uci_t *inUCI, uci_data_stats_t *outStats);
+void UCIdataResetStats(uci_t *inUCI);
@@ -1,10 +1,14 @@
 #include "uci_proto.h"
+#include "uci_buf.h"
+#include "uci_cap.h"
 #include "uci_defs.h"
 #include "uci_ext_defs.h"
 #include "hbci_proto.h"
 #include "nrfspi.h"
+#include "timesvc.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/types.h>
@@ -12,7 +16,8 @@
 #define COMPONENT_NAME uciproto
 #include "Logging.h"
 
-// Define this non-0 to dump protocol bytes
+// Define this non-0 to dump protocol bytes (printing them is slow
+// enough to change the timing, ucicap captures without that)
 #define DUMP_PROTO (0)
 
 // Define this non-0 to decode protocol in dump (else raw bytes)
@@ -24,20 +29,222 @@
 //
 #define UCI_RESET_DELAY_MS  (10)
 
-// give uwbs this many millisecs to respond before re-trying
+// a uwbs working on a slow command sends its first wait time extension
+// (see UCI_WTX_MAX) about this long (millisecs) after it got it
+//
+#define UCI_WTX_INTERVAL_MS (50)
+
+// give uwbs this many millisecs to respond before re-trying, until
+// there's an rtt for the command to go by.  After that it's the
+// smoothed rtt plus 4 times its variation (tcp's rto) kept between
+// the floor and ceiling, and doubled for each timeout in a row. The
+// floor leaves room for a wtx, a command that's usually quick would
+// otherwise be re-sent before the uwbs could say it's busy with it
 //
 #define UCI_RESP_TIMEOUT_MS (100)
+#define UCI_RTO_MIN_MS      (UCI_WTX_INTERVAL_MS + 10)
+#define UCI_RTO_MAX_MS      (1000)
+
+// commands with a learned rtt per unit, and the least used one makes
+// room for a new one.  Allowing for the main loop and reader latency
+// (microseconds) so a busy slice doesn't time a command out
+//
+#define UCI_RTT_ENTRIES     (24)
+#define UCI_RTO_SLACK_US    (2000)
 
 // after this many timeouts, reset the connnection
 //
 #define UCI_MAX_TIMEOUTS    (4)
 
-static struct
+// a uwbs working on a slow command says so with a wait time extension
+// (WTX) ntf, up to WTX_COUNT_CONFIG of them, and each one starts the
+// wait for its response over.  Past this many it times out as usual
+//
+#define UCI_WTX_MAX         (20)
+
+// uwbs needs this long (microseconds) between the header and
+// payload phase of a command.  This is the default, it can be changed
+// at run time and if set to 0 the header and payload are sent as one
+// spi transaction (uwbs firmware has to allow that)
+//
+#define UCI_TX_PHASE_GAP_US (80)
+
+// messages read back to back in one sync window when the uwbs keeps
+// signalling it has more (status + range data + ext ntfs come in
+// bursts). They are queued and handed up together
+//
+#define UCI_RX_BURST_MAX    (4)
+
+// bursts are off unless turned on (uci burst). Holding sync for the next
+// message relies on the uwbs raising irq again while sync stays up, the
+// simulated uwbs does that but it isn't something the SR150 is known to do
+//
+#define UCI_RX_BURST_DEFAULT (1)
+
+// how long (microseconds) to hold sync after a message waiting for
+// the uwbs to say it has another one
+//
+#define UCI_RX_BURST_WAIT_US (150)
+
+// a parked uwbs drops into dpd on its own (DPD_ENTRY_TIMEOUT in the
+// core config) and sync wakes it (DPD_WAKEUP_SRC). Hold sync this long
+// (microseconds) for it to come up, the part takes about 370
+//
+#define UCI_DPD_WAKE_US     (400)
+
+// The reader thread moves every unit's spi transfers along and reads
+// whatever the uwbs has, woken by its irq and by transfer completion,
+// so a message is off the bus and in the ring as soon as it's signalled
+// however long the main loop is busy with ble, display or logging.
+// Cooperative so a read isn't preempted partway, below the bt threads
+//
+#define UCI_READER_STACK_SIZE   (2048)
+#define UCI_READER_PRIORITY     K_PRIO_COOP(10)
+
+// irq masked for a read and raised again before it's unmasked has no
+// edge, so the reader looks at the lines this often (milliseconds)
+// even when nothing wakes it
+//
+#define UCI_READER_POLL_MS      (5)
+
+// irq to handed up histogram, upper bound of each bucket in
+// microseconds, the last one is everything over
+//
+#define UCI_LATENCY_BUCKETS     (11)
+
+static const uint32_t mUCIlatencyBounds[UCI_LATENCY_BUCKETS - 1] =
+{
+    100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000
+};
+
+typedef struct
+{
+    uint32_t    bursts;
+    uint32_t    messages;
+    uint32_t    dispatched;     // handed to a subscriber
+    uint32_t    sizes[UCI_RX_BURST_MAX];
+    uint32_t    latency_last_us;
+    uint32_t    latency_max_us;
+    uint64_t    latency_total_us;
+    uint32_t    latency_hist[UCI_LATENCY_BUCKETS];
+    uint64_t    bytes;
+    uint32_t    segments;
+    uint32_t    reassembled;
+    uint32_t    extended;
+    uint32_t    largest;
+    uint32_t    dropped;
+    uint32_t    ring_high_water;
+    uint32_t    ring_full;
+    uint32_t    overflows;
+    uint32_t    residency_last_us;
+    uint32_t    residency_max_us;
+    uint64_t    residency_total_us;
+}
+uci_rx_stats_t;
+
+typedef struct
+{
+    uint32_t    count;
+    uint32_t    last_us;
+    uint32_t    max_us;
+    uint64_t    total_us;
+    uint32_t    gaps;
+    uint32_t    gap_max_us;
+    uint64_t    gap_total_us;
+    uint32_t    sets;
+    uint32_t    set_failed;
+    uint32_t    set_commands;
+    uint32_t    set_last_us;
+    uint32_t    set_max_us;
+    uint64_t    set_total_us;
+    uint32_t    data;
+    uint32_t    data_failed;
+    uint64_t    data_bytes;
+    uint32_t    wtx;            // ntfs
+    uint32_t    wtx_stray;      // with no command waiting
+    uint32_t    wtx_commands;   // answered after at least one
+    uint32_t    wtx_max;        // most for one command
+    uint32_t    wtx_exhausted;  // command ran out of them
+}
+uci_tx_stats_t;
+
+// a queued command, the caller's bytes are sent as they are so they
+// have to stay put until the set is done
+//
+typedef struct
+{
+    const uint8_t  *data;
+    int             len;
+    bool            last;       // ends a set
+    uci_set_done_t  done;       // (on the last one)
+    void           *context;
+}
+uci_cmd_t;
+
+// a read message in the rx ring, when it went in and, for the
+// response that finishes a command set, the set's done to call as
+// it is handed up
+//
+typedef struct
+{
+    uci_buf_t      *buf;
+    uint32_t        queued;
+    bool            setend;
+    uci_set_done_t  done;
+    void           *context;
+    int             status;
+    int             answered;
+}
+uci_rx_slot_t;
+
+BUILD_ASSERT((UCI_RX_RING_SIZE & (UCI_RX_RING_SIZE - 1)) == 0, "rx ring size has to be a power of 2");
+
+// header to payload gap, outside of mUCI so it survives re-init
+//
+static uint32_t mUCItxGapUs = UCI_TX_PHASE_GAP_US;
+
+// read burst limit (1 is a message per sync cycle) and wait
+//
+static int      mUCIrxBurstMax = UCI_RX_BURST_DEFAULT;
+static uint32_t mUCIrxBurstWaitUs = UCI_RX_BURST_WAIT_US;
+
+// response time for each command, learned.  Outside of mUCI so a cold
+// boot doesn't forget them
+//
+typedef struct
+{
+    bool        used;
+    uint8_t     gid;
+    uint8_t     oid;
+    uint32_t    samples;
+    uint32_t    last_us;
+    uint32_t    max_us;
+    uint32_t    srtt_us;        // smoothed rtt
+    uint32_t    rttvar_us;      // and its mean deviation
+    uint32_t    rto_ms;         // timeout to use, backed off after a timeout
+    uint32_t    timeouts;
+    uint32_t    retries;        // resent after a timeout or resend request
+    uint32_t    used_at;        // lookup count when last used, the least recent is replaced
+}
+uci_rtt_t;
+
+static uci_rtt_t mUCIrtt[NRFSPI_MAX_DEVICES][UCI_RTT_ENTRIES];
+static uint32_t mUCIrttUses[NRFSPI_MAX_DEVICES];
+
+static uint32_t mUCIrtoMinMs = UCI_RTO_MIN_MS;
+static uint32_t mUCIrtoMaxMs = UCI_RTO_MAX_MS;
+
+struct uci
 {
+    int     unit;
+    nrfspi_t *spi;
+
     enum {
         UCI_IDLE,
         UCI_BOOT,
         UCI_INIT,
+        UCI_PARKED,
+        UCI_WAKE,
         UCI_READY,
         UCI_TX,
         UCI_RX
@@ -46,20 +253,153 @@ static struct
 
     bool    spi_inited;
 
+    // firmware is being downloaded by the slice, with the unit lock
+    // dropped. A re-init or de-init meanwhile clears it
+    //
+    bool    booting;
+
+    // a transfer the reader had fail, returned by the next slice
+    //
+    int     reader_ret;
+
+    // spi transfers are async, this tracks which phase of a
+    // command or message read is on the bus
+    //
+    enum {
+        UCI_XFER_IDLE,
+        UCI_XFER_TX_HDR,
+        UCI_XFER_TX_GAP,
+        UCI_XFER_TX_PAYLOAD,
+        UCI_XFER_RX_HDR,
+        UCI_XFER_RX_PAYLOAD
+    }
+    xfer;
+
+    volatile bool xfer_done;
+    int      xfer_result;
+    uint32_t xfer_stamp;
+
+    uint32_t wake_start;
+
+    int      tx_sent;
+    int      tx_chunk;
+    uint32_t tx_start;
+
+    uci_tx_stats_t tx_stats;
+    uci_rx_stats_t rx_stats;
+
     uint64_t cmd_start;
+    uint32_t cmd_rto_ms;
     uint32_t timeout_count;
 
+    // command in flight was sent more than once, so its response can't
+    // be timed (karn), it could be to any of them
+    //
+    bool     tx_retried;
+
+    // wait time extensions the uwbs sent for the command in flight
+    //
+    uint32_t cmd_wtx;
+
+    // largest packet payload to the uwbs, from its caps
+    //
     int     max_packet;
-    uint8_t txbuf[UCI_MSG_HDR_SIZE + UCI_MAX_PAYLOAD_SIZE];
+    uci_caps_t caps;
+
+    // command being sent is the header here and the payload where
+    // txpayload points, either the callers buffer or txbuf
+    //
+    uint8_t txhdr[UCI_MSG_HDR_SIZE];
+    const uint8_t *txpayload;
+    uint8_t txbuf[UCI_MAX_PAYLOAD_SIZE];
     int     txcnt;
-    uint8_t rxbuf[UCI_MAX_PAYLOAD_SIZE];
+
+    // a data packet waiting for the bus, it goes in txhdr/txpayload
+    // like a command once no command is outstanding, and tx_data is
+    // set while it's there.  Nothing answers it, it's done when sent
+    //
+    uint8_t datahdr[UCI_MSG_HDR_SIZE];
+    const uint8_t *datapayload;
+    int     datacnt;
+    bool    tx_data;
+    uci_data_done_t datadone;
+    void   *datacontext;
+
+    // queued command sets. The head command is the one on the bus or
+    // waiting for its response, the next goes out as soon as that is
+    // read. The response that finishes a set carries the set's done in
+    // its rx slot, it's called when that's handed up and setheld keeps
+    // the next set waiting until then
+    //
+    uci_cmd_t cmdq[UCI_CMD_QUEUE_DEPTH];
+    int     cmdhead;
+    int     cmdqueued;
+    int     setanswered;
+    uint32_t set_start;
+    atomic_t setheld;
+
+    // messages are read into pool buffers (rxread while on the bus),
+    // put in the rx ring until handed up and then rxcur is the one the
+    // caller is looking at, until the next call.  The reader only
+    // moves rxput and the caller only rxget (free running), so a slot
+    // is never looked at by both and the ring needs no lock
+    //
+    uci_rx_slot_t rxring[UCI_RX_RING_SIZE];
+    atomic_t rxput;
+    atomic_t rxget;
+    uci_buf_t *rxread;
+    uci_buf_t *rxcur;
+    int     rxburst;
     int     rxcnt;
+
+    // a message coming in PBF segments is put together in rxasm (a
+    // large buffer), each segment's header is read into rxread as
+    // usual and its payload goes on the end of rxasm. rxskip drops
+    // the rest of one that couldn't be taken
+    //
+    uci_buf_t *rxasm;
+    int     rxseglen;
+    bool    rxskip;
+};
+
+// one per uwbs, same unit numbers as nrfspi
+//
+static uci_t mUCI[NRFSPI_MAX_DEVICES];
+
+// Everything in a uci but its rx ring belongs to whoever holds its
+// lock, the reader or the caller.  These live outside mUCI since a
+// uci is wiped on init
+//
+static struct k_mutex mUCIlock[NRFSPI_MAX_DEVICES];
+
+// header to payload gap of a split command, the payload goes from
+// the reader when it's up
+//
+static struct k_timer mUCIgapTimer[NRFSPI_MAX_DEVICES];
+
+static struct k_sem mUCIreaderSem;
+static struct k_thread mUCIreaderThread;
+static K_THREAD_STACK_DEFINE(mUCIreaderStack, UCI_READER_STACK_SIZE);
+static bool mUCIreaderStarted;
+
+static void _UCIlock(uci_t *uci)
+{
+    k_mutex_lock(&mUCIlock[uci - mUCI], K_FOREVER);
+}
+
+// whatever the caller did (a command, a wake, taking a set's last
+// answer) usually leaves the reader something to do
+//
+static void _UCIunlock(uci_t *uci)
+{
+    k_mutex_unlock(&mUCIlock[uci - mUCI]);
+    k_sem_give(&mUCIreaderSem);
 }
-mUCI;
 
 #if DUMP_PROTO
 #if DUMP_PROTO_DECODE
 static void _uci_dump(
+                uci_t *uci,
                 const char *inBlurb,
                 uint8_t inType,
                 uint8_t inGID,
@@ -73,10 +413,12 @@ static void _uci_dump(
     const char *oidstr = "????";
     const char *devstatstr = "";
 
-    switch (mUCI.state)
+    switch (uci->state)
     {
     case UCI_BOOT:      statestr = "BOOT"; break;
     case UCI_INIT:      statestr = "INIT"; break;
+    case UCI_PARKED:    statestr = "PARKED"; break;
+    case UCI_WAKE:      statestr = "WAKE"; break;
     case UCI_READY:     statestr = "READY"; break;
     case UCI_TX:        statestr = "TX"; break;
     case UCI_RX:        statestr = "RX"; break;
@@ -181,470 +523,2590 @@ exit:
 #endif
 #endif
 
-static void uci_decode(
-                uint8_t inType,
-                uint8_t inGID,
-                uint8_t inOID,
-                uint8_t *inData,
-                const int inCount)
+// The uwbs says it's up, but a command still waiting for its response
+// keeps waiting (and timing out) for it
+//
+static void _UCIdeviceReady(uci_t *uci)
 {
-    switch (inType)
+    if (uci->txcnt == 0)
+    {
+        uci->state = UCI_READY;
+    }
+}
+
+static void _UCIntfDeviceStatus(uci_t *uci, const uint8_t *inData, const int inCount)
+{
+    if (inCount < 1)
+    {
+        return;
+    }
+
+    switch (inData[0])
     {
-    case UCI_MT_DATA:
+    case 0:
+        // NXP proprietary use of device status 0 as
+        // "init, ready to get a proprietary init sequence"
+        //
+        LOG_INF("UWB Device Status Init, Booting");
+        _UCIdeviceReady(uci);
         break;
-    case UCI_MT_NTF:
-        switch (inGID)
-        {
-        case UCI_GID_CORE:
-            switch (inOID)
-            {
-            case UCI_MSG_CORE_DEVICE_RESET:
-                break;
-            case UCI_MSG_CORE_DEVICE_STATUS_NTF:
-                if (inCount > 0)
-                {
-                    if (inData[0] == 0)
-                    {
-                        // NXP proprietary use of device status 0 as
-                        // "init, ready to get a proprietary init sequence"
-                        //
-                        LOG_INF("UWB Device Status Init, Booting");
-                        mUCI.state = UCI_READY;
-                    }
-                    else if (inData[0] == 1)
-                    {
-                        LOG_INF("UWB Device Ready");
-                        mUCI.state = UCI_READY;
-                    }
-                    else if (inData[0] == 2)
-                    {
-                        LOG_INF("UWB Device Active");
-                        mUCI.state = UCI_READY;
-                    }
-                    else if (inData[0] == 0xFE || inData[0] == 0xFF)
-                    {
-                        LOG_INF("UWB Device Error/Hang, resetting");
-                        // TODO - toggle power?
-                        mUCI.state = UCI_BOOT;
-                    }
-                }
-                break;
-            case UCI_MSG_CORE_GENERIC_ERROR_NTF:
-                if (inCount > 0 && inData[0] == 0xA)
-                {
-                    LOG_WRN("Resend request in state %d", mUCI.state);
-                    // repeat last command
-                    mUCI.state = UCI_TX;
-                }
-                break;
-            default:
-                break;
-            }
-            break;
-        default:
-            break;
-        }
+    case 1:
+        LOG_INF("UWB Device Ready");
+        _UCIdeviceReady(uci);
         break;
-    case UCI_MT_CMD:
+    case 2:
+        LOG_INF("UWB Device Active");
+        _UCIdeviceReady(uci);
         break;
-    case UCI_MT_RSP:
-        mUCI.state = mUCI.nextstate;
-        mUCI.timeout_count = 0;
-        mUCI.txcnt = 0;
+    case 0xFE:
+    case 0xFF:
+        LOG_INF("UWB Device Error/Hang, resetting");
+        // TODO - toggle power?
+        uci->state = UCI_BOOT;
         break;
     default:
         break;
     }
 }
 
-static int _UCItxCommand(void)
+static void _UCIntfGenericError(uci_t *uci, const uint8_t *inData, const int inCount)
 {
-    int ret = -EINVAL;
-    int chunk;
-    int total;
-    int remain;
-    uint8_t *header;
-    uint8_t *payload;
+    if (inCount > 0 && inData[0] == 0xA)
+    {
+        LOG_WRN("Resend request in state %d", uci->state);
+        // repeat last command
+        uci->state = UCI_TX;
+    }
+}
 
-    // make sure reply is countable
-    mUCI.rxcnt = 0;
+// What uci itself does with a message, looked up by type, then gid,
+// then oid.  Responses aren't here, they're matched to their command
+// as they're read (_UCIcmdResponse)
+//
+#define UCI_MT_COUNT    (4)
 
-    header = mUCI.txbuf;
-    payload = mUCI.txbuf + UCI_MSG_HDR_SIZE;
-    total = 0;
-    remain = mUCI.txcnt - UCI_MSG_HDR_SIZE;
+typedef void (*uci_decode_t)(uci_t *uci, const uint8_t *inData, const int inCount);
 
-    require(remain >= 0, exit);
+static const uci_decode_t mUCIcoreNtf[UCI_OID_COUNT] =
+{
+    [UCI_MSG_CORE_DEVICE_STATUS_NTF]    = _UCIntfDeviceStatus,
+    [UCI_MSG_CORE_GENERIC_ERROR_NTF]    = _UCIntfGenericError,
+};
 
-    // set response timeout time stamp
-    mUCI.cmd_start = k_uptime_get();
+static const uci_decode_t * const mUCIntfGroups[UCI_GID_COUNT] =
+{
+    [UCI_GID_CORE] = mUCIcoreNtf,
+};
 
-    // wait for reply (with timeout) in rx state and
-    // go back to idle when uwbs responds
-    //
-    mUCI.state = UCI_RX;
-    mUCI.nextstate = UCI_READY;
+static const uci_decode_t * const * const mUCIdecode[UCI_MT_COUNT] =
+{
+    [UCI_MT_NTF] = mUCIntfGroups,
+};
 
-#if DUMP_PROTO
-#if DUMP_DECODE_PROTO
-    uint8_t mt;
-    uint8_t gid;
-    uint8_t oid;
+// notification subscribers, chained per gid/oid in the order they
+// subscribed.  Heads are 1 + the index of the first, 0 for none
+//
+typedef struct
+{
+    uci_t               *uci;       // NULL for every unit
+    uci_ntf_handler_t   handler;    // NULL when the slot is free
+    void                *context;
+    uint8_t             next;
+    uint8_t             gid;
+    uint8_t             oid;
+}
+uci_sub_t;
 
-    mt  = (header[0] & UCI_MT_MASK) >> UCI_MT_SHIFT;
-    gid = (header[0] & UCI_GID_MASK) >> UCI_GID_SHIFT;
-    oid = (header[1] & UCI_OID_MASK) >> UCI_OID_SHIFT;
+static uci_sub_t mUCIsubs[UCI_MAX_SUBSCRIBERS];
+static uint8_t   mUCIsubHead[UCI_GID_COUNT][UCI_OID_COUNT];
+static uint8_t   mUCIsubData[UCI_DPF_COUNT];
 
-    _uci_dump("TX->", mt, gid, oid, payload, remain);
-#else
-    _uci_dump_raw(mUCI.txbuf, mUCI.txcnt, dump_buf, sizeof(dump_buf));
-    LOG_PRINTK("NXPUCIX => %s\n", dump_buf);
-#endif
-#endif
-    do
-    {
-        chunk = remain - total;
+static void _UCIdispatch(
+                uci_t *uci,
+                uint8_t inType,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *inData,
+                const int inCount)
+{
+    const uci_decode_t * const *groups;
+    const uci_decode_t *oids;
+    uci_sub_t *sub;
+    int next;
 
-        header[0] &= ~UCI_PBF_MASK;
+    inGID &= UCI_GID_MASK;
+    inOID &= UCI_OID_MASK;
 
-        if (chunk > mUCI.max_packet)
-        {
-            chunk = mUCI.max_packet;
-            header[0] |= UCI_PBF_MASK;
-        }
+    groups = (inType < UCI_MT_COUNT) ? mUCIdecode[inType] : NULL;
+    oids = groups ? groups[inGID] : NULL;
+    if (oids && oids[inOID])
+    {
+        oids[inOID](uci, inData, inCount);
+    }
 
-        header[3] = chunk;
+    if (inType == UCI_MT_NTF)
+    {
+        next = mUCIsubHead[inGID][inOID];
+    }
+    else if (inType == UCI_MT_DATA)
+    {
+        // gid is the data packet format, there's no oid
+        next = mUCIsubData[inGID];
+        inOID = 0;
+    }
+    else
+    {
+        return;
+    }
 
-        // xfer header
-        ret = NRFSPIwrite(header, 4);
-        require_noerr(ret, exit);
+    // a handler can unsubscribe itself, so get the next one first
+    //
+    while (next)
+    {
+        sub = &mUCIsubs[next - 1];
+        next = sub->next;
 
-        if (chunk)
+        if (!sub->uci || sub->uci == uci)
         {
-            k_sleep(K_USEC(80));
-
-            // xfer chunk
-            ret = NRFSPIwrite(payload, chunk);
-
-            total += chunk;
-            payload += chunk;
+            uci->rx_stats.dispatched++;
+            sub->handler(uci, inGID, inOID, inData, inCount, sub->context);
         }
     }
-    while (!ret && (total < remain));
-exit:
-    return ret;
 }
 
-int UCIprotoRead(
-                uint8_t *outType,
-                uint8_t *outGID,
-                uint8_t *outOID,
-                uint8_t *outData,
-                int inSize,
-                int *outCount)
-{
-    int ret = -1;
-    uint8_t header[4];
-    int payload_length;
-    uint8_t frag;
-    uint8_t type;
-    uint8_t gid;
-    uint8_t oid;
-
-    require(outType && outGID && outOID && outCount, exit);
-    require(outData, exit);
-    require(inSize > 0, exit);
-
-    // set sync line active
-    ret = NRFSPIstartSync();
+static void _uci_xfer_callback(int inResult, void *inContext)
+{
+    uci_t *uci = (uci_t *)inContext;
 
-    // read header
-    ret = NRFSPIread(header, sizeof(header));
-    require_noerr(ret, exit);
+    // spi isr context, just note completion and wake the reader
+    //
+    uci->xfer_result = inResult;
+    uci->xfer_stamp = k_cycle_get_32();
+    uci->xfer_done = true;
+    k_sem_give(&mUCIreaderSem);
+}
 
-    type = (header[0] & UCI_MT_MASK) >> UCI_MT_SHIFT;
-    *outType = type;
+// gap after a header is up, timer isr context.  Completes the gap
+// phase like a transfer would
+//
+static void _uci_gap_expiry(struct k_timer *timer)
+{
+    uci_t *uci = &mUCI[timer - mUCIgapTimer];
 
-    gid = (header[0] & UCI_GID_MASK) >> UCI_GID_SHIFT;
-    *outGID = gid;
+    uci->xfer_result = 0;
+    uci->xfer_done = true;
+    k_sem_give(&mUCIreaderSem);
+}
 
-    oid = (header[1] & UCI_OID_MASK) >> UCI_OID_SHIFT;
-    *outOID = oid;
+// irq isr, the uwbs has something for us
+//
+static void _uci_request_callback(void *inContext)
+{
+    k_sem_give(&mUCIreaderSem);
+}
 
-    *outCount = 0;
+static int _UCIxferStart(
+                uci_t *uci,
+                int inPhase,
+                const uint8_t *inTxData,
+                uint8_t *outRxData,
+                const int inCount)
+{
+    int ret;
 
-    frag = header[0] & UCI_PBF_MASK;
-    payload_length = header[3];
+    uci->xfer = inPhase;
+    uci->xfer_done = false;
 
-    if (header[1] & 0x80)
+    if (outRxData)
     {
-        // extended payload - length
-        LOG_ERR("Ext payload");
+        ret = NRFSPIreadAsync(uci->spi, outRxData, inCount, _uci_xfer_callback, uci);
     }
-
-    require(payload_length <= inSize, exit);
-
-    if (payload_length > 0)
+    else
     {
-        // read payload
-        ret = NRFSPIread(outData, payload_length);
-        require_noerr(ret, exit);
+        ret = NRFSPIwriteAsync(uci->spi, inTxData, inCount, _uci_xfer_callback, uci);
     }
 
-    *outCount = payload_length;
-
-#if DUMP_PROTO
-#if DUMP_DECODE_PROTO
-    _uci_dump("<-RX", type, gid, oid, mUCI.rxbuf, count);
-#else
-    int dl = snprintf(dump_buf, sizeof(dump_buf), "%02X %02X %02X %02X ",
-                header[0], header[1], header[2], header[3]);
-    if (payload_length)
+    if (ret)
     {
-        _uci_dump_raw(outData, payload_length, dump_buf + dl, sizeof(dump_buf) - dl);
+        uci->xfer = UCI_XFER_IDLE;
     }
-    LOG_PRINTK("NXPUCIR <= %s\n", dump_buf);
-#endif
-#endif
-exit:
-    // set sync line inactive
-    ret = NRFSPIstopSync();
+
     return ret;
 }
 
-int UCIprotoWriteRaw(
-                const uint8_t *inData,
-                const int inCount)
+static int _UCIxferStartv(
+                uci_t *uci,
+                int inPhase,
+                const nrfspi_iovec_t *inVec,
+                const int inVecCount)
 {
-    int ret = -EINVAL;
+    int ret;
 
-    require(mUCI.state == UCI_READY, exit);
-    require(inData, exit);
-    require(inCount >= UCI_MSG_HDR_SIZE, exit);
-    require(inCount <= sizeof(mUCI.txbuf), exit);
+    uci->xfer = inPhase;
+    uci->xfer_done = false;
 
-    memcpy(mUCI.txbuf, inData, inCount);
-    mUCI.txcnt = inCount;
+    ret = NRFSPIwritevAsync(uci->spi, inVec, inVecCount, _uci_xfer_callback, uci);
+    if (ret)
+    {
+        uci->xfer = UCI_XFER_IDLE;
+    }
 
-    ret = _UCItxCommand();
-exit:
     return ret;
 }
 
-int UCIprotoWrite(
-                const uint8_t inType,
-                const uint8_t inGID,
-                const uint8_t inOID,
-                const uint8_t *inData,
-                const int inCount)
+// The data packet on the bus is sent, or never will be.  Its done is
+// called last, it can write the next one
+//
+static void _UCIdataDone(uci_t *uci, int inResult)
 {
-    int ret = -EINVAL;
-    uint8_t *header;
-    uint8_t *payload;
+    uci_data_done_t done = uci->datadone;
+    void *context = uci->datacontext;
 
-    if (inCount)
+    if (inResult)
     {
-        require(inData, exit);
+        uci->tx_stats.data_failed++;
     }
     else
     {
-        require(inData == NULL, exit);
+        uci->tx_stats.data++;
+        uci->tx_stats.data_bytes += uci->txcnt - UCI_MSG_HDR_SIZE;
     }
 
-    require((inCount + UCI_MSG_HDR_SIZE) < sizeof(mUCI.txbuf), exit);
-
-    header  = mUCI.txbuf;
-    payload = mUCI.txbuf + UCI_MSG_HDR_SIZE;
+    if (uci->tx_data)
+    {
+        uci->tx_data = false;
+        uci->txcnt = 0;
+    }
+    uci->datacnt = 0;
+    uci->datadone = NULL;
+    uci->datacontext = NULL;
 
-    header[0] = (inType << UCI_MT_SHIFT) | ((inGID << UCI_GID_SHIFT) & UCI_GID_MASK);
-    header[1] = (inOID << UCI_OID_SHIFT) & UCI_OID_MASK;
-    header[2] = 0; // RFU
-    header[3] = inCount & 0xff; // will be filled out in txCommand
+    if (done)
+    {
+        done(uci, inResult, context);
+    }
+}
 
-    if (inCount)
+// A data packet still waiting, or on the bus, isn't going anywhere now
+//
+static void _UCIdataFlush(uci_t *uci)
+{
+    if (uci->tx_data || uci->datacnt)
     {
-        memcpy(payload, inData, inCount);
+        _UCIdataDone(uci, -ECANCELED);
     }
+}
 
-    mUCI.txcnt = UCI_MSG_HDR_SIZE + inCount;
+static void _UCItxDone(uci_t *uci)
+{
+    uci_tx_stats_t *stats = &uci->tx_stats;
+    uint32_t elapsed;
 
-    ret = _UCItxCommand();
-exit:
-    return ret;
-}
+    uci->xfer = UCI_XFER_IDLE;
 
-int UCIprotoSlice(
-                bool *outHaveMessage,
-                uint8_t *outType,
-                uint8_t *outGID,
-                uint8_t *outOID,
-                uint8_t **outPayload,
-                int *outPayloadLength,
-                uint32_t *delay)
+    elapsed = k_cyc_to_us_floor32(k_cycle_get_32() - uci->tx_start);
+
+    if (uci->tx_data)
+    {
+        // a data packet isn't answered, it's done once it's sent
+        _UCIdataDone(uci, 0);
+        return;
+    }
+
+    stats->count++;
+    stats->last_us = elapsed;
+    stats->total_us += elapsed;
+    if (elapsed > stats->max_us)
+    {
+        stats->max_us = elapsed;
+    }
+}
+
+static int _UCItxFragment(uci_t *uci)
 {
-    int ret = -EINVAL;
-    bool readable;
-    uint64_t now;
+    int remain;
+    uint8_t *header;
+    nrfspi_iovec_t vec[2];
 
-    require(outHaveMessage && outType && outGID && outOID, exit);
-    require(outPayload && outPayloadLength && delay, exit);
+    header = uci->txhdr;
+    remain = uci->txcnt - UCI_MSG_HDR_SIZE;
 
-    *outHaveMessage = false;
-    *outType = 0xFF;
-    *outGID = 0;
-    *outOID = 0;
-    *outPayload = NULL;
-    *outPayloadLength = 0;
+    uci->tx_chunk = remain - uci->tx_sent;
 
-    if (mUCI.state != UCI_BOOT && mUCI.state != UCI_TX)
+    if (uci->tx_data)
     {
-        ret = NRFSPIpoll(&readable);
-        require_noerr(ret, exit);
+        // the caller segments data, so it's one packet with the PBF it
+        // was given, and its length is always 16 bits little endian
+        //
+        header[1] = 0;
+        header[2] = uci->tx_chunk & 0xFF;
+        header[3] = uci->tx_chunk >> 8;
+    }
+    else
+    {
+        header[0] &= ~UCI_PBF_MASK;
+        header[1] &= ~UCI_EXT_MASK;
 
-        if (readable)
+        if (uci->tx_chunk > uci->max_packet)
         {
-            int count;
-            uint8_t type;
-            uint8_t gid;
-            uint8_t oid;
+            uci->tx_chunk = uci->max_packet;
+            header[0] |= UCI_PBF_MASK;
+        }
 
-            ret = UCIprotoRead(&type, &gid, &oid, mUCI.rxbuf, sizeof(mUCI.rxbuf), &count);
-            if (!ret)
-            {
-                mUCI.timeout_count = 0;
-                mUCI.rxcnt = count;
-
-                // advance our state depending upon response/notification
-                //
-                uci_decode(type, gid, oid, mUCI.rxbuf, count);
-
-                *outHaveMessage = true;
-                *outType = type;
-                *outGID = gid;
-                *outOID = oid;
-                *outPayload = mUCI.rxbuf;
-                *outPayloadLength = mUCI.rxcnt;
-
-                // dont ever look at this reply again
-                mUCI.rxcnt = 0;
-                ret = 0;
-            }
+        if (uci->tx_chunk > UCI_MAX_PAYLOAD_SIZE)
+        {
+            // only when the uwbs said it takes them
+            header[1] |= UCI_EXT_MASK;
+            header[2] = uci->tx_chunk >> 8;
         }
+        else
+        {
+            header[2] = 0;
+        }
+        header[3] = uci->tx_chunk & 0xFF;
     }
 
-    switch (mUCI.state)
+    if (mUCItxGapUs == 0 && uci->tx_chunk)
     {
-    case UCI_IDLE:
-        LOG_WRN("why call slice in idle state?");
-        break;
-
-    case UCI_BOOT:
-        // (re)setup the SPI interface
-        ret = NRFSPIinit();
-        require_noerr(ret, exit);
-
-        // allow later use of spi.  once its been inited once
-        // its usable for the rest of up-time
+        // no gap needed, so header and payload go in one transaction
         //
-        mUCI.spi_inited = true;
+        vec[0].data = header;
+        vec[0].count = UCI_MSG_HDR_SIZE;
+        vec[1].data = uci->txpayload + uci->tx_sent;
+        vec[1].count = uci->tx_chunk;
 
-        // load f/w
-        ret = HBCIprotoInit();
-        require_noerr(ret, exit);
+        return _UCIxferStartv(uci, UCI_XFER_TX_PAYLOAD, vec, 2);
+    }
 
-        // when the f/w load is complete, device will
-        // post status ready which moves us to from init state
-        //
-        mUCI.state = UCI_INIT;
-        mUCI.timeout_count = 0;
-        break;
+    // xfer header, payload follows when that completes
+    return _UCIxferStart(uci, UCI_XFER_TX_HDR, header, NULL, UCI_MSG_HDR_SIZE);
+}
 
-    case UCI_INIT:
-        // getting status in uci proto gets us to ready
-        ret = 0;
-        break;
+static uci_rtt_t *_UCIrtt(uci_t *uci, uint8_t inGID, uint8_t inOID, bool inAdd)
+{
+    uci_rtt_t *table = mUCIrtt[uci->unit];
+    uci_rtt_t *least = NULL;
+    int i;
 
-    case UCI_READY:
-        ret = 0;
-        break;
+    inGID &= UCI_GID_MASK;
+    inOID &= UCI_OID_MASK;
 
-    case UCI_TX: /* retransmit */
-        if (mUCI.txcnt > 0)
-        {
-            ret = _UCItxCommand();
-        }
-        else
+    for (i = 0; i < UCI_RTT_ENTRIES; i++)
+    {
+        if (table[i].used && table[i].gid == inGID && table[i].oid == inOID)
         {
-            LOG_ERR("No command to re-transmit?");
-            mUCI.state = UCI_READY;
+            table[i].used_at = ++mUCIrttUses[uci->unit];
+            return &table[i];
         }
-        *delay = 10;
-        break;
 
-    case UCI_RX:
-        now = k_uptime_get();
-        if ((now - mUCI.cmd_start) > UCI_RESP_TIMEOUT_MS)
+        // a free one, else the one used longest ago (a command sent
+        // often early on, like at boot, is not kept over ones in use)
+        //
+        if (
+                !least
+            ||  !table[i].used
+            ||  (least->used && (int32_t)(table[i].used_at - least->used_at) < 0)
+        )
         {
-            mUCI.timeout_count++;
-            if (mUCI.timeout_count > UCI_MAX_TIMEOUTS)
-            {
-                LOG_WRN("Too many timeouts, resetting");
-                mUCI.timeout_count = 0;
-                mUCI.state = UCI_BOOT;
-            }
-            else if (mUCI.txcnt)
-            {
-                LOG_WRN("Resp timeout, retry command");
-                mUCI.state = UCI_TX;
-            }
-            else
-            {
-                LOG_ERR("Why Rx if no Tx?");
-                mUCI.state = UCI_BOOT;
-            }
+            least = &table[i];
         }
-        break;
+    }
+    if (!inAdd)
+    {
+        return NULL;
+    }
 
-    default:
-        break;
+    memset(least, 0, sizeof(*least));
+    least->used_at = ++mUCIrttUses[uci->unit];
+    least->used = true;
+    least->gid = inGID;
+    least->oid = inOID;
+    least->rto_ms = UCI_RESP_TIMEOUT_MS;
+    return least;
+}
+
+static uint32_t _UCIrtoClamp(uint32_t inMs)
+{
+    if (inMs < mUCIrtoMinMs)
+    {
+        inMs = mUCIrtoMinMs;
+    }
+    if (inMs > mUCIrtoMaxMs)
+    {
+        inMs = mUCIrtoMaxMs;
+    }
+    return inMs;
+}
+
+// response to a command sent once, rfc 6298 with the gains as shifts
+//
+static void _UCIrttSample(uci_t *uci, uint32_t inUs)
+{
+    uci_rtt_t *rtt = _UCIrtt(uci, uci->txhdr[0], uci->txhdr[1], true);
+    uint32_t delta;
+
+    if (!rtt->samples)
+    {
+        rtt->srtt_us = inUs;
+        rtt->rttvar_us = inUs / 2;
+    }
+    else
+    {
+        delta = (inUs > rtt->srtt_us) ? (inUs - rtt->srtt_us) : (rtt->srtt_us - inUs);
+        rtt->rttvar_us = rtt->rttvar_us - (rtt->rttvar_us >> 2) + (delta >> 2);
+        rtt->srtt_us = rtt->srtt_us - (rtt->srtt_us >> 3) + (inUs >> 3);
+    }
+    rtt->samples++;
+    rtt->last_us = inUs;
+    if (inUs > rtt->max_us)
+    {
+        rtt->max_us = inUs;
+    }
+
+    rtt->rto_ms = _UCIrtoClamp((rtt->srtt_us + 4 * rtt->rttvar_us + UCI_RTO_SLACK_US + 999) / 1000);
+}
+
+// no answer in time, wait longer for the next try (until the next good
+// sample sets it back)
+//
+static void _UCIrttTimeout(uci_t *uci)
+{
+    uci_rtt_t *rtt = _UCIrtt(uci, uci->txhdr[0], uci->txhdr[1], true);
+
+    rtt->timeouts++;
+    rtt->rto_ms = _UCIrtoClamp(rtt->rto_ms * 2);
+}
+
+static void _UCIrttRetry(uci_t *uci)
+{
+    uci_rtt_t *rtt = _UCIrtt(uci, uci->txhdr[0], uci->txhdr[1], true);
+
+    rtt->retries++;
+    uci->tx_retried = true;
+}
+
+static int _UCItxCommand(uci_t *uci)
+{
+    int ret = -EINVAL;
+    int remain;
+
+    // make sure reply is countable
+    uci->rxcnt = 0;
+
+    remain = uci->txcnt - UCI_MSG_HDR_SIZE;
+
+    require(remain >= 0, exit);
+
+    ret = -EBUSY;
+    require(uci->xfer == UCI_XFER_IDLE, exit);
+
+    // set response timeout time stamp
+    uci->cmd_start = k_uptime_get();
+    uci->cmd_rto_ms = UCIprotoResponseTimeout(uci, uci->txhdr[0], uci->txhdr[1]);
+    uci->cmd_wtx = 0;
+    uci->tx_start = k_cycle_get_32();
+
+    // wait for reply (with timeout) in rx state and
+    // go back to idle when uwbs responds
+    //
+    uci->state = UCI_RX;
+    uci->nextstate = UCI_READY;
+
+#if DUMP_PROTO
+#if DUMP_DECODE_PROTO
+    uint8_t *header = uci->txhdr;
+    uint8_t mt;
+    uint8_t gid;
+    uint8_t oid;
+
+    mt  = (header[0] & UCI_MT_MASK) >> UCI_MT_SHIFT;
+    gid = (header[0] & UCI_GID_MASK) >> UCI_GID_SHIFT;
+    oid = (header[1] & UCI_OID_MASK) >> UCI_OID_SHIFT;
+
+    _uci_dump(uci, "TX->", mt, gid, oid, uci->txpayload, remain);
+#else
+    int dl = snprintf(dump_buf, sizeof(dump_buf), "%02X %02X %02X %02X ",
+                uci->txhdr[0], uci->txhdr[1], uci->txhdr[2], uci->txhdr[3]);
+    if (remain)
+    {
+        _uci_dump_raw(uci->txpayload, remain, dump_buf + dl, sizeof(dump_buf) - dl);
     }
+    LOG_PRINTK("NXPUCIX => %s\n", dump_buf);
+#endif
+#endif
+    UCIcapRecord(uci->unit, UCI_CAP_TX, uci->txhdr, uci->txpayload, remain);
 
+    uci->tx_sent = 0;
+
+    ret = _UCItxFragment(uci);
 exit:
     return ret;
 }
 
-bool UCIready(void)
+static void _UCIcmdPop(uci_t *uci)
+{
+    uci->cmdhead = (uci->cmdhead + 1) % UCI_CMD_QUEUE_DEPTH;
+    uci->cmdqueued--;
+}
+
+static void _UCIcmdFlush(uci_t *uci)
 {
-    return mUCI.state == UCI_READY;
+    uci->cmdhead = 0;
+    uci->cmdqueued = 0;
+    uci->setanswered = 0;
+    atomic_clear(&uci->setheld);
+    uci->txcnt = 0;
 }
 
-int UCIprotoDeInit(void)
+// Send the command at the head of the queue once the one before it
+// is answered and any finished set has been handed up
+//
+static int _UCIcmdNext(uci_t *uci)
 {
-    if (mUCI.spi_inited)
+    uci_cmd_t *cmd;
+
+    if (
+            uci->cmdqueued == 0
+        ||  uci->txcnt
+        ||  atomic_get(&uci->setheld)
+        ||  uci->state != UCI_READY
+        ||  uci->xfer != UCI_XFER_IDLE
+    )
     {
-        NRFSPIstopSync();
-        NRFSPIenableChip(false);
+        return 0;
     }
 
-    mUCI.state = UCI_IDLE;
-    return 0;
+    cmd = &uci->cmdq[uci->cmdhead];
+    if (uci->setanswered == 0)
+    {
+        uci->set_start = k_cycle_get_32();
+    }
+
+    memcpy(uci->txhdr, cmd->data, UCI_MSG_HDR_SIZE);
+    uci->txpayload = cmd->data + UCI_MSG_HDR_SIZE;
+    uci->txcnt = cmd->len;
+
+    return _UCItxCommand(uci);
 }
 
-int UCIprotoInit(void)
+// Send the waiting data packet when the bus is free and no command is
+// waiting for its response.  Queued commands go first
+//
+static int _UCIdataNext(uci_t *uci)
 {
-    int ret = 0;
+    int ret;
+
+    if (
+            uci->datacnt == 0
+        ||  uci->txcnt
+        ||  uci->state != UCI_READY
+        ||  uci->xfer != UCI_XFER_IDLE
+    )
+    {
+        return 0;
+    }
 
-    // NOTE: this can/should be callable
-    // per-session, not just once
+    memcpy(uci->txhdr, uci->datahdr, UCI_MSG_HDR_SIZE);
+    uci->txpayload = uci->datapayload;
+    uci->txcnt = uci->datacnt;
+    uci->datacnt = 0;
+    uci->tx_data = true;
+    uci->tx_sent = 0;
+    uci->tx_start = k_cycle_get_32();
 
-    memset(&mUCI, 0, sizeof(mUCI));
+    UCIcapRecord(uci->unit, UCI_CAP_TX, uci->txhdr, uci->txpayload, uci->txcnt - UCI_MSG_HDR_SIZE);
 
-    mUCI.state = UCI_BOOT;
-    mUCI.nextstate = UCI_INIT;
-    mUCI.timeout_count = 0;
-    mUCI.max_packet = UCI_MAX_PAYLOAD_SIZE;
-    mUCI.rxcnt = 0;
-    mUCI.txcnt = 0;
+    ret = _UCItxFragment(uci);
+    if (ret)
+    {
+        _UCIdataDone(uci, ret);
+    }
     return ret;
 }
 
+// Caps info response is status, tlv count and the tlvs, values little
+// endian.  The nxp ones are tagged EXTENDED_CAP_INFO_ID then their id
+//
+static void _UCIcapsParse(uci_t *uci, const uint8_t *inData, const int inCount)
+{
+    uci_caps_t *caps = &uci->caps;
+    const uint8_t *p = inData + 2;
+    const uint8_t *end = inData + inCount;
+    bool ext;
+    uint8_t id;
+    uint8_t len;
+    int tlvs;
+
+    tlvs = inData[1];
+
+    while (tlvs-- > 0 && (p + 2) <= end)
+    {
+        ext = (*p == EXTENDED_CAP_INFO_ID);
+        if (ext)
+        {
+            p++;
+            if ((p + 2) > end)
+            {
+                break;
+            }
+        }
+        id  = *p++;
+        len = *p++;
+        if ((p + len) > end)
+        {
+            LOG_WRN("Caps tlv %02X runs off the end", id);
+            break;
+        }
+
+        if (ext)
+        {
+            switch (id)
+            {
+            case UCI_EXT_PARAM_ID_UWBS_MAX_UCI_PAYLOAD_LENGTH:
+                if (len >= UCI_EXT_PARAM_ID_UWBS_MAX_UCI_PAYLOAD_LENGTH_LEN)
+                {
+                    caps->uwbs_max_payload = p[0] | (p[1] << 8);
+                }
+                break;
+            case UCI_EXT_PARAM_ID_UWBS_INBAND_DATA_BUFFER_BLOCK_SIZE:
+                if (len >= UCI_EXT_PARAM_ID_INBAND_DATA_BUFFER_BLOCK_SIZE_LEN)
+                {
+                    caps->data_block_size = p[0];
+                }
+                break;
+            case UCI_EXT_PARAM_ID_UWBS_INBAND_DATA_MAX_BLOCKS:
+                if (len >= UCI_EXT_PARAM_ID_INBAND_DATA_MAX_BLOCKS_LEN)
+                {
+                    caps->data_max_blocks = p[0];
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        p += len;
+    }
+
+    caps->valid = true;
+
+    uci->max_packet = UCI_MAX_PAYLOAD_SIZE;
+    if (caps->uwbs_max_payload)
+    {
+        uci->max_packet = (caps->uwbs_max_payload < UCI_MAX_DATA_PACKET_SIZE) ?
+                                caps->uwbs_max_payload : UCI_MAX_DATA_PACKET_SIZE;
+    }
+
+    LOG_INF("Unit %d uwbs takes %u byte packets (sending %d), data %u x %u byte blocks",
+                uci->unit, caps->uwbs_max_payload, uci->max_packet,
+                caps->data_max_blocks, caps->data_block_size);
+}
+
+// Keep what the core responses say about the uwbs, the rest of them
+// are only the callers business
+//
+static void _UCIcapsResponse(uci_t *uci, uci_buf_t *inBuf)
+{
+    if (
+            ((inBuf->hdr[0] & UCI_GID_MASK) >> UCI_GID_SHIFT) != UCI_GID_CORE
+        ||  inBuf->len < 1
+        ||  inBuf->data[0] != UCI_STATUS_OK
+    )
+    {
+        return;
+    }
+
+    switch ((inBuf->hdr[1] & UCI_OID_MASK) >> UCI_OID_SHIFT)
+    {
+    case UCI_MSG_CORE_DEVICE_RESET:
+        // uwbs is back to its defaults, 255 byte packets to us
+        uci->caps.host_max_payload = 0;
+        break;
+    case UCI_MSG_CORE_DEVICE_INFO:
+        if (inBuf->len >= 5)
+        {
+            uci->caps.uci_version = (inBuf->data[1] << 8) | inBuf->data[2];
+            uci->caps.mac_version = (inBuf->data[3] << 8) | inBuf->data[4];
+        }
+        break;
+    case UCI_MSG_CORE_GET_CAPS_INFO:
+        if (inBuf->len >= 2)
+        {
+            _UCIcapsParse(uci, inBuf->data, inBuf->len);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// A response was read, match it to the command that's waiting for one
+// and move the queue along. A failed command drops the rest of its set
+// and the response that ends a set gets the set's done in its slot
+//
+static void _UCIcmdResponse(uci_t *uci, uci_buf_t *inBuf, uci_rx_slot_t *ioSlot)
+{
+    uci_tx_stats_t *stats = &uci->tx_stats;
+    uci_cmd_t cmd;
+    uint32_t elapsed;
+    uint8_t status;
+
+    if (
+            uci->txcnt == 0
+        ||  ((inBuf->hdr[0] ^ uci->txhdr[0]) & UCI_GID_MASK)
+        ||  ((inBuf->hdr[1] ^ uci->txhdr[1]) & UCI_OID_MASK)
+    )
+    {
+        LOG_WRN("Response %02X %02X doesn't match command %02X %02X",
+                    inBuf->hdr[0], inBuf->hdr[1], uci->txhdr[0], uci->txhdr[1]);
+        return;
+    }
+
+    // a command the uwbs asked for more time on is one of its slow
+    // ones, timing it would only push the usual timeout out
+    //
+    if (uci->cmd_wtx)
+    {
+        stats->wtx_commands++;
+    }
+    else if (!uci->tx_retried)
+    {
+        _UCIrttSample(uci, k_cyc_to_us_floor32(k_cycle_get_32() - uci->tx_start));
+    }
+    uci->tx_retried = false;
+    uci->cmd_wtx = 0;
+
+    uci->state = uci->nextstate;
+    uci->timeout_count = 0;
+    uci->txcnt = 0;
+
+    _UCIcapsResponse(uci, inBuf);
+
+    if (uci->cmdqueued == 0)
+    {
+        // a single UCIprotoWrite
+        return;
+    }
+
+    status = inBuf->len ? inBuf->data[0] : UCI_STATUS_OK;
+
+    cmd = uci->cmdq[uci->cmdhead];
+    _UCIcmdPop(uci);
+    uci->setanswered++;
+    stats->set_commands++;
+
+    if (status != UCI_STATUS_OK)
+    {
+        LOG_WRN("Status %02X for command %d of set, dropping the rest", status, uci->setanswered);
+        stats->set_failed++;
+
+        while (!cmd.last && uci->cmdqueued)
+        {
+            cmd = uci->cmdq[uci->cmdhead];
+            _UCIcmdPop(uci);
+        }
+    }
+    else if (!cmd.last)
+    {
+        return;
+    }
+
+    elapsed = k_cyc_to_us_floor32(k_cycle_get_32() - uci->set_start);
+    stats->sets++;
+    stats->set_last_us = elapsed;
+    stats->set_total_us += elapsed;
+    if (elapsed > stats->set_max_us)
+    {
+        stats->set_max_us = elapsed;
+    }
+
+    ioSlot->setend = true;
+    ioSlot->done = cmd.done;
+    ioSlot->context = cmd.context;
+    ioSlot->status = status;
+    ioSlot->answered = uci->setanswered;
+
+    uci->setanswered = 0;
+    atomic_set(&uci->setheld, 1);
+}
+
+// The uwbs is still working on the command, its response wait starts
+// over.  Done as the ntf is read so a busy main loop can't time the
+// command out with the wtx sitting in the ring
+//
+static void _UCIwtx(uci_t *uci)
+{
+    uci_tx_stats_t *stats = &uci->tx_stats;
+
+    stats->wtx++;
+
+    if (uci->state != UCI_RX || uci->txcnt == 0)
+    {
+        stats->wtx_stray++;
+        return;
+    }
+
+    if (uci->cmd_wtx >= UCI_WTX_MAX)
+    {
+        if (uci->cmd_wtx++ == UCI_WTX_MAX)
+        {
+            LOG_WRN("WTX %u for %02X %02X, not waiting any longer", uci->cmd_wtx,
+                        uci->txhdr[0], uci->txhdr[1]);
+            stats->wtx_exhausted++;
+        }
+        return;
+    }
+
+    uci->cmd_wtx++;
+    uci->cmd_start = k_uptime_get();
+    uci->timeout_count = 0;
+
+    if (uci->cmd_wtx > stats->wtx_max)
+    {
+        stats->wtx_max = uci->cmd_wtx;
+    }
+}
+
+static bool _UCIisWtx(const uint8_t *inHdr)
+{
+#ifdef UCI_WTX_NTF_OID
+    return (inHdr[0] & UCI_MT_MASK) == UCI_MTS_NTF
+        && (inHdr[0] & UCI_GID_MASK) == UCI_GID_PROPRIETARY
+        && (inHdr[1] & UCI_OID_MASK) == UCI_WTX_NTF_OID;
+#else
+    return false;
+#endif
+}
+
+static int _UCIrxDepth(uci_t *uci)
+{
+    return (int)((uint32_t)atomic_get(&uci->rxput) - (uint32_t)atomic_get(&uci->rxget));
+}
+
+static bool _UCIrxRoom(uci_t *uci)
+{
+    return _UCIrxDepth(uci) < UCI_RX_RING_SIZE;
+}
+
+static int _UCIrxRead(uci_t *uci, uci_buf_t *inBuf)
+{
+    int ret;
+
+    uci->rxread = inBuf;
+    inBuf->stamp = NRFSPIrxRequestTime(uci->spi);
+
+    // read header, payload follows when that completes
+    ret = _UCIxferStart(uci, UCI_XFER_RX_HDR, NULL, inBuf->hdr, sizeof(inBuf->hdr));
+    if (ret)
+    {
+        UCIbufUnref(inBuf);
+        uci->rxread = NULL;
+    }
+    return ret;
+}
+
+static int _UCIrxStart(uci_t *uci)
+{
+    int ret;
+    uci_buf_t *buf;
+
+    buf = UCIbufAlloc();
+    if (!buf)
+    {
+        // everything is still held up the stack, the uwbs keeps
+        // irq up so try again next slice
+        //
+        return 0;
+    }
+
+    // set sync line active
+    ret = NRFSPIstartSync(uci->spi);
+    if (ret)
+    {
+        // the uwbs never got read-ready, nothing to read
+        UCIbufUnref(buf);
+        NRFSPIstopSync(uci->spi);
+        return ret;
+    }
+
+    uci->rxburst = 0;
+
+    ret = _UCIrxRead(uci, buf);
+    if (ret)
+    {
+        NRFSPIstopSync(uci->spi);
+    }
+
+    return ret;
+}
+
+static void _UCIrxBurstDone(uci_t *uci)
+{
+    uci_rx_stats_t *stats = &uci->rx_stats;
+
+    NRFSPIstopSync(uci->spi);
+    uci->xfer = UCI_XFER_IDLE;
+
+    // a read that didn't make it
+    UCIbufUnref(uci->rxread);
+    uci->rxread = NULL;
+
+    if (uci->rxburst > 0)
+    {
+        stats->bursts++;
+        stats->sizes[uci->rxburst - 1]++;
+    }
+}
+
+// If the uwbs has more, read the next packet in the same sync window
+//
+static int _UCIrxContinue(uci_t *uci)
+{
+    uci_buf_t *next = NULL;
+
+    if (uci->rxburst < mUCIrxBurstMax && _UCIrxRoom(uci))
+    {
+        // only hold sync for more if there is somewhere to put it
+        next = UCIbufAlloc();
+    }
+
+    if (next && NRFSPIcontinueSync(uci->spi, mUCIrxBurstWaitUs) == 0)
+    {
+        return _UCIrxRead(uci, next);
+    }
+
+    UCIbufUnref(next);
+    _UCIrxBurstDone(uci);
+    return 0;
+}
+
+// The message in the read slot is all here, put it in the ring and go
+// on to the next one.  The slot is filled in before rxput moves past
+// it, that's what hands it to the caller
+//
+static int _UCIrxComplete(uci_t *uci)
+{
+    uci_buf_t *buf = uci->rxread;
+
+#if DUMP_PROTO
+#if DUMP_DECODE_PROTO
+    _uci_dump(uci, "<-RX", (buf->hdr[0] & UCI_MT_MASK) >> UCI_MT_SHIFT,
+                (buf->hdr[0] & UCI_GID_MASK) >> UCI_GID_SHIFT,
+                (buf->hdr[1] & UCI_OID_MASK) >> UCI_OID_SHIFT,
+                buf->data, buf->len);
+#else
+    int dl = snprintf(dump_buf, sizeof(dump_buf), "%02X %02X %02X %02X ",
+                buf->hdr[0], buf->hdr[1], buf->hdr[2], buf->hdr[3]);
+    if (buf->len)
+    {
+        _uci_dump_raw(buf->data, buf->len, dump_buf + dl, sizeof(dump_buf) - dl);
+    }
+    LOG_PRINTK("NXPUCIR <= %s\n", dump_buf);
+#endif
+#endif
+    uci_rx_stats_t *stats = &uci->rx_stats;
+    uci_rx_slot_t *slot;
+    uint32_t depth;
+
+    uci->rxread = NULL;
+
+    UCIcapRecord(uci->unit, UCI_CAP_RX, buf->hdr, buf->data, buf->len);
+
+    if (!_UCIrxRoom(uci))
+    {
+        // reads only start with room, so this shouldn't happen
+        LOG_ERR("RX ring full, dropping %02X %02X", buf->hdr[0], buf->hdr[1]);
+        stats->overflows++;
+        UCIbufUnref(buf);
+        _UCIrxBurstDone(uci);
+        return 0;
+    }
+
+    slot = &uci->rxring[(uint32_t)atomic_get(&uci->rxput) & (UCI_RX_RING_SIZE - 1)];
+    memset(slot, 0, sizeof(*slot));
+    slot->buf = buf;
+    slot->queued = k_cycle_get_32();
+    uci->rxburst++;
+
+    if (((buf->hdr[0] & UCI_MT_MASK) >> UCI_MT_SHIFT) == UCI_MT_RSP)
+    {
+        _UCIcmdResponse(uci, buf, slot);
+    }
+    else if (_UCIisWtx(buf->hdr))
+    {
+        _UCIwtx(uci);
+    }
+
+    atomic_inc(&uci->rxput);
+    TimeSignalApplicationEvent();
+
+    depth = _UCIrxDepth(uci);
+    if (depth > stats->ring_high_water)
+    {
+        stats->ring_high_water = depth;
+    }
+
+    return _UCIrxContinue(uci);
+}
+
+// Payload length from a packet header.  With the extended bit set
+// the length is 16 bits, byte 2 is the high byte (how the nxp hal
+// reads large notifications)
+//
+static int _UCIrxPayloadLength(const uint8_t *inHdr)
+{
+    if ((inHdr[0] & UCI_MT_MASK) == UCI_MTS_DAT)
+    {
+        // data packets always have a 16 bit length, little endian
+        return inHdr[2] | (inHdr[3] << 8);
+    }
+    if (inHdr[1] & UCI_EXT_MASK)
+    {
+        return (inHdr[2] << 8) | inHdr[3];
+    }
+    return inHdr[3];
+}
+
+static void _UCIrxAsmDrop(uci_t *uci)
+{
+    UCIbufUnref(uci->rxasm);
+    uci->rxasm = NULL;
+}
+
+// Couldn't take a packet, its payload isn't read and, if more segments
+// of the message follow, those are dropped too
+//
+static int _UCIrxDrop(uci_t *uci, bool inMore)
+{
+    uci->rx_stats.dropped++;
+    uci->rxskip = inMore;
+    _UCIrxAsmDrop(uci);
+    _UCIrxBurstDone(uci);
+    return 0;
+}
+
+// A packet's payload is in.  The last segment of a message finishes
+// it, otherwise go on to the next packet
+//
+static int _UCIrxSegmentDone(uci_t *uci)
+{
+    uci_rx_stats_t *stats = &uci->rx_stats;
+    uci_buf_t *buf = uci->rxread;
+
+    stats->bytes += uci->rxseglen;
+
+    if (!uci->rxasm)
+    {
+        buf->len = uci->rxseglen;
+        return _UCIrxComplete(uci);
+    }
+
+    uci->rxasm->len += uci->rxseglen;
+
+    if (buf->hdr[0] & UCI_PBF_MASK)
+    {
+        // more segments to come, maybe in this sync window
+        UCIbufUnref(buf);
+        uci->rxread = NULL;
+        return _UCIrxContinue(uci);
+    }
+
+    // whole message, it replaces the header only read slot
+    //
+    UCIbufUnref(buf);
+    uci->rxread = uci->rxasm;
+    uci->rxasm = NULL;
+    uci->rxread->hdr[0] &= ~UCI_PBF_MASK;
+
+    stats->reassembled++;
+    if (uci->rxread->len > stats->largest)
+    {
+        stats->largest = uci->rxread->len;
+    }
+    return _UCIrxComplete(uci);
+}
+
+// A packet header is in, work out where its payload goes.  A message
+// that fits a packet is read into the read slot.  One that doesn't,
+// PBF segments or extended length, goes into a large buffer and the
+// segments are streamed onto its end as they come, even across sync
+// windows.  Only whole messages are queued
+//
+static int _UCIrxSegment(uci_t *uci)
+{
+    uci_rx_stats_t *stats = &uci->rx_stats;
+    uci_buf_t *buf = uci->rxread;
+    uci_buf_t *dest;
+    bool more;
+    int len;
+
+    more = (buf->hdr[0] & UCI_PBF_MASK) != 0;
+    len = _UCIrxPayloadLength(buf->hdr);
+
+    if (uci->rxskip)
+    {
+        // rest of a message already dropped
+        uci->rxskip = more;
+        _UCIrxBurstDone(uci);
+        return 0;
+    }
+
+    if (
+            uci->rxasm
+        &&  (
+                ((uci->rxasm->hdr[0] ^ buf->hdr[0]) & (UCI_MT_MASK | UCI_GID_MASK))
+            ||  ((uci->rxasm->hdr[1] ^ buf->hdr[1]) & UCI_OID_MASK)
+        )
+    )
+    {
+        LOG_ERR("Segment %02X %02X doesn't continue %02X %02X, dropping that",
+                    buf->hdr[0], buf->hdr[1], uci->rxasm->hdr[0], uci->rxasm->hdr[1]);
+        stats->dropped++;
+        _UCIrxAsmDrop(uci);
+    }
+
+    if ((buf->hdr[0] & UCI_MT_MASK) != UCI_MTS_DAT && (buf->hdr[1] & UCI_EXT_MASK))
+    {
+        stats->extended++;
+    }
+
+    if (uci->rxasm)
+    {
+        dest = uci->rxasm;
+    }
+    else if (more || len > buf->size)
+    {
+        dest = UCIbufAllocLarge();
+        if (!dest)
+        {
+            LOG_WRN("No large buffer for %02X %02X, dropping it", buf->hdr[0], buf->hdr[1]);
+            return _UCIrxDrop(uci, more);
+        }
+        memcpy(dest->hdr, buf->hdr, sizeof(dest->hdr));
+        dest->stamp = buf->stamp;
+        uci->rxasm = dest;
+    }
+    else
+    {
+        dest = buf;
+    }
+
+    if ((dest->len + len) > dest->size)
+    {
+        LOG_ERR("Message %02X %02X over %u bytes, dropping it", buf->hdr[0], buf->hdr[1], dest->size);
+        return _UCIrxDrop(uci, more);
+    }
+
+    if (uci->rxasm)
+    {
+        stats->segments++;
+    }
+
+    uci->rxseglen = len;
+    if (len > 0)
+    {
+        return _UCIxferStart(uci, UCI_XFER_RX_PAYLOAD, NULL, dest->data + dest->len, len);
+    }
+    return _UCIrxSegmentDone(uci);
+}
+
+// Drop the message the caller was last handed
+//
+static void _UCIrxRelease(uci_t *uci)
+{
+    UCIbufUnref(uci->rxcur);
+    uci->rxcur = NULL;
+}
+
+static void _UCIrxFlush(uci_t *uci)
+{
+    uci_rx_slot_t *slot;
+
+    _UCIrxRelease(uci);
+    _UCIrxAsmDrop(uci);
+    uci->rxskip = false;
+
+    // sets whose last answer is in here never finish
+    //
+    while (_UCIrxDepth(uci))
+    {
+        slot = &uci->rxring[(uint32_t)atomic_get(&uci->rxget) & (UCI_RX_RING_SIZE - 1)];
+        UCIbufUnref(slot->buf);
+        slot->buf = NULL;
+        atomic_inc(&uci->rxget);
+    }
+    atomic_clear(&uci->setheld);
+}
+
+// Hand up the oldest queued message, if any
+//
+static bool _UCIrxDeliver(
+                uci_t *uci,
+                uint8_t *outType,
+                uint8_t *outGID,
+                uint8_t *outOID,
+                uint8_t **outPayload,
+                int *outPayloadLength)
+{
+    uci_rx_stats_t *stats = &uci->rx_stats;
+    uci_rx_slot_t *ring;
+    uci_rx_slot_t slot;
+    uci_buf_t *buf;
+    uint32_t latency;
+    uint32_t now;
+    int i;
+
+    if (_UCIrxDepth(uci) == 0)
+    {
+        return false;
+    }
+
+    // caller owns the buffer now, until its next call, and the slot
+    // goes back to the reader
+    //
+    ring = &uci->rxring[(uint32_t)atomic_get(&uci->rxget) & (UCI_RX_RING_SIZE - 1)];
+    slot = *ring;
+    ring->buf = NULL;
+    atomic_inc(&uci->rxget);
+
+    buf = slot.buf;
+    uci->rxcur = buf;
+
+    // time in the ring, then irq (or continued sync) to here
+    now = k_cycle_get_32();
+    latency = k_cyc_to_us_floor32(now - slot.queued);
+    stats->residency_last_us = latency;
+    stats->residency_total_us += latency;
+    if (latency > stats->residency_max_us)
+    {
+        stats->residency_max_us = latency;
+    }
+
+    latency = k_cyc_to_us_floor32(now - buf->stamp);
+    stats->messages++;
+    stats->latency_last_us = latency;
+    stats->latency_total_us += latency;
+    if (latency > stats->latency_max_us)
+    {
+        stats->latency_max_us = latency;
+    }
+    for (i = 0; i < (UCI_LATENCY_BUCKETS - 1) && latency >= mUCIlatencyBounds[i]; i++)
+    {
+    }
+    stats->latency_hist[i]++;
+
+    *outType = (buf->hdr[0] & UCI_MT_MASK) >> UCI_MT_SHIFT;
+    *outGID  = (buf->hdr[0] & UCI_GID_MASK) >> UCI_GID_SHIFT;
+    *outOID  = (buf->hdr[1] & UCI_OID_MASK) >> UCI_OID_SHIFT;
+
+    uci->timeout_count = 0;
+    uci->rxcnt = buf->len;
+
+    // advance our state depending upon response/notification, and
+    // let anyone subscribed to it see it
+    //
+    _UCIdispatch(uci, *outType, *outGID, *outOID, buf->data, buf->len);
+
+    *outPayload = buf->data;
+    *outPayloadLength = uci->rxcnt;
+
+    if (slot.setend)
+    {
+        // last answer of a set, the next set can go
+        if (slot.done)
+        {
+            slot.done(uci, slot.status, slot.answered, slot.context);
+        }
+        atomic_clear(&uci->setheld);
+    }
+
+    // dont ever look at this reply again
+    uci->rxcnt = 0;
+    return true;
+}
+
+// Advance whatever transfer is on the bus when the last phase
+// of it completes.  Read messages are queued for _UCIrxDeliver
+//
+static int _UCIxferSlice(uci_t *uci)
+{
+    uci_buf_t *buf;
+    int ret = 0;
+    uint32_t elapsed;
+
+    if (!uci->xfer_done)
+    {
+        // still on the bus
+        goto exit;
+    }
+
+    uci->xfer_done = false;
+    ret = uci->xfer_result;
+
+    switch (uci->xfer)
+    {
+    case UCI_XFER_TX_HDR:
+        require_noerr(ret, exit);
+
+        if (!uci->tx_chunk)
+        {
+            _UCItxDone(uci);
+            break;
+        }
+
+        // getting the reader here often takes longer than the gap
+        // anyway, so only wait what's left.  On a timer, the reader
+        // sees to the other units meanwhile
+        //
+        elapsed = k_cyc_to_us_floor32(k_cycle_get_32() - uci->xfer_stamp);
+        if (elapsed < mUCItxGapUs)
+        {
+            uci->xfer = UCI_XFER_TX_GAP;
+            k_timer_start(&mUCIgapTimer[uci - mUCI], K_USEC(mUCItxGapUs - elapsed), K_NO_WAIT);
+            break;
+        }
+        // fall through
+
+    case UCI_XFER_TX_GAP:
+        elapsed = k_cyc_to_us_floor32(k_cycle_get_32() - uci->xfer_stamp);
+
+        uci->tx_stats.gaps++;
+        uci->tx_stats.gap_total_us += elapsed;
+        if (elapsed > uci->tx_stats.gap_max_us)
+        {
+            uci->tx_stats.gap_max_us = elapsed;
+        }
+
+        // xfer chunk
+        ret = _UCIxferStart(uci, UCI_XFER_TX_PAYLOAD, uci->txpayload + uci->tx_sent, NULL, uci->tx_chunk);
+        break;
+
+    case UCI_XFER_TX_PAYLOAD:
+        require_noerr(ret, exit);
+
+        uci->tx_sent += uci->tx_chunk;
+        if (uci->tx_sent < (uci->txcnt - UCI_MSG_HDR_SIZE))
+        {
+            ret = _UCItxFragment(uci);
+        }
+        else
+        {
+            _UCItxDone(uci);
+        }
+        break;
+
+    case UCI_XFER_RX_HDR:
+        require_noerr(ret, exit);
+
+        buf = uci->rxread;
+
+        // a message type that doesn't exist is a garbled header
+        //
+        if (((buf->hdr[0] & UCI_MT_MASK) >> UCI_MT_SHIFT) > UCI_MT_NTF)
+        {
+            LOG_ERR("Bad header %02X %02X", buf->hdr[0], buf->hdr[1]);
+            NRFSPIlinkCheck(uci->spi, false);
+            _UCIrxBurstDone(uci);
+            break;
+        }
+        NRFSPIlinkCheck(uci->spi, true);
+
+        // read payload, or finish the packet if there is none
+        ret = _UCIrxSegment(uci);
+        break;
+
+    case UCI_XFER_RX_PAYLOAD:
+        require_noerr(ret, exit);
+
+        ret = _UCIrxSegmentDone(uci);
+        break;
+
+    default:
+        uci->xfer = UCI_XFER_IDLE;
+        break;
+    }
+
+exit:
+    if (ret && uci->xfer != UCI_XFER_IDLE)
+    {
+        if (uci->xfer == UCI_XFER_RX_HDR || uci->xfer == UCI_XFER_RX_PAYLOAD)
+        {
+            // a segment that didn't make it spoils the whole message
+            _UCIrxAsmDrop(uci);
+            _UCIrxBurstDone(uci);
+        }
+        uci->xfer = UCI_XFER_IDLE;
+    }
+    if (ret && uci->tx_data)
+    {
+        // nothing resends data, its owner gets the error
+        _UCIdataDone(uci, ret);
+    }
+    if (!ret)
+    {
+        // a response just read frees the next queued command to go,
+        // right now rather than when the caller gets to the response
+        //
+        ret = _UCIcmdNext(uci);
+    }
+    if (!ret)
+    {
+        ret = _UCIdataNext(uci);
+    }
+    return ret;
+}
+
+// Move one unit's bus along: finish whatever phase just completed, or
+// start reading when the uwbs has something and the ring has room, or
+// send the next queued command.  True when a phase was finished, there
+// may be more right behind it
+//
+static bool _UCIreaderService(uci_t *uci)
+{
+    bool readable;
+    bool busy = false;
+    int ret = 0;
+
+    if (k_mutex_lock(&mUCIlock[uci - mUCI], K_NO_WAIT))
+    {
+        // the caller has it (booting it, sending), and wakes us after
+        return false;
+    }
+
+    if (!uci->spi_inited || uci->state == UCI_IDLE || uci->state == UCI_BOOT)
+    {
+        goto exit;
+    }
+
+    if (uci->xfer != UCI_XFER_IDLE)
+    {
+        if (uci->xfer_done)
+        {
+            ret = _UCIxferSlice(uci);
+            busy = true;
+        }
+    }
+    else if (!_UCIrxRoom(uci))
+    {
+        // the uwbs keeps irq up until there's room to read it
+        uci->rx_stats.ring_full++;
+    }
+    else if (uci->state != UCI_PARKED && uci->state != UCI_WAKE)
+    {
+        ret = NRFSPIpoll(uci->spi, &readable);
+        if (!ret && readable)
+        {
+            ret = _UCIrxStart(uci);
+        }
+    }
+
+    if (!ret && uci->xfer == UCI_XFER_IDLE)
+    {
+        ret = _UCIcmdNext(uci);
+    }
+    if (!ret && uci->xfer == UCI_XFER_IDLE)
+    {
+        ret = _UCIdataNext(uci);
+    }
+
+    if (ret && !uci->reader_ret)
+    {
+        uci->reader_ret = ret;
+        TimeSignalApplicationEvent();
+    }
+exit:
+    k_mutex_unlock(&mUCIlock[uci - mUCI]);
+    return busy;
+}
+
+static void _UCIreader(void *p1, void *p2, void *p3)
+{
+    bool busy;
+    int unit;
+
+    while (true)
+    {
+        k_sem_take(&mUCIreaderSem, K_MSEC(UCI_READER_POLL_MS));
+
+        do
+        {
+            busy = false;
+            for (unit = 0; unit < UCIprotoCount(); unit++)
+            {
+                if (_UCIreaderService(&mUCI[unit]))
+                {
+                    busy = true;
+                }
+            }
+        }
+        while (busy);
+    }
+}
+
+static void _UCIreaderStart(void)
+{
+    int unit;
+
+    if (mUCIreaderStarted)
+    {
+        return;
+    }
+    mUCIreaderStarted = true;
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        k_mutex_init(&mUCIlock[unit]);
+        k_timer_init(&mUCIgapTimer[unit], _uci_gap_expiry, NULL);
+    }
+    k_sem_init(&mUCIreaderSem, 0, 1);
+
+    k_thread_create(&mUCIreaderThread, mUCIreaderStack, K_THREAD_STACK_SIZEOF(mUCIreaderStack),
+                    _UCIreader, NULL, NULL, NULL, UCI_READER_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&mUCIreaderThread, "ucireader");
+}
+
+int UCIprotoWriteRaw(
+                uci_t *uci,
+                const uint8_t *inData,
+                const int inCount)
+{
+    int ret = -EINVAL;
+
+    require(uci, exit);
+    require(inData, exit);
+    require(inCount >= UCI_MSG_HDR_SIZE, exit);
+    require(inCount <= (UCI_MSG_HDR_SIZE + UCI_MAX_DATA_PACKET_SIZE), exit);
+
+    _UCIlock(uci);
+
+    require(uci->state == UCI_READY, unlock);
+    require(uci->cmdqueued == 0, unlock);
+
+    ret = -EBUSY;
+    require(!uci->tx_data, unlock);
+
+    // payload is sent straight from the callers buffer, only the
+    // header is copied since it gets changed for fragmenting
+    //
+    memcpy(uci->txhdr, inData, UCI_MSG_HDR_SIZE);
+    uci->txpayload = inData + UCI_MSG_HDR_SIZE;
+    uci->txcnt = inCount;
+
+    ret = _UCItxCommand(uci);
+unlock:
+    _UCIunlock(uci);
+exit:
+    return ret;
+}
+
+int UCIprotoWrite(
+                uci_t *uci,
+                const uint8_t inType,
+                const uint8_t inGID,
+                const uint8_t inOID,
+                const uint8_t *inData,
+                const int inCount)
+{
+    int ret = -EINVAL;
+    uint8_t *header;
+    uint8_t *payload;
+
+    if (inCount)
+    {
+        require(inData, exit);
+    }
+    else
+    {
+        require(inData == NULL, exit);
+    }
+
+    require(uci, exit);
+    require(inCount <= sizeof(uci->txbuf), exit);
+
+    _UCIlock(uci);
+
+    require(uci->cmdqueued == 0, unlock);
+
+    ret = -EBUSY;
+    require(!uci->tx_data, unlock);
+
+    header  = uci->txhdr;
+    payload = uci->txbuf;
+
+    header[0] = (inType << UCI_MT_SHIFT) | ((inGID << UCI_GID_SHIFT) & UCI_GID_MASK);
+    header[1] = (inOID << UCI_OID_SHIFT) & UCI_OID_MASK;
+    header[2] = 0; // RFU
+    header[3] = inCount & 0xff; // will be filled out in txCommand
+
+    if (inCount)
+    {
+        memcpy(payload, inData, inCount);
+    }
+
+    uci->txpayload = payload;
+    uci->txcnt = UCI_MSG_HDR_SIZE + inCount;
+
+    ret = _UCItxCommand(uci);
+unlock:
+    _UCIunlock(uci);
+exit:
+    return ret;
+}
+
+int UCIprotoSubmit(
+                uci_t *uci,
+                const uint8_t * const *inCommands,
+                const uint32_t *inSizes,
+                const int inCount,
+                uci_set_done_t inDone,
+                void *inContext)
+{
+    int ret = -EINVAL;
+    uci_cmd_t *cmd;
+    int i;
+
+    require(uci && inCommands && inSizes, exit);
+    require(inCount > 0, exit);
+
+    for (i = 0; i < inCount; i++)
+    {
+        require(inCommands[i], exit);
+        require(inSizes[i] >= UCI_MSG_HDR_SIZE, exit);
+        require(inSizes[i] <= (UCI_MSG_HDR_SIZE + UCI_MAX_DATA_PACKET_SIZE), exit);
+    }
+
+    _UCIlock(uci);
+
+    ret = -EBUSY;
+    require(uci->state == UCI_READY || uci->state == UCI_TX || uci->state == UCI_RX, unlock);
+
+    ret = -ENOMEM;
+    require((uci->cmdqueued + inCount) <= UCI_CMD_QUEUE_DEPTH, unlock);
+
+    for (i = 0; i < inCount; i++)
+    {
+        cmd = &uci->cmdq[(uci->cmdhead + uci->cmdqueued) % UCI_CMD_QUEUE_DEPTH];
+        uci->cmdqueued++;
+
+        cmd->data = inCommands[i];
+        cmd->len = inSizes[i];
+        cmd->last = (i == (inCount - 1));
+        cmd->done = cmd->last ? inDone : NULL;
+        cmd->context = inContext;
+    }
+
+    ret = _UCIcmdNext(uci);
+    if (ret)
+    {
+        // the set is queued now, the rx timeout resends this one
+        LOG_WRN("Set send %d, retried on timeout", ret);
+        ret = 0;
+    }
+unlock:
+    _UCIunlock(uci);
+exit:
+    return ret;
+}
+
+int UCIprotoWriteData(
+                uci_t *uci,
+                uint8_t inDPF,
+                bool inMore,
+                const uint8_t *inPayload,
+                const int inCount,
+                uci_data_done_t inDone,
+                void *inContext)
+{
+    int ret = -EINVAL;
+
+    require(uci && inPayload, exit);
+    require(inDPF < UCI_DPF_COUNT, exit);
+    require(inCount > 0 && inCount <= uci->max_packet, exit);
+
+    _UCIlock(uci);
+
+    ret = -EBUSY;
+    require(uci->state == UCI_READY || uci->state == UCI_TX || uci->state == UCI_RX, unlock);
+    require(uci->datacnt == 0 && !uci->tx_data, unlock);
+
+    // length goes in when it's sent
+    uci->datahdr[0] = (UCI_MT_DATA << UCI_MT_SHIFT) | (inMore ? UCI_PBF_MASK : 0) | inDPF;
+    uci->datahdr[1] = 0;
+    uci->datahdr[2] = 0;
+    uci->datahdr[3] = 0;
+    uci->datapayload = inPayload;
+    uci->datacnt = UCI_MSG_HDR_SIZE + inCount;
+    uci->datadone = inDone;
+    uci->datacontext = inContext;
+
+    ret = _UCIdataNext(uci);
+unlock:
+    _UCIunlock(uci);
+exit:
+    return ret;
+}
+
+void UCIprotoSetTxGap(uint32_t inGapUs)
+{
+    mUCItxGapUs = inGapUs;
+}
+
+int UCIprotoSlice(
+                uci_t *uci,
+                bool *outHaveMessage,
+                uint8_t *outType,
+                uint8_t *outGID,
+                uint8_t *outOID,
+                uint8_t **outPayload,
+                int *outPayloadLength,
+                uint32_t *delay)
+{
+    int ret = -EINVAL;
+    uint64_t now;
+    nrfspi_t *spi;
+
+    require(uci && uci->spi, exit);
+    require(outHaveMessage && outType && outGID && outOID, exit);
+    require(outPayload && outPayloadLength && delay, exit);
+
+    // the unit's bus, the firmware download uses it unlocked
+    spi = uci->spi;
+
+    *outHaveMessage = false;
+    *outType = 0xFF;
+    *outGID = 0;
+    *outOID = 0;
+    *outPayload = NULL;
+    *outPayloadLength = 0;
+
+    // done with whatever was handed up last time
+    _UCIrxRelease(uci);
+
+    // the reader thread does the reading, and moves transfers along,
+    // this is just the state machine and handing up what it read
+    //
+    _UCIlock(uci);
+
+    ret = uci->reader_ret;
+    uci->reader_ret = 0;
+    require_noerr(ret, unlock);
+
+    // hand up the oldest message read, the rest stay in the ring for
+    // UCIprotoNextMessage or the next slice
+    //
+    *outHaveMessage = _UCIrxDeliver(uci, outType, outGID, outOID, outPayload, outPayloadLength);
+
+    switch (uci->state)
+    {
+    case UCI_IDLE:
+        LOG_WRN("why call slice in idle state?");
+        break;
+
+    case UCI_BOOT:
+        // anything still queued is from before the reset, sets
+        // that were waiting never finish
+        _UCIrxFlush(uci);
+        _UCIdataFlush(uci);
+        _UCIcmdFlush(uci);
+        uci->tx_retried = false;
+
+        // (re)setup the SPI interface
+        ret = NRFSPIinit(uci->spi);
+        require_noerr(ret, unlock);
+
+        // allow later use of spi.  once its been inited once
+        // its usable for the rest of up-time
+        //
+        uci->spi_inited = true;
+
+        // load f/w without the lock, it takes a few hundred ms and
+        // other threads only need the lock to see the unit isn't ready.
+        // The reader leaves a unit in boot alone
+        //
+        uci->booting = true;
+        _UCIunlock(uci);
+
+        ret = HBCIprotoInit(spi);
+
+        _UCIlock(uci);
+        if (!uci->booting)
+        {
+            // re-inited or de-inited while loading, that stands
+            ret = 0;
+            goto unlock;
+        }
+        uci->booting = false;
+        require_noerr(ret, unlock);
+
+        // irq wakes the reader thread, not the main loop
+        NRFSPIsetRequestHandler(uci->spi, _uci_request_callback, uci);
+
+        // when the f/w load is complete, device will
+        // post status ready which moves us to from init state
+        //
+        uci->state = UCI_INIT;
+        uci->timeout_count = 0;
+        break;
+
+    case UCI_INIT:
+        // getting status in uci proto gets us to ready
+        ret = 0;
+        break;
+
+    case UCI_PARKED:
+        ret = 0;
+        break;
+
+    case UCI_WAKE:
+        ret = 0;
+        if (k_cyc_to_us_floor32(k_cycle_get_32() - uci->wake_start) >= UCI_DPD_WAKE_US)
+        {
+            NRFSPIstopSync(uci->spi);
+            uci->state = UCI_READY;
+        }
+        else
+        {
+            *delay = 1;
+        }
+        break;
+
+    case UCI_READY:
+        ret = _UCIcmdNext(uci);
+        if (!ret)
+        {
+            ret = _UCIdataNext(uci);
+        }
+        break;
+
+    case UCI_TX: /* retransmit */
+        if (uci->xfer != UCI_XFER_IDLE)
+        {
+            // let the bus finish first
+            ret = 0;
+        }
+        else if (uci->txcnt > 0)
+        {
+            _UCIrttRetry(uci);
+            ret = _UCItxCommand(uci);
+        }
+        else
+        {
+            LOG_ERR("No command to re-transmit?");
+            uci->state = UCI_READY;
+        }
+        *delay = 10;
+        break;
+
+    case UCI_RX:
+        now = k_uptime_get();
+        if ((now - uci->cmd_start) > uci->cmd_rto_ms)
+        {
+            if (uci->txcnt)
+            {
+                _UCIrttTimeout(uci);
+            }
+            uci->timeout_count++;
+            if (uci->timeout_count > UCI_MAX_TIMEOUTS)
+            {
+                LOG_WRN("Too many timeouts, resetting");
+                uci->timeout_count = 0;
+                uci->state = UCI_BOOT;
+            }
+            else if (uci->txcnt)
+            {
+                LOG_WRN("Resp timeout, retry command");
+                uci->state = UCI_TX;
+            }
+            else
+            {
+                LOG_ERR("Why Rx if no Tx?");
+                uci->state = UCI_BOOT;
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+unlock:
+    _UCIunlock(uci);
+
+    // a clock the reader thread dropped to on link errors
+    NRFSPIsaveClock(spi);
+exit:
+    return ret;
+}
+
+bool UCIprotoNextMessage(
+                uci_t *uci,
+                uint8_t *outType,
+                uint8_t *outGID,
+                uint8_t *outOID,
+                uint8_t **outPayload,
+                int *outPayloadLength)
+{
+    bool have;
+
+    if (!uci || !outType || !outGID || !outOID || !outPayload || !outPayloadLength)
+    {
+        return false;
+    }
+
+    _UCIrxRelease(uci);
+
+    // a reset (or retransmit) asked for by an earlier message in the
+    // batch has to happen before anything after it is looked at
+    //
+    if (uci->state == UCI_BOOT || uci->state == UCI_TX)
+    {
+        return false;
+    }
+
+    _UCIlock(uci);
+    have = _UCIrxDeliver(uci, outType, outGID, outOID, outPayload, outPayloadLength);
+    _UCIunlock(uci);
+    return have;
+}
+
+static int _UCIsubscribe(
+                uint8_t *inHead,
+                uci_t *uci,
+                uint8_t inGID,
+                uint8_t inOID,
+                uci_ntf_handler_t inHandler,
+                void *inContext)
+{
+    uci_sub_t *sub;
+    uint8_t *link;
+    int ret = -EINVAL;
+    int i;
+
+    require(inHandler, exit);
+
+    // end of the chain, checking it isn't there already on the way
+    //
+    ret = -EALREADY;
+    for (link = inHead; *link; link = &sub->next)
+    {
+        sub = &mUCIsubs[*link - 1];
+        require(sub->handler != inHandler || sub->context != inContext || sub->uci != uci, exit);
+    }
+
+    ret = -ENOMEM;
+    for (i = 0; i < UCI_MAX_SUBSCRIBERS; i++)
+    {
+        if (!mUCIsubs[i].handler)
+        {
+            break;
+        }
+    }
+    require(i < UCI_MAX_SUBSCRIBERS, exit);
+
+    sub = &mUCIsubs[i];
+    sub->uci = uci;
+    sub->handler = inHandler;
+    sub->context = inContext;
+    sub->gid = inGID;
+    sub->oid = inOID;
+    sub->next = 0;
+    *link = i + 1;
+    ret = 0;
+exit:
+    return ret;
+}
+
+static int _UCIunsubscribe(
+                uint8_t *inHead,
+                uci_t *uci,
+                uci_ntf_handler_t inHandler,
+                void *inContext)
+{
+    uci_sub_t *sub;
+    uint8_t *link;
+
+    for (link = inHead; *link; link = &sub->next)
+    {
+        sub = &mUCIsubs[*link - 1];
+        if (sub->handler == inHandler && sub->context == inContext && sub->uci == uci)
+        {
+            *link = sub->next;
+            memset(sub, 0, sizeof(*sub));
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+int UCIprotoSubscribe(
+                uci_t *uci,
+                uint8_t inGID,
+                uint8_t inOID,
+                uci_ntf_handler_t inHandler,
+                void *inContext)
+{
+    if (inGID >= UCI_GID_COUNT || inOID >= UCI_OID_COUNT)
+    {
+        return -EINVAL;
+    }
+    return _UCIsubscribe(&mUCIsubHead[inGID][inOID], uci, inGID, inOID, inHandler, inContext);
+}
+
+int UCIprotoUnsubscribe(
+                uci_t *uci,
+                uint8_t inGID,
+                uint8_t inOID,
+                uci_ntf_handler_t inHandler,
+                void *inContext)
+{
+    if (inGID >= UCI_GID_COUNT || inOID >= UCI_OID_COUNT)
+    {
+        return -EINVAL;
+    }
+    return _UCIunsubscribe(&mUCIsubHead[inGID][inOID], uci, inHandler, inContext);
+}
+
+// data subscribers are kept with oid 0xFF, so "uci subs" can tell
+//
+int UCIprotoSubscribeData(
+                uci_t *uci,
+                uint8_t inDPF,
+                uci_ntf_handler_t inHandler,
+                void *inContext)
+{
+    if (inDPF >= UCI_DPF_COUNT)
+    {
+        return -EINVAL;
+    }
+    return _UCIsubscribe(&mUCIsubData[inDPF], uci, inDPF, 0xFF, inHandler, inContext);
+}
+
+int UCIprotoUnsubscribeData(
+                uci_t *uci,
+                uint8_t inDPF,
+                uci_ntf_handler_t inHandler,
+                void *inContext)
+{
+    if (inDPF >= UCI_DPF_COUNT)
+    {
+        return -EINVAL;
+    }
+    return _UCIunsubscribe(&mUCIsubData[inDPF], uci, inHandler, inContext);
+}
+
+uint32_t UCIprotoResponseTimeout(uci_t *uci, uint8_t inGID, uint8_t inOID)
+{
+    uci_rtt_t *rtt = _UCIrtt(uci, inGID, inOID, false);
+
+    return rtt ? rtt->rto_ms : _UCIrtoClamp(UCI_RESP_TIMEOUT_MS);
+}
+
+uint32_t UCIprotoResponseDue(uci_t *uci)
+{
+    int64_t waited;
+
+    if (uci->state != UCI_RX)
+    {
+        return 0;
+    }
+
+    waited = k_uptime_get() - uci->cmd_start;
+    if (waited >= uci->cmd_rto_ms)
+    {
+        return 1;
+    }
+    return uci->cmd_rto_ms - (uint32_t)waited;
+}
+
+void UCIprotoSetResponseTimeouts(uint32_t inMinMs, uint32_t inMaxMs)
+{
+    if (inMinMs < 1)
+    {
+        inMinMs = 1;
+    }
+    if (inMaxMs < inMinMs)
+    {
+        inMaxMs = inMinMs;
+    }
+    mUCIrtoMinMs = inMinMs;
+    mUCIrtoMaxMs = inMaxMs;
+}
+
+int UCIprotoPending(uci_t *uci)
+{
+    return _UCIrxDepth(uci);
+}
+
+void UCIprotoSetRxBurst(int inMaxMessages, uint32_t inWaitUs)
+{
+    if (inMaxMessages < 1)
+    {
+        inMaxMessages = 1;
+    }
+    if (inMaxMessages > UCI_RX_BURST_MAX)
+    {
+        inMaxMessages = UCI_RX_BURST_MAX;
+    }
+
+    mUCIrxBurstMax = inMaxMessages;
+    mUCIrxBurstWaitUs = inWaitUs;
+}
+
+bool UCIready(uci_t *uci)
+{
+    return uci->state == UCI_READY && uci->xfer == UCI_XFER_IDLE;
+}
+
+int UCIprotoPark(uci_t *uci)
+{
+    int ret = -EINVAL;
+
+    require(uci && uci->spi_inited, exit);
+
+    _UCIlock(uci);
+
+    ret = -EBUSY;
+    require(uci->state == UCI_READY && uci->xfer == UCI_XFER_IDLE, unlock);
+
+    // firmware stays loaded and ce stays up, the uwbs goes into
+    // dpd by itself when nothing is talking to it
+    //
+    NRFSPIstopSync(uci->spi);
+    _UCIrxFlush(uci);
+    _UCIdataFlush(uci);
+    _UCIcmdFlush(uci);
+    uci->state = UCI_PARKED;
+    ret = 0;
+unlock:
+    _UCIunlock(uci);
+exit:
+    return ret;
+}
+
+int UCIprotoWake(uci_t *uci)
+{
+    int ret = -EINVAL;
+
+    require(uci, exit);
+
+    _UCIlock(uci);
+
+    require(uci->state == UCI_PARKED, unlock);
+
+    ret = NRFSPIstartSync(uci->spi);
+    require_noerr(ret, unlock);
+
+    uci->wake_start = k_cycle_get_32();
+    uci->timeout_count = 0;
+    uci->state = UCI_WAKE;
+unlock:
+    _UCIunlock(uci);
+exit:
+    return ret;
+}
+
+bool UCIprotoParked(uci_t *uci)
+{
+    return uci && uci->state == UCI_PARKED;
+}
+
+const uci_caps_t *UCIprotoCaps(uci_t *uci)
+{
+    return &uci->caps;
+}
+
+uint16_t UCIprotoHostMaxPayload(uci_t *uci)
+{
+    // a uwbs that takes no more than 255 itself doesn't do extended
+    // length packets
+    //
+    if (uci->caps.uwbs_max_payload <= UCI_MAX_PAYLOAD_SIZE)
+    {
+        return UCI_MAX_PAYLOAD_SIZE;
+    }
+    return UCI_BUF_LARGE_SIZE;
+}
+
+void UCIprotoSetHostMaxPayload(uci_t *uci, uint16_t inMaxPayload)
+{
+    uci->caps.host_max_payload = inMaxPayload;
+}
+
+int UCIprotoMaxPacket(uci_t *uci)
+{
+    return uci->max_packet;
+}
+
+int UCIprotoDeInit(uci_t *uci)
+{
+    _UCIlock(uci);
+
+    if (uci->spi_inited)
+    {
+        NRFSPIstopSync(uci->spi);
+        NRFSPIenableChip(uci->spi, false);
+    }
+
+    k_timer_stop(&mUCIgapTimer[uci - mUCI]);
+    uci->xfer = UCI_XFER_IDLE;
+    uci->state = UCI_IDLE;
+    uci->booting = false;
+    _UCIrxFlush(uci);
+    _UCIdataFlush(uci);
+    _UCIcmdFlush(uci);
+    UCIbufUnref(uci->rxread);
+    uci->rxread = NULL;
+
+    _UCIunlock(uci);
+    return 0;
+}
+
+int UCIprotoUnit(uci_t *uci)
+{
+    return uci->unit;
+}
+
+int UCIprotoCount(void)
+{
+    return NRFSPIcount();
+}
+
+uci_t *UCIprotoGet(int inUnit)
+{
+    if (inUnit < 0 || inUnit >= NRFSPI_MAX_DEVICES)
+    {
+        return NULL;
+    }
+
+    // every user of a unit gets it here first
+    _UCIreaderStart();
+    return &mUCI[inUnit];
+}
+
+int UCIprotoInit(uci_t *uci)
+{
+    int ret = -EINVAL;
+    int unit;
+
+    // NOTE: this can/should be callable
+    // per-session, not just once
+
+    require(uci, exit);
+    unit = uci - mUCI;
+
+    _UCIlock(uci);
+
+    // give back any buffers from last time, and a data packet's owner
+    // its buffer
+    _UCIrxFlush(uci);
+    UCIbufUnref(uci->rxread);
+    _UCIdataFlush(uci);
+    k_timer_stop(&mUCIgapTimer[unit]);
+
+    memset(uci, 0, sizeof(*uci));
+
+    uci->unit = unit;
+    uci->spi = NRFSPIget(unit);
+    require(uci->spi, unlock);
+
+    uci->state = UCI_BOOT;
+    uci->nextstate = UCI_INIT;
+    uci->timeout_count = 0;
+    uci->max_packet = UCI_MAX_PAYLOAD_SIZE;
+    uci->rxcnt = 0;
+    uci->txcnt = 0;
+    uci->xfer = UCI_XFER_IDLE;
+    ret = 0;
+unlock:
+    _UCIunlock(uci);
+exit:
+    return ret;
+}
+
+#ifdef CONFIG_SHELL
+
+#include <zephyr/shell/shell.h>
+
+static int _CmdUciStats( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_t *uci;
+    uci_tx_stats_t *stats;
+    uci_rx_stats_t *rstats;
+    int unit = 0;
+    int i;
+
+    if (argc > 1)
+    {
+        unit = strtoul(*++argv, NULL, 0);
+    }
+    uci = UCIprotoGet(unit);
+    if (!uci || unit >= UCIprotoCount())
+    {
+        shell_error(shell, "No unit %d, have %d", unit, UCIprotoCount());
+        return -EINVAL;
+    }
+    stats = &uci->tx_stats;
+    rstats = &uci->rx_stats;
+
+    shell_print(shell, "Unit %d of %d", unit, UCIprotoCount());
+    shell_print(shell, "TX gap=%uus (%s)", mUCItxGapUs,
+                mUCItxGapUs ? "split header/payload" : "single transaction");
+    shell_print(shell, "TX commands=%u  last=%uus max=%uus avg=%uus  total=%lluus",
+                stats->count, stats->last_us, stats->max_us,
+                stats->count ? (uint32_t)(stats->total_us / stats->count) : 0,
+                stats->total_us);
+    shell_print(shell, "TX gaps=%u  max=%uus avg=%uus",
+                stats->gaps, stats->gap_max_us,
+                stats->gaps ? (uint32_t)(stats->gap_total_us / stats->gaps) : 0);
+    shell_print(shell, "TX sets=%u (failed %u) of %u commands  last=%uus max=%uus avg=%uus  queued=%d",
+                stats->sets, stats->set_failed, stats->set_commands,
+                stats->set_last_us, stats->set_max_us,
+                stats->sets ? (uint32_t)(stats->set_total_us / stats->sets) : 0,
+                uci->cmdqueued);
+    shell_print(shell, "TX wtx=%u (stray %u)  commands extended=%u max=%u exhausted=%u  in flight=%u",
+                stats->wtx, stats->wtx_stray, stats->wtx_commands, stats->wtx_max,
+                stats->wtx_exhausted, uci->cmd_wtx);
+    shell_print(shell, "TX data packets=%u (failed %u)  bytes=%llu  waiting=%s",
+                stats->data, stats->data_failed, stats->data_bytes,
+                uci->datacnt ? "yes" : "no");
+
+    shell_print(shell, "RX burst max=%d wait=%uus  bursts=%u messages=%u (%u per burst)",
+                mUCIrxBurstMax, mUCIrxBurstWaitUs, rstats->bursts, rstats->messages,
+                rstats->bursts ? rstats->messages / rstats->bursts : 0);
+    for (i = 0; i < UCI_RX_BURST_MAX; i++)
+    {
+        shell_print(shell, "  %d message burst: %u", i + 1, rstats->sizes[i]);
+    }
+    shell_print(shell, "RX irq to handed up  last=%uus max=%uus avg=%uus",
+                rstats->latency_last_us, rstats->latency_max_us,
+                rstats->messages ? (uint32_t)(rstats->latency_total_us / rstats->messages) : 0);
+    shell_print(shell, "RX ring %d deep  high water=%u full=%u overflows=%u  queued=%d",
+                UCI_RX_RING_SIZE, rstats->ring_high_water, rstats->ring_full,
+                rstats->overflows, _UCIrxDepth(uci));
+    shell_print(shell, "RX time in ring  last=%uus max=%uus avg=%uus",
+                rstats->residency_last_us, rstats->residency_max_us,
+                rstats->messages ? (uint32_t)(rstats->residency_total_us / rstats->messages) : 0);
+    shell_print(shell, "RX dispatched to subscribers=%u", rstats->dispatched);
+    shell_print(shell, "RX bytes=%llu  segments=%u reassembled=%u extended=%u largest=%u  dropped=%u",
+                rstats->bytes, rstats->segments, rstats->reassembled, rstats->extended,
+                rstats->largest, rstats->dropped);
+    return 0;
+}
+
+static int _CmdUciCaps( const struct shell *shell, size_t argc, char **argv )
+{
+    const uci_caps_t *caps;
+    uci_t *uci;
+    int unit;
+
+    for (unit = 0; unit < UCIprotoCount(); unit++)
+    {
+        uci = &mUCI[unit];
+        caps = &uci->caps;
+
+        if (!caps->valid)
+        {
+            shell_print(shell, "Unit %d  no caps yet, 255 byte packets", unit);
+            continue;
+        }
+        shell_print(shell, "Unit %d  uci %X.%02X mac %X.%02X", unit,
+                    caps->uci_version >> 8, caps->uci_version & 0xFF,
+                    caps->mac_version >> 8, caps->mac_version & 0xFF);
+        shell_print(shell, "  uwbs max payload=%u (sending %d)  host max payload=%u",
+                    caps->uwbs_max_payload, uci->max_packet,
+                    caps->host_max_payload ? caps->host_max_payload : UCI_MAX_PAYLOAD_SIZE);
+        shell_print(shell, "  in-band data %u blocks of %u bytes",
+                    caps->data_max_blocks, caps->data_block_size);
+    }
+    return 0;
+}
+
+static int _CmdUciLatency( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_rx_stats_t *rstats;
+    uint32_t sum = 0;
+    int unit = 0;
+    int i;
+
+    if (argc > 1)
+    {
+        unit = strtoul(*++argv, NULL, 0);
+    }
+    if (unit < 0 || unit >= NRFSPI_MAX_DEVICES)
+    {
+        shell_error(shell, "No unit %d", unit);
+        return -EINVAL;
+    }
+    rstats = &mUCI[unit].rx_stats;
+
+    // irq edge (stamped in the isr) to the message handed up
+    shell_print(shell, "Unit %d irq to delivered, %u messages", unit, rstats->messages);
+    if (!rstats->messages)
+    {
+        return 0;
+    }
+    for (i = 0; i < UCI_LATENCY_BUCKETS; i++)
+    {
+        sum += rstats->latency_hist[i];
+        if (i < (UCI_LATENCY_BUCKETS - 1))
+        {
+            shell_print(shell, "  < %6uus  %8u  %3u%%", mUCIlatencyBounds[i],
+                        rstats->latency_hist[i], (uint32_t)((uint64_t)sum * 100 / rstats->messages));
+        }
+        else
+        {
+            shell_print(shell, "  >=%6uus  %8u  %3u%%", mUCIlatencyBounds[i - 1],
+                        rstats->latency_hist[i], (uint32_t)((uint64_t)sum * 100 / rstats->messages));
+        }
+    }
+    return 0;
+}
+
+static int _CmdUciRtt( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_rtt_t *rtt;
+    int unit = 0;
+    int i;
+
+    if (argc > 1)
+    {
+        unit = strtoul(*++argv, NULL, 0);
+    }
+    if (unit < 0 || unit >= NRFSPI_MAX_DEVICES)
+    {
+        shell_error(shell, "No unit %d", unit);
+        return -EINVAL;
+    }
+
+    shell_print(shell, "Unit %d response timeouts %u..%ums (%ums until learned)", unit,
+                mUCIrtoMinMs, mUCIrtoMaxMs, _UCIrtoClamp(UCI_RESP_TIMEOUT_MS));
+    shell_print(shell, "  gid/oid  samples   last_us    max_us   srtt_us rttvar_us  rto_ms  timeouts retries");
+
+    for (i = 0; i < UCI_RTT_ENTRIES; i++)
+    {
+        rtt = &mUCIrtt[unit][i];
+        if (!rtt->used)
+        {
+            continue;
+        }
+        shell_print(shell, "  %X/%02X   %8u  %8u  %8u  %8u  %8u  %6u  %8u %7u",
+                    rtt->gid, rtt->oid, rtt->samples, rtt->last_us, rtt->max_us,
+                    rtt->srtt_us, rtt->rttvar_us, rtt->rto_ms, rtt->timeouts, rtt->retries);
+    }
+    return 0;
+}
+
+static int _CmdUciRto( const struct shell *shell, size_t argc, char **argv )
+{
+    uint32_t min = strtoul(*++argv, NULL, 0);
+    uint32_t max = strtoul(*++argv, NULL, 0);
+
+    UCIprotoSetResponseTimeouts(min, max);
+    return 0;
+}
+
+static int _CmdUciSubs( const struct shell *shell, size_t argc, char **argv )
+{
+    char what[16];
+    uci_sub_t *sub;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < UCI_MAX_SUBSCRIBERS; i++)
+    {
+        sub = &mUCIsubs[i];
+        if (!sub->handler)
+        {
+            continue;
+        }
+        count++;
+
+        if (sub->oid == 0xFF)
+        {
+            snprintf(what, sizeof(what), "data dpf %X", sub->gid);
+        }
+        else
+        {
+            snprintf(what, sizeof(what), "ntf %X/%02X", sub->gid, sub->oid);
+        }
+
+        if (sub->uci)
+        {
+            shell_print(shell, "  %s  unit %d  %p(%p)", what,
+                        sub->uci->unit, sub->handler, sub->context);
+        }
+        else
+        {
+            shell_print(shell, "  %s  all units  %p(%p)", what,
+                        sub->handler, sub->context);
+        }
+    }
+    shell_print(shell, "%d of %d subscribers", count, UCI_MAX_SUBSCRIBERS);
+    return 0;
+}
+
+static int _CmdUciReset( const struct shell *shell, size_t argc, char **argv )
+{
+    int unit;
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        memset(&mUCI[unit].tx_stats, 0, sizeof(mUCI[unit].tx_stats));
+        memset(&mUCI[unit].rx_stats, 0, sizeof(mUCI[unit].rx_stats));
+    }
+    UCIbufResetStats();
+    return 0;
+}
+
+static int _CmdUciPool( const struct shell *shell, size_t argc, char **argv )
+{
+    uci_buf_stats_t stats;
+
+    UCIbufGetStats(&stats);
+
+    shell_print(shell, "RX pool %d x %u bytes  in use=%u high water=%u",
+                UCI_BUF_COUNT, (uint32_t)(sizeof(uci_buf_t) + UCI_MAX_PAYLOAD_SIZE), stats.in_use, stats.high_water);
+    shell_print(shell, "  allocs=%u frees=%u failed=%u",
+                stats.allocs, stats.frees, stats.fails);
+    shell_print(shell, "RX large pool %d x %u bytes  in use=%u high water=%u  allocs=%u failed=%u",
+                UCI_BUF_LARGE_COUNT, (uint32_t)(sizeof(uci_buf_t) + UCI_BUF_LARGE_SIZE),
+                stats.large_in_use, stats.large_high_water, stats.large_allocs, stats.large_fails);
+    return 0;
+}
+
+static int _CmdUciGap( const struct shell *shell, size_t argc, char **argv )
+{
+    UCIprotoSetTxGap(strtoul(*++argv, NULL, 0));
+    return 0;
+}
+
+static int _CmdUciBurst( const struct shell *shell, size_t argc, char **argv )
+{
+    int max = strtoul(*++argv, NULL, 0);
+    uint32_t wait = mUCIrxBurstWaitUs;
+
+    if (argc > 2)
+    {
+        wait = strtoul(*++argv, NULL, 0);
+    }
+    UCIprotoSetRxBurst(max, wait);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_uci,
+    SHELL_CMD_ARG(stats, NULL, " Print UCI statistics (use uci stats [unit], reset at each UCI init)\n", _CmdUciStats, 1, 1),
+    SHELL_CMD_ARG(latency, NULL, " Print irq to delivered latency histogram (use uci latency [unit])\n", _CmdUciLatency, 1, 1),
+    SHELL_CMD(subs, NULL,    " Print notification and data subscribers\n", _CmdUciSubs),
+    SHELL_CMD_ARG(rtt, NULL, " Print learned response times and timeouts (use uci rtt [unit])\n", _CmdUciRtt, 1, 1),
+    SHELL_CMD_ARG(rto, NULL, " Set response timeout floor and ceiling (use uci rto <min ms> <max ms>)\n", _CmdUciRto, 3, 0),
+    SHELL_CMD(reset, NULL,   " Reset UCI statistics\n", _CmdUciReset),
+    SHELL_CMD(pool, NULL,    " Print RX buffer pool usage\n", _CmdUciPool),
+    SHELL_CMD(caps, NULL,    " Print what each uwbs reported and the packet sizes in use\n", _CmdUciCaps),
+    SHELL_CMD_ARG(gap, NULL, " Set header to payload gap (use uci gap <microseconds>, 0 for one transaction)\n", _CmdUciGap, 2, 0),
+    SHELL_CMD_ARG(burst, NULL, " Set read burst (use uci burst <max messages> [wait microseconds], 1 for no bursts)\n", _CmdUciBurst, 2, 1),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(uci, &sub_uci, "UCI protocol", NULL);
+
+#endif
+
@@ -4,24 +4,64 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-bool UCIready(void);
+// One uci instance per uwbs, unit numbers are the nrfspi ones.  The
+// instances are independent, each has its own state, command and rx
+// queue, so a caller just slices all of them
+//
+typedef struct uci uci_t;
+
+int UCIprotoCount(void);
+uci_t *UCIprotoGet(int inUnit);
+int UCIprotoUnit(uci_t *inUCI);
+
+bool UCIready(uci_t *inUCI);
+// Note the payload is sent from inData directly, so it has to stay
+// valid until the command is answered (canned commands are static).
+// Payloads can be up to UCI_MAX_DATA_PACKET_SIZE, segmented by what
+// the uwbs takes
+//
 int UCIprotoWriteRaw(
+                uci_t *inUCI,
                 const uint8_t *inData,
                 const int inCount);
 int UCIprotoWrite(
+                uci_t *inUCI,
                 const uint8_t inType,
                 const uint8_t inGID,
                 const uint8_t inOID,
                 const uint8_t *inData,
                 const int inCount);
-int UCIprotoRead(
-                uint8_t *outType,
-                uint8_t *outGID,
-                uint8_t *outOID,
-                uint8_t *outData,
-                int inSize,
-                int *outCount);
+
+// Commands are queued a whole set at a time and each one goes out as
+// soon as the response to the one before it is read, without waiting
+// for the caller to look at that response.  UCI only allows one command
+// outstanding so they are still answered one at a time, responses are
+// matched to commands by GID/OID and handed up like any other message
+//
+// inDone is called once per set, as the response to its last command
+// (or the first one with a non-0 status, which drops the rest of the
+// set) is handed up, just before it's returned.  Commands are sent from
+// the callers buffers, same as UCIprotoWriteRaw, until then
+//
+// Returns 0 once the set is queued (a first command that didn't go out
+// is resent when its response times out, like a lost one). Otherwise
+// nothing was queued, -EBUSY while uci isn't up or -ENOMEM when the
+// queue is too full for the set, and it can be submitted again
+//
+#define UCI_CMD_QUEUE_DEPTH (16)
+
+typedef void (*uci_set_done_t)(uci_t *inUCI, int inStatus, int inAnswered, void *inContext);
+
+int UCIprotoSubmit(
+                uci_t *inUCI,
+                const uint8_t * const *inCommands,
+                const uint32_t *inSizes,
+                const int inCount,
+                uci_set_done_t inDone,
+                void *inContext);
+
 int UCIprotoSlice(
+                uci_t *inUCI,
                 bool *outHaveMessage,
                 uint8_t *outType,
                 uint8_t *outGID,
@@ -29,6 +69,161 @@ int UCIprotoSlice(
                 uint8_t **outPayload,
                 int *outPayloadLength,
                 uint32_t *delay);
-int UCIprotoDeInit(void);
-int UCIprotoInit(void);
+
+// UCIprotoSlice hands up one message. When the uwbs had a burst of
+// them queued, they were all read in one sync window and the rest
+// come from here, in order, until it returns false. Payloads are
+// valid until the next call to either, they live in a pool buffer
+// (UCIbufFromPayload) so take a reference on that to keep one longer
+//
+bool UCIprotoNextMessage(
+                uci_t *inUCI,
+                uint8_t *outType,
+                uint8_t *outGID,
+                uint8_t *outOID,
+                uint8_t **outPayload,
+                int *outPayloadLength);
+int UCIprotoPending(uci_t *inUCI);
+
+// Notifications are handed to whoever subscribed to their gid/oid, for
+// one unit or all of them (inUCI NULL), as they are handed up from
+// UCIprotoSlice or UCIprotoNextMessage and before the caller gets them.
+// Lookup is a table index, so any number of components can watch for
+// their own notifications without the session code knowing about them.
+// Handlers run in the caller's thread and can send commands
+//
+#define UCI_MAX_SUBSCRIBERS (16)
+#define UCI_GID_COUNT       (16)
+#define UCI_OID_COUNT       (64)
+
+typedef void (*uci_ntf_handler_t)(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *inPayload,
+                int inPayloadLength,
+                void *inContext);
+
+int UCIprotoSubscribe(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                uci_ntf_handler_t inHandler,
+                void *inContext);
+int UCIprotoUnsubscribe(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                uci_ntf_handler_t inHandler,
+                void *inContext);
+
+// Data messages (MT_DATA) go to whoever subscribed to their data packet
+// format the same way, the handler gets the dpf as inGID and 0 as inOID
+//
+#define UCI_DPF_COUNT       (16)
+
+int UCIprotoSubscribeData(
+                uci_t *inUCI,
+                uint8_t inDPF,
+                uci_ntf_handler_t inHandler,
+                void *inContext);
+int UCIprotoUnsubscribeData(
+                uci_t *inUCI,
+                uint8_t inDPF,
+                uci_ntf_handler_t inHandler,
+                void *inContext);
+
+// Send one data packet (MT_DATA, inDPF, PBF set when inMore) with
+// inPayload as its payload.  It goes out between commands, when none
+// is waiting for its response, and there's no response to a data packet
+// so inDone is called (from the reader thread, holding the unit) as
+// soon as it's on the bus, or with an error if it never gets there.
+// The payload is sent from the caller's buffer until then, one packet
+// at a time per unit (-EBUSY), at most UCIprotoMaxPacket bytes
+//
+typedef void (*uci_data_done_t)(uci_t *inUCI, int inResult, void *inContext);
+
+int UCIprotoWriteData(
+                uci_t *inUCI,
+                uint8_t inDPF,
+                bool inMore,
+                const uint8_t *inPayload,
+                const int inCount,
+                uci_data_done_t inDone,
+                void *inContext);
+
+// How long to wait for the response to a command (milliseconds), learned
+// per gid/oid from how long the uwbs has taken to answer it.  A command
+// not seen yet gets the default.  Due is how long until the command in
+// flight times out and is resent, 0 when there isn't one
+//
+uint32_t UCIprotoResponseTimeout(uci_t *inUCI, uint8_t inGID, uint8_t inOID);
+uint32_t UCIprotoResponseDue(uci_t *inUCI);
+void UCIprotoSetResponseTimeouts(uint32_t inMinMs, uint32_t inMaxMs);
+
+// The OID (in UCI_GID_PROPRIETARY) of the wait time extension ntf a
+// uwbs sends while it works on a slow command.  It isn't in the vendor
+// headers and hasn't been checked against the NXP UCI spec for the
+// firmware, so there's no default and wtx ntfs are passed up like any
+// other unless the build sets it.  native_sim builds do, uwbsim sends
+// them with it
+//
+// #define UCI_WTX_NTF_OID
+
+// Up to inMaxMessages are read per sync window (all units), waiting inWaitUs
+// after each for the uwbs to say it has another (1 turns bursts off, the
+// default: only a uwbs that re-raises irq with sync held can burst)
+//
+void UCIprotoSetRxBurst(int inMaxMessages, uint32_t inWaitUs);
+// Microseconds between the header and payload transactions of a
+// command, 0 sends both in one transaction
+//
+void UCIprotoSetTxGap(uint32_t inGapUs);
+// Park keeps the firmware loaded and the chip enabled so it can drop
+// into deep power down (dpd) between sessions, Wake brings it back in
+// well under a millisecond instead of a full boot and download.  A
+// uwbs that doesn't answer after a wake times out into a cold boot
+// like any other
+//
+int UCIprotoPark(uci_t *inUCI);
+int UCIprotoWake(uci_t *inUCI);
+bool UCIprotoParked(uci_t *inUCI);
+
+// What the uwbs says about itself, from the device info and caps info
+// responses as they go by (the nxp caps are the extended tlvs).  Until
+// it reports a max payload, packets to it are UCI's 255 bytes and it
+// sends 255 byte ones until told HOST_MAX_UCI_PAYLOAD_LENGTH.  Kept
+// while parked, cleared by a cold Init
+//
+typedef struct
+{
+    bool     valid;
+    uint16_t uci_version;       // generic uci version, major in the high byte
+    uint16_t mac_version;
+    uint16_t uwbs_max_payload;  // largest packet payload the uwbs takes (0 not reported)
+    uint8_t  data_block_size;   // in-band data buffer block size
+    uint8_t  data_max_blocks;   // and how many of them it has
+    uint16_t host_max_payload;  // what it was told we take, 0 not told (255)
+}
+uci_caps_t;
+
+const uci_caps_t *UCIprotoCaps(uci_t *inUCI);
+
+// Largest packet payload to program as HOST_MAX_UCI_PAYLOAD_LENGTH,
+// what the large rx buffers hold, or 255 when the uwbs doesn't do
+// extended length so there's nothing to program.  Once it has it, say
+// so with UCIprotoSetHostMaxPayload
+//
+uint16_t UCIprotoHostMaxPayload(uci_t *inUCI);
+void UCIprotoSetHostMaxPayload(uci_t *inUCI, uint16_t inMaxPayload);
+
+// Largest packet payload sent to the uwbs, longer commands go in PBF
+// segments of this
+//
+int  UCIprotoMaxPacket(uci_t *inUCI);
+
+// DeInit powers the uwbs off (ce low, hpd), the next Init is a cold boot
+//
+int UCIprotoDeInit(uci_t *inUCI);
+int UCIprotoInit(uci_t *inUCI);
 
@@ -2,6 +2,7 @@
 #include "uwb_range.h"
 #include "uwb_defs.h"
 #include "uwb_canned.h"
+#include "uwb_power.h"
 #include "hbci_proto.h"
 #include "uci_proto.h"
 #include "uci_defs.h"
@@ -10,6 +11,7 @@
 #include "timesvc.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/types.h>
@@ -30,14 +32,24 @@
 #define UWB_MAX_RANGE_ERRORS    (32)
 
 #define UWB_NEXT_STATE(ns)  \
-    if (DUMP_PROTO) { LOG_INF("Session-State %d -> %d", mUWB.session_state, ns); }  \
-    mUWB.session_state = ns;                        \
-    mUWB.state_timer = TimeUptimeMilliseconds() + _uwb_time_for_state(ns)
+    if (DUMP_PROTO) { LOG_INF("Session-State %d -> %d", uwb->session_state, ns); }  \
+    uwb->session_state = ns;                        \
+    uwb->state_timer = TimeUptimeMilliseconds() + _uwb_time_for_state(ns)
 
 #define UWB_MAX_COMMAND_SET (16)
 
-static struct
+// commands that carry the session id are copied out of the canned
+// ones and stamped with it, so each uwbs sends its own. A command set
+// has at most 3 of them and is answered before the next is built
+//
+#define UWB_SESSION_CMD_SLOTS   (4)
+#define UWB_SESSION_CMD_MAX     (128)
+
+typedef struct
 {
+    int  unit;
+    uci_t *uci;
+
     bool initialized;
     bool is_responder;
     int  power_offset;
@@ -51,6 +63,12 @@ static struct
     bool start_request;
     bool stop_request;
 
+    // started from parked, and not yet ranging. If it fails before
+    // then the uwbs gets a cold boot and the start is tried again
+    //
+    bool warm_start;
+    uint64_t parked_at;
+
     uint64_t state_timer;
     uint32_t range_errors;
 
@@ -68,6 +86,7 @@ static struct
         SS_INIT,
         SS_RESET,
         SS_SET_CONFIG,
+        SS_SET_PACKET_SIZE,
         SS_READ_OTP_XTAL,
         SS_READ_OTP_TXPOWER,
         SS_CALIBRATE,
@@ -84,20 +103,45 @@ static struct
 
     uint8_t uwb_session_state;
 
+    // HOST_MAX_UCI_PAYLOAD_LENGTH being programmed
+    uint16_t host_max_payload;
+
+    // READ_CALIB_DATA sent, the ntf with the value doesn't say which
+    const uint8_t *calib_read;
+
     int command_set_count;
     int command_set_state;
+    bool set_done;
+    int  set_status;
     uint32_t command_size[UWB_MAX_COMMAND_SET];
     const uint8_t *commands[UWB_MAX_COMMAND_SET];
 
+    uint8_t  session_cmd[UWB_SESSION_CMD_SLOTS][UWB_SESSION_CMD_MAX];
+    int      session_cmd_next;
+
+    /* shared configuration data from mobile app wrapped
+     * in a profile command
+     */
+    uint8_t  profile_cmd[64];
+    uint32_t profile_cmd_count;
+
+    uint32_t range_ntfs;
+
     session_state_callback_t session_callback;
 }
-mUWB;
+uwb_dev_t;
+
+// one per uwbs, same unit numbers as uci and nrfspi
+//
+static uwb_dev_t mUWB[NRFSPI_MAX_DEVICES];
+
+// unit UWBslice starts with, moves along each slice
+//
+static int mUWBnext;
 
-/* shared configuration data from mobile app wrapped
- * in a profile command
- */
-static uint8_t UWB_PROPRIETARY_SET_PROFILE_CMD[64];
-static uint32_t UWB_PROPRIETARY_SET_PROFILE_CMD_COUNT;
+// start of the window the range ntf counts are over
+//
+static uint64_t mUWBstatsStart;
 
 static uint64_t _uwb_time_for_state(int state)
 {
@@ -120,6 +164,7 @@ static uint64_t _uwb_time_for_state(int state)
 }
 
 static int _uwb_write(
+                uwb_dev_t *uwb,
                 const uint8_t *inData,
                 const int inCount)
 {
@@ -128,416 +173,628 @@ static int _uwb_write(
     require(inData, exit);
     require(inCount, exit);
 
-    ret = UCIprotoWriteRaw(inData, inCount);
+    ret = UCIprotoWriteRaw(uwb->uci, inData, inCount);
 exit:
     return ret;
 }
 
-static uint8_t *_uwb_add_session_id(uint8_t *command)
+// uci is done with the command set we queued, called as the last
+// response is handed up so it's the next message we see
+//
+static void _uwb_set_done(uci_t *inUCI, int inStatus, int inAnswered, void *inContext)
 {
+    uwb_dev_t *uwb = (uwb_dev_t *)inContext;
+
+    uwb->set_done = true;
+    uwb->set_status = inStatus;
+    uwb->command_set_state = inAnswered;
+}
+
+// long enough for each command of the set to be answered, by what uci
+// has learned about them
+//
+static uint64_t _uwb_set_timeout(uwb_dev_t *uwb)
+{
+    uint64_t expect = 0;
+    int i;
+
+    for (i = 0; i < uwb->command_set_count; i++)
+    {
+        expect += MAX(UWB_STATE_TRANSITION_TIMEOUT_MS,
+                    UCIprotoResponseTimeout(uwb->uci, uwb->commands[i][0], uwb->commands[i][1]));
+    }
+    return expect;
+}
+
+static uint8_t *_uwb_add_session_id(uwb_dev_t *uwb, uint8_t *command, uint32_t size)
+{
+    uint8_t *copy;
+
+    if (size > UWB_SESSION_CMD_MAX)
+    {
+        // stamp the canned one, ok as long as only one uwbs uses it
+        LOG_WRN("Session command %u bytes, not copied", size);
+        copy = command;
+    }
+    else
+    {
+        copy = uwb->session_cmd[uwb->session_cmd_next];
+        uwb->session_cmd_next = (uwb->session_cmd_next + 1) % UWB_SESSION_CMD_SLOTS;
+        memcpy(copy, command, size);
+    }
+
     // todo - worry about endianess?
-    memcpy(command + UWB_SESSION_ID_OFFSET_IN_CMD, &mUWB.session_id, sizeof(uint32_t));
-    return command;
+    memcpy(copy + UWB_SESSION_ID_OFFSET_IN_CMD, &uwb->session_id, sizeof(uint32_t));
+    return copy;
 }
 
-static int _uwb_initialize(
-                bool    haveMessage,
-                uint8_t type,
-                uint8_t gid,
-                uint8_t oid,
-                uint8_t *payload,
-                int payloadLength)
+static const uint8_t *_uwb_add_host_max(uwb_dev_t *uwb, uint16_t inMaxPayload)
 {
-    int ret = 0;
+    uint8_t *copy;
+
+    copy = uwb->session_cmd[uwb->session_cmd_next];
+    uwb->session_cmd_next = (uwb->session_cmd_next + 1) % UWB_SESSION_CMD_SLOTS;
+    memcpy(copy, UWB_CORE_SET_HOST_MAX_PAYLOAD, UWB_CORE_SET_HOST_MAX_PAYLOAD_SIZE);
+
+    copy[UWB_HOST_MAX_PAYLOAD_OFFSET_IN_CMD] = inMaxPayload & 0xFF;
+    copy[UWB_HOST_MAX_PAYLOAD_OFFSET_IN_CMD + 1] = inMaxPayload >> 8;
+    return copy;
+}
+
+// Notifications come to these as uci hands them up, see _uwb_subscribe.
+// They only matter while setting up or in a session
+//
+static void _uwb_ntf_device_status(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *payload,
+                int payloadLength,
+                void *inContext)
+{
+    uwb_dev_t *uwb = (uwb_dev_t *)inContext;
     uint8_t status;
 
-    LOG_DBG("Init UWBS state %d [%d of %d]", mUWB.session_state, mUWB.command_set_state, mUWB.command_set_count);
+    if (uwb->state != UWB_SESSION)
+    {
+        return;
+    }
 
-    if (haveMessage && (type == UCI_MT_NTF))
+    status = 0;
+    if (payloadLength > 0)
     {
-        if (gid == UCI_GID_CORE && oid == UCI_MSG_CORE_DEVICE_STATUS_NTF)
-        {
-            status = 0;
-            if (payloadLength > 0)
-            {
-                status = payload[0];
-            }
+        status = payload[0];
+    }
 
-            if (status)
-            {
-                if (mUWB.next_session_state == SS_RESET)
-                {
-                    LOG_INF("UWBS Ready after devid set, reset");
-                    UWB_NEXT_STATE(mUWB.next_session_state);
-                }
-                else if (mUWB.next_session_state == SS_SET_CONFIG)
-                {
-                    LOG_INF("UWBS Ready after reset, set config");
-                    UWB_NEXT_STATE(mUWB.next_session_state);
-                }
-                else
-                {
-                    LOG_INF("UWBS Ready, no action needed");
-                }
-            }
-            else
-            {
-                LOG_INF("UWBS Not Ready");
-            }
+    if (status)
+    {
+        if (uwb->next_session_state == SS_RESET)
+        {
+            LOG_INF("UWBS Ready after devid set, reset");
+            UWB_NEXT_STATE(uwb->next_session_state);
         }
-        else if (gid == UCI_GID_SESSION_MANAGE && oid == UCI_MSG_SESSION_STATUS_NTF)
+        else if (uwb->next_session_state == SS_SET_CONFIG)
         {
-            if (payloadLength >= 6)
-            {
-                uint32_t session_id;
-                uint8_t  sess_state;
-                uint8_t  sess_reason;
+            LOG_INF("UWBS Ready after reset, set config");
+            UWB_NEXT_STATE(uwb->next_session_state);
+        }
+        else
+        {
+            LOG_INF("UWBS Ready, no action needed");
+        }
+    }
+    else
+    {
+        LOG_INF("UWBS Not Ready");
+    }
+}
 
-                memcpy(&session_id, payload, 4);
+static void _uwb_ntf_session_status(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *payload,
+                int payloadLength,
+                void *inContext)
+{
+    uwb_dev_t *uwb = (uwb_dev_t *)inContext;
+    uint32_t session_id;
+    uint8_t  sess_state;
+    uint8_t  sess_reason;
 
-                sess_state  = payload[4];
-                sess_reason = payload[5];
+    if (uwb->state != UWB_SESSION)
+    {
+        return;
+    }
 
-                mUWB.uwb_session_state = sess_state;
+    if (payloadLength < UCI_MSG_SESSION_STATUS_NTF_LEN)
+    {
+        LOG_WRN("bad pl for sess ntf");
+        return;
+    }
 
-                LOG_INF("Session %08X state %02X %02X", session_id, sess_state, sess_reason);
+    memcpy(&session_id, payload, 4);
 
-                if (
-                        (mUWB.next_session_state == SS_APP_CONFIG)
-                     || ( mUWB.next_session_state == SS_IN_SESSION)
-                     || ( mUWB.next_session_state == SS_SESSION_DEINIT)
-                )
-                {
-                    if (mUWB.session_state == SS_WAIT_NTF)
-                    {
-                        UWB_NEXT_STATE(mUWB.next_session_state);
-                    }
-                }
+    sess_state  = payload[4];
+    sess_reason = payload[5];
 
-                switch (sess_state)
-                {
-                case UWB_SESSION_INITIALIZED:
-                    if (session_id != mUWB.session_id)
-                    {
-                        LOG_INF("UWBS sets session handle to %08X", session_id);
-                        mUWB.session_id = session_id;
-                    }
-                    break;
-                case UWB_SESSION_DEINITIALIZED:
-                    LOG_DBG("Session %08X de-initialized", session_id);
-                    break;
-                case UWB_SESSION_ACTIVE:
-                    LOG_DBG("Session %08X Active!", session_id);
-                    break;
-                case UWB_SESSION_IDLE:
-                    LOG_DBG("Session %08X idle", session_id);
-                    break;
-                case UWB_SESSION_ERROR:
-                    LOG_DBG("Session %08X error", session_id);
-                    break;
-                default:
-                    LOG_WRN("unhandled sess state %02X", sess_state);
-                    break;
-                }
+    uwb->uwb_session_state = sess_state;
 
-                if (mUWB.session_callback)
-                {
-                    mUWB.session_callback(session_id, sess_state, sess_reason);
-                }
-            }
-            else
-            {
-                LOG_WRN("bad pl for sess ntf");
-            }
+    LOG_INF("Session %08X state %02X %02X", session_id, sess_state, sess_reason);
+
+    if (
+            (uwb->next_session_state == SS_APP_CONFIG)
+         || ( uwb->next_session_state == SS_IN_SESSION)
+         || ( uwb->next_session_state == SS_SESSION_DEINIT)
+    )
+    {
+        if (uwb->session_state == SS_WAIT_NTF)
+        {
+            UWB_NEXT_STATE(uwb->next_session_state);
         }
-        else if (gid == UCI_GID_RANGE_MANAGE && oid == 0x00)
+    }
+
+    switch (sess_state)
+    {
+    case UWB_SESSION_INITIALIZED:
+        if (session_id != uwb->session_id)
         {
-            int rret = UWBrangeData(payload, payloadLength);
+            LOG_INF("UWBS sets session handle to %08X", session_id);
+            uwb->session_id = session_id;
+        }
+        break;
+    case UWB_SESSION_DEINITIALIZED:
+        LOG_DBG("Session %08X de-initialized", session_id);
+        break;
+    case UWB_SESSION_ACTIVE:
+        LOG_DBG("Session %08X Active!", session_id);
+        break;
+    case UWB_SESSION_IDLE:
+        LOG_DBG("Session %08X idle", session_id);
+        break;
+    case UWB_SESSION_ERROR:
+        LOG_DBG("Session %08X error", session_id);
+        break;
+    default:
+        LOG_WRN("unhandled sess state %02X", sess_state);
+        break;
+    }
 
-            if (rret)
-            {
-                mUWB.range_errors++;
+    if (uwb->session_callback)
+    {
+        uwb->session_callback(uwb->unit, session_id, sess_state, sess_reason);
+    }
+}
 
-                // if consequetive range errors get big assume
-                // the session is hopeless and stop it
-                //
-                if (mUWB.range_errors > UWB_MAX_RANGE_ERRORS && !mUWB.stop_request)
-                {
-                    LOG_ERR("Too many consequetive range errors, stopping");
-                    mUWB.stop_request = true;
-                }
-            }
-            else
-            {
-                mUWB.range_errors = 0;
-            }
-        }
-        else if (gid == UCI_GID_PROPRIETARY_SE)
+static void _uwb_ntf_range_data(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *payload,
+                int payloadLength,
+                void *inContext)
+{
+    uwb_dev_t *uwb = (uwb_dev_t *)inContext;
+    int rret;
+
+    if (uwb->state != UWB_SESSION)
+    {
+        return;
+    }
+
+    rret = UWBrangeData(uwb->unit, payload, payloadLength);
+
+    uwb->range_ntfs++;
+    UWBpowerFirstRange(uwb->unit);
+
+    if (rret)
+    {
+        uwb->range_errors++;
+
+        // if consequetive range errors get big assume
+        // the session is hopeless and stop it
+        //
+        if (uwb->range_errors > UWB_MAX_RANGE_ERRORS && !uwb->stop_request)
         {
-            switch (oid)
-            {
-            case EXT_UCI_MSG_READ_CALIB_DATA_CMD:
-                // use the calib data to update the commands we use to
-                // setup the h/w.  this is really hacky, maybe be
-                // smarter about this?
-                //
-                // as you can see, this is a horrific use of payload length as
-                // a command descriminator.. why did nxp not just invent sub cmds?
-                //
-                if (payloadLength == 0x05)
-                {
-                    /*UWB_EXT_READ_CALIB_DATA_XTAL_CAP_NTF*/
-                    UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5[8]  = payload[2];
-                    UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5[10] = payload[3];
-                    UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5[12] = payload[4];
-                    UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9[8]  = payload[2];
-                    UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9[10] = payload[3];
-                    UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9[12] = payload[4];
-                    mUWB.do_OTP_Read_XTAL = false;
-                }
-                else if (payloadLength == 0x06)
-                {
-                    /*UWB_EXT_READ_CALIB_DATA_TX_POWER_NTF*/
-                    uint8_t offset;
-                    offset = (uint8_t)((int)payload[2] + (int)(mUWB.power_offset + ((2.1-0.6+0.5)*4))); /* murata evk */
-                    UWB_SET_CALIBRATION_TX_POWER_CH5[11] = offset;
-                    UWB_SET_CALIBRATION_TX_POWER_CH9[11] = offset;
-                    UWB_SET_CALIBRATION_TX_POWER_CH5[9] = payload[3];
-                    UWB_SET_CALIBRATION_TX_POWER_CH9[9] = payload[3];
-                    mUWB.do_OTP_Read_Power = false;
-                }
-                else
-                {
-                    LOG_WRN("Unhandled read-calib-data ntf");
-                }
+            LOG_ERR("Too many consequetive range errors, stopping");
+            uwb->stop_request = true;
+        }
+    }
+    else
+    {
+        uwb->range_errors = 0;
+    }
+}
 
-                if (mUWB.session_state == SS_WAIT_NTF)
-                {
-                    UWB_NEXT_STATE(mUWB.next_session_state);
-                }
-                break;
-            default:
-                break;
-            }
+static void _uwb_ntf_calib_data(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *payload,
+                int payloadLength,
+                void *inContext)
+{
+    uwb_dev_t *uwb = (uwb_dev_t *)inContext;
+    uint8_t offset;
+
+    if (uwb->state != UWB_SESSION)
+    {
+        return;
+    }
+
+    // use the calib data to update the commands we use to setup the
+    // h/w.  the ntf doesn't say what was read, so it's whichever read
+    // we sent last
+    //
+    // note the calibration commands are shared by all units, so
+    // each uwbs gets the otp values of the last one that read them
+    // (fine for boards with one module type)
+    //
+    if (uwb->calib_read == UWB_EXT_READ_CALIB_DATA_XTAL_CAP && payloadLength >= 5)
+    {
+        UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5[8]  = payload[2];
+        UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5[10] = payload[3];
+        UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5[12] = payload[4];
+        UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9[8]  = payload[2];
+        UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9[10] = payload[3];
+        UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9[12] = payload[4];
+        uwb->do_OTP_Read_XTAL = false;
+    }
+    else if (uwb->calib_read == UWB_EXT_READ_CALIB_DATA_TX_POWER && payloadLength >= 4)
+    {
+        offset = (uint8_t)((int)payload[2] + (int)(uwb->power_offset + ((2.1-0.6+0.5)*4))); /* murata evk */
+        UWB_SET_CALIBRATION_TX_POWER_CH5[11] = offset;
+        UWB_SET_CALIBRATION_TX_POWER_CH9[11] = offset;
+        UWB_SET_CALIBRATION_TX_POWER_CH5[9] = payload[3];
+        UWB_SET_CALIBRATION_TX_POWER_CH9[9] = payload[3];
+        uwb->do_OTP_Read_Power = false;
+    }
+    else
+    {
+        LOG_WRN("Unhandled read-calib-data ntf");
+    }
+    uwb->calib_read = NULL;
+
+    if (uwb->session_state == SS_WAIT_NTF)
+    {
+        UWB_NEXT_STATE(uwb->next_session_state);
+    }
+}
+
+#ifdef UCI_WTX_NTF_OID
+// the uwbs wants more time for a command of the set (uci is already
+// waiting longer for it), so the set gets as long again from now
+//
+static void _uwb_ntf_wtx(
+                uci_t *inUCI,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *payload,
+                int payloadLength,
+                void *inContext)
+{
+    uwb_dev_t *uwb = (uwb_dev_t *)inContext;
+
+    if (uwb->state != UWB_SESSION || uwb->session_state != SS_WAIT_RSP)
+    {
+        return;
+    }
+
+    uwb->state_timer = MAX(uwb->state_timer, TimeUptimeMilliseconds() + _uwb_set_timeout(uwb));
+}
+#endif
+
+// what each notification the session cares about goes to, anything
+// else that wants them subscribes for itself
+//
+static const struct
+{
+    uint8_t gid;
+    uint8_t oid;
+    uci_ntf_handler_t handler;
+}
+mUWBsubs[] =
+{
+    { UCI_GID_CORE,             UCI_MSG_CORE_DEVICE_STATUS_NTF,     _uwb_ntf_device_status },
+    { UCI_GID_SESSION_MANAGE,   UCI_MSG_SESSION_STATUS_NTF,         _uwb_ntf_session_status },
+    { UCI_GID_RANGE_MANAGE,     UCI_MSG_SESSION_INFO_NTF,           _uwb_ntf_range_data },
+    { UCI_GID_PROPRIETARY_SE,   EXT_UCI_MSG_READ_CALIB_DATA_CMD,    _uwb_ntf_calib_data },
+#ifdef UCI_WTX_NTF_OID
+    { UCI_GID_PROPRIETARY,      UCI_WTX_NTF_OID,                    _uwb_ntf_wtx },
+#endif
+};
+
+static int _uwb_subscribe(uwb_dev_t *uwb)
+{
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(mUWBsubs) && !ret; i++)
+    {
+        ret = UCIprotoSubscribe(uwb->uci, mUWBsubs[i].gid, mUWBsubs[i].oid, mUWBsubs[i].handler, uwb);
+        if (ret == -EALREADY)
+        {
+            ret = 0;
         }
+    }
+    return ret;
+}
 
+static int _uwb_initialize(
+                uwb_dev_t *uwb,
+                bool    haveMessage,
+                uint8_t type,
+                uint8_t gid,
+                uint8_t oid,
+                uint8_t *payload,
+                int payloadLength)
+{
+    int ret = 0;
+    uint8_t status;
+
+    LOG_DBG("Init UWBS state %d [%d of %d]", uwb->session_state, uwb->command_set_state, uwb->command_set_count);
+
+    if (haveMessage && (type == UCI_MT_NTF || type == UCI_MT_DATA))
+    {
+        // already handled by the subscriptions as it was handed up,
+        // data is uci_data's
         haveMessage = false;
     }
 
-    if (mUWB.session_state != SS_WAIT_RSP && mUWB.command_set_count)
+    if (uwb->session_state != SS_WAIT_RSP && uwb->command_set_count)
     {
-        if (mUWB.command_set_state < mUWB.command_set_count)
+        if (uwb->command_set_state < uwb->command_set_count)
         {
-            // send next command to uwbs and wait for reply
+            // queue the whole set, uci sends each command as soon as the
+            // one before it is answered and tells us once it's all done
             //
-            ret = _uwb_write(mUWB.commands[mUWB.command_set_state], mUWB.command_size[mUWB.command_set_state]);
-            mUWB.next_session_state = mUWB.session_state;
-            mUWB.session_state = SS_WAIT_RSP;
+            uwb->set_done = false;
+            ret = UCIprotoSubmit(uwb->uci, uwb->commands, uwb->command_size, uwb->command_set_count, _uwb_set_done, uwb);
+            if (ret == 0)
+            {
+                uwb->next_session_state = uwb->session_state;
+                uwb->session_state = SS_WAIT_RSP;
+                uwb->state_timer = TimeUptimeMilliseconds() + _uwb_set_timeout(uwb);
+            }
+            else
+            {
+                // nothing was queued, stay in this state and submit it
+                // again next slice. The state timer still resets one
+                // that never goes
+                //
+                LOG_DBG("Unit %d set not queued (%d), again next slice", uwb->unit, ret);
+                ret = 0;
+            }
         }
     }
     else
     {
-        if (mUWB.session_state != SS_WAIT_RSP)
+        if (uwb->session_state != SS_WAIT_RSP)
         {
-            if (mUWB.stop_request)
+            if (uwb->stop_request)
             {
-                mUWB.stop_request = false;
-                mUWB.start_request = false;
+                uwb->stop_request = false;
+                uwb->start_request = false;
+                uwb->warm_start = false;
                 UWB_NEXT_STATE(SS_SESSION_STOP);
             };
+            if (uwb->session_state == SS_IN_SESSION)
+            {
+                uwb->warm_start = false;
+                UWBpowerInSession(uwb->unit);
+            }
         }
-        switch (mUWB.session_state)
+        switch (uwb->session_state)
         {
         case SS_INIT:
-            mUWB.range_errors = 0;
-            mUWB.command_set_count = 0;
-            mUWB.command_size[mUWB.command_set_count] = UWB_INIT_BOARD_VARIANT_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = UWB_INIT_BOARD_VARIANT;
-            mUWB.command_set_state = 0;
+            uwb->range_errors = 0;
+            uwb->command_set_count = 0;
+            uwb->command_size[uwb->command_set_count] = UWB_INIT_BOARD_VARIANT_SIZE;
+            uwb->commands[uwb->command_set_count++] = UWB_INIT_BOARD_VARIANT;
+            uwb->command_set_state = 0;
             break;
         case SS_RESET:
-            mUWB.command_set_count = 0;
-            mUWB.command_size[mUWB.command_set_count] = UWB_RESET_DEVICE_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = UWB_RESET_DEVICE;
-            mUWB.command_set_state = 0;
+            uwb->command_set_count = 0;
+            uwb->command_size[uwb->command_set_count] = UWB_RESET_DEVICE_SIZE;
+            uwb->commands[uwb->command_set_count++] = UWB_RESET_DEVICE;
+            uwb->command_set_state = 0;
             break;
         case SS_SET_CONFIG:
-            mUWB.command_set_count = 0;
-            mUWB.command_size[mUWB.command_set_count] = UWB_CORE_SET_CONFIG_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = UWB_CORE_SET_CONFIG;
-            mUWB.command_size[mUWB.command_set_count] = UWB_VENDOR_COMMAND_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = UWB_VENDOR_COMMAND;
-            mUWB.command_size[mUWB.command_set_count] = UWB_CORE_GET_DEVICE_INFO_CMD_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = UWB_CORE_GET_DEVICE_INFO_CMD;
-            mUWB.command_size[mUWB.command_set_count] = UWB_CORE_GET_CAPS_INFO_CMD_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = UWB_CORE_GET_CAPS_INFO_CMD;
-            mUWB.command_size[mUWB.command_set_count] = UWB_CORE_SET_ANTENNAS_DEFINE_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = UWB_CORE_SET_ANTENNAS_DEFINE;
-            mUWB.command_set_state = 0;
+            uwb->command_set_count = 0;
+            uwb->command_size[uwb->command_set_count] = UWB_CORE_SET_CONFIG_SIZE;
+            uwb->commands[uwb->command_set_count++] = UWB_CORE_SET_CONFIG;
+            uwb->command_size[uwb->command_set_count] = UWB_VENDOR_COMMAND_SIZE;
+            uwb->commands[uwb->command_set_count++] = UWB_VENDOR_COMMAND;
+            uwb->command_size[uwb->command_set_count] = UWB_CORE_GET_DEVICE_INFO_CMD_SIZE;
+            uwb->commands[uwb->command_set_count++] = UWB_CORE_GET_DEVICE_INFO_CMD;
+            uwb->command_size[uwb->command_set_count] = UWB_CORE_GET_CAPS_INFO_CMD_SIZE;
+            uwb->commands[uwb->command_set_count++] = UWB_CORE_GET_CAPS_INFO_CMD;
+            uwb->command_size[uwb->command_set_count] = UWB_CORE_SET_ANTENNAS_DEFINE_SIZE;
+            uwb->commands[uwb->command_set_count++] = UWB_CORE_SET_ANTENNAS_DEFINE;
+            uwb->command_set_state = 0;
+            break;
+        case SS_SET_PACKET_SIZE:
+            // uci has the caps from set config now, let the uwbs send us
+            // packets as big as we can read instead of 255 byte segments
+            //
+            uwb->command_set_count = 0;
+            uwb->host_max_payload = UCIprotoHostMaxPayload(uwb->uci);
+            if (uwb->host_max_payload > UCI_MAX_PAYLOAD_SIZE)
+            {
+                uwb->command_size[uwb->command_set_count] = UWB_CORE_SET_HOST_MAX_PAYLOAD_SIZE;
+                uwb->commands[uwb->command_set_count++] = _uwb_add_host_max(uwb, uwb->host_max_payload);
+            }
+            else
+            {
+                UWB_NEXT_STATE(SS_READ_OTP_XTAL);
+            }
+            uwb->command_set_state = 0;
             break;
         case SS_READ_OTP_XTAL:
-            mUWB.command_set_count = 0;
-            if (mUWB.do_OTP_Read_XTAL)
+            uwb->command_set_count = 0;
+            if (uwb->do_OTP_Read_XTAL)
             {
                 // read calibration OTP at least once
-                mUWB.command_size[mUWB.command_set_count] = UWB_EXT_READ_CALIB_DATA_XTAL_CAP_SIZE;
-                mUWB.commands[mUWB.command_set_count++] = UWB_EXT_READ_CALIB_DATA_XTAL_CAP;
+                uwb->command_size[uwb->command_set_count] = UWB_EXT_READ_CALIB_DATA_XTAL_CAP_SIZE;
+                uwb->commands[uwb->command_set_count++] = UWB_EXT_READ_CALIB_DATA_XTAL_CAP;
+                uwb->calib_read = UWB_EXT_READ_CALIB_DATA_XTAL_CAP;
             }
             else
             {
                 UWB_NEXT_STATE(SS_READ_OTP_TXPOWER);
             }
-            mUWB.command_set_state = 0;
+            uwb->command_set_state = 0;
             break;
         case SS_READ_OTP_TXPOWER:
-            mUWB.command_set_count = 0;
-            if (mUWB.do_OTP_Read_Power)
+            uwb->command_set_count = 0;
+            if (uwb->do_OTP_Read_Power)
             {
-                mUWB.command_size[mUWB.command_set_count] = UWB_EXT_READ_CALIB_DATA_TX_POWER_SIZE;
-                mUWB.commands[mUWB.command_set_count++] = UWB_EXT_READ_CALIB_DATA_TX_POWER;
+                uwb->command_size[uwb->command_set_count] = UWB_EXT_READ_CALIB_DATA_TX_POWER_SIZE;
+                uwb->commands[uwb->command_set_count++] = UWB_EXT_READ_CALIB_DATA_TX_POWER;
+                uwb->calib_read = UWB_EXT_READ_CALIB_DATA_TX_POWER;
             }
             else
             {
                 UWB_NEXT_STATE(SS_CALIBRATE);
             }
-            mUWB.command_set_state = 0;
+            uwb->command_set_state = 0;
             break;
         case SS_CALIBRATE:
-            mUWB.command_set_count = 0;
-            if (mUWB.channel_id == 0x05)
+            uwb->command_set_count = 0;
+            if (uwb->channel_id == 0x05)
             {
-                if (mUWB.do_AoA_Calibration)
+                if (uwb->do_AoA_Calibration)
                 {
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH5;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_PDOA_OFFSET_CALIB_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_PDOA_OFFSET_CALIB_CH5;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_AOA_THRESHOLD_PDOA_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_AOA_THRESHOLD_PDOA_CH5;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR2_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR2_CH5;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR1_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR1_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_PDOA_OFFSET_CALIB_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_PDOA_OFFSET_CALIB_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_AOA_THRESHOLD_PDOA_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_AOA_THRESHOLD_PDOA_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR2_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR2_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR1_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR1_CH5;
                     /*
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_PDOA_MANUFACT_ZERO_OFFSET_CALIB_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_PDOA_MANUFACT_ZERO_OFFSET_CALIB_CH5;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_PDOA_MULTIPOINT_CALIB_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_PDOA_MULTIPOINT_CALIB_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_PDOA_MANUFACT_ZERO_OFFSET_CALIB_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_PDOA_MANUFACT_ZERO_OFFSET_CALIB_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_PDOA_MULTIPOINT_CALIB_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_PDOA_MULTIPOINT_CALIB_CH5;
                     */
                 }
-                if (mUWB.do_Calibration)
+                if (uwb->do_Calibration)
                 {
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH5;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_TX_POWER_CH5_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_TX_POWER_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH5;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_TX_POWER_CH5_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_TX_POWER_CH5;
                 }
             }
             else /* channel 0x09 */
             {
-                if (mUWB.do_AoA_Calibration)
+                if (uwb->do_AoA_Calibration)
                 {
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH9;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_PDOA_OFFSET_CALIB_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_PDOA_OFFSET_CALIB_CH9;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_AOA_THRESHOLD_PDOA_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_AOA_THRESHOLD_PDOA_CH9;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR2_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR2_CH9;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR1_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR1_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_PDOA_OFFSET_CALIB_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_PDOA_OFFSET_CALIB_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_AOA_THRESHOLD_PDOA_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_AOA_THRESHOLD_PDOA_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR2_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR2_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR1_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_AOA_ANTENNAS_PDOA_CALIB_PAIR1_CH9;
                     /*
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_PDOA_MANUFACT_ZERO_OFFSET_CALIB_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_PDOA_MANUFACT_ZERO_OFFSET_CALIB_CH9;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_PDOA_MULTIPOINT_CALIB_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_PDOA_MULTIPOINT_CALIB_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_PDOA_MANUFACT_ZERO_OFFSET_CALIB_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_PDOA_MANUFACT_ZERO_OFFSET_CALIB_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_PDOA_MULTIPOINT_CALIB_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_PDOA_MULTIPOINT_CALIB_CH9;
                     */
                 }
-                if (mUWB.do_Calibration)
+                if (uwb->do_Calibration)
                 {
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH9;
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SET_CALIBRATION_TX_POWER_CH9_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = UWB_SET_CALIBRATION_TX_POWER_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_RF_CLK_ACCURACY_CALIB_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_RX_ANT_DELAY_CALIB_CH9;
+                    uwb->command_size[uwb->command_set_count] = UWB_SET_CALIBRATION_TX_POWER_CH9_SIZE;
+                    uwb->commands[uwb->command_set_count++] = UWB_SET_CALIBRATION_TX_POWER_CH9;
                 }
             }
-            if (mUWB.command_set_count == 0)
+            if (uwb->command_set_count == 0)
             {
                 UWB_NEXT_STATE(SS_START_SESSION);
             }
-            mUWB.command_set_state = 0;
+            uwb->command_set_state = 0;
             break;
         case SS_INIT_SESSION:
-            mUWB.command_set_count = 0;
-            if (UWB_PROPRIETARY_SET_PROFILE_CMD_COUNT == 0)
+            uwb->command_set_count = 0;
+            if (uwb->profile_cmd_count == 0)
             {
-                mUWB.command_size[mUWB.command_set_count] = UWB_SESSION_INIT_RANGING_SIZE;
-                mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_SESSION_INIT_RANGING);
+                uwb->command_size[uwb->command_set_count] = UWB_SESSION_INIT_RANGING_SIZE;
+                uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_SESSION_INIT_RANGING, UWB_SESSION_INIT_RANGING_SIZE);
             }
             else
             {
-                mUWB.command_size[mUWB.command_set_count] = UWB_PROPRIETARY_SET_PROFILE_CMD_COUNT;
-                mUWB.commands[mUWB.command_set_count++] = UWB_PROPRIETARY_SET_PROFILE_CMD;
+                uwb->command_size[uwb->command_set_count] = uwb->profile_cmd_count;
+                uwb->commands[uwb->command_set_count++] = uwb->profile_cmd;
             }
-            mUWB.command_set_state = 0;
+            uwb->command_set_state = 0;
             break;
         case SS_APP_CONFIG:
-            mUWB.command_set_count = 0;
-            if (UWB_PROPRIETARY_SET_PROFILE_CMD_COUNT != 0)
+            uwb->command_set_count = 0;
+            if (uwb->profile_cmd_count != 0)
             {
                 UWB_NEXT_STATE(SS_START_SESSION);
                 break;
             }
 
-            mUWB.command_size[mUWB.command_set_count] = UWB_SESSION_SET_APP_CONFIG_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_SESSION_SET_APP_CONFIG);
-            mUWB.command_size[mUWB.command_set_count] = UWB_SESSION_SET_APP_CONFIG_NXP_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_SESSION_SET_APP_CONFIG_NXP);
-            if (UWB_PROPRIETARY_SET_PROFILE_CMD_COUNT == 0)
+            uwb->command_size[uwb->command_set_count] = UWB_SESSION_SET_APP_CONFIG_SIZE;
+            uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_SESSION_SET_APP_CONFIG, UWB_SESSION_SET_APP_CONFIG_SIZE);
+            uwb->command_size[uwb->command_set_count] = UWB_SESSION_SET_APP_CONFIG_NXP_SIZE;
+            uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_SESSION_SET_APP_CONFIG_NXP, UWB_SESSION_SET_APP_CONFIG_NXP_SIZE);
+            if (uwb->profile_cmd_count == 0)
             {
-                if (mUWB.is_responder)
+                if (uwb->is_responder)
                 {
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SESSION_SET_RESPONDER_CONFIG_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_SESSION_SET_RESPONDER_CONFIG);
+                    uwb->command_size[uwb->command_set_count] = UWB_SESSION_SET_RESPONDER_CONFIG_SIZE;
+                    uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_SESSION_SET_RESPONDER_CONFIG, UWB_SESSION_SET_RESPONDER_CONFIG_SIZE);
                 }
                 else
                 {
-                    mUWB.command_size[mUWB.command_set_count] = UWB_SESSION_SET_INITIATOR_CONFIG_SIZE;
-                    mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_SESSION_SET_INITIATOR_CONFIG);
+                    uwb->command_size[uwb->command_set_count] = UWB_SESSION_SET_INITIATOR_CONFIG_SIZE;
+                    uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_SESSION_SET_INITIATOR_CONFIG, UWB_SESSION_SET_INITIATOR_CONFIG_SIZE);
                 }
             }
-            mUWB.command_set_state = 0;
+            uwb->command_set_state = 0;
             break;
         case SS_START_SESSION:
-            mUWB.command_set_count = 0;
-            mUWB.command_size[mUWB.command_set_count] = UWB_SESSION_SET_DEBUG_CONFIG_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_SESSION_SET_DEBUG_CONFIG);
-            mUWB.command_size[mUWB.command_set_count] = UWB_RANGE_START_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_RANGE_START);
-            mUWB.command_set_state = 0;
+            uwb->command_set_count = 0;
+            uwb->command_size[uwb->command_set_count] = UWB_SESSION_SET_DEBUG_CONFIG_SIZE;
+            uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_SESSION_SET_DEBUG_CONFIG, UWB_SESSION_SET_DEBUG_CONFIG_SIZE);
+            uwb->command_size[uwb->command_set_count] = UWB_RANGE_START_SIZE;
+            uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_RANGE_START, UWB_RANGE_START_SIZE);
+            uwb->command_set_state = 0;
             break;
         case SS_IN_SESSION:
             break;
         case SS_SESSION_STOP:
-            mUWB.command_set_count = 0;
-            mUWB.command_size[mUWB.command_set_count] = UWB_RANGE_STOP_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_RANGE_STOP);
-            mUWB.command_set_state = 0;
+            uwb->command_set_count = 0;
+            uwb->command_size[uwb->command_set_count] = UWB_RANGE_STOP_SIZE;
+            uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_RANGE_STOP, UWB_RANGE_STOP_SIZE);
+            uwb->command_set_state = 0;
             break;
         case SS_SESSION_DEINIT:
-            mUWB.command_set_count = 0;
-            mUWB.command_size[mUWB.command_set_count] = UWB_SESSION_DEINIT_SIZE;
-            mUWB.commands[mUWB.command_set_count++] = _uwb_add_session_id(UWB_SESSION_DEINIT);
-            mUWB.command_set_state = 0;
+            uwb->command_set_count = 0;
+            uwb->command_size[uwb->command_set_count] = UWB_SESSION_DEINIT_SIZE;
+            uwb->commands[uwb->command_set_count++] = _uwb_add_session_id(uwb, UWB_SESSION_DEINIT, UWB_SESSION_DEINIT_SIZE);
+            uwb->command_set_state = 0;
             break;
         case SS_WAIT_RSP:
             if (!haveMessage)
@@ -550,52 +807,53 @@ static int _uwb_initialize(
                 break;
             }
 
-            status = 0;
-            if (payload && payloadLength > 0)
+            if (!uwb->set_done)
             {
-                status = payload[0];
+                // answer to an earlier command of the set, uci has
+                // already sent the next one
+                //
+                break;
             }
+            uwb->set_done = false;
+            status = uwb->set_status;
 
             if (status == 0)
             {
-                // got an OK response, go back to state we were in
+                // got OK responses to the whole set, go back to state we were in
                 //
-                UWB_NEXT_STATE(mUWB.next_session_state);
-
-                if (mUWB.command_set_state < mUWB.command_set_count)
-                {
-                    // We sent a command set ok, count that
-                    //
-                    mUWB.command_set_state++;
-                }
+                UWB_NEXT_STATE(uwb->next_session_state);
 
-                if (mUWB.command_set_state >= mUWB.command_set_count)
+                if (uwb->command_set_state >= uwb->command_set_count)
                 {
-                    mUWB.command_set_count = 0;
-                    mUWB.command_set_state = 0;
+                    uwb->command_set_count = 0;
+                    uwb->command_set_state = 0;
 
                     // Finished a command set, advance state
                     //
-                    switch (mUWB.session_state)
+                    switch (uwb->session_state)
                     {
                     case SS_INIT:
                         // wait for ready ntf before doing a reset
                         UWB_NEXT_STATE(SS_WAIT_NTF);
-                        mUWB.next_session_state = SS_RESET;
+                        uwb->next_session_state = SS_RESET;
                         break;
                     case SS_RESET:
                         // wait for ready ntf before set config
                         UWB_NEXT_STATE(SS_WAIT_NTF);
-                        mUWB.next_session_state = SS_SET_CONFIG;
+                        uwb->next_session_state = SS_SET_CONFIG;
                         break;
                     case SS_SET_CONFIG:
+                        UWB_NEXT_STATE(SS_SET_PACKET_SIZE);
+                        break;
+                    case SS_SET_PACKET_SIZE:
+                        UCIprotoSetHostMaxPayload(uwb->uci, uwb->host_max_payload);
                         UWB_NEXT_STATE(SS_READ_OTP_XTAL);
                         break;
                     case SS_READ_OTP_XTAL:
                         // wait for otp notification before moving on?
                         #if  1
                         UWB_NEXT_STATE(SS_WAIT_NTF);
-                        mUWB.next_session_state = SS_READ_OTP_TXPOWER;
+                        uwb->next_session_state = SS_READ_OTP_TXPOWER;
                         #else
                         UWB_NEXT_STATE(SS_READ_OTP_TXPOWER);
                         #endif
@@ -604,7 +862,7 @@ static int _uwb_initialize(
                         // wait for otp notification before moving on?
                         #if  1
                         UWB_NEXT_STATE(SS_WAIT_NTF);
-                        mUWB.next_session_state = SS_CALIBRATE;
+                        uwb->next_session_state = SS_CALIBRATE;
                         #else
                         UWB_NEXT_STATE(SS_CALIBRATE);
                         #endif
@@ -634,14 +892,14 @@ static int _uwb_initialize(
 
                                 LOG_INF("Response to %s sets session id to %08X",
                                         (gid == UCI_GID_SESSION_MANAGE) ? "INIT-RANGING":"SET_PROFILE", session_id);
-                                mUWB.session_id = session_id;
+                                uwb->session_id = session_id;
                             }
                         }
                         // after an init-session, need to wait for an initialized
                         // notification before we can advance to config app and start
                         //
                         UWB_NEXT_STATE(SS_WAIT_NTF);
-                        mUWB.next_session_state = SS_APP_CONFIG;
+                        uwb->next_session_state = SS_APP_CONFIG;
                         break;
                     case SS_APP_CONFIG:
                         UWB_NEXT_STATE(SS_START_SESSION);
@@ -651,24 +909,37 @@ static int _uwb_initialize(
                         // notification to ensure we started it ok
                         //
                         UWB_NEXT_STATE(SS_WAIT_NTF);
-                        mUWB.next_session_state = SS_IN_SESSION;
+                        uwb->next_session_state = SS_IN_SESSION;
                         break;
                     case SS_IN_SESSION:
                         break;
                     case SS_SESSION_STOP:
                         // wait for session status to go idle or less to de-init
                         UWB_NEXT_STATE(SS_WAIT_NTF);
-                        mUWB.next_session_state = SS_SESSION_DEINIT;
+                        uwb->next_session_state = SS_SESSION_DEINIT;
                         break;
                     case SS_SESSION_DEINIT:
                         // for some reason chip doesn't send a notificatoin for this
                         // so announce it ourselves
                         UWB_NEXT_STATE(UWB_SESSION_DEINITIALIZED);
-                        mUWB.state = UWB_IDLE;
-                        UCIprotoDeInit();
-                        if (mUWB.session_callback)
+                        uwb->state = UWB_IDLE;
+
+                        // keep the firmware and park the uwbs for the next
+                        // session, only power it off if it can't be parked
+                        //
+                        if (UCIprotoPark(uwb->uci) == 0)
                         {
-                            mUWB.session_callback(mUWB.session_id, UWB_SESSION_DEINITIALIZED, 0);
+                            uwb->parked_at = TimeUptimeMilliseconds();
+                            UWBpowerState(uwb->unit, UWB_POWER_PARKED);
+                        }
+                        else
+                        {
+                            UCIprotoDeInit(uwb->uci);
+                            UWBpowerState(uwb->unit, UWB_POWER_OFF);
+                        }
+                        if (uwb->session_callback)
+                        {
+                            uwb->session_callback(uwb->unit, uwb->session_id, UWB_SESSION_DEINITIALIZED, 0);
                         }
                         break;
                     case SS_WAIT_RSP:
@@ -690,7 +961,7 @@ static int _uwb_initialize(
         default:
             LOG_INF("Done with Init");
             UWB_NEXT_STATE(SS_IN_SESSION);
-            mUWB.state = UWB_SESSION;
+            uwb->state = UWB_SESSION;
             break;
         }
     }
@@ -698,67 +969,101 @@ static int _uwb_initialize(
     return ret;
 }
 
-void _uwb_reset(void)
+static void _uwb_reset(uwb_dev_t *uwb)
 {
-    UCIprotoDeInit();
-    mUWB.state = UWB_IDLE;
-    mUWB.session_state = SS_INIT;
-    mUWB.uwb_session_state = UWB_SESSION_DEINITIALIZED;
-    mUWB.command_set_count = 0;
-    mUWB.command_set_state = 0;
-    mUWB.uwb_session_state = UWB_SESSION_DEINITIALIZED;
-    UWB_PROPRIETARY_SET_PROFILE_CMD_COUNT = 0;
+    bool retry = uwb->warm_start && uwb->state == UWB_SESSION;
+
+    UCIprotoDeInit(uwb->uci);
+    UWBpowerState(uwb->unit, UWB_POWER_OFF);
+    uwb->state = UWB_IDLE;
+    uwb->session_state = SS_INIT;
+    uwb->uwb_session_state = UWB_SESSION_DEINITIALIZED;
+    uwb->command_set_count = 0;
+    uwb->command_set_state = 0;
+    uwb->set_done = false;
+    uwb->uwb_session_state = UWB_SESSION_DEINITIALIZED;
+    uwb->warm_start = false;
+
+    if (retry)
+    {
+        // the parked uwbs didn't come back (lost its firmware, hung in
+        // dpd..) so start the same session again from a cold boot
+        //
+        LOG_WRN("Unit %d warm start failed, cold booting", uwb->unit);
+        UWBpowerWarmFailed(uwb->unit);
+        uwb->start_request = true;
+        return;
+    }
+
+    uwb->profile_cmd_count = 0;
 
-    if (mUWB.session_callback)
+    if (uwb->session_callback)
     {
-        mUWB.session_callback(0, UWB_SESSION_DEINITIALIZED, 0);
+        uwb->session_callback(uwb->unit, 0, UWB_SESSION_DEINITIALIZED, 0);
     }
 }
 
+int UWBcount(void)
+{
+    return UCIprotoCount();
+}
+
+static uwb_dev_t *_uwb_dev(int inUnit)
+{
+    if (inUnit < 0 || inUnit >= UWBcount())
+    {
+        return NULL;
+    }
+    return &mUWB[inUnit];
+}
+
 int UWBstart(
+        int inUnit,
         const uint8_t inType,
         const uint32_t inSessionID,
         const uint8_t *inProfile,
         const int inProfileLength)
 {
+    uwb_dev_t *uwb = _uwb_dev(inUnit);
     int ret = -EINVAL;
 
+    require(uwb, exit);
     require((inSessionID != 0 || (inProfile && inProfileLength)), exit);
 
-    if (mUWB.state != UWB_SESSION)
+    if (uwb->state != UWB_SESSION)
     {
         // invalidate any prior session
-        UWB_PROPRIETARY_SET_PROFILE_CMD_COUNT = 0;
+        uwb->profile_cmd_count = 0;
 
         if (inType == UWB_DeviceType_Controller)
         {
-            mUWB.is_responder = false;
+            uwb->is_responder = false;
         }
         else
         {
-            mUWB.is_responder = true;
+            uwb->is_responder = true;
         }
 
         if (inSessionID)
         {
-            mUWB.session_id = inSessionID;
-            LOG_INF("Starting Local session %08X", inSessionID);
+            uwb->session_id = inSessionID;
+            LOG_INF("Starting Local session %08X on %d", inSessionID, inUnit);
         }
         else
         {
-            uint8_t *cmd = UWB_PROPRIETARY_SET_PROFILE_CMD;
-            mUWB.session_id = 0xDEADBEEF;
-            require((inProfileLength + UCI_MSG_HDR_SIZE) < sizeof(UWB_PROPRIETARY_SET_PROFILE_CMD), exit);
+            uint8_t *cmd = uwb->profile_cmd;
+            uwb->session_id = 0xDEADBEEF;
+            require((inProfileLength + UCI_MSG_HDR_SIZE) < sizeof(uwb->profile_cmd), exit);
             cmd[0] = UCI_MTS_CMD | UCI_GID_PROPRIETARY_SE;
             cmd[1] = EXT_UCI_MSG_SET_PROFILE;
             cmd[2] = 0;
             cmd[3] = inProfileLength;
             memcpy(cmd + UCI_MSG_HDR_SIZE, inProfile, inProfileLength);
-            UWB_PROPRIETARY_SET_PROFILE_CMD_COUNT = inProfileLength + UCI_MSG_HDR_SIZE;
+            uwb->profile_cmd_count = inProfileLength + UCI_MSG_HDR_SIZE;
             LOG_INF("Starting NI Session");
         }
-        mUWB.start_request = true;
-        mUWB.stop_request = false;
+        uwb->start_request = true;
+        uwb->stop_request = false;
         ret = 0;
     }
     else
@@ -772,14 +1077,20 @@ exit:
     return ret;
 }
 
-int UWBstop(void)
+int UWBstop(int inUnit)
 {
+    uwb_dev_t *uwb = _uwb_dev(inUnit);
     int ret = -EINVAL;
 
-    if (mUWB.state != UWB_IDLE)
+    if (!uwb)
     {
-        mUWB.start_request = false;
-        mUWB.stop_request = true;
+        return ret;
+    }
+
+    if (uwb->state != UWB_IDLE)
+    {
+        uwb->start_request = false;
+        uwb->stop_request = true;
         ret = 0;
     }
     else
@@ -791,27 +1102,31 @@ int UWBstop(void)
     return ret;
 }
 
-bool UWBReady(void)
+bool UWBready(int inUnit)
 {
-    return mUWB.state == UWB_IDLE;
+    uwb_dev_t *uwb = _uwb_dev(inUnit);
+
+    return uwb && uwb->state == UWB_IDLE;
 }
 
-int UWBgetSessionState(uint32_t *outSessionID, eSESSION_STATUS_t *outState)
+int UWBgetSessionState(int inUnit, uint32_t *outSessionID, eSESSION_STATUS_t *outState)
 {
+    uwb_dev_t *uwb = _uwb_dev(inUnit);
     int ret = -EINVAL;
     eSESSION_STATUS_t state = UWB_SESSION_DEINITIALIZED;
     uint32_t session_id = 0;
 
+    require(uwb, exit);
     require(outSessionID, exit);
     require(outState, exit);
 
-    if (mUWB.state == UWB_SESSION)
+    if (uwb->state == UWB_SESSION)
     {
-        session_id = mUWB.session_id;
+        session_id = uwb->session_id;
 
-        if (mUWB.session_state >= SS_INIT_SESSION)
+        if (uwb->session_state >= SS_INIT_SESSION)
         {
-            state = mUWB.uwb_session_state;
+            state = uwb->uwb_session_state;
         }
     }
 
@@ -822,7 +1137,7 @@ exit:
     return ret;
 }
 
-int UWBslice(uint32_t *delay)
+static int _uwb_slice(uwb_dev_t *uwb, uint32_t *delay)
 {
     int ret = 0;
     bool gotMessage;
@@ -832,13 +1147,13 @@ int UWBslice(uint32_t *delay)
     uint8_t *payload;
     int     payloadLength;
 
-    if (mUWB.state != UWB_IDLE)
+    if (uwb->state != UWB_IDLE)
     {
-        ret = UCIprotoSlice(&gotMessage, &type, &gid, &oid, &payload, &payloadLength, delay);
+        ret = UCIprotoSlice(uwb->uci, &gotMessage, &type, &gid, &oid, &payload, &payloadLength, delay);
         if (ret)
         {
             LOG_ERR("UCI Error resets UWB");
-            _uwb_reset();
+            _uwb_reset(uwb);
         }
     }
     else
@@ -847,36 +1162,90 @@ int UWBslice(uint32_t *delay)
         ret = 0;
     }
 
-    switch (mUWB.state)
+    switch (uwb->state)
     {
     case UWB_IDLE:
-        if (mUWB.start_request)
+        if (uwb->start_request)
         {
-            // Bring up the UCI interface
-            // (setup SPI, load f/w and init UCI)
-            //
-            ret = UCIprotoInit();
-
-            mUWB.start_request = false;
-            mUWB.state = UWB_SESSION;
-            UWB_NEXT_STATE(SS_INIT);
-            mUWB.command_set_count = 0;
-            mUWB.command_set_state = 0;
-            *delay = 20; // let chip boot
+            uwb->start_request = false;
+            uwb->state = UWB_SESSION;
+            uwb->command_set_count = 0;
+            uwb->command_set_state = 0;
+
+            if (UCIprotoParked(uwb->uci) && UCIprotoWake(uwb->uci) == 0)
+            {
+                // firmware is loaded and the core config, otp reads and
+                // device info are still good, so go right to calibration
+                //
+                uwb->warm_start = true;
+                UWBpowerStart(uwb->unit, true);
+                UWBpowerState(uwb->unit, UWB_POWER_ACTIVE);
+                UWB_NEXT_STATE(SS_CALIBRATE);
+                *delay = 1; // let chip wake
+            }
+            else
+            {
+                // Bring up the UCI interface
+                // (setup SPI, load f/w and init UCI)
+                //
+                ret = UCIprotoInit(uwb->uci);
+
+                uwb->warm_start = false;
+                UWBpowerStart(uwb->unit, false);
+                UWBpowerState(uwb->unit, UWB_POWER_BOOT);
+                UWB_NEXT_STATE(SS_INIT);
+                *delay = 20; // let chip boot
+            }
+        }
+        else if (UCIprotoParked(uwb->uci) && UWBpowerParkTimeout())
+        {
+            uint64_t now = TimeUptimeMilliseconds();
+            uint64_t off_at = uwb->parked_at + UWBpowerParkTimeout();
+
+            if (now >= off_at)
+            {
+                LOG_INF("Unit %d parked %ums, powering off", uwb->unit, UWBpowerParkTimeout());
+                UCIprotoDeInit(uwb->uci);
+                UWBpowerState(uwb->unit, UWB_POWER_OFF);
+            }
+            else if ((off_at - now) < *delay)
+            {
+                *delay = (uint32_t)(off_at - now);
+            }
         }
         break;
     case UWB_SESSION:
-        if (UCIready())
+        // uci is busy with a queued set most of the time now, so messages
+        // are looked at whenever they come, not just when it's idle
+        //
+        if (gotMessage || UCIready(uwb->uci))
         {
-            ret = _uwb_initialize(gotMessage, type, gid, oid, payload, payloadLength);
-            if (mUWB.session_state == SS_WAIT_RSP || mUWB.session_state == SS_WAIT_NTF)
+            UWBpowerState(uwb->unit, UWB_POWER_ACTIVE);
+
+            ret = _uwb_initialize(uwb, gotMessage, type, gid, oid, payload, payloadLength);
+
+            // rest of a read burst
+            //
+            while (!ret && UCIprotoNextMessage(uwb->uci, &type, &gid, &oid, &payload, &payloadLength))
+            {
+                ret = _uwb_initialize(uwb, true, type, gid, oid, payload, payloadLength);
+            }
+
+            if (uwb->session_state == SS_WAIT_RSP || uwb->session_state == SS_WAIT_NTF)
             {
                 // SPI interrupt will shorten delay in wait-app-event in main loop
-                // so ok to delay a bunch while waiting for uci response
+                // so ok to delay a bunch while waiting for uci response, but
+                // be back for it timing out
                 //
+                uint32_t due = UCIprotoResponseDue(uwb->uci);
+
                 *delay = 100;
+                if (due && due < *delay)
+                {
+                    *delay = due;
+                }
             }
-            else if (mUWB.session_state == SS_IN_SESSION)
+            else if (uwb->session_state == SS_IN_SESSION)
             {
                 *delay = 20;
             }
@@ -887,70 +1256,217 @@ int UWBslice(uint32_t *delay)
             }
 
             // check state transition timer. if it expires, reset states
+            // (not while uci is still retrying a command)
             //
-            if (mUWB.session_state != SS_IN_SESSION)
+            if (uwb->session_state != SS_IN_SESSION && UCIready(uwb->uci))
             {
                 volatile uint64_t now = TimeUptimeMilliseconds();
 
-                if (now  > mUWB.state_timer)
+                if (now  > uwb->state_timer)
                 {
-                    LOG_INF("Del=%u  now=%llu to=%llu", *delay, now, mUWB.state_timer);
-                    LOG_ERR("Did not transition from state %d, resetting states",  mUWB.session_state);
-                    _uwb_reset();
+                    LOG_INF("Del=%u  now=%llu to=%llu", *delay, now, uwb->state_timer);
+                    LOG_ERR("Did not transition from state %d, resetting states",  uwb->session_state);
+                    _uwb_reset(uwb);
                 }
             }
         }
         break;
     case UWB_STOP:
-        if (UCIready())
+        if (UCIready(uwb->uci))
         {
-            ret = _uwb_write(_uwb_add_session_id(UWB_SESSION_DEINIT), UWB_SESSION_DEINIT_SIZE);
-            mUWB.state = UWB_RX;
-            mUWB.next_state = UWB_IDLE;
+            ret = _uwb_write(uwb, _uwb_add_session_id(uwb, UWB_SESSION_DEINIT, UWB_SESSION_DEINIT_SIZE), UWB_SESSION_DEINIT_SIZE);
+            uwb->state = UWB_RX;
+            uwb->next_state = UWB_IDLE;
         }
         break;
     case UWB_RX:
         if (gotMessage)
         {
             *delay = 0;
-            mUWB.state = mUWB.next_state;
+            uwb->state = uwb->next_state;
         }
         break;
     }
 
+    if (UCIprotoPending(uwb->uci))
+    {
+        // more of a burst is already read, come right back for it
+        *delay = 0;
+    }
+
     return ret;
 }
 
-int UWBinit(session_state_callback_t inSessionStateCallback)
+int UWBslice(uint32_t *delay)
 {
+    uint32_t unitDelay;
+    uint32_t minDelay;
+    int count = UWBcount();
     int ret = 0;
+    int uret;
+    int unit;
+    int i;
+
+    minDelay = *delay;
+
+    // every uwbs gets a turn each slice, and a burst read from one is
+    // capped in uci, so a chatty one can't starve the others. Starting
+    // one further along each time means none is always serviced last
+    //
+    for (i = 0; i < count; i++)
+    {
+        unit = (mUWBnext + i) % count;
+        unitDelay = *delay;
+
+        uret = _uwb_slice(&mUWB[unit], &unitDelay);
+        if (uret && !ret)
+        {
+            ret = uret;
+        }
+        if (unitDelay < minDelay)
+        {
+            minDelay = unitDelay;
+        }
+    }
+
+    if (count)
+    {
+        mUWBnext = (mUWBnext + 1) % count;
+    }
+
+    *delay = minDelay;
+    return ret;
+}
+
+static void _uwb_init_dev(uwb_dev_t *uwb, int inUnit, session_state_callback_t inSessionStateCallback)
+{
+    memset(uwb, 0, sizeof(*uwb));
 
-    memset(&mUWB, 0, sizeof(mUWB));
+    uwb->unit = inUnit;
+    uwb->uci = UCIprotoGet(inUnit);
 
-    mUWB.session_callback = inSessionStateCallback;
+    uwb->session_callback = inSessionStateCallback;
 
-    mUWB.power_offset = 0;
-    mUWB.do_OTP_Read_XTAL = true;
-    mUWB.do_OTP_Read_Power = true;
+    uwb->power_offset = 0;
+    uwb->do_OTP_Read_XTAL = true;
+    uwb->do_OTP_Read_Power = true;
 
     /* note this has to exactly match "other radio" of
      * the ranging session to work, so beware
      */
-    mUWB.session_id = 0x11223344;
-    mUWB.channel_id = 0x09;
-    mUWB.is_responder = true;
+    uwb->session_id = 0x11223344;
+    uwb->channel_id = 0x09;
+    uwb->is_responder = true;
 
-    mUWB.do_AoA_Calibration = true;
-    mUWB.do_Calibration = true;
+    uwb->do_AoA_Calibration = true;
+    uwb->do_Calibration = true;
 
-    mUWB.start_request = false;
-    mUWB.stop_request = false;
+    uwb->start_request = false;
+    uwb->stop_request = false;
 
-    _uwb_reset();
+    _uwb_reset(uwb);
 
-    mUWB.initialized = true;
+    if (_uwb_subscribe(uwb))
+    {
+        LOG_ERR("Unit %d can't subscribe to ntfs", inUnit);
+    }
 
-    ret = 0;
+    uwb->initialized = true;
+}
+
+int UWBinit(session_state_callback_t inSessionStateCallback)
+{
+    int unit;
+
+    // all of them, on native_sim more uwbs can be attached later
+    //
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        _uwb_init_dev(&mUWB[unit], unit, inSessionStateCallback);
+    }
+
+    mUWBnext = 0;
+    mUWBstatsStart = TimeUptimeMilliseconds();
+    UWBpowerInit();
+
+    LOG_INF("%d UWBS", UWBcount());
+    return 0;
+}
+
+#ifdef CONFIG_SHELL
+
+#include <zephyr/shell/shell.h>
+
+static int _CmdUwbStart( const struct shell *shell, size_t argc, char **argv )
+{
+    int unit = strtoul(*++argv, NULL, 0);
+    uint8_t type = UWB_DeviceType_Controlee;
+    uint32_t session_id = 0x11223344;
+    int ret;
+
+    if (argc > 2)
+    {
+        argv++;
+        type = (**argv == 'i') ? UWB_DeviceType_Controller : UWB_DeviceType_Controlee;
+    }
+    if (argc > 3)
+    {
+        session_id = strtoul(*++argv, NULL, 0);
+    }
+
+    ret = UWBstart(unit, type, session_id, NULL, 0);
+    if (ret)
+    {
+        shell_error(shell, "Can't start unit %d (%d), have %d", unit, ret, UWBcount());
+    }
     return ret;
 }
 
+static int _CmdUwbStop( const struct shell *shell, size_t argc, char **argv )
+{
+    return UWBstop(strtoul(*++argv, NULL, 0));
+}
+
+static int _CmdUwbStats( const struct shell *shell, size_t argc, char **argv )
+{
+    uint64_t elapsed = TimeUptimeMilliseconds() - mUWBstatsStart;
+    uint32_t total = 0;
+    int unit;
+
+    for (unit = 0; unit < UWBcount(); unit++)
+    {
+        shell_print(shell, "Unit %d  state=%d session=%d %08X  range ntfs=%u",
+                    unit, mUWB[unit].state, mUWB[unit].session_state,
+                    mUWB[unit].session_id, mUWB[unit].range_ntfs);
+        total += mUWB[unit].range_ntfs;
+    }
+
+    shell_print(shell, "%d UWBS, %u range ntfs in %llums (%u ntf/s)",
+                UWBcount(), total, elapsed,
+                elapsed ? (uint32_t)(((uint64_t)total * 1000) / elapsed) : 0);
+    return 0;
+}
+
+static int _CmdUwbReset( const struct shell *shell, size_t argc, char **argv )
+{
+    int unit;
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        mUWB[unit].range_ntfs = 0;
+    }
+    mUWBstatsStart = TimeUptimeMilliseconds();
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_uwb,
+    SHELL_CMD_ARG(start, NULL, " Start a local session (use uwb start <unit> [i|r] [session])\n", _CmdUwbStart, 2, 2),
+    SHELL_CMD_ARG(stop, NULL,  " Stop the session (use uwb stop <unit>)\n", _CmdUwbStop, 2, 0),
+    SHELL_CMD(stats, NULL,     " Print per unit and total range notifications\n", _CmdUwbStats),
+    SHELL_CMD(reset, NULL,     " Reset range notification counts\n", _CmdUwbReset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(uwb, &sub_uwb, "UWB sessions", NULL);
+
+#endif
@@ -1,19 +1,22 @@
-
 #pragma once
 #include "uci_defs.h"
 #include <stdint.h>
 #include <stdbool.h>
 
-typedef int (*session_state_callback_t)(uint32_t session_id, uint8_t state, uint8_t reason);
+// One session state machine per uwbs, units are the uci/nrfspi ones.
+// UWBslice services all of them
+//
+typedef int (*session_state_callback_t)(int unit, uint32_t session_id, uint8_t state, uint8_t reason);
 
-int UWBgetSessionState(uint32_t *outSessionID, eSESSION_STATUS_t *outState);
+int UWBcount(void);
+int UWBgetSessionState(int inUnit, uint32_t *outSessionID, eSESSION_STATUS_t *outState);
 int UWBstart(
+        int inUnit,
         const uint8_t inType,
         const uint32_t inSessionID,
         const uint8_t *inProfile,
         const int inProfileLength);
-int UWBstop(void);
-bool UWBready(void);
+int UWBstop(int inUnit);
+bool UWBready(int inUnit);
 int UWBslice(uint32_t *delay);
 int UWBinit(session_state_callback_t inSesionStateCallback);
-
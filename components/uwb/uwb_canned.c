@@ -33,6 +33,14 @@ const uint8_t UWB_CORE_SET_CONFIG[] = {0x20, 0x04, 0x00, 0x1C,
 };
 const uint32_t UWB_CORE_SET_CONFIG_SIZE = sizeof(UWB_CORE_SET_CONFIG);
 
+// Largest packet payload the host takes, filled in from what
+// uci can read once the caps say the uwbs does extended length
+const uint8_t UWB_CORE_SET_HOST_MAX_PAYLOAD[] = {0x20, 0x04, 0x00, 0x06,
+    0x01,                                             // Number of parameters
+    0xE4, 0x31, 0x02, 0xFF, 0x00                      // HOST_MAX_UCI_PAYLOAD_LENGTH
+};
+const uint32_t UWB_CORE_SET_HOST_MAX_PAYLOAD_SIZE = sizeof(UWB_CORE_SET_HOST_MAX_PAYLOAD);
+
 // Set Antenna define
 const uint8_t UWB_CORE_SET_ANTENNAS_DEFINE[] = {0x20, 0x04, 0x00, 0x3B,
     0x03,                                             // Number of parameters
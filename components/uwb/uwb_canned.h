@@ -9,6 +9,9 @@
 // session ID in commands is always the first 4 data bytes
 #define UWB_SESSION_ID_OFFSET_IN_CMD (4)
 
+// HOST_MAX_UCI_PAYLOAD_LENGTH value (little endian) in its set config
+#define UWB_HOST_MAX_PAYLOAD_OFFSET_IN_CMD (8)
+
 extern const uint8_t UWB_INIT_BOARD_VARIANT[];
 extern const uint32_t UWB_INIT_BOARD_VARIANT_SIZE;
 extern const uint8_t UWB_RESET_DEVICE[];
@@ -19,6 +22,8 @@ extern const uint8_t UWB_CORE_GET_CAPS_INFO_CMD[];
 extern const uint32_t UWB_CORE_GET_CAPS_INFO_CMD_SIZE;
 extern const uint8_t UWB_CORE_SET_CONFIG[];
 extern const uint32_t UWB_CORE_SET_CONFIG_SIZE;
+extern const uint8_t UWB_CORE_SET_HOST_MAX_PAYLOAD[];
+extern const uint32_t UWB_CORE_SET_HOST_MAX_PAYLOAD_SIZE;
 extern const uint8_t UWB_CORE_SET_ANTENNAS_DEFINE[];
 extern const uint32_t UWB_CORE_SET_ANTENNAS_DEFINE_SIZE;
 extern       uint8_t UWB_SESSION_INIT_RANGING[];
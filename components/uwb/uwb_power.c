@@ -0,0 +1,287 @@
+#include "uwb_power.h"
+#include "nrfspi.h"
+#include "timesvc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+
+#define COMPONENT_NAME uwbpower
+#include "Logging.h"
+
+// default time a uwbs stays parked before it's powered off
+// (milliseconds). Parked in dpd it draws microamps, so stay
+// there unless told otherwise
+//
+#define UWB_POWER_PARK_TIMEOUT_MS   (0)
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t last_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+}
+uwb_power_ttfr_t;
+
+typedef struct
+{
+    uwb_power_state_t state;
+    uint64_t state_start;
+
+    uint32_t entries[UWB_POWER_STATES];
+    uint64_t residency[UWB_POWER_STATES];
+
+    // bring-up, from start to in session, and time to first range,
+    // from start to the first range ntf
+    //
+    bool     up_pending;
+    bool     start_pending;
+    bool     start_warm;
+    int64_t  start_ticks;
+
+    uwb_power_ttfr_t cold_up;
+    uwb_power_ttfr_t warm_up;
+    uwb_power_ttfr_t cold;
+    uwb_power_ttfr_t warm;
+    uint32_t warm_failed;
+}
+uwb_power_t;
+
+static uwb_power_t mPower[NRFSPI_MAX_DEVICES];
+
+static uint32_t mParkTimeout = UWB_POWER_PARK_TIMEOUT_MS;
+
+static const char *_power_state_name(uwb_power_state_t inState)
+{
+    switch (inState)
+    {
+    case UWB_POWER_OFF:     return "off";
+    case UWB_POWER_BOOT:    return "boot";
+    case UWB_POWER_ACTIVE:  return "active";
+    case UWB_POWER_PARKED:  return "parked";
+    default:                return "?";
+    }
+}
+
+static uwb_power_t *_power_unit(int inUnit)
+{
+    if (inUnit < 0 || inUnit >= NRFSPI_MAX_DEVICES)
+    {
+        return NULL;
+    }
+    return &mPower[inUnit];
+}
+
+void UWBpowerState(int inUnit, uwb_power_state_t inState)
+{
+    uwb_power_t *pwr = _power_unit(inUnit);
+    uint64_t now;
+
+    if (!pwr || inState >= UWB_POWER_STATES || pwr->state == inState)
+    {
+        return;
+    }
+
+    now = TimeUptimeMilliseconds();
+
+    pwr->residency[pwr->state] += now - pwr->state_start;
+    pwr->entries[inState]++;
+    pwr->state = inState;
+    pwr->state_start = now;
+
+    if (inState == UWB_POWER_OFF)
+    {
+        // a start that never got to ranging doesn't get a time
+        pwr->up_pending = false;
+        pwr->start_pending = false;
+    }
+}
+
+uwb_power_state_t UWBpowerGetState(int inUnit)
+{
+    uwb_power_t *pwr = _power_unit(inUnit);
+
+    return pwr ? pwr->state : UWB_POWER_OFF;
+}
+
+void UWBpowerStart(int inUnit, bool inWarm)
+{
+    uwb_power_t *pwr = _power_unit(inUnit);
+
+    if (!pwr)
+    {
+        return;
+    }
+
+    pwr->up_pending = true;
+    pwr->start_pending = true;
+    pwr->start_warm = inWarm;
+    pwr->start_ticks = k_uptime_ticks();
+}
+
+static uint32_t _power_since_start(uwb_power_t *pwr, uwb_power_ttfr_t *ttfr)
+{
+    uint32_t us;
+
+    us = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks() - pwr->start_ticks);
+
+    if (!ttfr->count || us < ttfr->min_us)
+    {
+        ttfr->min_us = us;
+    }
+    if (us > ttfr->max_us)
+    {
+        ttfr->max_us = us;
+    }
+    ttfr->last_us = us;
+    ttfr->total_us += us;
+    ttfr->count++;
+    return us;
+}
+
+void UWBpowerInSession(int inUnit)
+{
+    uwb_power_t *pwr = _power_unit(inUnit);
+    uint32_t us;
+
+    if (!pwr || !pwr->up_pending)
+    {
+        return;
+    }
+
+    pwr->up_pending = false;
+
+    us = _power_since_start(pwr, pwr->start_warm ? &pwr->warm_up : &pwr->cold_up);
+    LOG_INF("Unit %d %s start, in session in %u us", inUnit, pwr->start_warm ? "warm" : "cold", us);
+}
+
+void UWBpowerFirstRange(int inUnit)
+{
+    uwb_power_t *pwr = _power_unit(inUnit);
+    uint32_t us;
+
+    if (!pwr || !pwr->start_pending)
+    {
+        return;
+    }
+
+    pwr->start_pending = false;
+
+    us = _power_since_start(pwr, pwr->start_warm ? &pwr->warm : &pwr->cold);
+    LOG_INF("Unit %d %s start, first range in %u us", inUnit, pwr->start_warm ? "warm" : "cold", us);
+}
+
+void UWBpowerWarmFailed(int inUnit)
+{
+    uwb_power_t *pwr = _power_unit(inUnit);
+
+    if (pwr)
+    {
+        pwr->warm_failed++;
+    }
+}
+
+uint32_t UWBpowerParkTimeout(void)
+{
+    return mParkTimeout;
+}
+
+void UWBpowerSetParkTimeout(uint32_t inMilliseconds)
+{
+    mParkTimeout = inMilliseconds;
+}
+
+static void _power_reset(void)
+{
+    uint64_t now = TimeUptimeMilliseconds();
+    uwb_power_state_t state;
+    int unit;
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        state = mPower[unit].state;
+        memset(&mPower[unit], 0, sizeof(mPower[unit]));
+        mPower[unit].state = state;
+        mPower[unit].state_start = now;
+    }
+}
+
+void UWBpowerInit(void)
+{
+    _power_reset();
+}
+
+#ifdef CONFIG_SHELL
+
+#include <zephyr/shell/shell.h>
+
+static void _CmdPrintTTFR(const struct shell *shell, const char *inName, const uwb_power_ttfr_t *ttfr)
+{
+    if (!ttfr->count)
+    {
+        shell_print(shell, "  %s: none", inName);
+        return;
+    }
+    shell_print(shell, "  %s: %u  us last=%u min=%u max=%u avg=%u",
+                inName, ttfr->count, ttfr->last_us, ttfr->min_us, ttfr->max_us,
+                (uint32_t)(ttfr->total_us / ttfr->count));
+}
+
+static int _CmdPowerStats( const struct shell *shell, size_t argc, char **argv )
+{
+    uint64_t now = TimeUptimeMilliseconds();
+    uwb_power_t *pwr;
+    uint64_t ms;
+    int state;
+    int unit;
+
+    for (unit = 0; unit < NRFSPIcount(); unit++)
+    {
+        pwr = &mPower[unit];
+
+        shell_print(shell, "Unit %d  %s  warm failed=%u", unit, _power_state_name(pwr->state), pwr->warm_failed);
+
+        for (state = 0; state < UWB_POWER_STATES; state++)
+        {
+            ms = pwr->residency[state];
+            if (state == pwr->state)
+            {
+                ms += now - pwr->state_start;
+            }
+            shell_print(shell, "  %-7s entries=%u  %llums", _power_state_name(state), pwr->entries[state], ms);
+        }
+        _CmdPrintTTFR(shell, "cold start to in session", &pwr->cold_up);
+        _CmdPrintTTFR(shell, "warm start to in session", &pwr->warm_up);
+        _CmdPrintTTFR(shell, "cold start to first range", &pwr->cold);
+        _CmdPrintTTFR(shell, "warm start to first range", &pwr->warm);
+    }
+    shell_print(shell, "Park timeout %ums%s", mParkTimeout, mParkTimeout ? "" : " (never)");
+    return 0;
+}
+
+static int _CmdPowerReset( const struct shell *shell, size_t argc, char **argv )
+{
+    _power_reset();
+    return 0;
+}
+
+static int _CmdPowerPark( const struct shell *shell, size_t argc, char **argv )
+{
+    UWBpowerSetParkTimeout(strtoul(*++argv, NULL, 0));
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_uwbpower,
+    SHELL_CMD(stats, NULL,     " Print per unit power state residency and time to first range\n", _CmdPowerStats),
+    SHELL_CMD(reset, NULL,     " Reset power stats\n", _CmdPowerReset),
+    SHELL_CMD_ARG(park, NULL,  " Power off after parked this long (use uwbpower park <ms>, 0 never)\n", _CmdPowerPark, 2, 0),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(uwbpower, &sub_uwbpower, "UWBS power management", NULL);
+
+#endif
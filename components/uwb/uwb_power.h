@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Power state bookkeeping for each uwbs.  Between sessions a uwbs is
+// parked with its firmware loaded (it drops into deep power down by
+// itself) rather than powered off, so the next session skips the boot
+// and firmware download.  This keeps how long each unit spends in each
+// state and how long a start takes to get to its first range ntf
+//
+typedef enum
+{
+    UWB_POWER_OFF,      // ce low (hpd), next start is a cold boot
+    UWB_POWER_BOOT,     // firmware download and uci bring-up
+    UWB_POWER_ACTIVE,   // uci up, setting up or in a session
+    UWB_POWER_PARKED,   // firmware resident, in or headed for dpd
+    UWB_POWER_STATES
+}
+uwb_power_state_t;
+
+void UWBpowerState(int inUnit, uwb_power_state_t inState);
+uwb_power_state_t UWBpowerGetState(int inUnit);
+
+// a start from parked (warm) or off (cold), the session coming up
+// (bring-up) and then its first range ntf
+//
+void UWBpowerStart(int inUnit, bool inWarm);
+void UWBpowerInSession(int inUnit);
+void UWBpowerFirstRange(int inUnit);
+
+// a warm start that didn't come up and went cold instead
+//
+void UWBpowerWarmFailed(int inUnit);
+
+// how long a unit stays parked before it's powered off, 0 is forever
+//
+uint32_t UWBpowerParkTimeout(void);
+void UWBpowerSetParkTimeout(uint32_t inMilliseconds);
+
+void UWBpowerInit(void);
@@ -1,6 +1,7 @@
 #include "uwb_range.h"
 #include "uwb.h"
 #include "uwb_defs.h"
+#include "uci_buf.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -16,6 +17,15 @@
 //
 #define UWB_ORIENT_HORIZ    (1)
 
+typedef struct
+{
+    uwb_range_consumer_t    consumer;
+    void                   *context;
+}
+uwb_range_consumer_entry_t;
+
+static uwb_range_consumer_entry_t mUWBrangeConsumers[UWB_RANGE_MAX_CONSUMERS];
+
 static uint8_t _UWB_GET_UINT8(uint8_t **pcursor)
 {
     uint8_t *cursor = *pcursor;
@@ -35,7 +45,7 @@ static uint16_t _UWB_GET_UINT16(uint8_t **pcursor)
     return val;
 }
 
-static uint8_t _UWB_GET_UINT32(uint8_t **pcursor)
+static uint32_t _UWB_GET_UINT32(uint8_t **pcursor)
 {
     uint8_t *cursor = *pcursor;
     uint32_t val = (uint32_t)*cursor++;
@@ -161,9 +171,69 @@ static void _DisplayRange(float distance, float azimuth, float elevation)
     snprintf(text, sizeof(text), "%7.3f  %6.1f %6.1f",
            distance, azimuth, elevation);
     LOG_INF("%s", text);
+}
 #endif
 
-int UWBrangeData(const uint8_t *inData, const int inCount)
+int UWBrangeRegister(uwb_range_consumer_t inConsumer, void *inContext)
+{
+    int i;
+
+    if (!inConsumer)
+    {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < UWB_RANGE_MAX_CONSUMERS; i++)
+    {
+        if (!mUWBrangeConsumers[i].consumer)
+        {
+            mUWBrangeConsumers[i].consumer = inConsumer;
+            mUWBrangeConsumers[i].context = inContext;
+            return 0;
+        }
+    }
+
+    LOG_ERR("No room for range consumer");
+    return -ENOMEM;
+}
+
+int UWBrangeUnregister(uwb_range_consumer_t inConsumer, void *inContext)
+{
+    int i;
+
+    for (i = 0; i < UWB_RANGE_MAX_CONSUMERS; i++)
+    {
+        if (
+                mUWBrangeConsumers[i].consumer == inConsumer
+            &&  mUWBrangeConsumers[i].context == inContext
+        )
+        {
+            mUWBrangeConsumers[i].consumer = NULL;
+            mUWBrangeConsumers[i].context = NULL;
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+static void _UWBrangeDispatch(
+                    const range_data_t *inRange,
+                    const two_way_range_data_t *inMeasurement,
+                    uci_buf_t *inBuf)
+{
+    int i;
+
+    for (i = 0; i < UWB_RANGE_MAX_CONSUMERS; i++)
+    {
+        if (mUWBrangeConsumers[i].consumer)
+        {
+            mUWBrangeConsumers[i].consumer(inRange, inMeasurement, inBuf,
+                                            mUWBrangeConsumers[i].context);
+        }
+    }
+}
+
+int UWBrangeData(int inUnit, const uint8_t *inData, const int inCount)
 {
     int ret = -EINVAL;
     range_data_t range;
@@ -180,6 +250,7 @@ int UWBrangeData(const uint8_t *inData, const int inCount)
     require(inData, exit);
     require(inCount >= 27, exit);
 
+    range.unit                      = inUnit;
     range.sequence                  = _UWB_GET_UINT32(&cursor);
     range.session_id                = _UWB_GET_UINT32(&cursor);
     range.rcr_indication            = _UWB_GET_UINT8(&cursor);
@@ -249,11 +320,21 @@ int UWBrangeData(const uint8_t *inData, const int inCount)
             two_way_data.AoA_dst_elevation      = (int16_t)_UWB_GET_UINT16(&cursor);
             two_way_data.AoA_dst_elevation_fom  = _UWB_GET_UINT8(&cursor);
 
+            // the notification was read straight into a pool buffer,
+            // hand that on rather than copying the measurement out
+            //
+            _UWBrangeDispatch(&range, &two_way_data, UCIbufFromPayload(inData));
+
             distance = (float)two_way_data.distance / 100.0;
             // angles are signed in 9.7 format
             azimuth = (float)(int)two_way_data.AoA_azimuth / (float)(1 << 7);
             elevation = (float)(int)two_way_data.AoA_elevation / (float)(1 << 7);
 
+            // one display, it shows the first uwbs
+            if (inUnit != 0)
+            {
+                continue;
+            }
 #if UWB_ORIENT_HORIZ
             _DisplayRange(distance, elevation, azimuth);
 #else
@@ -49,6 +49,7 @@ two_way_range_data_t;
 //
 typedef struct
 {
+    uint8_t  unit;              // uwbs it came from
     uint32_t sequence;
     uint32_t session_id;
     uint8_t  rcr_indication;
@@ -59,5 +60,23 @@ typedef struct
 }
 range_data_t;
 
-int UWBrangeData(const uint8_t *inData, const int inCount);
+// Range consumers get each two-way measurement as it is parsed along
+// with the pool buffer the notification was read into (see uci_buf.h).
+// The buffer is only good for the call, take a reference with UCIbufRef
+// to keep the raw notification past it
+//
+#define UWB_RANGE_MAX_CONSUMERS             (4)
+
+struct uci_buf;
+
+typedef void (*uwb_range_consumer_t)(
+                    const range_data_t *inRange,
+                    const two_way_range_data_t *inMeasurement,
+                    struct uci_buf *inBuf,
+                    void *inContext);
+
+int UWBrangeRegister(uwb_range_consumer_t inConsumer, void *inContext);
+int UWBrangeUnregister(uwb_range_consumer_t inConsumer, void *inContext);
+
+int UWBrangeData(int inUnit, const uint8_t *inData, const int inCount);
 
@@ -0,0 +1,2251 @@
+#include "uwbsim.h"
+#include "nrfspi.h"
+#include "nrfspi_sim.h"
+#include "hbci_defs.h"
+#include "uwb_defs.h"
+#include "uci_defs.h"
+#include "uci_ext_defs.h"
+#include "uwb_range.h"
+#include "uci_cap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+
+#define COMPONENT_NAME uwbsim
+#include "Logging.h"
+
+// messages the uwbs can have queued for the host.  When the host can't
+// keep up (high notification rates) new ones are dropped and counted
+//
+#define UWBSIM_QUEUE_DEPTH  (32)
+
+// packets either way can be bigger than 255, with an extended length,
+// once the other end says it takes them
+//
+#define UWBSIM_MAX_PKT      (UCI_MSG_HDR_SIZE + UCI_MAX_DATA_PACKET_SIZE)
+
+// bulk notifications (uwbsim bulk) stand in for radar/cir logs, sent
+// as fast as the host reads them
+//
+#define UWBSIM_BULK_GID     UCI_GID_VENDOR
+#define UWBSIM_BULK_OID     (0x3E)
+#define UWBSIM_BULK_SIZE    (4096)
+#define UWBSIM_BULK_POLL_US (500)
+
+// ucicap records to replay, loaded from a capture or from the host
+// a line at a time (ucicap.py replay)
+//
+#define UWBSIM_REPLAY_SIZE  (UCI_CAP_SIZE)
+
+// largest reassembled (PBF) host command
+//
+#define UWBSIM_MAX_CMD      (1024)
+
+// session handle handed out for set-profile (nxp ni) sessions
+//
+#define UWBSIM_PROFILE_SESSION_HANDLE   (0x5A000001)
+
+// defaults, roughly what the real part does
+//
+#define UWBSIM_BOOT_DELAY_US    (9000)
+#define UWBSIM_FLASH_DELAY_US   (20000)
+#define UWBSIM_INSTALL_DELAY_US (40000)
+#define UWBSIM_CHIP_ID          (0x15000001)
+#define UWBSIM_HELIOS_ID        (0x00000002)
+#define UWBSIM_CHIP_ID_LEN      (16)
+#define UWBSIM_RSP_DELAY_US     (400)
+#define UWBSIM_ACK_DELAY_US     (400)
+#define UWBSIM_NTF_DELAY_US     (1000)
+#define UWBSIM_READY_DELAY_US   (40)
+#define UWBSIM_RANGE_INTERVAL_US (200000)
+#define UWBSIM_DPD_TIMEOUT_US   (500000)
+#define UWBSIM_DPD_WAKE_US      (370)
+#define UWBSIM_MAX_PAYLOAD      (2048)
+#define UWBSIM_DATA_DELAY_US    (2000)
+#define UWBSIM_SLOW_DELAY_US    (300000)
+#define UWBSIM_WTX_INTERVAL_US  (50000)
+
+typedef enum
+{
+    SIM_OFF,
+    SIM_HBCI,
+    SIM_UCI,
+    SIM_DPD,
+    SIM_HUNG
+}
+uwbsim_mode_t;
+
+// done when the message has been read (or dropped) by the host
+//
+typedef enum
+{
+    SIM_ACT_NONE,
+    SIM_ACT_BOOT_UCI,
+    SIM_ACT_HANG,
+    SIM_ACT_BULK_DONE,
+    SIM_ACT_REPLAY_DONE
+}
+uwbsim_action_t;
+
+typedef struct
+{
+    int64_t         due;
+    uwbsim_action_t action;
+    int             len;
+    uint8_t         data[UWBSIM_MAX_PKT];
+}
+uwbsim_msg_t;
+
+typedef struct
+{
+    int         unit;
+    uwbsim_config_t config;
+    struct k_spinlock lock;
+
+    uwbsim_mode_t mode;
+    bool        ce;
+    bool        sync;
+    bool        sync_ready;
+    bool        irq;
+
+    // hbci
+    bool        hif;
+    bool        fw_expect_payload;
+    bool        fw_last_seg;
+    bool        fw_done;
+    uint8_t     fw_hdr[HBCI_HDR_LEN];
+    int64_t     fw_start;
+    int64_t     fw_installed;
+
+    // for the jitter
+    uint32_t    rng;
+
+    // host -> uwbs uci packet and reassembled command
+    uint8_t     pkt[UWBSIM_MAX_PKT];
+    int         pktlen;
+    uint8_t     cmdhdr[UCI_MSG_HDR_SIZE];
+    uint8_t     cmd[UWBSIM_MAX_CMD];
+    int         cmdlen;
+    uint32_t    cmd_count;
+
+    // last command and when its response goes, the same one again
+    // before then is the host retrying one it gave up on
+    //
+    uint32_t    cmd_hash;
+    int64_t     rsp_due;
+
+    // HOST_MAX_UCI_PAYLOAD_LENGTH, 0 until set (255)
+    uint32_t    host_max;
+
+    // uwbs -> host
+    uwbsim_msg_t queue[UWBSIM_QUEUE_DEPTH];
+    int         head;
+    int         count;
+    int         rdoff;
+
+    // session
+    bool        ranging;
+    uint32_t    session_id;
+    uint32_t    range_seq;
+
+    struct k_timer bootTimer;
+    struct k_timer irqTimer;
+    struct k_timer readyTimer;
+    struct k_timer rangeTimer;
+    struct k_timer dpdTimer;
+    struct k_timer bulkTimer;
+    struct k_timer replayTimer;
+
+    // bulk notifications still to send, and when the run started
+    uint32_t    bulk_remaining;
+    uint32_t    bulk_size;
+    uint32_t    bulk_seq;
+    int64_t     bulk_start;
+
+    // replaying what unit replay_from was sent in a capture, each command
+    // answered with what came back for it there
+    //
+    bool        replaying;
+    int         replay_from;
+    int         replay_pos;
+    int64_t     replay_start;
+
+    uwbsim_stats_t stats;
+}
+uwbsim_t;
+
+// one per simulated uwbs, attached as nrfspi units 0..mSimDevices-1
+//
+static uwbsim_t mSim[NRFSPI_MAX_DEVICES];
+static int      mSimDevices;
+
+static uint8_t  mSimReplay[UWBSIM_REPLAY_SIZE];
+static int      mSimReplayLen;
+
+static int64_t _sim_now_us(void)
+{
+    return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+// 0..jitter_us, xorshift
+//
+static uint32_t _sim_jitter(uwbsim_t *sim)
+{
+    if (sim->config.jitter_us == 0)
+    {
+        return 0;
+    }
+
+    sim->rng ^= sim->rng << 13;
+    sim->rng ^= sim->rng >> 17;
+    sim->rng ^= sim->rng << 5;
+    return sim->rng % (sim->config.jitter_us + 1);
+}
+
+static void _sim_set_irq(uwbsim_t *sim, bool inActive)
+{
+    sim->irq = inActive;
+    NRFSPIsimSetIrq(sim->unit, inActive);
+}
+
+// Work out where the irq line should be for what is queued.  Called
+// with the lock held whenever the queue or lines change
+//
+static void _sim_kick(uwbsim_t *sim)
+{
+    uwbsim_msg_t *msg;
+    int64_t now;
+    bool level = false;
+
+    if ((sim->mode == SIM_HBCI || sim->mode == SIM_UCI) && sim->count > 0)
+    {
+        msg = &sim->queue[sim->head];
+        now = _sim_now_us();
+
+        if (msg->due > now)
+        {
+            // not yet, come back when it is
+            k_timer_start(&sim->irqTimer, K_USEC(msg->due - now), K_NO_WAIT);
+        }
+        else if (sim->sync)
+        {
+            // host is in the read handshake, irq comes back up
+            // (read-ready) a bit after sync goes active. If the host
+            // holds sync after a message, the next one is signalled
+            // the same way so it can be read in the same window
+            //
+            if (sim->sync_ready)
+            {
+                level = true;
+            }
+            else if (k_timer_remaining_get(&sim->readyTimer) == 0)
+            {
+                k_timer_start(&sim->readyTimer, K_USEC(sim->config.ready_delay_us), K_NO_WAIT);
+            }
+        }
+        else
+        {
+            level = true;
+        }
+    }
+
+    if (level != sim->irq)
+    {
+        _sim_set_irq(sim, level);
+    }
+}
+
+// Bus activity in uci mode holds off deep power down, the part goes
+// into dpd when left alone with nothing to say
+//
+static void _sim_activity(uwbsim_t *sim)
+{
+    if (sim->mode == SIM_UCI && sim->config.dpd_timeout_us)
+    {
+        k_timer_start(&sim->dpdTimer, K_USEC(sim->config.dpd_timeout_us), K_NO_WAIT);
+    }
+}
+
+static void _sim_flush(uwbsim_t *sim)
+{
+    sim->head = 0;
+    sim->count = 0;
+    sim->rdoff = 0;
+    k_timer_stop(&sim->irqTimer);
+    k_timer_stop(&sim->readyTimer);
+}
+
+static void _sim_pop(uwbsim_t *sim)
+{
+    uwbsim_action_t action;
+
+    if (sim->count == 0)
+    {
+        return;
+    }
+
+    action = sim->queue[sim->head].action;
+
+    sim->head = (sim->head + 1) % UWBSIM_QUEUE_DEPTH;
+    sim->count--;
+    sim->rdoff = 0;
+    sim->sync_ready = false;
+
+    switch (action)
+    {
+    case SIM_ACT_BOOT_UCI:
+        LOG_INF("Sim UWBS firmware running");
+        sim->mode = SIM_UCI;
+        _sim_activity(sim);
+        break;
+    case SIM_ACT_BULK_DONE:
+        sim->stats.bulk_us = _sim_now_us() - sim->bulk_start;
+        LOG_INF("Sim UWBS %d bulk done, %llu bytes in %lluus",
+                    sim->unit, sim->stats.bulk_bytes, sim->stats.bulk_us);
+        break;
+    case SIM_ACT_REPLAY_DONE:
+        sim->stats.replay_us = _sim_now_us() - sim->replay_start;
+        LOG_INF("Sim UWBS %d replay done, %u messages %llu bytes in %lluus, %u mismatched",
+                    sim->unit, sim->stats.replay_msgs, sim->stats.replay_bytes,
+                    sim->stats.replay_us, sim->stats.replay_mismatched);
+        break;
+    case SIM_ACT_HANG:
+        LOG_WRN("Sim UWBS hung");
+        sim->mode = SIM_HUNG;
+        sim->ranging = false;
+        k_timer_stop(&sim->rangeTimer);
+        _sim_flush(sim);
+        break;
+    default:
+        break;
+    }
+}
+
+static uwbsim_msg_t *_sim_queue(
+                uwbsim_t *sim,
+                const uint8_t *inHdr,
+                const int inHdrCount,
+                const uint8_t *inData,
+                const int inCount,
+                uint32_t inDelay)
+{
+    uwbsim_msg_t *msg = NULL;
+    int64_t due;
+    int tail;
+
+    require((inHdrCount + inCount) <= UWBSIM_MAX_PKT, exit);
+
+    if (sim->count >= UWBSIM_QUEUE_DEPTH)
+    {
+        sim->stats.dropped++;
+        goto exit;
+    }
+
+    due = _sim_now_us() + inDelay;
+
+    // keep it fifo, nothing goes out before what's ahead of it
+    //
+    if (sim->count > 0)
+    {
+        tail = (sim->head + sim->count - 1) % UWBSIM_QUEUE_DEPTH;
+        if (sim->queue[tail].due > due)
+        {
+            due = sim->queue[tail].due;
+        }
+    }
+
+    tail = (sim->head + sim->count) % UWBSIM_QUEUE_DEPTH;
+    msg = &sim->queue[tail];
+
+    msg->due = due;
+    msg->action = SIM_ACT_NONE;
+    msg->len = inHdrCount + inCount;
+    memcpy(msg->data, inHdr, inHdrCount);
+    if (inCount)
+    {
+        memcpy(msg->data + inHdrCount, inData, inCount);
+    }
+
+    sim->count++;
+    if (sim->count > sim->stats.max_depth)
+    {
+        sim->stats.max_depth = sim->count;
+    }
+exit:
+    return msg;
+}
+
+// Largest packet payload to the host, frag_size as long as the host
+// said it takes that (HOST_MAX_UCI_PAYLOAD_LENGTH)
+//
+static int _sim_frag(uwbsim_t *sim)
+{
+    int frag;
+    int host;
+
+    frag = sim->config.frag_size;
+    if (frag <= 0 || frag > UCI_MAX_DATA_PACKET_SIZE)
+    {
+        frag = UCI_MAX_PAYLOAD_SIZE;
+    }
+    host = sim->host_max ? sim->host_max : UCI_MAX_PAYLOAD_SIZE;
+
+    return (frag < host) ? frag : host;
+}
+
+// Queue a uci message, split into PBF fragments of at most frag_size.
+// Packets over 255 bytes go with an extended length
+//
+static uwbsim_msg_t *_sim_queue_uci(
+                uwbsim_t *sim,
+                uint8_t inType,
+                uint8_t inGID,
+                uint8_t inOID,
+                const uint8_t *inPayload,
+                const int inCount,
+                uint32_t inDelay)
+{
+    uwbsim_msg_t *msg = NULL;
+    uint8_t hdr[UCI_MSG_HDR_SIZE];
+    int frag;
+    int sent;
+    int chunk;
+
+    frag = _sim_frag(sim);
+
+    sent = 0;
+    do
+    {
+        chunk = inCount - sent;
+        hdr[0] = (inType << UCI_MT_SHIFT) | (inGID & UCI_GID_MASK);
+        if (chunk > frag)
+        {
+            chunk = frag;
+            hdr[0] |= UCI_PBF_MASK;
+        }
+        hdr[1] = inOID & UCI_OID_MASK;
+        hdr[2] = 0;
+        hdr[3] = chunk;
+        if (inType == UCI_MT_DATA)
+        {
+            hdr[1] = 0;
+            hdr[2] = chunk & 0xFF;
+            hdr[3] = chunk >> 8;
+        }
+        else if (chunk > UCI_MAX_PAYLOAD_SIZE)
+        {
+            hdr[1] |= UCI_EXT_MASK;
+            hdr[2] = chunk >> 8;
+            hdr[3] = chunk & 0xFF;
+        }
+
+        msg = _sim_queue(sim, hdr, sizeof(hdr), inPayload + sent, chunk, sent ? 0 : inDelay);
+        if (!msg)
+        {
+            break;
+        }
+        sent += chunk;
+    }
+    while (sent < inCount);
+
+    if (msg)
+    {
+        if (inType == UCI_MT_RSP)
+        {
+            sim->stats.rsps++;
+            sim->rsp_due = msg->due;
+        }
+        else if (inType == UCI_MT_NTF)
+        {
+            sim->stats.ntfs++;
+        }
+    }
+    return msg;
+}
+
+static void _sim_device_status(uwbsim_t *sim, uint8_t inStatus, uint32_t inDelay)
+{
+    _sim_queue_uci(sim, UCI_MT_NTF, UCI_GID_CORE, UCI_MSG_CORE_DEVICE_STATUS_NTF, &inStatus, 1, inDelay);
+}
+
+static void _sim_generic_error(uwbsim_t *sim, uint8_t inStatus, uint32_t inDelay)
+{
+    _sim_queue_uci(sim, UCI_MT_NTF, UCI_GID_CORE, UCI_MSG_CORE_GENERIC_ERROR_NTF, &inStatus, 1, inDelay);
+}
+
+static void _sim_session_status(uwbsim_t *sim, uint8_t inState, uint32_t inDelay)
+{
+    uint8_t ntf[UCI_MSG_SESSION_STATUS_NTF_LEN];
+
+    memcpy(ntf, &sim->session_id, 4);
+    ntf[4] = inState;
+    ntf[5] = 0;
+    _sim_queue_uci(sim, UCI_MT_NTF, UCI_GID_SESSION_MANAGE, UCI_MSG_SESSION_STATUS_NTF, ntf, sizeof(ntf), inDelay);
+}
+
+static void _sim_hang(uwbsim_t *sim)
+{
+    uwbsim_msg_t *msg;
+    uint8_t status = 0xFE;
+
+    sim->stats.hangs++;
+    msg = _sim_queue_uci(sim, UCI_MT_NTF, UCI_GID_CORE, UCI_MSG_CORE_DEVICE_STATUS_NTF, &status, 1, 0);
+    if (msg)
+    {
+        msg->action = SIM_ACT_HANG;
+    }
+    else
+    {
+        sim->mode = SIM_HUNG;
+    }
+}
+
+static void _sim_hbci_answer_after(uwbsim_t *sim, uint8_t inCLA, uint8_t inINS, uwbsim_action_t inAction, uint32_t inDelay)
+{
+    uwbsim_msg_t *msg;
+    uint8_t ans[HBCI_HDR_LEN] = { inCLA, inINS, 0, 0 };
+
+    msg = _sim_queue(sim, ans, sizeof(ans), NULL, 0, inDelay);
+    if (msg)
+    {
+        msg->action = inAction;
+    }
+}
+
+static void _sim_hbci_answer(uwbsim_t *sim, uint8_t inCLA, uint8_t inINS, uwbsim_action_t inAction)
+{
+    _sim_hbci_answer_after(sim, inCLA, inINS, inAction, sim->config.rsp_delay_us);
+}
+
+// an answer with a payload, and the checksum that makes it all sum to 0
+//
+static void _sim_hbci_answer_data(uwbsim_t *sim, uint8_t inCLA, uint8_t inINS, const uint8_t *inData, int inCount)
+{
+    uint8_t ans[HBCI_HDR_LEN] = { inCLA, inINS, 0, 0 };
+    uint8_t payload[UWBSIM_CHIP_ID_LEN + 1];
+    uint8_t sum = 0;
+    int i;
+
+    // the length counts the lrc, the way the host sends it
+    ans[HBCI_HDR_LEN_MSB] = ((inCount + 1) >> 8) & 0x0F;
+    ans[HBCI_HDR_LEN_LSB] = (inCount + 1) & 0xFF;
+
+    memcpy(payload, inData, inCount);
+    for (i = 0; i < HBCI_HDR_LEN; i++)
+    {
+        sum += ans[i];
+    }
+    for (i = 0; i < inCount; i++)
+    {
+        sum += payload[i];
+    }
+    payload[inCount] = (sum ^ 0xFF) + 1;
+
+    _sim_queue(sim, ans, sizeof(ans), payload, inCount + 1, sim->config.rsp_delay_us);
+}
+
+static void _sim_hbci_id(uwbsim_t *sim, uint8_t inINS)
+{
+    uint8_t id[UWBSIM_CHIP_ID_LEN];
+    uint32_t value = (inINS == QRY_CHIP_ID_INS) ? sim->config.chip_id : sim->config.helios_id;
+
+    memset(id, 0, sizeof(id));
+    id[0] = value >> 24;
+    id[1] = value >> 16;
+    id[2] = value >> 8;
+    id[3] = value;
+    if (inINS == QRY_CHIP_ID_INS)
+    {
+        id[UWBSIM_CHIP_ID_LEN - 1] = sim->unit;
+    }
+    _sim_hbci_answer_data(sim, GENERAL_ANS_CLA, inINS, id, (inINS == QRY_CHIP_ID_INS) ? UWBSIM_CHIP_ID_LEN : 4);
+}
+
+static void _sim_hbci(uwbsim_t *sim, const uint8_t *inData, const int inCount)
+{
+    uint8_t sum;
+    int i;
+
+    if (sim->fw_installed > _sim_now_us())
+    {
+        // busy installing the image, not listening
+        sim->stats.fw_ignored++;
+        return;
+    }
+
+    if (sim->fw_expect_payload)
+    {
+        // payload of a download chunk, header + payload + lrc sums to 0
+        //
+        sim->fw_expect_payload = false;
+
+        sum = 0;
+        for (i = 0; i < HBCI_HDR_LEN; i++)
+        {
+            sum += sim->fw_hdr[i];
+        }
+        for (i = 0; i < inCount; i++)
+        {
+            sum += inData[i];
+        }
+
+        if (sum)
+        {
+            sim->stats.fw_lrc_errors++;
+            _sim_hbci_answer(sim, GENERAL_ACK_CLA, ACK_LRC_MISMATCH_INS, SIM_ACT_NONE);
+            return;
+        }
+
+        sim->stats.fw_bytes += inCount - 1;
+        sim->stats.fw_chunks++;
+        if (sim->fw_last_seg)
+        {
+            sim->fw_done = true;
+            sim->stats.fw_us += _sim_now_us() - sim->fw_start;
+
+            // installs it once the host has the ack
+            sim->stats.install_last_us = sim->config.ack_delay_us + sim->config.install_delay_us + _sim_jitter(sim);
+            sim->fw_installed = _sim_now_us() + sim->stats.install_last_us;
+        }
+        _sim_hbci_answer_after(sim, GENERAL_ACK_CLA, ACK_VALID_APDU_INS, SIM_ACT_NONE, sim->config.ack_delay_us);
+        return;
+    }
+
+    if (inCount < HBCI_HDR_LEN)
+    {
+        _sim_hbci_answer(sim, GENERAL_ACK_CLA, ACK_INVALID_LEN_INS, SIM_ACT_NONE);
+        return;
+    }
+
+    if (inData[0] == GENERAL_QRY_CLA && inData[1] == QRY_STATUS_INS)
+    {
+        _sim_hbci_answer(sim, GENERAL_ANS_CLA,
+                    sim->hif ? ANS_MODE_PATCH_HIF_READY_INS : ANS_HBCI_READY_INS, SIM_ACT_NONE);
+    }
+    else if (inData[0] == GENERAL_QRY_CLA && (inData[1] == QRY_CHIP_ID_INS || inData[1] == QRY_HELIOS_ID_INS))
+    {
+        _sim_hbci_id(sim, inData[1]);
+    }
+    else if (inData[0] == GENERAL_CMD_CLA && inData[1] == CMD_MODE_HIF_INS)
+    {
+        sim->hif = true;
+        _sim_hbci_answer(sim, GENERAL_ACK_CLA, ACK_VALID_APDU_INS, SIM_ACT_NONE);
+    }
+    else if (inData[0] == FW_DWNLD_CMD_CLA && inData[1] == FW_DWNLD_DWNLD_IMAGE && sim->hif)
+    {
+        if (sim->fw_done || sim->fw_start == 0)
+        {
+            // first chunk of an image
+            sim->fw_done = false;
+            sim->fw_start = _sim_now_us();
+        }
+        memcpy(sim->fw_hdr, inData, HBCI_HDR_LEN);
+        sim->fw_last_seg = ((inData[3] >> 4) == FINAL_PACKET);
+        sim->fw_expect_payload = true;
+        _sim_hbci_answer_after(sim, GENERAL_ACK_CLA, ACK_VALID_APDU_INS, SIM_ACT_NONE, sim->config.ack_delay_us);
+    }
+    else if (inData[0] == FW_DWNLD_QRY_CLA && inData[1] == FW_DWNLD_QRY_IMAGE_STATUS)
+    {
+        if (sim->fw_done)
+        {
+            // firmware boots once the host has the answer, and reports
+            // status init when it's up
+            //
+            _sim_hbci_answer(sim, FW_DWNLD_ANS_CLA, FW_DWNLD_IMAGE_SUCCESS, SIM_ACT_BOOT_UCI);
+            _sim_device_status(sim, 0x00, sim->config.flash_delay_us);
+        }
+        else
+        {
+            _sim_hbci_answer(sim, FW_DWNLD_ANS_CLA, FW_DWNLD_PAYLOAD_TOO_LARGE, SIM_ACT_NONE);
+        }
+    }
+    else
+    {
+        _sim_hbci_answer(sim, GENERAL_ACK_CLA, ACK_INVALID_INS_INS, SIM_ACT_NONE);
+    }
+}
+
+static void _sim_range_ntf(uwbsim_t *sim)
+{
+    uint8_t ntf[64];
+    uint8_t *cursor = ntf;
+    uint8_t status = UCI_STATUS_OK;
+    uint16_t distance;
+    int16_t azimuth;
+    int16_t elevation;
+    uint32_t interval_ms;
+
+    sim->range_seq++;
+
+    if (sim->config.range_error_every && !(sim->range_seq % sim->config.range_error_every))
+    {
+        status = sim->config.range_error_status;
+        sim->stats.range_errors++;
+    }
+
+    // sweep a target 0.5 - 5.5m out, +/- 60 deg az, +/- 20 deg el
+    //
+    distance  = 50 + (sim->range_seq % 500);
+    azimuth   = (int16_t)(((int)(sim->range_seq % 121) - 60) * (1 << 7));
+    elevation = (int16_t)(((int)(sim->range_seq % 41) - 20) * (1 << 7));
+    interval_ms = sim->config.range_interval_us / 1000;
+
+    memcpy(cursor, &sim->range_seq, 4);         cursor += 4;
+    memcpy(cursor, &sim->session_id, 4);        cursor += 4;
+    *cursor++ = 0;                              // rcr indication
+    memcpy(cursor, &interval_ms, 4);            cursor += 4;
+    *cursor++ = UWB_RANGE_MEASUREMENT_TYPE_TWO_WAY;
+    *cursor++ = 0;                              // rfu
+    *cursor++ = UWB_MAC_MODE_2_BYTE;
+    memset(cursor, 0, 8);                       cursor += 8;
+    *cursor++ = 1;                              // measurements
+
+    *cursor++ = 0x11;                           // mac
+    *cursor++ = 0x11;
+    *cursor++ = status;
+    *cursor++ = 0;                              // nlos
+    memcpy(cursor, &distance, 2);               cursor += 2;
+    memcpy(cursor, &azimuth, 2);                cursor += 2;
+    *cursor++ = 100;
+    memcpy(cursor, &elevation, 2);              cursor += 2;
+    *cursor++ = 100;
+    memset(cursor, 0, 6);                       cursor += 6;    // dest az/el
+    *cursor++ = 0;                              // slot index
+    *cursor++ = 0;                              // rssi
+    memset(cursor, 0, 11);                      cursor += 11;   // rfu
+
+    if (_sim_queue_uci(sim, UCI_MT_NTF, UCI_GID_RANGE_MANAGE, 0x00, ntf, cursor - ntf, 0))
+    {
+        sim->stats.range_ntfs++;
+    }
+}
+
+static void _sim_start_ranging(uwbsim_t *sim)
+{
+    uint32_t interval = sim->config.range_interval_us;
+
+    sim->ranging = true;
+    sim->range_seq = 0;
+    k_timer_start(&sim->rangeTimer,
+                K_USEC(interval + sim->config.ntf_delay_us), K_USEC(interval));
+}
+
+// The only core config the sim acts on is the host's max packet
+// payload, nxp extended (E4) params take a two byte tag
+//
+static void _sim_set_config(uwbsim_t *sim, const uint8_t *inPayload, const int inCount)
+{
+    const uint8_t *p = inPayload + 1;
+    const uint8_t *end = inPayload + inCount;
+    bool ext;
+    uint8_t id;
+    uint8_t len;
+    int params;
+
+    if (inCount < 1)
+    {
+        return;
+    }
+
+    params = inPayload[0];
+    while (params-- > 0 && (p + 2) <= end)
+    {
+        ext = (*p == EXTENDED_DEVICE_CONFIG_ID);
+        if (ext)
+        {
+            p++;
+            if ((p + 2) > end)
+            {
+                break;
+            }
+        }
+        id  = *p++;
+        len = *p++;
+        if ((p + len) > end)
+        {
+            break;
+        }
+
+        if (
+                ext
+            &&  id == UCI_EXT_PARAM_ID_HOST_MAX_UCI_PAYLOAD_LENGTH
+            &&  len == UCI_EXT_PARAM_ID_HOST_MAX_UCI_PAYLOAD_LENGTH_LEN
+        )
+        {
+            sim->host_max = p[0] | (p[1] << 8);
+            if (sim->host_max > UCI_MAX_DATA_PACKET_SIZE)
+            {
+                sim->host_max = UCI_MAX_DATA_PACKET_SIZE;
+            }
+            LOG_INF("Sim %d host takes %u byte packets", sim->unit, sim->host_max);
+        }
+        p += len;
+    }
+}
+
+// Header of the next replay record of the unit being replayed, at or
+// after *ioPos, false at the end.  Records are packed so they're
+// copied out rather than looked at in place
+//
+static bool _sim_replay_rec(uwbsim_t *sim, int *ioPos, uci_cap_rec_t *outRec)
+{
+    while ((*ioPos + (int)sizeof(*outRec)) <= mSimReplayLen)
+    {
+        memcpy(outRec, mSimReplay + *ioPos, sizeof(*outRec));
+        if (outRec->size < sizeof(*outRec) || (*ioPos + outRec->size) > mSimReplayLen)
+        {
+            // not a record, give up on the rest
+            *ioPos = mSimReplayLen;
+            break;
+        }
+        if (outRec->unit == sim->replay_from)
+        {
+            return true;
+        }
+        *ioPos += outRec->size;
+    }
+    return false;
+}
+
+// Queue what the uwbs said up to the next command, as fast as the host
+// reads it.  Called with the lock held, when a command comes in and
+// from the timer while there's more than the queue holds
+//
+static void _sim_replay_run(uwbsim_t *sim)
+{
+    uci_cap_rec_t rec;
+    uwbsim_msg_t *msg = NULL;
+    int count;
+    int pkts;
+
+    while (sim->replaying && _sim_replay_rec(sim, &sim->replay_pos, &rec))
+    {
+        if (rec.dir == UCI_CAP_TX)
+        {
+            // wait for the host to send it
+            return;
+        }
+
+        // whole messages, UWBsimReplay turns down a capture with any cut
+        count = rec.size - sizeof(rec);
+        pkts = (count + _sim_frag(sim) - 1) / _sim_frag(sim);
+        if ((sim->count + (pkts ? pkts : 1)) > UWBSIM_QUEUE_DEPTH)
+        {
+            // rest when there's room
+            k_timer_start(&sim->replayTimer, K_USEC(UWBSIM_BULK_POLL_US), K_NO_WAIT);
+            return;
+        }
+
+        msg = _sim_queue_uci(sim, (rec.hdr0 & UCI_MT_MASK) >> UCI_MT_SHIFT, rec.hdr0 & UCI_GID_MASK,
+                            rec.oid, mSimReplay + sim->replay_pos + sizeof(rec), count, 0);
+        if (!msg)
+        {
+            return;
+        }
+        sim->replay_pos += rec.size;
+        sim->stats.replay_msgs++;
+        sim->stats.replay_bytes += count;
+    }
+
+    if (sim->replaying)
+    {
+        sim->replaying = false;
+        if (msg)
+        {
+            msg->action = SIM_ACT_REPLAY_DONE;
+        }
+        else
+        {
+            sim->stats.replay_us = _sim_now_us() - sim->replay_start;
+        }
+    }
+}
+
+// The host sent a command, pass the one it stands for in the capture
+// and answer with what followed it there
+//
+static void _sim_replay_command(uwbsim_t *sim, uint8_t inGID, uint8_t inOID)
+{
+    uci_cap_rec_t rec;
+    bool have;
+
+    while ((have = _sim_replay_rec(sim, &sim->replay_pos, &rec)) && rec.dir != UCI_CAP_TX)
+    {
+        // host got ahead of the capture
+        sim->stats.replay_skipped++;
+        sim->replay_pos += rec.size;
+    }
+
+    if (have)
+    {
+        if ((rec.hdr0 & UCI_GID_MASK) != inGID || rec.oid != inOID)
+        {
+            sim->stats.replay_mismatched++;
+        }
+        sim->replay_pos += rec.size;
+    }
+    _sim_replay_run(sim);
+}
+
+// A DATA_MESSAGE_SND from the host: session handle, destination, sequence
+// number, length and the data.  It goes out over the air in data_delay,
+// then the transmit status says so and its blocks are free again
+//
+static void _sim_data(uwbsim_t *sim, uint8_t inDPF, const uint8_t *inPayload, const int inCount)
+{
+    uint8_t ntf[8];
+    uint8_t rcv[17 + APP_DATA_MAX_SIZE];
+    uint16_t len;
+    uint8_t status = 0x00;
+
+    if (inDPF != UCI_DPF_SND)
+    {
+        _sim_generic_error(sim, UCI_STATUS_SYNTAX_ERROR, sim->config.rsp_delay_us);
+        return;
+    }
+    if (inCount < 16)
+    {
+        sim->stats.data_errors++;
+        _sim_generic_error(sim, UCI_STATUS_SYNTAX_ERROR, sim->config.rsp_delay_us);
+        return;
+    }
+
+    len = inPayload[14] | (inPayload[15] << 8);
+    if (len != (inCount - 16))
+    {
+        // data transfer error
+        sim->stats.data_errors++;
+        status = 0x01;
+    }
+    else
+    {
+        sim->stats.data_msgs++;
+        sim->stats.data_bytes += len;
+    }
+
+    // session, sequence number, status, tx count
+    //
+    memcpy(ntf, inPayload, 4);
+    ntf[4] = inPayload[12];
+    ntf[5] = inPayload[13];
+    ntf[6] = status;
+    ntf[7] = 1;
+    _sim_queue_uci(sim, UCI_MT_NTF, UCI_GID_DATA_CONTROL, UCI_MSG_DATA_TRANSMIT_STATUS_NTF,
+                    ntf, 8, sim->config.data_delay_us);
+
+    // session, credit available
+    ntf[4] = 1;
+    _sim_queue_uci(sim, UCI_MT_NTF, UCI_GID_DATA_CONTROL, UCI_MSG_DATA_CREDIT_NTF, ntf, 5, 0);
+
+    if (!sim->config.data_loopback || status || len > APP_DATA_MAX_SIZE)
+    {
+        return;
+    }
+
+    // the peer sends it straight back: session, status, source address
+    // (the one it went to), sequence number, length, data
+    //
+    memcpy(rcv, inPayload, 4);
+    memcpy(rcv + 5, inPayload + 4, 8);
+    memcpy(rcv + 17, inPayload + 16, len);
+    rcv[4] = UCI_STATUS_OK;
+    rcv[13] = inPayload[12];
+    rcv[14] = inPayload[13];
+    rcv[15] = len & 0xFF;
+    rcv[16] = len >> 8;
+
+    sim->stats.data_loops++;
+    _sim_queue_uci(sim, UCI_MT_DATA, UCI_DPF_RCV, 0, rcv, 17 + len, 0);
+}
+
+// fnv-1a over a command's header and payload
+//
+static uint32_t _sim_cmd_hash(const uint8_t *inHdr, const uint8_t *inPayload, const int inCount)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+
+    hash = (hash ^ (inHdr[0] & (UCI_MT_MASK | UCI_GID_MASK))) * 16777619u;
+    hash = (hash ^ (inHdr[1] & UCI_OID_MASK)) * 16777619u;
+    for (i = 0; i < inCount; i++)
+    {
+        hash = (hash ^ inPayload[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// A slow command: say it's still being worked on every wtx interval
+// until its answer is due (the queue is fifo, so they all go before it).
+// Only with the ntf the host takes as a wtx (UCI_WTX_NTF_OID)
+//
+static void _sim_wtx(uwbsim_t *sim, uint32_t inUntil)
+{
+#ifdef UCI_WTX_NTF_OID
+    uint32_t at;
+    int sent = 0;
+
+    if (!sim->config.wtx_interval_us)
+    {
+        return;
+    }
+    for (at = sim->config.wtx_interval_us; at < inUntil && sent < (UWBSIM_QUEUE_DEPTH / 2); at += sim->config.wtx_interval_us)
+    {
+        if (!_sim_queue_uci(sim, UCI_MT_NTF, UCI_GID_PROPRIETARY, UCI_WTX_NTF_OID, NULL, 0, at))
+        {
+            break;
+        }
+        sim->stats.wtx_ntfs++;
+        sent++;
+    }
+#endif
+}
+
+static void _sim_uci_command(uwbsim_t *sim, const uint8_t *inHdr, const uint8_t *inPayload, const int inCount)
+{
+    uint8_t mt;
+    uint8_t gid;
+    uint8_t oid;
+    uint8_t rsp[32];
+    int rsplen;
+    uint32_t ntfdelay;
+    uint32_t rspdelay;
+    uint32_t hash;
+
+    mt  = (inHdr[0] & UCI_MT_MASK) >> UCI_MT_SHIFT;
+    gid = inHdr[0] & UCI_GID_MASK;
+    oid = inHdr[1] & UCI_OID_MASK;
+
+    if (mt == UCI_MT_DATA)
+    {
+        _sim_data(sim, gid, inPayload, inCount);
+        return;
+    }
+
+    sim->stats.cmds++;
+
+    if (mt != UCI_MT_CMD)
+    {
+        // what a running uwbs says to an hbci probe
+        _sim_generic_error(sim, UCI_STATUS_SYNTAX_ERROR, sim->config.rsp_delay_us);
+        return;
+    }
+
+    sim->cmd_count++;
+
+    hash = _sim_cmd_hash(inHdr, inPayload, inCount);
+    if (hash == sim->cmd_hash && _sim_now_us() < sim->rsp_due)
+    {
+        LOG_WRN("Sim %d got %02X %02X again before answering it", sim->unit, inHdr[0], inHdr[1]);
+        sim->stats.dup_cmds++;
+    }
+    sim->cmd_hash = hash;
+
+    if (sim->replaying)
+    {
+        _sim_replay_command(sim, gid, oid);
+        return;
+    }
+
+    if (sim->config.hang_after && sim->cmd_count >= sim->config.hang_after)
+    {
+        sim->config.hang_after = 0;
+        _sim_hang(sim);
+        return;
+    }
+
+    if (sim->config.resend_every && !(sim->cmd_count % sim->config.resend_every))
+    {
+        sim->stats.resends++;
+        _sim_generic_error(sim, UCI_STATUS_COMMAND_RETRY, sim->config.rsp_delay_us);
+        return;
+    }
+
+    rsp[0] = UCI_STATUS_OK;
+    rsplen = 1;
+    ntfdelay = sim->config.ntf_delay_us;
+    rspdelay = sim->config.rsp_delay_us;
+
+    if (sim->config.slow_every && !(sim->cmd_count % sim->config.slow_every))
+    {
+        sim->stats.slow_cmds++;
+        rspdelay = sim->config.slow_delay_us;
+        _sim_wtx(sim, rspdelay);
+    }
+
+    switch (gid)
+    {
+    case UCI_GID_CORE:
+        switch (oid)
+        {
+        case UCI_MSG_CORE_DEVICE_RESET:
+            sim->host_max = 0;
+            sim->ranging = false;
+            k_timer_stop(&sim->rangeTimer);
+            _sim_queue_uci(sim, UCI_MT_RSP, gid, oid, rsp, rsplen, rspdelay);
+            _sim_device_status(sim, 0x01, ntfdelay);
+            return;
+        case UCI_MSG_CORE_DEVICE_INFO:
+            // status, uci/mac/phy/test versions, no vendor info
+            memset(rsp, 0, 10);
+            rsp[1] = 0x02;
+            rsp[3] = 0x02;
+            rsp[5] = 0x02;
+            rsp[7] = 0x02;
+            rsplen = 10;
+            break;
+        case UCI_MSG_CORE_GET_CAPS_INFO:
+            // just the nxp packet and in-band data sizes
+            rsp[1] = 0;
+            rsplen = 2;
+            if (sim->config.max_payload)
+            {
+                static const uint8_t caps[] = {
+                    EXTENDED_CAP_INFO_ID, UCI_EXT_PARAM_ID_UWBS_MAX_UCI_PAYLOAD_LENGTH, 2, 0, 0,
+                    EXTENDED_CAP_INFO_ID, UCI_EXT_PARAM_ID_UWBS_INBAND_DATA_BUFFER_BLOCK_SIZE, 1, 0x80,
+                    EXTENDED_CAP_INFO_ID, UCI_EXT_PARAM_ID_UWBS_INBAND_DATA_MAX_BLOCKS, 1, 0x08
+                };
+
+                memcpy(rsp + rsplen, caps, sizeof(caps));
+                rsp[rsplen + 3] = sim->config.max_payload & 0xFF;
+                rsp[rsplen + 4] = sim->config.max_payload >> 8;
+                rsp[1] = 3;
+                rsplen += sizeof(caps);
+            }
+            break;
+        case UCI_MSG_CORE_SET_CONFIG:
+            _sim_set_config(sim, inPayload, inCount);
+            // no tlvs
+            rsp[1] = 0;
+            rsplen = 2;
+            break;
+        default:
+            break;
+        }
+        break;
+
+    case UCI_GID_SESSION_MANAGE:
+        switch (oid)
+        {
+        case UCI_MSG_SESSION_INIT:
+            if (inCount >= 4)
+            {
+                memcpy(&sim->session_id, inPayload, 4);
+            }
+            // nxp returns the session handle in the response
+            memcpy(rsp + 1, &sim->session_id, 4);
+            rsplen = 5;
+            _sim_queue_uci(sim, UCI_MT_RSP, gid, oid, rsp, rsplen, rspdelay);
+            _sim_session_status(sim, UWB_SESSION_INITIALIZED, ntfdelay);
+            return;
+        case UCI_MSG_SESSION_SET_APP_CONFIG:
+            rsp[1] = 0;
+            rsplen = 2;
+            break;
+        case UCI_MSG_SESSION_DEINIT:
+            // real part doesn't notify this one
+            sim->ranging = false;
+            k_timer_stop(&sim->rangeTimer);
+            break;
+        default:
+            break;
+        }
+        break;
+
+    case UCI_GID_RANGE_MANAGE:
+        switch (oid)
+        {
+        case UCI_MSG_RANGE_START:
+            _sim_queue_uci(sim, UCI_MT_RSP, gid, oid, rsp, rsplen, rspdelay);
+            _sim_session_status(sim, UWB_SESSION_ACTIVE, ntfdelay);
+            _sim_start_ranging(sim);
+            return;
+        case UCI_MSG_RANGE_STOP:
+            sim->ranging = false;
+            k_timer_stop(&sim->rangeTimer);
+            _sim_queue_uci(sim, UCI_MT_RSP, gid, oid, rsp, rsplen, rspdelay);
+            _sim_session_status(sim, UWB_SESSION_IDLE, ntfdelay);
+            return;
+        default:
+            break;
+        }
+        break;
+
+    case UCI_GID_PROPRIETARY_SE:
+        switch (oid)
+        {
+        case EXT_UCI_MSG_READ_CALIB_DATA_CMD:
+            _sim_queue_uci(sim, UCI_MT_RSP, gid, oid, rsp, rsplen, rspdelay);
+            if (inCount >= 3 && inPayload[2] == 0x02)
+            {
+                // xtal cap
+                static const uint8_t xtal[] = { 0x00, 0x03, 0x24, 0x0F, 0x24 };
+                _sim_queue_uci(sim, UCI_MT_NTF, gid, oid, xtal, sizeof(xtal), ntfdelay);
+            }
+            else
+            {
+                // tx power
+                static const uint8_t power[] = { 0x00, 0x02, 0x08, 0x00, 0x00, 0x00 };
+                _sim_queue_uci(sim, UCI_MT_NTF, gid, oid, power, sizeof(power), ntfdelay);
+            }
+            return;
+        case EXT_UCI_MSG_SET_PROFILE:
+            sim->session_id = UWBSIM_PROFILE_SESSION_HANDLE;
+            memcpy(rsp + 1, &sim->session_id, 4);
+            rsplen = 5;
+            _sim_queue_uci(sim, UCI_MT_RSP, gid, oid, rsp, rsplen, rspdelay);
+            _sim_session_status(sim, UWB_SESSION_INITIALIZED, ntfdelay);
+            return;
+        default:
+            break;
+        }
+        break;
+
+    case UCI_GID_PROPRIETARY:
+        if (oid == 0x00)
+        {
+            // board variant, the part re-inits and says ready
+            _sim_queue_uci(sim, UCI_MT_RSP, gid, oid, rsp, rsplen, rspdelay);
+            _sim_device_status(sim, 0x01, ntfdelay);
+            return;
+        }
+        break;
+
+    default:
+        // app/debug config, calibrations, vendor: just ok them
+        break;
+    }
+
+    _sim_queue_uci(sim, UCI_MT_RSP, gid, oid, rsp, rsplen, rspdelay);
+}
+
+// Bytes from the host in uci mode.  Header and payload can come in
+// one transaction or two, and a command can be PBF fragmented
+//
+static int _sim_pkt_payload(const uint8_t *inHdr)
+{
+    if ((inHdr[0] & UCI_MT_MASK) == UCI_MTS_DAT)
+    {
+        return inHdr[2] | (inHdr[3] << 8);
+    }
+    if (inHdr[1] & UCI_EXT_MASK)
+    {
+        return (inHdr[2] << 8) | inHdr[3];
+    }
+    return inHdr[3];
+}
+
+static void _sim_uci(uwbsim_t *sim, const uint8_t *inData, const int inCount)
+{
+    int need;
+    int take;
+    int len = 0;
+    int used = 0;
+
+    while (used < inCount)
+    {
+        if (sim->pktlen >= UCI_MSG_HDR_SIZE)
+        {
+            len = _sim_pkt_payload(sim->pkt);
+            if (len > (int)(sizeof(sim->pkt) - UCI_MSG_HDR_SIZE))
+            {
+                // bigger than any the part takes, lose it
+                LOG_WRN("Sim %d dropping %d byte packet", sim->unit, len);
+                sim->pktlen = 0;
+                sim->cmdlen = 0;
+                break;
+            }
+        }
+        need = (sim->pktlen < UCI_MSG_HDR_SIZE) ? UCI_MSG_HDR_SIZE : UCI_MSG_HDR_SIZE + len;
+        take = need - sim->pktlen;
+        if (take > (inCount - used))
+        {
+            take = inCount - used;
+        }
+
+        memcpy(sim->pkt + sim->pktlen, inData + used, take);
+        sim->pktlen += take;
+        used += take;
+
+        if (sim->pktlen < UCI_MSG_HDR_SIZE)
+        {
+            break;
+        }
+        len = _sim_pkt_payload(sim->pkt);
+        if (sim->pktlen < (UCI_MSG_HDR_SIZE + len))
+        {
+            continue;
+        }
+
+        // have a whole packet
+        //
+        if (sim->cmdlen == 0)
+        {
+            memcpy(sim->cmdhdr, sim->pkt, UCI_MSG_HDR_SIZE);
+        }
+        if ((sim->cmdlen + len) <= sizeof(sim->cmd))
+        {
+            memcpy(sim->cmd + sim->cmdlen, sim->pkt + UCI_MSG_HDR_SIZE, len);
+            sim->cmdlen += len;
+        }
+
+        if (!(sim->pkt[0] & UCI_PBF_MASK))
+        {
+            _sim_uci_command(sim, sim->cmdhdr, sim->cmd, sim->cmdlen);
+            sim->cmdlen = 0;
+        }
+        sim->pktlen = 0;
+    }
+}
+
+static void _sim_power(uwbsim_t *sim, bool inOn)
+{
+    sim->mode = SIM_OFF;
+    sim->sync_ready = false;
+    sim->hif = false;
+    sim->fw_expect_payload = false;
+    sim->fw_done = false;
+    sim->fw_start = 0;
+    sim->fw_installed = 0;
+    sim->pktlen = 0;
+    sim->cmdlen = 0;
+    sim->cmd_count = 0;
+    sim->host_max = 0;
+    sim->ranging = false;
+
+    k_timer_stop(&sim->rangeTimer);
+    k_timer_stop(&sim->bootTimer);
+    k_timer_stop(&sim->dpdTimer);
+    k_timer_stop(&sim->bulkTimer);
+    sim->bulk_remaining = 0;
+    _sim_flush(sim);
+
+    if (inOn)
+    {
+        sim->stats.boot_last_us = sim->config.boot_delay_us + _sim_jitter(sim);
+        k_timer_start(&sim->bootTimer, K_USEC(sim->stats.boot_last_us), K_NO_WAIT);
+    }
+}
+
+// nrfspi sim peer callbacks, from the host thread
+//
+static void _sim_ce(void *inContext, bool inActive)
+{
+    uwbsim_t *sim = (uwbsim_t *)inContext;
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    sim->ce = inActive;
+    _sim_power(sim, inActive);
+    _sim_kick(sim);
+
+    k_spin_unlock(&sim->lock, key);
+}
+
+static void _sim_sync(void *inContext, bool inActive)
+{
+    uwbsim_t *sim = (uwbsim_t *)inContext;
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    sim->sync = inActive;
+    sim->sync_ready = false;
+    k_timer_stop(&sim->readyTimer);
+
+    if (inActive && sim->mode == SIM_DPD)
+    {
+        // sync is the dpd wakeup source, up again after dpd_wake_us
+        k_timer_start(&sim->dpdTimer, K_USEC(sim->config.dpd_wake_us), K_NO_WAIT);
+    }
+    else if (inActive)
+    {
+        // ack sync by dropping irq, it comes back when read-ready
+        if (sim->irq)
+        {
+            _sim_set_irq(sim, false);
+        }
+        k_timer_start(&sim->readyTimer, K_USEC(sim->config.ready_delay_us), K_NO_WAIT);
+    }
+    else if (sim->rdoff > 0)
+    {
+        // host is done with this message, even if it didn't read it all
+        _sim_pop(sim);
+    }
+
+    _sim_kick(sim);
+    k_spin_unlock(&sim->lock, key);
+}
+
+static void _sim_write(void *inContext, const uint8_t *inData, const int inCount)
+{
+    uwbsim_t *sim = (uwbsim_t *)inContext;
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    sim->stats.bytes_in += inCount;
+
+    if (sim->rdoff > 0)
+    {
+        // abandoned a partly read message
+        _sim_pop(sim);
+    }
+
+    switch (sim->mode)
+    {
+    case SIM_HBCI:
+        _sim_hbci(sim, inData, inCount);
+        break;
+    case SIM_UCI:
+        _sim_uci(sim, inData, inCount);
+        break;
+    case SIM_DPD:
+        // asleep, nothing is listening
+        sim->stats.lost_in_dpd++;
+        break;
+    default:
+        // off or hung, ignore
+        break;
+    }
+
+    _sim_activity(sim);
+    _sim_kick(sim);
+    k_spin_unlock(&sim->lock, key);
+}
+
+static void _sim_read(void *inContext, uint8_t *outData, const int inCount)
+{
+    uwbsim_t *sim = (uwbsim_t *)inContext;
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+    uwbsim_msg_t *msg;
+    int count;
+
+    sim->stats.bytes_out += inCount;
+
+    if (sim->count > 0 && sim->queue[sim->head].due <= _sim_now_us())
+    {
+        msg = &sim->queue[sim->head];
+
+        count = msg->len - sim->rdoff;
+        if (count > inCount)
+        {
+            count = inCount;
+        }
+        if (count > 0)
+        {
+            memcpy(outData, msg->data + sim->rdoff, count);
+            sim->rdoff += count;
+        }
+
+        if (sim->rdoff >= msg->len)
+        {
+            _sim_pop(sim);
+            if (sim->irq)
+            {
+                _sim_set_irq(sim, false);
+            }
+        }
+    }
+
+    _sim_activity(sim);
+    _sim_kick(sim);
+    k_spin_unlock(&sim->lock, key);
+}
+
+static const nrfspi_sim_peer_t mSimPeer =
+{
+    .ce     = _sim_ce,
+    .sync   = _sim_sync,
+    .write  = _sim_write,
+    .read   = _sim_read,
+};
+
+// timers, isr context
+//
+static void _sim_boot_expiry(struct k_timer *timer)
+{
+    uwbsim_t *sim = CONTAINER_OF(timer, uwbsim_t, bootTimer);
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    if (sim->ce && sim->mode == SIM_OFF)
+    {
+        sim->mode = SIM_HBCI;
+    }
+
+    k_spin_unlock(&sim->lock, key);
+}
+
+static void _sim_irq_expiry(struct k_timer *timer)
+{
+    uwbsim_t *sim = CONTAINER_OF(timer, uwbsim_t, irqTimer);
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    _sim_kick(sim);
+    k_spin_unlock(&sim->lock, key);
+}
+
+static void _sim_ready_expiry(struct k_timer *timer)
+{
+    uwbsim_t *sim = CONTAINER_OF(timer, uwbsim_t, readyTimer);
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    if (sim->sync)
+    {
+        sim->sync_ready = true;
+    }
+    _sim_kick(sim);
+    k_spin_unlock(&sim->lock, key);
+}
+
+static void _sim_range_expiry(struct k_timer *timer)
+{
+    uwbsim_t *sim = CONTAINER_OF(timer, uwbsim_t, rangeTimer);
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+    uint32_t i;
+
+    if (sim->ranging && sim->mode == SIM_UCI)
+    {
+        for (i = 0; i < sim->config.range_burst || i == 0; i++)
+        {
+            _sim_range_ntf(sim);
+        }
+        _sim_kick(sim);
+    }
+    k_spin_unlock(&sim->lock, key);
+}
+
+static void _sim_dpd_expiry(struct k_timer *timer)
+{
+    uwbsim_t *sim = CONTAINER_OF(timer, uwbsim_t, dpdTimer);
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    if (sim->mode == SIM_DPD)
+    {
+        sim->stats.dpd_wakes++;
+        sim->mode = SIM_UCI;
+        _sim_activity(sim);
+    }
+    else if (sim->mode == SIM_UCI)
+    {
+        if (!sim->ranging && !sim->sync && sim->count == 0 && !sim->bulk_remaining)
+        {
+            sim->stats.dpd_entries++;
+            sim->mode = SIM_DPD;
+        }
+        else
+        {
+            _sim_activity(sim);
+        }
+    }
+    k_spin_unlock(&sim->lock, key);
+}
+
+// Keep the queue topped up with bulk notifications while there is
+// room for a whole one
+//
+static void _sim_bulk_expiry(struct k_timer *timer)
+{
+    uwbsim_t *sim = CONTAINER_OF(timer, uwbsim_t, bulkTimer);
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+    static uint8_t ntf[UCI_MAX_DATA_PACKET_SIZE];
+    uwbsim_msg_t *msg;
+    int frag;
+    int pkts;
+    int i;
+
+    frag = _sim_frag(sim);
+    pkts = (sim->bulk_size + frag - 1) / frag;
+
+    while (
+            sim->mode == SIM_UCI
+        &&  sim->bulk_remaining
+        &&  (sim->count + pkts) <= UWBSIM_QUEUE_DEPTH
+    )
+    {
+        sim->bulk_seq++;
+        memcpy(ntf, &sim->bulk_seq, 4);
+        for (i = 4; i < sim->bulk_size; i++)
+        {
+            ntf[i] = (uint8_t)(i + sim->bulk_seq);
+        }
+
+        msg = _sim_queue_uci(sim, UCI_MT_NTF, UWBSIM_BULK_GID, UWBSIM_BULK_OID, ntf, sim->bulk_size, 0);
+        if (!msg)
+        {
+            break;
+        }
+
+        sim->stats.bulk_ntfs++;
+        sim->stats.bulk_bytes += sim->bulk_size;
+        if (--sim->bulk_remaining == 0)
+        {
+            msg->action = SIM_ACT_BULK_DONE;
+            k_timer_stop(&sim->bulkTimer);
+        }
+    }
+
+    _sim_kick(sim);
+    k_spin_unlock(&sim->lock, key);
+}
+
+int UWBsimBulk(int inUnit, uint32_t inCount, uint32_t inSize)
+{
+    uwbsim_t *sim;
+    k_spinlock_key_t key;
+    int ret = -EINVAL;
+
+    require(inUnit >= 0 && inUnit < mSimDevices, exit);
+    require(inSize >= 4 && inSize <= UCI_MAX_DATA_PACKET_SIZE, exit);
+
+    sim = &mSim[inUnit];
+    key = k_spin_lock(&sim->lock);
+
+    if (sim->mode == SIM_UCI)
+    {
+        sim->bulk_remaining = inCount;
+        sim->bulk_size = inSize;
+        sim->bulk_start = _sim_now_us();
+        sim->stats.bulk_ntfs = 0;
+        sim->stats.bulk_bytes = 0;
+        sim->stats.bulk_us = 0;
+        k_timer_start(&sim->bulkTimer, K_NO_WAIT, K_USEC(UWBSIM_BULK_POLL_US));
+        ret = 0;
+    }
+    else
+    {
+        ret = -EAGAIN;
+    }
+
+    k_spin_unlock(&sim->lock, key);
+exit:
+    return ret;
+}
+
+static void _sim_replay_expiry(struct k_timer *timer)
+{
+    uwbsim_t *sim = CONTAINER_OF(timer, uwbsim_t, replayTimer);
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    if (sim->mode == SIM_UCI)
+    {
+        _sim_replay_run(sim);
+        _sim_kick(sim);
+    }
+    k_spin_unlock(&sim->lock, key);
+}
+
+void UWBsimReplayClear(void)
+{
+    int unit;
+
+    for (unit = 0; unit < mSimDevices; unit++)
+    {
+        UWBsimReplayStop(unit);
+    }
+    mSimReplayLen = 0;
+}
+
+int UWBsimReplayLoad(const uint8_t *inData, int inCount)
+{
+    int ret = -ENOMEM;
+
+    require((mSimReplayLen + inCount) <= sizeof(mSimReplay), exit);
+
+    memcpy(mSimReplay + mSimReplayLen, inData, inCount);
+    mSimReplayLen += inCount;
+    ret = 0;
+exit:
+    return ret;
+}
+
+int UWBsimReplayCapture(void)
+{
+    uint32_t pos = 0;
+    int size;
+
+    UWBsimReplayClear();
+
+    while ((size = UCIcapNext(&pos, mSimReplay + mSimReplayLen, sizeof(mSimReplay) - mSimReplayLen)) > 0)
+    {
+        mSimReplayLen += size;
+    }
+    return mSimReplayLen;
+}
+
+// Messages from the uwbs in the capture that were cut at the snap
+// length, they can't be sent as they were.  What came before the
+// first command isn't sent, the sim boots itself
+//
+static int _sim_replay_cut(int inFromUnit, uint32_t *outLongest)
+{
+    uci_cap_rec_t rec;
+    bool sent = false;
+    int pos;
+    int cut = 0;
+
+    for (pos = 0; (pos + (int)sizeof(rec)) <= mSimReplayLen; pos += rec.size)
+    {
+        memcpy(&rec, mSimReplay + pos, sizeof(rec));
+        if (rec.size < sizeof(rec))
+        {
+            break;
+        }
+        if (rec.unit != inFromUnit)
+        {
+            continue;
+        }
+        if (rec.dir == UCI_CAP_TX)
+        {
+            sent = true;
+        }
+        else if (sent && rec.length > (rec.size - sizeof(rec)))
+        {
+            cut++;
+            *outLongest = MAX(*outLongest, rec.length);
+        }
+    }
+    return cut;
+}
+
+int UWBsimReplay(int inUnit, int inFromUnit)
+{
+    uci_cap_rec_t rec;
+    uwbsim_t *sim;
+    k_spinlock_key_t key;
+    uint32_t longest = 0;
+    int cut;
+    int ret = -EINVAL;
+
+    require(inUnit >= 0 && inUnit < mSimDevices, exit);
+    require(mSimReplayLen > 0, exit);
+
+    // the host would be sent something other than what it was, and a
+    // length that doesn't match the payload
+    //
+    cut = _sim_replay_cut(inFromUnit, &longest);
+    if (cut)
+    {
+        LOG_ERR("Capture has %d uwbs messages cut at the snap length, up to %u bytes, capture with "
+                "ucicap start %u to replay it", cut, longest, longest);
+        ret = -EMSGSIZE;
+        goto exit;
+    }
+
+    sim = &mSim[inUnit];
+    key = k_spin_lock(&sim->lock);
+
+    sim->replaying = true;
+    sim->replay_from = inFromUnit;
+    sim->replay_pos = 0;
+    sim->replay_start = _sim_now_us();
+    sim->stats.replay_msgs = 0;
+    sim->stats.replay_bytes = 0;
+    sim->stats.replay_mismatched = 0;
+    sim->stats.replay_skipped = 0;
+    sim->stats.replay_us = 0;
+
+    // what it said before the first command was its boot, which the
+    // sim does itself
+    //
+    while (_sim_replay_rec(sim, &sim->replay_pos, &rec) && rec.dir != UCI_CAP_TX)
+    {
+        sim->replay_pos += rec.size;
+    }
+
+    k_spin_unlock(&sim->lock, key);
+    ret = 0;
+exit:
+    return ret;
+}
+
+void UWBsimReplayStop(int inUnit)
+{
+    uwbsim_t *sim;
+    k_spinlock_key_t key;
+
+    if (inUnit < 0 || inUnit >= mSimDevices)
+    {
+        return;
+    }
+
+    sim = &mSim[inUnit];
+    key = k_spin_lock(&sim->lock);
+    sim->replaying = false;
+    k_timer_stop(&sim->replayTimer);
+    k_spin_unlock(&sim->lock, key);
+}
+
+void UWBsimGetConfig(uwbsim_config_t *outConfig)
+{
+    uwbsim_t *sim = &mSim[0];
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    *outConfig = sim->config;
+    k_spin_unlock(&sim->lock, key);
+}
+
+static void _sim_configure(uwbsim_t *sim, const uwbsim_config_t *inConfig)
+{
+    k_spinlock_key_t key = k_spin_lock(&sim->lock);
+
+    sim->config = *inConfig;
+    if (sim->ranging)
+    {
+        // pick up a new rate
+        k_timer_start(&sim->rangeTimer,
+                    K_USEC(sim->config.range_interval_us), K_USEC(sim->config.range_interval_us));
+    }
+
+    k_spin_unlock(&sim->lock, key);
+
+    NRFSPIsimSetFailAbove(sim->unit, inConfig->spi_fail_hz);
+}
+
+int UWBsimConfigure(const uwbsim_config_t *inConfig)
+{
+    int ret = -EINVAL;
+    int unit;
+
+    require(inConfig, exit);
+    require(inConfig->range_interval_us >= 1000, exit);
+    require(inConfig->ready_delay_us < 1000, exit);
+    require(inConfig->max_payload <= UCI_MAX_DATA_PACKET_SIZE, exit);
+
+    // every simulated uwbs behaves the same, new ones copy unit 0
+    //
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        _sim_configure(&mSim[unit], inConfig);
+    }
+    ret = 0;
+exit:
+    return ret;
+}
+
+int UWBsimGetStats(int inUnit, uwbsim_stats_t *outStats)
+{
+    uwbsim_t *sim;
+    k_spinlock_key_t key;
+    int ret = -EINVAL;
+
+    require(inUnit >= 0 && inUnit < mSimDevices, exit);
+
+    sim = &mSim[inUnit];
+    key = k_spin_lock(&sim->lock);
+    *outStats = sim->stats;
+    k_spin_unlock(&sim->lock, key);
+    ret = 0;
+exit:
+    return ret;
+}
+
+void UWBsimResetStats(void)
+{
+    uwbsim_t *sim;
+    k_spinlock_key_t key;
+    int unit;
+
+    for (unit = 0; unit < NRFSPI_MAX_DEVICES; unit++)
+    {
+        sim = &mSim[unit];
+        key = k_spin_lock(&sim->lock);
+        memset(&sim->stats, 0, sizeof(sim->stats));
+        k_spin_unlock(&sim->lock, key);
+    }
+}
+
+void UWBsimHang(int inUnit)
+{
+    uwbsim_t *sim;
+    k_spinlock_key_t key;
+
+    if (inUnit < 0 || inUnit >= mSimDevices)
+    {
+        return;
+    }
+
+    sim = &mSim[inUnit];
+    key = k_spin_lock(&sim->lock);
+
+    if (sim->mode == SIM_UCI)
+    {
+        _sim_hang(sim);
+        _sim_kick(sim);
+    }
+    k_spin_unlock(&sim->lock, key);
+}
+
+#ifdef CONFIG_SHELL
+
+#include <zephyr/shell/shell.h>
+
+#define UWBSIM_PARAM(name, field) { name, offsetof(uwbsim_config_t, field), sizeof(((uwbsim_config_t *)0)->field) }
+
+static const struct
+{
+    const char *name;
+    size_t      offset;
+    size_t      size;
+}
+mSimParams[] =
+{
+    UWBSIM_PARAM("boot",        boot_delay_us),
+    UWBSIM_PARAM("install",     install_delay_us),
+    UWBSIM_PARAM("flash",       flash_delay_us),
+    UWBSIM_PARAM("jitter",      jitter_us),
+    UWBSIM_PARAM("rsp",         rsp_delay_us),
+    UWBSIM_PARAM("ack",         ack_delay_us),
+    UWBSIM_PARAM("ntf",         ntf_delay_us),
+    UWBSIM_PARAM("ready",       ready_delay_us),
+    UWBSIM_PARAM("frag",        frag_size),
+    UWBSIM_PARAM("interval",    range_interval_us),
+    UWBSIM_PARAM("burst",       range_burst),
+    UWBSIM_PARAM("resend",      resend_every),
+    UWBSIM_PARAM("slow",        slow_every),
+    UWBSIM_PARAM("slowdelay",   slow_delay_us),
+    UWBSIM_PARAM("wtx",         wtx_interval_us),
+    UWBSIM_PARAM("rangeerr",    range_error_every),
+    UWBSIM_PARAM("errstatus",   range_error_status),
+    UWBSIM_PARAM("hang",        hang_after),
+    UWBSIM_PARAM("spifail",     spi_fail_hz),
+    UWBSIM_PARAM("dpd",         dpd_timeout_us),
+    UWBSIM_PARAM("dpdwake",     dpd_wake_us),
+    UWBSIM_PARAM("maxpayload",  max_payload),
+    UWBSIM_PARAM("datadelay",   data_delay_us),
+    UWBSIM_PARAM("loopback",    data_loopback),
+    UWBSIM_PARAM("chipid",      chip_id),
+    UWBSIM_PARAM("heliosid",    helios_id),
+};
+
+static uint32_t _sim_param_get(const uwbsim_config_t *inConfig, int inIndex)
+{
+    const uint8_t *field = (const uint8_t *)inConfig + mSimParams[inIndex].offset;
+
+    switch (mSimParams[inIndex].size)
+    {
+    case 1:     return *field;
+    case 2:     return *(const uint16_t *)field;
+    default:    return *(const uint32_t *)field;
+    }
+}
+
+static void _sim_param_set(uwbsim_config_t *inConfig, int inIndex, uint32_t inValue)
+{
+    uint8_t *field = (uint8_t *)inConfig + mSimParams[inIndex].offset;
+
+    switch (mSimParams[inIndex].size)
+    {
+    case 1:     *field = (uint8_t)inValue; break;
+    case 2:     *(uint16_t *)field = (uint16_t)inValue; break;
+    default:    *(uint32_t *)field = inValue; break;
+    }
+}
+
+static int _CmdSimShow( const struct shell *shell, size_t argc, char **argv )
+{
+    uwbsim_config_t config;
+    int i;
+
+    UWBsimGetConfig(&config);
+
+    for (i = 0; i < ARRAY_SIZE(mSimParams); i++)
+    {
+        shell_print(shell, "%-10s %u", mSimParams[i].name, _sim_param_get(&config, i));
+    }
+    return 0;
+}
+
+static int _CmdSimSet( const struct shell *shell, size_t argc, char **argv )
+{
+    uwbsim_config_t config;
+    int i;
+
+    UWBsimGetConfig(&config);
+
+    for (i = 0; i < ARRAY_SIZE(mSimParams); i++)
+    {
+        if (!strcmp(argv[1], mSimParams[i].name))
+        {
+            _sim_param_set(&config, i, strtoul(argv[2], NULL, 0));
+            if (UWBsimConfigure(&config))
+            {
+                shell_error(shell, "Bad value");
+                return -EINVAL;
+            }
+            return 0;
+        }
+    }
+
+    shell_error(shell, "No param %s", argv[1]);
+    return -EINVAL;
+}
+
+static int _CmdSimStats( const struct shell *shell, size_t argc, char **argv )
+{
+    uwbsim_t *sim;
+    uwbsim_stats_t *stats;
+    int unit;
+
+    for (unit = 0; unit < mSimDevices; unit++)
+    {
+        sim = &mSim[unit];
+        stats = &sim->stats;
+
+        shell_print(shell, "Unit %d  mode %d  ranging=%d  queued=%d (max %u)  dropped=%u",
+                    unit, sim->mode, sim->ranging, sim->count, stats->max_depth, stats->dropped);
+        shell_print(shell, "Cmds=%u rsps=%u ntfs=%u  range ntfs=%u (errors %u)",
+                    stats->cmds, stats->rsps, stats->ntfs, stats->range_ntfs, stats->range_errors);
+        shell_print(shell, "Injected resends=%u hangs=%u  slow cmds=%u wtx ntfs=%u  cmds repeated before answered=%u",
+                    stats->resends, stats->hangs, stats->slow_cmds, stats->wtx_ntfs, stats->dup_cmds);
+        shell_print(shell, "FW bytes=%u chunks=%u in %lluus (%u KB/s)  lrc errors=%u  bus in=%llu out=%llu",
+                    stats->fw_bytes, stats->fw_chunks, stats->fw_us,
+                    stats->fw_us ? (uint32_t)(((uint64_t)stats->fw_bytes * 1000) / stats->fw_us) : 0,
+                    stats->fw_lrc_errors, stats->bytes_in, stats->bytes_out);
+        shell_print(shell, "Last boot %uus install %uus  writes while installing=%u",
+                    stats->boot_last_us, stats->install_last_us, stats->fw_ignored);
+        shell_print(shell, "DPD entries=%u wakes=%u  writes lost in dpd=%u",
+                    stats->dpd_entries, stats->dpd_wakes, stats->lost_in_dpd);
+        shell_print(shell, "Bulk ntfs=%u bytes=%llu in %lluus (%u KB/s)%s",
+                    stats->bulk_ntfs, stats->bulk_bytes, stats->bulk_us,
+                    stats->bulk_us ? (uint32_t)((stats->bulk_bytes * 1000) / stats->bulk_us) : 0,
+                    sim->bulk_remaining ? " running" : "");
+        shell_print(shell, "Replay msgs=%u bytes=%llu in %lluus (%u msgs/s)  mismatched=%u skipped=%u%s",
+                    stats->replay_msgs, stats->replay_bytes, stats->replay_us,
+                    stats->replay_us ? (uint32_t)(((uint64_t)stats->replay_msgs * 1000000) / stats->replay_us) : 0,
+                    stats->replay_mismatched, stats->replay_skipped,
+                    sim->replaying ? " running" : "");
+        shell_print(shell, "Data msgs=%u bytes=%llu errors=%u  looped back=%u",
+                    stats->data_msgs, stats->data_bytes, stats->data_errors, stats->data_loops);
+    }
+    return 0;
+}
+
+static int _CmdSimReset( const struct shell *shell, size_t argc, char **argv )
+{
+    UWBsimResetStats();
+    return 0;
+}
+
+static int _CmdSimHang( const struct shell *shell, size_t argc, char **argv )
+{
+    int unit = 0;
+
+    if (argc > 1)
+    {
+        unit = strtoul(*++argv, NULL, 0);
+    }
+    UWBsimHang(unit);
+    return 0;
+}
+
+static int _CmdSimBulk( const struct shell *shell, size_t argc, char **argv )
+{
+    uint32_t count = strtoul(*++argv, NULL, 0);
+    uint32_t size = UWBSIM_BULK_SIZE;
+    int unit = 0;
+    int ret;
+
+    if (argc > 2)
+    {
+        size = strtoul(*++argv, NULL, 0);
+    }
+    if (argc > 3)
+    {
+        unit = strtoul(*++argv, NULL, 0);
+    }
+
+    ret = UWBsimBulk(unit, count, size);
+    if (ret)
+    {
+        shell_error(shell, "Can't send bulk on unit %d (%d), firmware has to be running", unit, ret);
+    }
+    return ret;
+}
+
+static int _CmdSimReplayClear( const struct shell *shell, size_t argc, char **argv )
+{
+    UWBsimReplayClear();
+    return 0;
+}
+
+static int _CmdSimReplayLoad( const struct shell *shell, size_t argc, char **argv )
+{
+    uint8_t data[128];
+    const char *hex = *++argv;
+    size_t count;
+    int ret;
+
+    count = hex2bin(hex, strlen(hex), data, sizeof(data));
+    if (!count)
+    {
+        shell_error(shell, "Not hex, or more than %d bytes", (int)sizeof(data));
+        return -EINVAL;
+    }
+
+    ret = UWBsimReplayLoad(data, count);
+    if (ret)
+    {
+        shell_error(shell, "Replay buffer full (%d bytes)", UWBSIM_REPLAY_SIZE);
+    }
+    return ret;
+}
+
+static int _CmdSimReplayCapture( const struct shell *shell, size_t argc, char **argv )
+{
+    shell_print(shell, "%d bytes from the capture", UWBsimReplayCapture());
+    return 0;
+}
+
+static int _CmdSimReplayStart( const struct shell *shell, size_t argc, char **argv )
+{
+    int unit = 0;
+    int from;
+    int ret;
+
+    if (argc > 1)
+    {
+        unit = strtoul(*++argv, NULL, 0);
+    }
+    from = unit;
+    if (argc > 2)
+    {
+        from = strtoul(*++argv, NULL, 0);
+    }
+
+    ret = UWBsimReplay(unit, from);
+    if (ret == -EMSGSIZE)
+    {
+        shell_error(shell, "Capture was cut at its snap length, can't replay it");
+    }
+    else if (ret)
+    {
+        shell_error(shell, "Can't replay on unit %d (%d), nothing loaded?", unit, ret);
+    }
+    return ret;
+}
+
+static int _CmdSimReplayStop( const struct shell *shell, size_t argc, char **argv )
+{
+    int unit = 0;
+
+    if (argc > 1)
+    {
+        unit = strtoul(*++argv, NULL, 0);
+    }
+    UWBsimReplayStop(unit);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_uwbsim_replay,
+    SHELL_CMD(clear, NULL,       " Empty the replay buffer\n", _CmdSimReplayClear),
+    SHELL_CMD_ARG(load, NULL,    " Add capture bytes (use uwbsim replay load <hex>)\n", _CmdSimReplayLoad, 2, 0),
+    SHELL_CMD(capture, NULL,     " Load what ucicap has captured\n", _CmdSimReplayCapture),
+    SHELL_CMD_ARG(start, NULL,   " Answer commands from the capture (use uwbsim replay start [unit] [captured unit])\n", _CmdSimReplayStart, 1, 2),
+    SHELL_CMD_ARG(stop, NULL,    " Stop replaying (use uwbsim replay stop [unit])\n", _CmdSimReplayStop, 1, 1),
+    SHELL_SUBCMD_SET_END
+);
+
+static int _CmdSimDevices( const struct shell *shell, size_t argc, char **argv )
+{
+    int ret;
+
+    if (argc > 1)
+    {
+        ret = UWBsimAttach(strtoul(*++argv, NULL, 0));
+        if (ret)
+        {
+            shell_error(shell, "Can't attach (%d), max %d", ret, NRFSPI_MAX_DEVICES);
+            return ret;
+        }
+    }
+    shell_print(shell, "%d simulated UWBS (max %d)", mSimDevices, NRFSPI_MAX_DEVICES);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_uwbsim,
+    SHELL_CMD(show, NULL,      " Print simulator settings\n", _CmdSimShow),
+    SHELL_CMD_ARG(set, NULL,   " Change a setting (use uwbsim set <name> <value>)\n", _CmdSimSet, 3, 0),
+    SHELL_CMD(stats, NULL,     " Print simulator statistics\n", _CmdSimStats),
+    SHELL_CMD(reset, NULL,     " Reset simulator statistics\n", _CmdSimReset),
+    SHELL_CMD_ARG(hang, NULL,  " Report a hang (0xFE) and go quiet (use uwbsim hang [unit])\n", _CmdSimHang, 1, 1),
+    SHELL_CMD_ARG(devices, NULL, " Show or grow the number of simulated UWBS (use uwbsim devices [count])\n", _CmdSimDevices, 1, 1),
+    SHELL_CMD_ARG(bulk, NULL,  " Send large notifications as fast as they're read (use uwbsim bulk <count> [bytes] [unit])\n", _CmdSimBulk, 2, 2),
+    SHELL_CMD(replay, &sub_uwbsim_replay, " Replay a ucicap capture at full speed\n", NULL),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(uwbsim, &sub_uwbsim, "Simulated UWBS", NULL);
+
+#endif
+
+static void _sim_init(uwbsim_t *sim, int inUnit, const uwbsim_config_t *inConfig)
+{
+    memset(sim, 0, sizeof(*sim));
+
+    sim->unit = inUnit;
+    sim->config = *inConfig;
+    sim->rng = (k_cycle_get_32() ^ (0x9E3779B9u * (inUnit + 1))) | 1;
+
+    k_timer_init(&sim->bootTimer, _sim_boot_expiry, NULL);
+    k_timer_init(&sim->irqTimer, _sim_irq_expiry, NULL);
+    k_timer_init(&sim->readyTimer, _sim_ready_expiry, NULL);
+    k_timer_init(&sim->rangeTimer, _sim_range_expiry, NULL);
+    k_timer_init(&sim->dpdTimer, _sim_dpd_expiry, NULL);
+    k_timer_init(&sim->bulkTimer, _sim_bulk_expiry, NULL);
+    k_timer_init(&sim->replayTimer, _sim_replay_expiry, NULL);
+
+    NRFSPIsimSetFailAbove(inUnit, inConfig->spi_fail_hz);
+    NRFSPIsimAttach(inUnit, &mSimPeer, sim);
+}
+
+int UWBsimAttach(int inDevices)
+{
+    int ret = -EINVAL;
+
+    require(inDevices <= NRFSPI_MAX_DEVICES, exit);
+
+    // only grows, the host side of attached ones may be running
+    //
+    while (mSimDevices < inDevices)
+    {
+        _sim_init(&mSim[mSimDevices], mSimDevices, &mSim[0].config);
+        mSimDevices++;
+        LOG_INF("Simulated UWBS %d attached", mSimDevices - 1);
+    }
+    ret = 0;
+exit:
+    return ret;
+}
+
+int UWBsimInit(int inDevices)
+{
+    uwbsim_config_t config;
+
+    memset(&config, 0, sizeof(config));
+
+    config.boot_delay_us       = UWBSIM_BOOT_DELAY_US;
+    config.install_delay_us    = UWBSIM_INSTALL_DELAY_US;
+    config.flash_delay_us      = UWBSIM_FLASH_DELAY_US;
+    config.rsp_delay_us        = UWBSIM_RSP_DELAY_US;
+    config.ack_delay_us        = UWBSIM_ACK_DELAY_US;
+    config.ntf_delay_us        = UWBSIM_NTF_DELAY_US;
+    config.ready_delay_us      = UWBSIM_READY_DELAY_US;
+    config.frag_size           = UCI_MAX_DATA_PACKET_SIZE;
+    config.range_interval_us   = UWBSIM_RANGE_INTERVAL_US;
+    config.range_burst         = 1;
+    config.range_error_status  = 0x21;
+    config.dpd_timeout_us      = UWBSIM_DPD_TIMEOUT_US;
+    config.dpd_wake_us         = UWBSIM_DPD_WAKE_US;
+    config.max_payload         = UWBSIM_MAX_PAYLOAD;
+    config.data_delay_us       = UWBSIM_DATA_DELAY_US;
+    config.slow_delay_us       = UWBSIM_SLOW_DELAY_US;
+    config.wtx_interval_us     = UWBSIM_WTX_INTERVAL_US;
+    config.chip_id             = UWBSIM_CHIP_ID;
+    config.helios_id           = UWBSIM_HELIOS_ID;
+
+    // unit 0 holds the config new ones start from
+    //
+    _sim_init(&mSim[0], 0, &config);
+    mSimDevices = 1;
+    LOG_INF("Simulated UWBS 0 attached");
+
+    return UWBsimAttach(inDevices);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Behavioral model of an NXP SR150 UWBS for native_sim builds.  It
+// attaches to the nrfspi sim transport and answers the host like the
+// real part does: HBCI boot/firmware download, then UCI core, session
+// and ranging commands with status and range data notifications
+//
+// Everything is timed off kernel timers so delays, notification rates
+// and injected errors exercise the same host code paths as the board
+//
+// Each simulated uwbs is its own nrfspi unit, they all share one
+// config
+//
+
+typedef struct
+{
+    uint32_t    boot_delay_us;      // ce active to hbci ready
+    uint32_t    install_delay_us;   // last fw chunk to the image installed, queries go unanswered until then
+    uint32_t    flash_delay_us;     // fw download done to uci status ntf
+    uint32_t    jitter_us;          // boot and install each take up to this much longer, at random
+    uint32_t    rsp_delay_us;       // command to response
+    uint32_t    ack_delay_us;       // fw download chunk header or payload to its ack (the flash write)
+    uint32_t    ntf_delay_us;       // response to any follow-on notification
+    uint32_t    ready_delay_us;     // sync active to irq re-raised (read-ready)
+    int         frag_size;          // max payload per uci packet (PBF set when split, over 255 is extended length
+                                    // and only once the host sets HOST_MAX_UCI_PAYLOAD_LENGTH)
+    uint32_t    range_interval_us;  // range data ntf period while ranging
+    uint32_t    range_burst;        // range data ntfs posted back to back each period
+    uint32_t    resend_every;       // every Nth command gets a 0x0A resend ntf (0 off)
+    uint32_t    slow_every;         // every Nth command is answered after slow_delay (0 off)
+    uint32_t    slow_delay_us;      // how long those take
+    uint32_t    wtx_interval_us;    // a wtx ntf this often until a slow answer (0 none)
+    uint32_t    range_error_every;  // every Nth range ntf has an error status (0 off)
+    uint8_t     range_error_status; // status for those (0x21, 0x81, ..)
+    uint32_t    hang_after;         // post a 0xFE hang after N commands (0 off)
+    uint32_t    spi_fail_hz;        // bus garbles reads above this clock (0 off)
+    uint32_t    dpd_timeout_us;     // idle in uci mode this long goes to dpd (0 never)
+    uint32_t    dpd_wake_us;        // sync active in dpd to listening again
+    uint32_t    max_payload;        // largest packet payload the caps say it takes (0 no nxp caps, 255)
+    uint32_t    data_delay_us;      // data message to its transmit status and credit ntfs (the air time)
+    uint32_t    data_loopback;      // echo each data message back as if the peer sent it (0 off)
+    uint32_t    chip_id;            // first 4 bytes of the 16 byte chip id the boot loader answers with,
+                                    // big endian, the last is the unit (hbci picks its image by them)
+    uint32_t    helios_id;          // the 4 byte helios id
+}
+uwbsim_config_t;
+
+void UWBsimGetConfig(uwbsim_config_t *outConfig);
+int  UWBsimConfigure(const uwbsim_config_t *inConfig);
+
+// what a uwbs has seen and done, as "uwbsim stats" prints it
+//
+typedef struct
+{
+    uint32_t    cmds;
+    uint32_t    rsps;
+    uint32_t    ntfs;
+    uint32_t    range_ntfs;
+    uint32_t    range_errors;
+    uint32_t    resends;
+    uint32_t    slow_cmds;
+    uint32_t    wtx_ntfs;
+    uint32_t    dup_cmds;
+    uint32_t    hangs;
+    uint32_t    dropped;
+    uint32_t    max_depth;
+    uint32_t    fw_bytes;
+    uint32_t    fw_chunks;
+    uint32_t    fw_lrc_errors;
+    uint64_t    fw_us;
+    uint32_t    fw_ignored;         // hbci writes while installing
+    uint32_t    boot_last_us;
+    uint32_t    install_last_us;
+    uint32_t    dpd_entries;
+    uint32_t    dpd_wakes;
+    uint32_t    lost_in_dpd;
+    uint32_t    bulk_ntfs;
+    uint64_t    bulk_bytes;
+    uint64_t    bulk_us;
+    uint32_t    replay_msgs;
+    uint32_t    replay_mismatched;
+    uint32_t    replay_skipped;
+    uint64_t    replay_bytes;
+    uint64_t    replay_us;
+    uint32_t    data_msgs;
+    uint32_t    data_errors;
+    uint32_t    data_loops;
+    uint64_t    data_bytes;
+    uint64_t    bytes_in;
+    uint64_t    bytes_out;
+}
+uwbsim_stats_t;
+
+int  UWBsimGetStats(int inUnit, uwbsim_stats_t *outStats);
+void UWBsimResetStats(void);
+
+// make a uwbs report a hang (status 0xFE) and go quiet until ce is cycled
+//
+void UWBsimHang(int inUnit);
+
+// send inCount notifications of inSize bytes (up to 4200) as fast as
+// the host reads them, to measure large message throughput. Split up
+// by frag_size.  uwbsim stats has the time it took
+//
+int  UWBsimBulk(int inUnit, uint32_t inCount, uint32_t inSize);
+
+// Replay a capture (ucicap records) at full speed: each command the host
+// sends is answered with what followed it in the capture, taken from
+// what unit inFromUnit was sent there, and everything the uwbs said
+// between commands goes as fast as the host reads it.  Commands the
+// capture doesn't have in that order are counted (mismatched) and
+// answered anyway, uwbsim stats has it all and the time it took
+//
+// The records come from the ucicap ring (Capture) or are loaded by the
+// host a piece at a time (ucicap.py replay)
+//
+void UWBsimReplayClear(void);
+int  UWBsimReplayLoad(const uint8_t *inData, int inCount);
+int  UWBsimReplayCapture(void);
+int  UWBsimReplay(int inUnit, int inFromUnit);
+void UWBsimReplayStop(int inUnit);
+
+// attach more simulated uwbs, up to inDevices in all (never fewer)
+//
+int  UWBsimAttach(int inDevices);
+int  UWBsimInit(int inDevices);
@@ -0,0 +1,209 @@
+#include "hbci_proto.h"
+#include "nrfspi.h"
+#include "uwbsim.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/ztest.h>
+
+#include <string.h>
+
+// Which image hbci downloads from the uwbs_fw partition.  The test
+// writes the images itself, uwbsim takes any content (it only checks
+// each chunk's checksum), and sets the chip id the boot loader
+// answers with.  The first image for the chip id is downloaded, one
+// whose crc is wrong fails on its last chunk and the retry goes on to
+// the next one for it, an image for any chip last
+//
+#define TEST_UNIT           (0)
+#define TEST_PARTITION      FIXED_PARTITION_ID(uwbs_fw)
+
+// a few chunks and a short last one
+#define TEST_IMAGE_LEN      (3 * 2048 + 100)
+
+// chip ids, the first 4 bytes of the uwbs's answer
+#define TEST_CHIP_A         (0x15000001)    // a corrupt image, then a good one
+#define TEST_CHIP_B         (0x22000002)    // a good one
+#define TEST_CHIP_C         (0x33000003)    // a corrupt one only
+#define TEST_CHIP_OTHER     (0x44000004)    // none
+
+// the partition image header as hbci_chunks.py --partition writes it
+// (hbci_fw_hdr_t in hbci_proto.c)
+//
+#define TEST_FW_MAGIC       (0x57464248)
+#define TEST_FW_FORMAT      (1)
+#define TEST_QRY_CHIP_ID    (0x31)
+#define TEST_FW_PAGE        (0x1000)
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t hdr_len;
+    uint16_t format;
+    uint32_t size;
+    uint32_t next;
+    uint32_t version;
+    uint32_t crc;
+    uint8_t  match_ins;
+    uint8_t  match_len;
+    uint8_t  reserved[2];
+    uint8_t  match[16];
+    uint32_t hdr_crc;
+}
+test_fw_hdr_t;
+
+BUILD_ASSERT(sizeof(test_fw_hdr_t) == 48, "not the partition image header");
+
+typedef struct
+{
+    uint32_t chip;          // 0 any
+    uint32_t version;
+    bool     corrupt;
+}
+test_image_t;
+
+// in partition order, each on its own TEST_IMAGE_PAGES
+//
+#define TEST_IMAGE_PAGES    (2)
+
+static const test_image_t mImages[] =
+{
+    { TEST_CHIP_A,  0x000101,   true },
+    { TEST_CHIP_A,  0x000102,   false },
+    { TEST_CHIP_B,  0x000201,   false },
+    { TEST_CHIP_C,  0x000301,   true },
+    { 0,            0x000401,   false },
+};
+
+#define TEST_IMAGES         ARRAY_SIZE(mImages)
+#define TEST_IMAGE_AT(i)    ((i) * TEST_IMAGE_PAGES * TEST_FW_PAGE)
+
+BUILD_ASSERT(sizeof(test_fw_hdr_t) + TEST_IMAGE_LEN <= TEST_IMAGE_PAGES * TEST_FW_PAGE, "images overlap");
+
+static nrfspi_t *mSPI;
+static uwbsim_config_t mDefault;
+static uint8_t mData[TEST_IMAGE_LEN];
+
+static void _write_image(const struct flash_area *fa, int inIndex)
+{
+    const test_image_t *image = &mImages[inIndex];
+    test_fw_hdr_t hdr;
+    uint32_t at = TEST_IMAGE_AT(inIndex);
+    int i;
+
+    for (i = 0; i < sizeof(mData); i++)
+    {
+        mData[i] = (uint8_t)(i * 7 + inIndex);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic   = TEST_FW_MAGIC;
+    hdr.hdr_len = sizeof(hdr);
+    hdr.format  = TEST_FW_FORMAT;
+    hdr.size    = sizeof(mData);
+    hdr.next    = (inIndex + 1 < TEST_IMAGES) ? TEST_IMAGE_AT(inIndex + 1) : 0;
+    hdr.version = image->version;
+    hdr.crc     = crc32_ieee(mData, sizeof(mData)) ^ (image->corrupt ? 1 : 0);
+    if (image->chip)
+    {
+        hdr.match_ins = TEST_QRY_CHIP_ID;
+        hdr.match_len = 4;
+        sys_put_be32(image->chip, hdr.match);
+    }
+    hdr.hdr_crc = crc32_ieee((const uint8_t *)&hdr, offsetof(test_fw_hdr_t, hdr_crc));
+
+    zassert_ok(flash_area_write(fa, at, &hdr, sizeof(hdr)));
+    zassert_ok(flash_area_write(fa, at + sizeof(hdr), mData, sizeof(mData)));
+}
+
+// boot the uwbs with inChip from ce off, and where its image came from
+//
+static int _boot(uint32_t inChip, int32_t *outAt, uint32_t *outVersion)
+{
+    uwbsim_config_t config = mDefault;
+    int ret;
+
+    config.chip_id = inChip;
+    zassert_ok(UWBsimConfigure(&config));
+
+    NRFSPIenableChip(mSPI, false);
+    k_sleep(K_MSEC(1));
+
+    ret = HBCIprotoInit(mSPI);
+    zassert_ok(HBCIprotoImage(mSPI, outAt, outVersion), "no image picked for %08x", inChip);
+    return ret;
+}
+
+static void *_image_setup(void)
+{
+    const struct flash_area *fa;
+    int i;
+
+    zassert_ok(UWBsimInit(1));
+    UWBsimGetConfig(&mDefault);
+
+    mSPI = NRFSPIget(TEST_UNIT);
+    zassert_not_null(mSPI);
+    zassert_ok(NRFSPIinit(mSPI));
+
+    zassert_ok(flash_area_open(TEST_PARTITION, &fa));
+    zassert_ok(flash_area_erase(fa, 0, fa->fa_size));
+    for (i = 0; i < TEST_IMAGES; i++)
+    {
+        _write_image(fa, i);
+    }
+    flash_area_close(fa);
+    return NULL;
+}
+
+ZTEST(hbci_fw, test_image_picked_by_chip_id)
+{
+    int32_t at;
+    uint32_t version;
+
+    zassert_ok(_boot(TEST_CHIP_B, &at, &version));
+    zassert_equal(at, TEST_IMAGE_AT(2), "chip B got the image at 0x%x", at);
+    zassert_equal(version, 0x000201);
+
+    // nothing for this one, the image for any uwbs
+    //
+    zassert_ok(_boot(TEST_CHIP_OTHER, &at, &version));
+    zassert_equal(at, TEST_IMAGE_AT(4), "other chip got the image at 0x%x", at);
+    zassert_equal(version, 0x000401);
+}
+
+ZTEST(hbci_fw, test_corrupt_image_skipped)
+{
+    int32_t at;
+    uint32_t version;
+
+    // the first for chip A fails its crc, its last chunk isn't sent
+    //
+    zassert_not_equal(_boot(TEST_CHIP_A, &at, &version), 0, "corrupt image downloaded");
+    zassert_equal(at, TEST_IMAGE_AT(0), "chip A tried the image at 0x%x", at);
+
+    // and the retry passes it over for the next one for chip A
+    //
+    zassert_ok(_boot(TEST_CHIP_A, &at, &version));
+    zassert_equal(at, TEST_IMAGE_AT(1), "chip A retried with the image at 0x%x", at);
+    zassert_equal(version, 0x000102);
+}
+
+ZTEST(hbci_fw, test_corrupt_image_falls_back)
+{
+    int32_t at;
+    uint32_t version;
+
+    // chip C's only image is corrupt, the retry takes the one for any uwbs
+    //
+    zassert_not_equal(_boot(TEST_CHIP_C, &at, &version), 0, "corrupt image downloaded");
+    zassert_equal(at, TEST_IMAGE_AT(3), "chip C tried the image at 0x%x", at);
+
+    zassert_ok(_boot(TEST_CHIP_C, &at, &version));
+    zassert_equal(at, TEST_IMAGE_AT(4), "chip C retried with the image at 0x%x", at);
+    zassert_equal(version, 0x000401);
+}
+
+ZTEST_SUITE(hbci_fw, NULL, _image_setup, NULL, NULL, NULL);
@@ -0,0 +1,190 @@
+#include "nrfspi.h"
+#include "nrfspi_sim.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/ztest.h>
+
+#include <string.h>
+
+// Bus clock calibration and downshift against the sim transport.  The
+// sim garbles every byte read back above its fail clock, the peer
+// answers each read with a known pattern, so a probe is a read that
+// has to come back as that
+//
+#define TEST_UNIT           (0)
+#define TEST_PROBE_LEN      (16)
+
+// the sim's default (its spi-max-frequency) is 8MHz, it fails above
+// this and calibration has to come down to the step under it
+//
+#define TEST_FAIL_HZ        (3000000)
+#define TEST_SETTLED_HZ     (2000000)
+
+// what nrfspi keeps the clock under
+#define TEST_SETTINGS_KEY   "uwbspi/0/clock"
+
+static nrfspi_t *mSPI;
+
+static void _peer_read(void *inContext, uint8_t *outData, const int inCount)
+{
+    int i;
+
+    for (i = 0; i < inCount; i++)
+    {
+        outData[i] = (uint8_t)(0x5A + i);
+    }
+}
+
+static const nrfspi_sim_peer_t mPeer =
+{
+    .read = _peer_read,
+};
+
+static int _probe(nrfspi_t *inSPI)
+{
+    uint8_t data[TEST_PROBE_LEN];
+    int ret;
+    int i;
+
+    ret = NRFSPIread(inSPI, data, sizeof(data));
+    if (ret)
+    {
+        return ret;
+    }
+    for (i = 0; i < sizeof(data); i++)
+    {
+        if (data[i] != (uint8_t)(0x5A + i))
+        {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+static int _settings_read(
+                    const char *key,
+                    size_t len,
+                    settings_read_cb read_cb,
+                    void *cb_arg,
+                    void *param)
+{
+    uint32_t *hz = (uint32_t *)param;
+
+    if (len == sizeof(*hz))
+    {
+        read_cb(cb_arg, hz, sizeof(*hz));
+    }
+    return 0;
+}
+
+// the clock saved for the next boot, 0 for none
+//
+static uint32_t _saved_clock(void)
+{
+    uint32_t hz = 0;
+
+    settings_load_subtree_direct(TEST_SETTINGS_KEY, _settings_read, &hz);
+    return hz;
+}
+
+static void *_clock_setup(void)
+{
+    // a clock saved by an earlier run would be loaded and only
+    // re-verified, start from none
+    //
+    zassert_ok(settings_subsys_init());
+    settings_delete(TEST_SETTINGS_KEY);
+
+    zassert_ok(NRFSPIsimAttach(TEST_UNIT, &mPeer, NULL));
+    mSPI = NRFSPIget(TEST_UNIT);
+    zassert_not_null(mSPI);
+    zassert_ok(NRFSPIinit(mSPI));
+    zassert_ok(NRFSPIenableChip(mSPI, true));
+    return NULL;
+}
+
+static void _clock_before(void *fixture)
+{
+    // back at the configured clock with a bus that works there
+    //
+    NRFSPIsimSetFailAbove(TEST_UNIT, 0);
+    zassert_ok(NRFSPIsetClock(mSPI, 0));
+    zassert_ok(NRFSPIcalibrate(mSPI, _probe));
+}
+
+ZTEST(nrfspi_clock, test_calibrate_settles_under_fail_clock)
+{
+    uint32_t max = NRFSPIgetClock(mSPI);
+
+    zassert_true(max > TEST_FAIL_HZ, "sim default %u under the fail clock", max);
+
+    NRFSPIsimSetFailAbove(TEST_UNIT, TEST_FAIL_HZ);
+
+    zassert_ok(NRFSPIcalibrate(mSPI, _probe));
+    zassert_equal(NRFSPIgetClock(mSPI), TEST_SETTLED_HZ,
+                  "calibrated to %u", NRFSPIgetClock(mSPI));
+    zassert_ok(_probe(mSPI), "probe fails at the calibrated clock");
+    zassert_equal(_saved_clock(), TEST_SETTLED_HZ, "saved %u", _saved_clock());
+
+    // the next boot re-verifies the saved clock and keeps it
+    //
+    zassert_ok(NRFSPIcalibrate(mSPI, _probe));
+    zassert_equal(NRFSPIgetClock(mSPI), TEST_SETTLED_HZ);
+}
+
+ZTEST(nrfspi_clock, test_calibrate_never_goes_past_default)
+{
+    uint32_t max = NRFSPIgetClock(mSPI);
+
+    // with a bus that works at any clock it stays at the configured one
+    //
+    zassert_ok(NRFSPIcalibrate(mSPI, _probe));
+    zassert_equal(NRFSPIgetClock(mSPI), max);
+
+    zassert_ok(NRFSPIsetClock(mSPI, 4 * max));
+    zassert_equal(NRFSPIgetClock(mSPI), max, "set past the max to %u", NRFSPIgetClock(mSPI));
+}
+
+ZTEST(nrfspi_clock, test_link_errors_downshift)
+{
+    int i;
+
+    NRFSPIsimSetFailAbove(TEST_UNIT, TEST_FAIL_HZ);
+    zassert_ok(NRFSPIcalibrate(mSPI, _probe));
+    zassert_equal(NRFSPIgetClock(mSPI), TEST_SETTLED_HZ);
+
+    // a couple of errors in a window of good checks is noise
+    //
+    NRFSPIlinkCheck(mSPI, false);
+    NRFSPIlinkCheck(mSPI, false);
+    for (i = 0; i < 64; i++)
+    {
+        NRFSPIlinkCheck(mSPI, true);
+    }
+    NRFSPIlinkCheck(mSPI, false);
+    zassert_equal(NRFSPIgetClock(mSPI), TEST_SETTLED_HZ, "downshifted on scattered errors");
+
+    // three in a window drops a step
+    //
+    NRFSPIlinkCheck(mSPI, false);
+    NRFSPIlinkCheck(mSPI, false);
+    zassert_equal(NRFSPIgetClock(mSPI), TEST_SETTLED_HZ / 2, "clock %u", NRFSPIgetClock(mSPI));
+
+    // the link check thread doesn't write flash, the main loop saves it
+    //
+    zassert_equal(_saved_clock(), TEST_SETTLED_HZ, "saved %u before the main loop did", _saved_clock());
+    NRFSPIsaveClock(mSPI);
+    zassert_equal(_saved_clock(), TEST_SETTLED_HZ / 2, "saved %u", _saved_clock());
+
+    // and nothing comes under the slowest step
+    //
+    for (i = 0; i < 3; i++)
+    {
+        NRFSPIlinkCheck(mSPI, false);
+    }
+    zassert_equal(NRFSPIgetClock(mSPI), TEST_SETTLED_HZ / 2);
+    zassert_equal(NRFSPIdownshift(mSPI), -ERANGE);
+}
+
+ZTEST_SUITE(nrfspi_clock, NULL, _clock_setup, _clock_before, NULL, NULL);
@@ -0,0 +1,212 @@
+#include "nrfspi.h"
+#include "nrfspi_backend.h"
+#include "nrfspi_sim.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <string.h>
+
+// The read handshake against the sim transport: raise sync, the uwbs
+// drops its irq line and raises it again once it has the data ready.
+// NRFSPIstartSync sleeps until the irq edges say so.  The same peer is
+// run through the handshake as it was before that, sleep-polling the
+// line, and both are measured for how long after the uwbs was ready
+// the host noticed (latency) and how long the waiting thread ran
+// (cpu time).  native_sim charges no time to running code, only to
+// busy waits, so there the cpu time is what a thread spins
+//
+#define TEST_UNIT               (0)
+
+// the peer takes this long from sync to ready (off the poll period so
+// the polled handshake can't happen to look at the line right then)
+//
+#define TEST_READY_US           (145)
+#define TEST_HANDSHAKES         (200)
+
+// how the polled handshake waited on the line
+//
+#define TEST_POLL_US            (20)
+#define TEST_POLL_TIMEOUT_US    (1000)
+
+typedef struct
+{
+    uint32_t    count;
+    uint32_t    failures;
+    uint32_t    wakeups;        // polls of the line (polled only)
+    uint32_t    max_latency_us;
+    uint64_t    latency_us;     // uwbs ready to the host returning
+    uint64_t    cpu_us;         // waiting thread run time
+}
+test_sync_stats_t;
+
+static nrfspi_t *mSPI;
+static struct k_timer mReadyTimer;
+static volatile uint32_t mReadyStamp;
+
+// the uwbs side: acknowledge sync by dropping irq and raise it again
+// from a timer (isr context, like the gpio edge on the board)
+//
+static void _peer_ready(struct k_timer *timer)
+{
+    mReadyStamp = k_cycle_get_32();
+    NRFSPIsimSetIrq(TEST_UNIT, true);
+}
+
+static void _peer_sync(void *inContext, bool inActive)
+{
+    if (inActive)
+    {
+        NRFSPIsimSetIrq(TEST_UNIT, false);
+        k_timer_start(&mReadyTimer, K_USEC(TEST_READY_US), K_NO_WAIT);
+    }
+}
+
+static const nrfspi_sim_peer_t mPeer =
+{
+    .sync = _peer_sync,
+};
+
+static uint64_t _cpu_us(void)
+{
+    k_thread_runtime_stats_t stats;
+
+    k_thread_runtime_stats_get(k_current_get(), &stats);
+    return k_cyc_to_us_floor64(stats.execution_cycles);
+}
+
+// The handshake before it was edge driven, on the same lines
+//
+static int _polled_sync(uint32_t *ioWakeups)
+{
+    const nrfspi_ops_t *ops = &NRFSPIsimOps;
+    int timeout;
+
+    ops->set_sync(TEST_UNIT, true);
+
+    for (timeout = 0; ops->get_irq(TEST_UNIT) && timeout < TEST_POLL_TIMEOUT_US; timeout += TEST_POLL_US)
+    {
+        k_sleep(K_USEC(TEST_POLL_US));
+        (*ioWakeups)++;
+    }
+    if (ops->get_irq(TEST_UNIT))
+    {
+        return -ETIMEDOUT;
+    }
+
+    for (timeout = 0; !ops->get_irq(TEST_UNIT) && timeout < TEST_POLL_TIMEOUT_US; timeout += TEST_POLL_US)
+    {
+        k_sleep(K_USEC(TEST_POLL_US));
+        (*ioWakeups)++;
+    }
+    if (!ops->get_irq(TEST_UNIT))
+    {
+        return -ETIMEDOUT;
+    }
+    return 0;
+}
+
+static int _polled_stop(void)
+{
+    return NRFSPIsimOps.set_sync(TEST_UNIT, false);
+}
+
+static int _edge_sync(uint32_t *ioWakeups)
+{
+    return NRFSPIstartSync(mSPI);
+}
+
+static int _edge_stop(void)
+{
+    return NRFSPIstopSync(mSPI);
+}
+
+static void _measure(
+                int (*inSync)(uint32_t *ioWakeups),
+                int (*inStop)(void),
+                test_sync_stats_t *outStats)
+{
+    uint32_t latency;
+    uint64_t cpu;
+    int i;
+
+    memset(outStats, 0, sizeof(*outStats));
+
+    for (i = 0; i < TEST_HANDSHAKES; i++)
+    {
+        cpu = _cpu_us();
+
+        if (inSync(&outStats->wakeups))
+        {
+            outStats->failures++;
+        }
+        else
+        {
+            latency = k_cyc_to_us_floor32(k_cycle_get_32() - mReadyStamp);
+
+            outStats->count++;
+            outStats->latency_us += latency;
+            outStats->cpu_us += _cpu_us() - cpu;
+            if (latency > outStats->max_latency_us)
+            {
+                outStats->max_latency_us = latency;
+            }
+        }
+        inStop();
+
+        // let the timer from a failed one run out
+        k_sleep(K_USEC(2 * TEST_READY_US));
+    }
+}
+
+static void _print(const char *inName, const test_sync_stats_t *inStats)
+{
+    TC_PRINT("%-8s handshakes=%u failed=%u  latency avg=%uus max=%uus  cpu avg=%uus  polls=%u\n",
+             inName, inStats->count, inStats->failures,
+             inStats->count ? (uint32_t)(inStats->latency_us / inStats->count) : 0,
+             inStats->max_latency_us,
+             inStats->count ? (uint32_t)(inStats->cpu_us / inStats->count) : 0,
+             inStats->wakeups);
+}
+
+static void *_sync_setup(void)
+{
+    k_timer_init(&mReadyTimer, _peer_ready, NULL);
+
+    zassert_ok(NRFSPIsimAttach(TEST_UNIT, &mPeer, NULL));
+    mSPI = NRFSPIget(TEST_UNIT);
+    zassert_not_null(mSPI);
+    zassert_ok(NRFSPIinit(mSPI));
+    zassert_ok(NRFSPIenableChip(mSPI, true));
+
+    // the uwbs has a message for the host
+    NRFSPIsimSetIrq(TEST_UNIT, true);
+    return NULL;
+}
+
+ZTEST(nrfspi_sync, test_handshake_latency_and_cpu)
+{
+    test_sync_stats_t polled;
+    test_sync_stats_t edge;
+
+    _measure(_polled_sync, _polled_stop, &polled);
+    _measure(_edge_sync, _edge_stop, &edge);
+
+    _print("polled", &polled);
+    _print("edge", &edge);
+
+    zassert_equal(polled.failures, 0, "polled handshake failed %u times", polled.failures);
+    zassert_equal(edge.failures, 0, "edge handshake failed %u times", edge.failures);
+
+    // the edge wakes the reader, it never waits out a poll period
+    // and never runs while waiting
+    //
+    zassert_true(edge.max_latency_us < TEST_POLL_US,
+                 "edge latency %uus, polled every %uus", edge.max_latency_us, TEST_POLL_US);
+    zassert_true(edge.latency_us <= polled.latency_us,
+                 "edge latency %lluus total, polled %lluus", edge.latency_us, polled.latency_us);
+    zassert_true(edge.cpu_us <= polled.cpu_us,
+                 "edge cpu %lluus total, polled %lluus", edge.cpu_us, polled.cpu_us);
+}
+
+ZTEST_SUITE(nrfspi_sync, NULL, _sync_setup, NULL, NULL, NULL);
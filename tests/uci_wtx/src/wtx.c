@@ -0,0 +1,188 @@
+#include "uci_proto.h"
+#include "uci_defs.h"
+#include "uwbsim.h"
+#include "timesvc.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+// Slow commands against uwbsim: it answers every command after
+// TEST_SLOW_US, well past uci's response timeout, and says it's still
+// working on it with a wtx ntf every wtx interval (or not, with 0).
+// uwbsim counts a command that comes again before it was answered, the
+// resends a wtx is there to save
+//
+#define TEST_UNIT           (0)
+#define TEST_SLOW_US        (300000)
+#define TEST_WTX_US         (50000)
+#define TEST_COMMANDS       (5)
+
+#define TEST_BOOT_MS        (5000)
+#define TEST_ANSWER_MS      (2000)
+
+// answers to resent commands come in after the first one, they are
+// read before the next command goes
+//
+#define TEST_DRAIN_MS       ((2 * TEST_SLOW_US) / 1000)
+
+static uci_t *mUCI;
+static uwbsim_config_t mDefault;
+static int mRsps;
+static uint8_t mRspGID;
+static uint8_t mRspOID;
+
+// one pass of the main loop's uwb slice
+//
+static int _slice(void)
+{
+    bool have;
+    uint8_t type;
+    uint8_t gid;
+    uint8_t oid;
+    uint8_t *payload;
+    int len;
+    uint32_t delay = 20;
+    int ret;
+
+    ret = UCIprotoSlice(mUCI, &have, &type, &gid, &oid, &payload, &len, &delay);
+    if (ret || !have)
+    {
+        TimeWaitApplicationEvent(delay);
+        return ret;
+    }
+    do
+    {
+        if (type == UCI_MT_RSP)
+        {
+            mRsps++;
+            mRspGID = gid;
+            mRspOID = oid;
+        }
+    }
+    while (UCIprotoNextMessage(mUCI, &type, &gid, &oid, &payload, &len));
+
+    return 0;
+}
+
+static void _drain(int inMs)
+{
+    int64_t end = k_uptime_get() + inMs;
+
+    while (k_uptime_get() < end)
+    {
+        _slice();
+    }
+}
+
+// a command and the wait for its answer
+//
+static int _command(uint8_t inGID, uint8_t inOID)
+{
+    int64_t end = k_uptime_get() + TEST_ANSWER_MS;
+    int rsps;
+    int ret;
+
+    // the bus can be busy reading a notification
+    //
+    while ((ret = UCIprotoWrite(mUCI, UCI_MT_CMD, inGID, inOID, NULL, 0)) == -EBUSY && k_uptime_get() < end)
+    {
+        _slice();
+    }
+    if (ret)
+    {
+        return ret;
+    }
+
+    rsps = mRsps;
+    while (k_uptime_get() < end)
+    {
+        ret = _slice();
+        if (ret)
+        {
+            return ret;
+        }
+        if (mRsps != rsps && mRspGID == inGID && mRspOID == inOID)
+        {
+            return 0;
+        }
+    }
+    return -ETIMEDOUT;
+}
+
+// every command of the test slow, with a wtx this often
+//
+static void _slow_commands(uint32_t inWtxUs, uwbsim_stats_t *outStats)
+{
+    uwbsim_config_t config = mDefault;
+    int i;
+
+    config.slow_every = 1;
+    config.slow_delay_us = TEST_SLOW_US;
+    config.wtx_interval_us = inWtxUs;
+    zassert_ok(UWBsimConfigure(&config));
+
+    for (i = 0; i < TEST_COMMANDS; i++)
+    {
+        zassert_ok(_command(UCI_GID_CORE, UCI_MSG_CORE_DEVICE_INFO), "command %d not answered", i);
+        _drain(TEST_DRAIN_MS);
+    }
+
+    zassert_ok(UWBsimGetStats(TEST_UNIT, outStats));
+    TC_PRINT("wtx %uus: cmds=%u slow=%u wtx ntfs=%u repeated before answered=%u\n",
+             inWtxUs, outStats->cmds, outStats->slow_cmds, outStats->wtx_ntfs, outStats->dup_cmds);
+}
+
+static void *_wtx_setup(void)
+{
+    int64_t end;
+
+    zassert_ok(UWBsimInit(1));
+
+    // nothing here parks the uwbs and wakes it for a command, it stays up
+    //
+    UWBsimGetConfig(&mDefault);
+    mDefault.dpd_timeout_us = 0;
+    zassert_ok(UWBsimConfigure(&mDefault));
+
+    mUCI = UCIprotoGet(TEST_UNIT);
+    zassert_not_null(mUCI);
+    zassert_ok(UCIprotoInit(mUCI));
+
+    end = k_uptime_get() + TEST_BOOT_MS;
+    while (!UCIready(mUCI))
+    {
+        zassert_ok(_slice());
+        zassert_true(k_uptime_get() < end, "uwbs not up in %dms", TEST_BOOT_MS);
+    }
+    return NULL;
+}
+
+static void _wtx_before(void *fixture)
+{
+    zassert_ok(UWBsimConfigure(&mDefault));
+    _drain(TEST_DRAIN_MS);
+    UWBsimResetStats();
+}
+
+ZTEST(uci_wtx, test_wtx_holds_slow_commands)
+{
+    uwbsim_stats_t stats;
+
+    _slow_commands(TEST_WTX_US, &stats);
+
+    zassert_true(stats.slow_cmds >= TEST_COMMANDS, "only %u slow", stats.slow_cmds);
+    zassert_true(stats.wtx_ntfs > 0, "no wtx sent");
+    zassert_equal(stats.dup_cmds, 0, "%u commands repeated before answered", stats.dup_cmds);
+}
+
+ZTEST(uci_wtx, test_no_wtx_slow_commands_resent)
+{
+    uwbsim_stats_t stats;
+
+    _slow_commands(0, &stats);
+
+    zassert_equal(stats.wtx_ntfs, 0);
+    zassert_true(stats.dup_cmds > 0, "slow commands never resent");
+}
+
+ZTEST_SUITE(uci_wtx, NULL, _wtx_setup, _wtx_before, NULL, NULL);
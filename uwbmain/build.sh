@@ -26,8 +26,11 @@ case $REVISION in
 "nrf5340dk_nrf5340_cpuapp"|"5340dk"|"5340")
 	revision_name="nrf5340dk_nrf5340_cpuapp"
 	;;
+"native_sim"|"sim")
+	revision_name="native_sim"
+	;;
 *)
-	echo "unknown revision, should be 5340dk | evt | dvt"
+	echo "unknown revision, should be 5340dk | evt | dvt | sim"
 	exit 1
 esac
 
@@ -15,6 +15,9 @@
 #ifdef CONFIG_SSD1306
 #include "display.h"
 #endif
+#ifdef CONFIG_BOARD_NATIVE_SIM
+#include "uwbsim.h"
+#endif
 
 int main( void )
 {
@@ -31,6 +34,13 @@ int main( void )
     ret = TimeInit();
     require_noerr(ret, exit);
 
+    #ifdef CONFIG_BOARD_NATIVE_SIM
+    // simulated uwbs has to be on the bus before the stack opens it,
+    // more can be attached from the shell (uwbsim devices)
+    ret = UWBsimInit(1);
+    require_noerr(ret, exit);
+    #endif
+
     ret = NIinit();
     require_noerr(ret, exit);
 
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+#
+# UCI traffic captures, as printed by "ucicap dump" on the target
+#
+#   ucicap.py extract console.log -o session.ucap   pull the records out of a console log
+#   ucicap.py show session.ucap                     print them, decoded a bit
+#   ucicap.py replay session.ucap [--unit N]        shell commands that load and start it
+#                                                   on native_sim (uwbsim replay)
+#
+# A .ucap file is "UCAP", a version byte, 3 reserved bytes, then the
+# records as the target keeps them (see uci_cap.h):
+#
+#   u16 size, u8 unit, u8 dir, u32 stamp_us, u8 mt|gid, u8 oid, u16 length, payload
+#
+# Replay output goes to the native_sim console, e.g.
+#
+#   ucicap.py replay session.ucap > /dev/pts/3
+#
+import argparse
+import struct
+import sys
+
+MAGIC = b"UCAP"
+VERSION = 1
+REC = struct.Struct("<HBBIBBH")
+
+# the dump lines are "UCICAP <hex>", a record can span several
+PREFIX = "UCICAP "
+
+# bytes per "uwbsim replay load", the shell line has to hold it
+LOAD_CHUNK = 96
+
+MT_NAMES = {0: "DATA", 1: "CMD", 2: "RSP", 3: "NTF"}
+
+
+def records(data):
+    pos = 0
+    while pos + REC.size <= len(data):
+        size, unit, direction, stamp, hdr0, oid, length = REC.unpack_from(data, pos)
+        if size < REC.size or pos + size > len(data):
+            raise ValueError("bad record at offset %d" % pos)
+        payload = data[pos + REC.size:pos + size]
+        yield unit, direction, stamp, hdr0, oid, length, payload, data[pos:pos + size]
+        pos += size
+
+
+def extract(lines):
+    data = bytearray()
+    for line in lines:
+        at = line.find(PREFIX)
+        if at < 0:
+            continue
+        data += bytes.fromhex(line[at + len(PREFIX):].strip())
+    return bytes(data)
+
+
+def read_ucap(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != MAGIC or data[4] != VERSION:
+        raise ValueError("%s is not a version %d capture" % (path, VERSION))
+    return data[8:]
+
+
+def cmd_extract(args):
+    with open(args.log, "r", errors="replace") as f:
+        data = extract(f)
+    count = sum(1 for _ in records(data))
+    with open(args.output, "wb") as f:
+        f.write(MAGIC + bytes([VERSION, 0, 0, 0]) + data)
+    print("%d records, %d bytes" % (count, len(data)), file=sys.stderr)
+
+
+def cmd_show(args):
+    data = read_ucap(args.capture)
+    last = None
+    for unit, direction, stamp, hdr0, oid, length, payload, _ in records(data):
+        mt = (hdr0 >> 5) & 0x07
+        gid = hdr0 & 0x0F
+        delta = 0 if last is None else (stamp - last) & 0xFFFFFFFF
+        last = stamp
+        cut = "" if len(payload) == length else " (%d captured)" % len(payload)
+        print("%10.3f ms +%7u us  unit %u %s %-4s %X/%02X  %4u%s  %s" % (
+            stamp / 1000.0, delta, unit, "->" if direction == 0 else "<-",
+            MT_NAMES.get(mt, "?"), gid, oid, length, cut, payload.hex(" ").upper()))
+
+
+def cmd_replay(args):
+    data = read_ucap(args.capture)
+    from_unit = args.unit if args.from_unit is None else args.from_unit
+    cut = []
+    sent = False
+    for unit, direction, _, _, _, length, payload, _ in records(data):
+        # what it said before the first command isn't replayed
+        if unit != from_unit:
+            continue
+        if direction == 0:
+            sent = True
+        elif sent and len(payload) < length:
+            cut.append(length)
+    if cut:
+        # uwbsim turns these down, the messages can't be sent as they were
+        sys.exit("%d uwbs messages were cut at the snap length, up to %d bytes, "
+                 "capture with ucicap start %d to replay" % (len(cut), max(cut), max(cut)))
+    out = sys.stdout
+    out.write("uwbsim replay clear\n")
+    for at in range(0, len(data), LOAD_CHUNK):
+        out.write("uwbsim replay load %s\n" % data[at:at + LOAD_CHUNK].hex().upper())
+    out.write("uwbsim replay start %d %d\n" % (args.unit, from_unit))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="UCI capture tool")
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("extract", help="pull a capture out of a console log")
+    p.add_argument("log")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(func=cmd_extract)
+
+    p = sub.add_parser("show", help="print a capture")
+    p.add_argument("capture")
+    p.set_defaults(func=cmd_show)
+
+    p = sub.add_parser("replay", help="shell commands to replay a capture on native_sim")
+    p.add_argument("capture")
+    p.add_argument("--unit", type=int, default=0, help="simulated uwbs to replay on")
+    p.add_argument("--from-unit", type=int, default=None, help="unit it was captured on (default same)")
+    p.set_defaults(func=cmd_replay)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()